@@ -0,0 +1,500 @@
+/*
+ * End-to-end benchmark of the draw path against the local simulator in modbus_sim.c.
+ * Usage: modbus_bench [-m 10,100,1000,10000] [-t seconds] [-n max cycles] [-f frame us] [-w outputs per cycle]
+ *                     [-P poll ms] [-r rtt us] [-j jitter us] [-l loss %] [-c coils] [-x changes/s] [-p port] [-S]
+ *                     [-L pollers] [-D depth] [-W write %] [-T tcp|udp|rtu] [-R registers] [-H]
+ * -S only runs the simulator, so a real HMI build can be pointed at it.
+ * -R also maps int32 holding and float32 input registers, the timed runs write them and a check after the runs
+ * reads every one back through the simulator.
+ * -H first checks that a history ring reads back its newest transitions after it wrapped around.
+ * -T picks the framing of the simulator and the bench device, rtu is RTU frames carried over TCP.
+ * -L turns on server_port one above the simulator port and loads it with as many masters while the draw path is timed.
+ * Build: see "Benchmark" in README.md, the context is the synthetic one of modbus_bench_context.h.
+ */
+#include "modbus_comm.h"
+#include "modbus_sim.h"
+#include "modbus_load.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#define BENCH_DEFAULT_SIZES "10,100,1000,10000"
+#define BENCH_MAX_SIZES 16
+#define BENCH_CONNECT_TIMEOUT_MS 5000
+#define BENCH_WARMUP_MS 200
+#define BENCH_LOAD_TIMEOUT_MS 1000
+#define BENCH_CHECK_TIMEOUT_MS 3000
+#define BENCH_SETTLE_MS 300 // Writes must have reached the slave this long before the check changes it
+#define BENCH_HISTORY_DEPTH 16
+
+typedef bool (*BenchFunction)(CONTEXT_STRUCT_NAME *context);
+
+typedef struct {
+    const char* name;
+    BenchFunction function;
+    bool writes; // Outputs are toggled before every cycle
+} BenchMode;
+
+typedef struct {
+    int sizes[BENCH_MAX_SIZES];
+    int size_count;
+    double seconds;
+    long max_cycles;
+    long frame_us;
+    int toggles;
+    int poll_ms;
+    int registers; // Holding and input register mappings of -R
+    bool sim_only;
+    bool history_check;
+    ModbusSimConfig sim;
+    ModbusLoadConfig load; // Pollers of the server mode, none when load.pollers is 0
+} BenchOptions;
+
+// Context fields the runs change and check
+typedef struct {
+    SGLbool** outputs;
+    SGLint32* holding[BENCH_MAX_REGISTERS];
+    SGLfloat* inputs[BENCH_MAX_REGISTERS];
+} BenchFields;
+
+static const BenchMode modes[] = {
+    { "read_modbus_values", read_modbus_values, false },
+    { "update_modbus_values", update_modbus_values, true },
+    { "update_modbus_values_all", update_modbus_values_all, true },
+};
+
+// Every malloc, calloc and realloc of the linked objects, counted through -Wl,--wrap
+static atomic_ulong bench_allocs = 0;
+static volatile sig_atomic_t bench_stop = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    atomic_fetch_add_explicit(&bench_allocs, 1, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&bench_allocs, 1, memory_order_relaxed);
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    atomic_fetch_add_explicit(&bench_allocs, 1, memory_order_relaxed);
+    return __real_realloc(ptr, size);
+}
+
+static long long bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void bench_sleep_until(long long deadline_ns) {
+    struct timespec ts = { deadline_ns / 1000000000LL, deadline_ns % 1000000000LL };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !bench_stop) {}
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    bench_stop = 1;
+}
+
+static int compare_latency(const void* a, const void* b) {
+    unsigned int x = *(const unsigned int*)a;
+    unsigned int y = *(const unsigned int*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(const unsigned int* sorted, long count, double p) {
+    long i = (long)(p * count + 0.999999) - 1;
+    if (i < 0) i = 0;
+    return sorted[i] / 1000.0;
+}
+
+// Half of the mappings are discrete inputs from address 0, the rest are coils from address 0
+static int input_count(int mappings) {
+    return mappings / 2;
+}
+
+static bool write_bench_config(const BenchOptions* opt, int mappings) {
+    FILE* file = fopen(CONFIG_FILE, "w");
+    if (!file) return false;
+    fprintf(file, "[ModbusConfig]\nserver_ip=127.0.0.1\nport=%d\nslave_id=1\npoll_ms=%d\n", opt->sim.port, opt->poll_ms);
+    fprintf(file, "reconnect_min_ms=100\nreconnect_max_ms=1000\nlog_level=error\ntransport=%s\n",
+            modbus_transport_name(opt->sim.transport));
+    if (opt->load.pollers > 0) {
+        fprintf(file, "server_port=%d\nserver_max_clients=%d\n", opt->load.port, opt->load.pollers);
+    }
+    fprintf(file, "\n[InputMappings]\n");
+    int inputs = input_count(mappings);
+    for (int i = 0; i < inputs; i++) fprintf(file, "bench_%04d=%d\n", i, i);
+    fprintf(file, "\n[OutputMappings]\n");
+    for (int i = inputs; i < mappings; i++) fprintf(file, "bench_%04d=%d\n", i, i - inputs);
+    // Register i takes addresses 2i and 2i + 1 of its kind, input registers exercise word order and scale
+    if (opt->registers > 0) {
+        fprintf(file, "\n[HoldingRegisters]\n");
+        for (int i = 0; i < opt->registers; i++) fprintf(file, "bench_reg_%02d=%d:int32\n", i, 2 * i);
+        fprintf(file, "\n[InputRegisters]\n");
+        for (int i = 0; i < opt->registers; i++) fprintf(file, "bench_ireg_%02d=%d:float32:cdab:0.5\n", i, 2 * i);
+    }
+    return fclose(file) == 0;
+}
+
+static void* bench_field(CONTEXT_STRUCT_NAME* context, const char* format, int index) {
+    char name[SIGNAL_NAME_SIZE];
+    snprintf(name, sizeof(name), format, index);
+    const ModbusField* field = modbus_find_field(name);
+    return field ? (char*)context + field->offset : NULL;
+}
+
+// Pollers' latency of one run is the difference of the cumulative histograms around it
+static void print_load(const ModbusLoadStats* before, const ModbusLoadStats* after, long long elapsed_ns) {
+    MetricsHistogram delta;
+    memset(&delta, 0, sizeof(delta));
+    for (int b = 0; b < METRICS_BUCKETS; b++) {
+        atomic_init(&delta.buckets[b], atomic_load(&after->latency.buckets[b]) - atomic_load(&before->latency.buckets[b]));
+    }
+    atomic_init(&delta.max_ns, atomic_load(&after->latency.max_ns));
+    char name[32];
+    snprintf(name, sizeof(name), "  %lu pollers", after->connected);
+    printf("%8s  %-24s %11.0f %8.2f %8.2f %8.2f %11s %9s %12s\n", "", name,
+           (after->responses - before->responses) / (elapsed_ns / 1e9),
+           metrics_percentile_ns(&delta, 0.50) / 1000.0, metrics_percentile_ns(&delta, 0.99) / 1000.0,
+           metrics_percentile_ns(&delta, 0.999) / 1000.0, "-", "-", "-");
+}
+
+// Every cycle is timed on its own, counters of the simulator and the allocator are read around the run
+static void run_mode(const BenchOptions* opt, const BenchMode* mode, CONTEXT_STRUCT_NAME* context,
+                     int mappings, const BenchFields* fields, unsigned int* latencies) {
+    int inputs = input_count(mappings);
+    int output_count = mappings - inputs;
+    long toggle = 0;
+
+    long long warmup_end = bench_now_ns() + BENCH_WARMUP_MS * 1000000LL;
+    while (bench_now_ns() < warmup_end && !bench_stop) mode->function(context);
+
+    ModbusSimStats before, after;
+    static ModbusLoadStats load_before, load_after;
+    modbus_sim_get_stats(&before);
+    modbus_load_get_stats(&load_before);
+    unsigned long allocs = atomic_load(&bench_allocs);
+    long long start = bench_now_ns();
+    long long end = start + (long long)(opt->seconds * 1e9);
+    long long frame = start;
+    long cycles = 0;
+
+    while (cycles < opt->max_cycles && !bench_stop) {
+        if (mode->writes && output_count > 0) {
+            for (int t = 0; t < opt->toggles; t++, toggle++) {
+                SGLbool* field = fields->outputs[toggle % output_count];
+                if (field) *field = !*field;
+                if (opt->registers > 0) (*fields->holding[toggle % opt->registers])++;
+            }
+        }
+        long long t0 = bench_now_ns();
+        mode->function(context);
+        long long t1 = bench_now_ns();
+        latencies[cycles++] = (unsigned int)(t1 - t0);
+        if (t1 >= end) break;
+        if (opt->frame_us > 0) {
+            frame += opt->frame_us * 1000LL;
+            bench_sleep_until(frame);
+        }
+    }
+
+    long long elapsed = bench_now_ns() - start;
+    allocs = atomic_load(&bench_allocs) - allocs;
+    modbus_sim_get_stats(&after);
+    modbus_load_get_stats(&load_after);
+    unsigned long wire = (after.bytes_in - before.bytes_in) + (after.bytes_out - before.bytes_out);
+    if (cycles == 0) return;
+
+    qsort(latencies, cycles, sizeof(unsigned int), compare_latency);
+    printf("%8d  %-24s %11.0f %8.2f %8.2f %8.2f %11.1f %9.1f %12.3f\n",
+           mappings, mode->name, cycles / (elapsed / 1e9),
+           percentile_us(latencies, cycles, 0.50), percentile_us(latencies, cycles, 0.99),
+           percentile_us(latencies, cycles, 0.999),
+           (double)wire / cycles, wire / 1024.0 / (elapsed / 1e9), (double)allocs / cycles);
+    if (opt->load.pollers > 0) print_load(&load_before, &load_after, elapsed);
+    fflush(stdout);
+}
+
+// Holding registers of the timed runs must have reached the simulator, then values put into the simulator
+// must come back through the FC03 and FC04 decoding
+static bool check_registers(const BenchOptions* opt, CONTEXT_STRUCT_NAME* context, const BenchFields* fields) {
+    int count = opt->registers;
+    int written = 0;
+    long long settled = 0;
+    long long deadline = bench_now_ns() + BENCH_CHECK_TIMEOUT_MS * 1000000LL;
+    while (!bench_stop) {
+        update_modbus_values(context);
+        long long now = bench_now_ns();
+        written = 0;
+        for (int i = 0; i < count; i++) {
+            uint32_t raw = ((uint32_t)modbus_sim_get_register(true, 2 * i) << 16) | modbus_sim_get_register(true, 2 * i + 1);
+            written += (int32_t)raw == *fields->holding[i];
+        }
+        if (written < count) settled = 0;
+        else if (settled == 0) settled = now;
+        if ((settled && now - settled >= BENCH_SETTLE_MS * 1000000LL) || now > deadline) break;
+        usleep(1000);
+    }
+
+    for (int i = 0; i < count; i++) {
+        uint32_t holding = (uint32_t)(-1000 * i - 7);
+        float raw = 2 * i + 0.5f;
+        uint32_t input;
+        memcpy(&input, &raw, sizeof(input));
+        modbus_sim_set_register(true, 2 * i, (uint16_t)(holding >> 16));
+        modbus_sim_set_register(true, 2 * i + 1, (uint16_t)holding);
+        modbus_sim_set_register(false, 2 * i, (uint16_t)input); // cdab, low word first
+        modbus_sim_set_register(false, 2 * i + 1, (uint16_t)(input >> 16));
+    }
+    int read_back = 0;
+    deadline = bench_now_ns() + BENCH_CHECK_TIMEOUT_MS * 1000000LL;
+    while (!bench_stop) {
+        read_modbus_values(context);
+        read_back = 0;
+        for (int i = 0; i < count; i++) {
+            read_back += *fields->holding[i] == -1000 * i - 7;
+            read_back += *fields->inputs[i] == i + 0.25f;
+        }
+        if (read_back == 2 * count || bench_now_ns() > deadline) break;
+        usleep(1000);
+    }
+
+    printf("%8s  registers: %d of %d holding written, %d of %d holding and input read back\n", "",
+           written, count, read_back, 2 * count);
+    return written == count && read_back == 2 * count;
+}
+
+// A ring gets three times its depth in transitions, every readable one must come back by time and in the
+// window, and an entry stamped before the last one must not unsort the ring
+static bool check_history(void) {
+    HistoryRing ring;
+    memset(&ring, 0, sizeof(ring));
+    strcpy(ring.device, "bench");
+    strcpy(ring.name, "bench_history");
+    ModbusHistory history;
+    if (!history_open(&history, NULL, &ring, 1, BENCH_HISTORY_DEPTH, NULL)) {
+        fprintf(stderr, "Unable to open a history: %s\n", strerror(errno));
+        return false;
+    }
+
+    int total = 3 * BENCH_HISTORY_DEPTH;
+    int readable = BENCH_HISTORY_DEPTH - 1;
+    for (int i = 0; i < total; i++) history_record(&history, 0, 1000LL * (i + 1), i);
+    int values = 0;
+    double value;
+    for (int i = total - readable; i < total; i++) {
+        values += history_value_at(&history, 0, 1000LL * (i + 1) + 500, &value) && value == i;
+    }
+    HistoryEntry entries[BENCH_HISTORY_DEPTH];
+    int n = history_window(&history, 0, 0, INT64_MAX, entries, BENCH_HISTORY_DEPTH);
+    int window = 0;
+    for (int k = 0; k < n; k++) window += entries[k].value == total - readable + k;
+    history_record(&history, 0, 500, -1);
+    bool ordered = history_value_at(&history, 0, 1000LL * total, &value) && value == -1 &&
+                   history_value_at(&history, 0, 1000LL * total - 1, &value) && value == total - 2;
+    history_close(&history);
+
+    printf("history: %d of %d values and %d of %d window entries after %d transitions, %s after a clock step back\n",
+           values, readable, window, readable, total, ordered ? "ordered" : "NOT ordered");
+    return values == readable && n == readable && window == readable && ordered;
+}
+
+static bool run_size(const BenchOptions* opt, int mappings, unsigned int* latencies) {
+    if (!write_bench_config(opt, mappings)) {
+        fprintf(stderr, "Unable to write %s: %s\n", CONFIG_FILE, strerror(errno));
+        return false;
+    }
+    CONTEXT_STRUCT_NAME* context = calloc(1, sizeof(CONTEXT_STRUCT_NAME));
+    SGLbool** outputs = calloc(mappings, sizeof(SGLbool*));
+    if (!context || !outputs) {
+        free(context);
+        free(outputs);
+        return false;
+    }
+    int inputs = input_count(mappings);
+    BenchFields fields = { .outputs = outputs };
+    for (int i = inputs; i < mappings; i++) outputs[i - inputs] = bench_field(context, "bench_%04d", i);
+    for (int i = 0; i < opt->registers; i++) {
+        fields.holding[i] = bench_field(context, "bench_reg_%02d", i);
+        fields.inputs[i] = bench_field(context, "bench_ireg_%02d", i);
+    }
+
+    // Connection and the first full read happen before anything is timed
+    bool ok = init_modbus_communication(context);
+    long long deadline = bench_now_ns() + BENCH_CONNECT_TIMEOUT_MS * 1000000LL;
+    while (ok && !read_modbus_values(context)) {
+        if (bench_now_ns() > deadline || bench_stop) {
+            fprintf(stderr, "No answer from the simulator with %d mappings\n", mappings);
+            ok = false;
+        }
+        usleep(1000);
+    }
+
+    // Pollers cover the mapped addresses, every one is connected before anything is timed
+    if (ok && opt->load.pollers > 0) {
+        ModbusLoadConfig load = opt->load;
+        load.inputs = inputs;
+        load.coils = mappings - inputs;
+        ok = modbus_load_start(&load);
+        ModbusLoadStats stats;
+        deadline = bench_now_ns() + BENCH_LOAD_TIMEOUT_MS * 1000000LL * (1 + load.pollers / 100);
+        do {
+            read_modbus_values(context);
+            usleep(1000);
+            modbus_load_get_stats(&stats);
+        } while (ok && stats.connected < (unsigned long)load.pollers && bench_now_ns() < deadline && !bench_stop);
+        if (ok && stats.connected < (unsigned long)load.pollers) {
+            fprintf(stderr, "Only %lu of %d pollers connected\n", stats.connected, load.pollers);
+        }
+    }
+    for (size_t m = 0; ok && m < sizeof(modes) / sizeof(modes[0]) && !bench_stop; m++) {
+        run_mode(opt, &modes[m], context, mappings, &fields, latencies);
+    }
+    if (ok && opt->registers > 0 && !bench_stop) ok = check_registers(opt, context, &fields);
+
+    modbus_load_stop();
+    cleanup_modbus();
+    free(context);
+    free(outputs);
+    return ok;
+}
+
+static bool parse_sizes(BenchOptions* opt, const char* list) {
+    opt->size_count = 0;
+    for (const char* p = list; *p; ) {
+        char* end;
+        long n = strtol(p, &end, 10);
+        if (end == p || n < 1 || n > BENCH_MAX_MAPPINGS || opt->size_count == BENCH_MAX_SIZES) return false;
+        opt->sizes[opt->size_count++] = (int)n;
+        p = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',') return false;
+    }
+    return opt->size_count > 0;
+}
+
+static void print_sim_stats(void) {
+    ModbusSimStats stats;
+    modbus_sim_get_stats(&stats);
+    printf("connections %lu, requests %lu, dropped %lu, exceptions %lu, bytes in %lu, bytes out %lu, changes %lu\n",
+           stats.connections, stats.requests, stats.dropped, stats.exceptions,
+           stats.bytes_in, stats.bytes_out, stats.changes);
+}
+
+static void print_load_stats(void) {
+    ModbusServerStats stats;
+    modbus_server_get_stats(&stats);
+    printf("server connections %lu, rejected %lu, requests %lu, exceptions %lu, busy %lu, writes %lu\n",
+           stats.connections, stats.rejected, stats.requests, stats.exceptions, stats.busy, stats.writes);
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "Usage: %s [-m 10,100,1000,10000] [-t seconds] [-n max cycles] [-f frame us] [-w outputs per cycle]\n"
+            "          [-P poll ms] [-r rtt us] [-j jitter us] [-l loss %%] [-c coils] [-x changes/s] [-p port] [-S]\n"
+            "          [-L pollers] [-D depth] [-W write %%] [-T tcp|udp|rtu] [-R registers] [-H]\n",
+            name);
+}
+
+int main(int argc, char** argv) {
+    BenchOptions opt = {
+        .seconds = 2, .max_cycles = 1000000, .frame_us = 0, .toggles = 1, .poll_ms = 20,
+        .sim = { "127.0.0.1", 15502, 200, 50, 0, BENCH_MAX_MAPPINGS, 100, 1 },
+        .load = { "127.0.0.1", 0, 0, 1, 1, 0, 0, 0, 1000, 1 },
+    };
+    parse_sizes(&opt, BENCH_DEFAULT_SIZES);
+
+    int c;
+    while ((c = getopt(argc, argv, "m:t:n:f:w:P:r:j:l:c:x:p:SL:D:W:T:R:H")) != -1) {
+        bool ok = true;
+        switch (c) {
+        case 'm': ok = parse_sizes(&opt, optarg); break;
+        case 't': opt.seconds = atof(optarg); ok = opt.seconds > 0; break;
+        case 'n': opt.max_cycles = atol(optarg); ok = opt.max_cycles > 0; break;
+        case 'f': opt.frame_us = atol(optarg); ok = opt.frame_us >= 0; break;
+        case 'w': opt.toggles = atoi(optarg); ok = opt.toggles >= 0; break;
+        case 'P': opt.poll_ms = atoi(optarg); ok = opt.poll_ms > 0; break;
+        case 'r': opt.sim.rtt_us = atoi(optarg); ok = opt.sim.rtt_us >= 0; break;
+        case 'j': opt.sim.jitter_us = atoi(optarg); ok = opt.sim.jitter_us >= 0; break;
+        case 'l': opt.sim.loss = atof(optarg) / 100; ok = opt.sim.loss >= 0 && opt.sim.loss <= 1; break;
+        case 'c': opt.sim.coils = atoi(optarg); ok = opt.sim.coils > 0 && opt.sim.coils <= MODBUS_ADDRESS_COUNT; break;
+        case 'x': opt.sim.change_rate = atof(optarg); ok = opt.sim.change_rate >= 0; break;
+        case 'p': opt.sim.port = atoi(optarg); ok = opt.sim.port > 0 && opt.sim.port < 65536; break;
+        case 'S': opt.sim_only = true; break;
+        case 'H': opt.history_check = true; break;
+        case 'L': opt.load.pollers = atoi(optarg); ok = opt.load.pollers >= 0 && opt.load.pollers <= MODBUS_SERVER_MAX_CLIENTS; break;
+        case 'D': opt.load.depth = atoi(optarg); ok = opt.load.depth > 0 && opt.load.depth <= MODBUS_TCP_MAX_WINDOW; break;
+        case 'W': opt.load.write_share = atof(optarg) / 100; ok = opt.load.write_share >= 0 && opt.load.write_share <= 1; break;
+        case 'T': ok = modbus_transport_parse(optarg, &opt.sim.transport); break;
+        case 'R': opt.registers = atoi(optarg); ok = opt.registers >= 0 && opt.registers <= BENCH_MAX_REGISTERS; break;
+        default: ok = false; break;
+        }
+        if (!ok) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    opt.load.port = opt.sim.port + 1;
+    if (opt.history_check && !check_history()) return 1;
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    if (!modbus_sim_start(&opt.sim)) return 1;
+    printf("Simulator on %s port %d: rtt %d us, jitter %d us, loss %.2f %%, %d coils, %.0f changes/s\n",
+           modbus_transport_name(opt.sim.transport), opt.sim.port, opt.sim.rtt_us, opt.sim.jitter_us, opt.sim.loss * 100, opt.sim.coils, opt.sim.change_rate);
+
+    if (opt.sim_only) {
+        while (!bench_stop) {
+            sleep(1);
+            print_sim_stats();
+        }
+        modbus_sim_stop();
+        return 0;
+    }
+
+    // Config, cache and log of the runs stay out of the working directory
+    char dir[] = "/tmp/modbus_bench.XXXXXX";
+    unsigned int* latencies = malloc(opt.max_cycles * sizeof(unsigned int));
+    if (!latencies || !mkdtemp(dir) || chdir(dir) != 0) {
+        fprintf(stderr, "Unable to prepare a work directory: %s\n", strerror(errno));
+        modbus_sim_stop();
+        free(latencies);
+        return 1;
+    }
+
+    printf("%8s  %-24s %11s %8s %8s %8s %11s %9s %12s\n", "mappings", "function", "cycles/s",
+           "p50 us", "p99 us", "p999 us", "wire B/cyc", "wire KiB/s", "allocs/cycle");
+    bool ok = true;
+    for (int s = 0; s < opt.size_count && ok && !bench_stop; s++) {
+        int mappings = opt.sizes[s];
+        int needed = mappings - input_count(mappings);
+        if (needed < 2 * opt.registers) needed = 2 * opt.registers;
+        if (needed > opt.sim.coils) {
+            fprintf(stderr, "%d mappings and %d registers need at least %d coils\n", mappings, opt.registers, needed);
+            ok = false;
+            break;
+        }
+        ok = run_size(&opt, mappings, latencies);
+    }
+    print_sim_stats();
+    if (opt.load.pollers > 0) print_load_stats();
+
+    modbus_sim_stop();
+    free(latencies);
+    unlink(CONFIG_FILE);
+    unlink(CONFIG_CACHE_FILE);
+    unlink(LOG_FILE);
+    if (chdir("/") == 0) rmdir(dir);
+    return ok ? 0 : 1;
+}
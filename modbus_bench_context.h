@@ -0,0 +1,40 @@
+#ifndef MODBUS_BENCH_CONTEXT_H
+#define MODBUS_BENCH_CONTEXT_H
+
+#include "sgl_types.h"
+
+/*
+ * Synthetic context for modbus_bench with the bool fields bench_0000 to bench_9999, and bench_reg_00 to
+ * bench_reg_99 and bench_ireg_00 to bench_ireg_99 for the holding and input registers of -R.
+ * modbus_bindgen does not expand macros, run it on the output of gcc -E -P of this header.
+ */
+#define BENCH_FIELD(a, b, c, d) SGLbool bench_##a##b##c##d;
+#define BENCH_FIELDS_10(a, b, c) \
+    BENCH_FIELD(a, b, c, 0) BENCH_FIELD(a, b, c, 1) BENCH_FIELD(a, b, c, 2) BENCH_FIELD(a, b, c, 3) \
+    BENCH_FIELD(a, b, c, 4) BENCH_FIELD(a, b, c, 5) BENCH_FIELD(a, b, c, 6) BENCH_FIELD(a, b, c, 7) \
+    BENCH_FIELD(a, b, c, 8) BENCH_FIELD(a, b, c, 9)
+#define BENCH_FIELDS_100(a, b) \
+    BENCH_FIELDS_10(a, b, 0) BENCH_FIELDS_10(a, b, 1) BENCH_FIELDS_10(a, b, 2) BENCH_FIELDS_10(a, b, 3) \
+    BENCH_FIELDS_10(a, b, 4) BENCH_FIELDS_10(a, b, 5) BENCH_FIELDS_10(a, b, 6) BENCH_FIELDS_10(a, b, 7) \
+    BENCH_FIELDS_10(a, b, 8) BENCH_FIELDS_10(a, b, 9)
+#define BENCH_FIELDS_1000(a) \
+    BENCH_FIELDS_100(a, 0) BENCH_FIELDS_100(a, 1) BENCH_FIELDS_100(a, 2) BENCH_FIELDS_100(a, 3) \
+    BENCH_FIELDS_100(a, 4) BENCH_FIELDS_100(a, 5) BENCH_FIELDS_100(a, 6) BENCH_FIELDS_100(a, 7) \
+    BENCH_FIELDS_100(a, 8) BENCH_FIELDS_100(a, 9)
+
+#define BENCH_REGISTER(a, b) SGLint32 bench_reg_##a##b; SGLfloat bench_ireg_##a##b;
+#define BENCH_REGISTERS_10(a) \
+    BENCH_REGISTER(a, 0) BENCH_REGISTER(a, 1) BENCH_REGISTER(a, 2) BENCH_REGISTER(a, 3) BENCH_REGISTER(a, 4) \
+    BENCH_REGISTER(a, 5) BENCH_REGISTER(a, 6) BENCH_REGISTER(a, 7) BENCH_REGISTER(a, 8) BENCH_REGISTER(a, 9)
+
+#define BENCH_MAX_MAPPINGS 10000
+#define BENCH_MAX_REGISTERS 100
+
+typedef struct {
+    BENCH_FIELDS_1000(0) BENCH_FIELDS_1000(1) BENCH_FIELDS_1000(2) BENCH_FIELDS_1000(3) BENCH_FIELDS_1000(4)
+    BENCH_FIELDS_1000(5) BENCH_FIELDS_1000(6) BENCH_FIELDS_1000(7) BENCH_FIELDS_1000(8) BENCH_FIELDS_1000(9)
+    BENCH_REGISTERS_10(0) BENCH_REGISTERS_10(1) BENCH_REGISTERS_10(2) BENCH_REGISTERS_10(3) BENCH_REGISTERS_10(4)
+    BENCH_REGISTERS_10(5) BENCH_REGISTERS_10(6) BENCH_REGISTERS_10(7) BENCH_REGISTERS_10(8) BENCH_REGISTERS_10(9)
+} specification_typ_genel;
+
+#endif // MODBUS_BENCH_CONTEXT_H
@@ -0,0 +1,272 @@
+/*
+ * Generates modbus_bindings.c from the SCADE context header.
+ * Usage: modbus_bindgen specification_genel.h specification_typ_genel modbus_bindings.c
+ * Build: gcc -o modbus_bindgen modbus_bindgen.c
+ * Run it again whenever the model changes the context struct.
+ */
+#include "modbus_bindings.h"
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GEN_NAME_SIZE 128
+#define GEN_MAX_SEED 1000000u
+
+typedef struct {
+    char name[GEN_NAME_SIZE];
+    ModbusFieldType type;
+    uint32_t bucket;
+} GenField;
+
+static const struct {
+    const char* name;
+    ModbusFieldType type;
+} scalar_types[] = {
+    { "SGLbool", MODBUS_FIELD_BOOL },
+    { "SGLint8", MODBUS_FIELD_INT8 },
+    { "SGLuint8", MODBUS_FIELD_UINT8 },
+    { "SGLint16", MODBUS_FIELD_INT16 },
+    { "SGLuint16", MODBUS_FIELD_UINT16 },
+    { "SGLint32", MODBUS_FIELD_INT32 },
+    { "SGLuint32", MODBUS_FIELD_UINT32 },
+    { "SGLfloat", MODBUS_FIELD_FLOAT },
+    { "SGLdouble", MODBUS_FIELD_DOUBLE },
+};
+
+static const char* type_names[] = {
+    "MODBUS_FIELD_BOOL", "MODBUS_FIELD_INT8", "MODBUS_FIELD_UINT8", "MODBUS_FIELD_INT16", "MODBUS_FIELD_UINT16",
+    "MODBUS_FIELD_INT32", "MODBUS_FIELD_UINT32", "MODBUS_FIELD_FLOAT", "MODBUS_FIELD_DOUBLE",
+};
+
+static GenField* fields = NULL;
+static int field_count = 0;
+
+static char* read_file(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return NULL;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* text = malloc(size + 1);
+    if (text && fread(text, 1, size, file) != (size_t)size) {
+        free(text);
+        text = NULL;
+    }
+    if (text) text[size] = '\0';
+    fclose(file);
+    return text;
+}
+
+// Comments are blanked in place so offsets and line structure stay intact
+static void strip_comments(char* text) {
+    for (char* p = text; *p; p++) {
+        if (p[0] == '/' && p[1] == '*') {
+            char* end = strstr(p + 2, "*/");
+            char* stop = end ? end + 2 : p + strlen(p);
+            for (; p < stop; p++) if (*p != '\n') *p = ' ';
+            p--;
+        } else if (p[0] == '/' && p[1] == '/') {
+            for (; *p && *p != '\n'; p++) *p = ' ';
+            if (!*p) break;
+        }
+    }
+}
+
+// Body of the typedef struct that ends with the given type name, NULL if there is none
+static char* find_struct_body(char* text, const char* struct_name, char** body_end) {
+    size_t name_length = strlen(struct_name);
+    for (char* p = strstr(text, "typedef struct"); p; p = strstr(p + 1, "typedef struct")) {
+        char* open = strchr(p, '{');
+        if (!open) return NULL;
+
+        int depth = 0;
+        char* close = open;
+        for (; *close; close++) {
+            if (*close == '{') depth++;
+            else if (*close == '}' && --depth == 0) break;
+        }
+        if (!*close) return NULL;
+
+        char* name = close + 1;
+        while (isspace((unsigned char)*name)) name++;
+        if (strncmp(name, struct_name, name_length) == 0 &&
+            !isalnum((unsigned char)name[name_length]) && name[name_length] != '_') {
+            *body_end = close;
+            return open + 1;
+        }
+    }
+    return NULL;
+}
+
+static bool add_field(const char* name, ModbusFieldType type) {
+    GenField* grown = realloc(fields, (field_count + 1) * sizeof(GenField));
+    if (!grown) return false;
+    fields = grown;
+    GenField* field = &fields[field_count++];
+    strncpy(field->name, name, GEN_NAME_SIZE - 1);
+    field->name[GEN_NAME_SIZE - 1] = '\0';
+    field->type = type;
+    return true;
+}
+
+// Declarations are "type name;", scalar fields are kept, arrays and subcontexts are skipped
+static bool parse_fields(char* body, char* body_end) {
+    *body_end = '\0';
+    for (char* decl = strtok(body, ";"); decl; decl = strtok(NULL, ";")) {
+        char type[GEN_NAME_SIZE], name[GEN_NAME_SIZE];
+        if (sscanf(decl, " %127[A-Za-z0-9_] %127[A-Za-z0-9_]", type, name) != 2) continue;
+        if (strchr(decl, '[') || strchr(decl, '*') || strchr(decl, ',')) {
+            fprintf(stderr, "Skipping %s: arrays, pointers and lists are not mappable\n", name);
+            continue;
+        }
+
+        for (size_t t = 0; t < sizeof(scalar_types) / sizeof(scalar_types[0]); t++) {
+            if (strcmp(type, scalar_types[t].name) != 0) continue;
+            if (!add_field(name, scalar_types[t].type)) return false;
+            break;
+        }
+    }
+    return true;
+}
+
+static int* sort_sizes = NULL;
+
+// Larger buckets first, they are the hardest to place
+static int compare_buckets(const void* a, const void* b) {
+    int x = sort_sizes[*(const int*)a];
+    int y = sort_sizes[*(const int*)b];
+    return (y > x) - (y < x);
+}
+
+// Hash and displace: buckets are placed largest first, each gets the first seed that maps all of
+// its names to free slots
+static bool build_perfect_hash(int buckets, uint32_t* seeds, int* slots) {
+    int* sizes = calloc(buckets, sizeof(int));
+    int* order = malloc(buckets * sizeof(int));
+    int* members = malloc((field_count + 1) * sizeof(int));
+    int* wanted = malloc((field_count + 1) * sizeof(int));
+    if (!sizes || !order || !members || !wanted) return false;
+
+    for (int f = 0; f < field_count; f++) {
+        fields[f].bucket = modbus_field_hash(fields[f].name, 0) % (uint32_t)buckets;
+        sizes[fields[f].bucket]++;
+    }
+    for (int b = 0; b < buckets; b++) order[b] = b;
+    sort_sizes = sizes;
+    qsort(order, buckets, sizeof(int), compare_buckets);
+    for (int s = 0; s < field_count; s++) slots[s] = -1;
+
+    bool ok = true;
+    for (int o = 0; o < buckets && ok; o++) {
+        int b = order[o];
+        seeds[b] = 0;
+        if (sizes[b] == 0) continue;
+
+        int count = 0;
+        for (int f = 0; f < field_count; f++) if (fields[f].bucket == (uint32_t)b) members[count++] = f;
+
+        ok = false;
+        for (uint32_t seed = 1; seed < GEN_MAX_SEED && !ok; seed++) {
+            ok = true;
+            for (int m = 0; m < count && ok; m++) {
+                wanted[m] = (int)(modbus_field_hash(fields[members[m]].name, seed) % (uint32_t)field_count);
+                if (slots[wanted[m]] >= 0) ok = false;
+                for (int k = 0; k < m && ok; k++) ok = wanted[k] != wanted[m];
+            }
+            if (ok) {
+                seeds[b] = seed;
+                for (int m = 0; m < count; m++) slots[wanted[m]] = members[m];
+            }
+        }
+    }
+
+    free(sizes);
+    free(order);
+    free(members);
+    free(wanted);
+    return ok;
+}
+
+static const char* base_name(const char* path) {
+    const char* slash = strrchr(path, '/');
+    const char* backslash = strrchr(path, '\\');
+    if (backslash && (!slash || backslash > slash)) slash = backslash;
+    return slash ? slash + 1 : path;
+}
+
+// Numbers are written twelve to a row
+static const char* row_separator(int i) {
+    if (i == 0) return "\n    ";
+    return i % 12 ? ", " : ",\n    ";
+}
+
+static bool write_output(const char* path, const char* header, const char* struct_name,
+                         int buckets, const uint32_t* seeds, const int* slots) {
+    FILE* out = fopen(path, "w");
+    if (!out) return false;
+
+    fprintf(out, "/* Generated by modbus_bindgen from %s, do not edit */\n", base_name(header));
+    fprintf(out, "#include \"modbus_bindings.h\"\n#include \"%s\"\n\n", base_name(header));
+
+    fprintf(out, "const ModbusField modbus_fields[] = {\n");
+    for (int f = 0; f < field_count; f++) {
+        fprintf(out, "    { \"%s\", offsetof(%s, %s), %s },\n",
+                fields[f].name, struct_name, fields[f].name, type_names[fields[f].type]);
+    }
+    if (field_count == 0) fprintf(out, "    { NULL, 0, MODBUS_FIELD_BOOL },\n");
+    fprintf(out, "};\nconst int modbus_field_count = %d;\n\n", field_count);
+
+    fprintf(out, "const uint32_t modbus_field_seed[] = {");
+    for (int b = 0; b < buckets; b++) fprintf(out, "%s%u", row_separator(b), seeds[b]);
+    fprintf(out, "\n};\nconst int modbus_field_buckets = %d;\n\n", buckets);
+
+    fprintf(out, "const int modbus_field_slot[] = {");
+    for (int s = 0; s < field_count; s++) fprintf(out, "%s%d", row_separator(s), slots[s]);
+    if (field_count == 0) fprintf(out, "\n    0");
+    fprintf(out, "\n};\n");
+
+    return fclose(out) == 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <context header> <context struct> <output.c>\n", argv[0]);
+        return 1;
+    }
+
+    char* text = read_file(argv[1]);
+    if (!text) {
+        fprintf(stderr, "Unable to read %s\n", argv[1]);
+        return 1;
+    }
+    strip_comments(text);
+
+    char* body_end = NULL;
+    char* body = find_struct_body(text, argv[2], &body_end);
+    if (!body) {
+        fprintf(stderr, "No typedef struct %s in %s\n", argv[2], argv[1]);
+        free(text);
+        return 1;
+    }
+    if (!parse_fields(body, body_end)) {
+        fprintf(stderr, "Out of memory\n");
+        free(text);
+        return 1;
+    }
+
+    int buckets = field_count / 2 + 1;
+    uint32_t* seeds = calloc(buckets, sizeof(uint32_t));
+    int* slots = malloc((field_count + 1) * sizeof(int));
+    bool ok = seeds && slots && build_perfect_hash(buckets, seeds, slots) &&
+              write_output(argv[3], argv[1], argv[2], buckets, seeds, slots);
+    if (ok) printf("%d fields of %s written to %s\n", field_count, argv[2], argv[3]);
+    else fprintf(stderr, "Unable to generate %s\n", argv[3]);
+
+    free(seeds);
+    free(slots);
+    free(fields);
+    free(text);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,26 @@
+/* Generated by modbus_bindgen from specification_genel.h, do not edit */
+#include "modbus_bindings.h"
+#include "specification_genel.h"
+
+const ModbusField modbus_fields[] = {
+    { "out_RT01_Accept", offsetof(specification_typ_genel, out_RT01_Accept), MODBUS_FIELD_BOOL },
+    { "out_RT01_Reject", offsetof(specification_typ_genel, out_RT01_Reject), MODBUS_FIELD_BOOL },
+    { "out_RT01_RejectAck", offsetof(specification_typ_genel, out_RT01_RejectAck), MODBUS_FIELD_BOOL },
+    { "out_RT01_Request", offsetof(specification_typ_genel, out_RT01_Request), MODBUS_FIELD_BOOL },
+    { "out_RT01_Reserve", offsetof(specification_typ_genel, out_RT01_Reserve), MODBUS_FIELD_BOOL },
+    { "in_RT01_RejectAck", offsetof(specification_typ_genel, in_RT01_RejectAck), MODBUS_FIELD_BOOL },
+    { "in_RT01_Request", offsetof(specification_typ_genel, in_RT01_Request), MODBUS_FIELD_BOOL },
+    { "in_TC03_I_Occupied_hws", offsetof(specification_typ_genel, in_TC03_I_Occupied_hws), MODBUS_FIELD_BOOL },
+    { "in_RT02_RejectAck", offsetof(specification_typ_genel, in_RT02_RejectAck), MODBUS_FIELD_BOOL },
+    { "in_RT02_Request", offsetof(specification_typ_genel, in_RT02_Request), MODBUS_FIELD_BOOL },
+};
+const int modbus_field_count = 10;
+
+const uint32_t modbus_field_seed[] = {
+    2, 7, 0, 1, 1, 8
+};
+const int modbus_field_buckets = 6;
+
+const int modbus_field_slot[] = {
+    9, 6, 5, 4, 0, 1, 7, 8, 2, 3
+};
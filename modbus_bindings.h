@@ -0,0 +1,53 @@
+#ifndef MODBUS_BINDINGS_H
+#define MODBUS_BINDINGS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Scalar types of context fields, everything else in the context is not mappable
+typedef enum {
+    MODBUS_FIELD_BOOL,
+    MODBUS_FIELD_INT8,
+    MODBUS_FIELD_UINT8,
+    MODBUS_FIELD_INT16,
+    MODBUS_FIELD_UINT16,
+    MODBUS_FIELD_INT32,
+    MODBUS_FIELD_UINT32,
+    MODBUS_FIELD_FLOAT,
+    MODBUS_FIELD_DOUBLE
+} ModbusFieldType;
+
+typedef struct {
+    const char* name;
+    size_t offset; // offsetof the field in the context struct
+    ModbusFieldType type;
+} ModbusField;
+
+// Generated by modbus_bindgen into modbus_bindings.c
+extern const ModbusField modbus_fields[];
+extern const int modbus_field_count;
+extern const uint32_t modbus_field_seed[]; // Displacement seed of every bucket
+extern const int modbus_field_buckets;
+extern const int modbus_field_slot[]; // Field index of every hash slot
+
+// FNV-1a, the generator and the lookup must agree on it
+static inline uint32_t modbus_field_hash(const char* name, uint32_t seed) {
+    uint32_t h = 2166136261u ^ seed;
+    for (; *name; name++) {
+        h ^= (uint8_t)*name;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Perfect hash lookup, one compare confirms the name so unknown fields are reported instead of misbound
+static inline const ModbusField* modbus_find_field(const char* name) {
+    if (modbus_field_count == 0) return NULL;
+    uint32_t bucket = modbus_field_hash(name, 0) % (uint32_t)modbus_field_buckets;
+    uint32_t slot = modbus_field_hash(name, modbus_field_seed[bucket]) % (uint32_t)modbus_field_count;
+    const ModbusField* field = &modbus_fields[modbus_field_slot[slot]];
+    return strcmp(field->name, name) == 0 ? field : NULL;
+}
+
+#endif // MODBUS_BINDINGS_H
@@ -0,0 +1,281 @@
+#include "modbus_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// File starts with this header, the rest is the config image followed by every device and its arrays
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint64_t size; // Whole file, a truncated cache is rejected
+} CacheHeader;
+
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+    bool ok;
+} CacheWriter;
+
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    size_t used;
+} CacheReader;
+
+static uint64_t fnv64(uint64_t h, const void* data, size_t size) {
+    const uint8_t* bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        h ^= bytes[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// INI text, binding table, struct layouts and the build stamp together, any change rebuilds the cache.
+// The build stamp covers compiled defaults that the INI does not repeat.
+uint64_t config_cache_key(const char* text, size_t size) {
+    uint64_t h = fnv64(14695981039346656037ULL, text, size);
+    static const char build[] = __DATE__ " " __TIME__;
+    size_t layout[] = { CONFIG_CACHE_VERSION, sizeof(ModbusConfig), sizeof(ModbusDevice), sizeof(SignalInfo),
+                        sizeof(ModbusReadBlock), sizeof(ModbusPollGroup), sizeof(QualityBinding), sizeof(RegisterFormat) };
+    h = fnv64(h, build, sizeof(build));
+    h = fnv64(h, layout, sizeof(layout));
+    for (int f = 0; f < modbus_field_count; f++) {
+        h = fnv64(h, modbus_fields[f].name, strlen(modbus_fields[f].name) + 1);
+        h = fnv64(h, &modbus_fields[f].offset, sizeof(modbus_fields[f].offset));
+        h = fnv64(h, &modbus_fields[f].type, sizeof(modbus_fields[f].type));
+    }
+    return h;
+}
+
+static void cache_put(CacheWriter* w, const void* data, size_t size) {
+    if (!w->ok || size == 0) return;
+    if (w->size + size > w->capacity) {
+        size_t capacity = w->capacity ? w->capacity : 4096;
+        while (w->size + size > capacity) capacity *= 2;
+        uint8_t* grown = realloc(w->data, capacity);
+        if (!grown) {
+            w->ok = false;
+            return;
+        }
+        w->data = grown;
+        w->capacity = capacity;
+    }
+    memcpy(w->data + w->size, data, size);
+    w->size += size;
+}
+
+static void cache_put_table(CacheWriter* w, const SignalTable* table) {
+    cache_put(w, &table->count, sizeof(int));
+    cache_put(w, table->address, table->count * sizeof(uint16_t));
+    cache_put(w, table->read_offset, table->count * sizeof(int));
+    cache_put(w, table->info, table->count * sizeof(SignalInfo));
+}
+
+static void cache_put_registers(CacheWriter* w, const RegisterTable* registers) {
+    int count = registers->signals.count;
+    cache_put_table(w, &registers->signals);
+    cache_put(w, registers->format, count * sizeof(RegisterFormat));
+    cache_put(w, registers->scale, count * sizeof(double));
+    cache_put(w, registers->offset, count * sizeof(double));
+}
+
+// Parsed and planned config is written next to the INI, a temporary file is renamed so readers never see half a cache
+bool config_cache_save(const ModbusConfig* cfg, const char* path, uint64_t key) {
+    CacheWriter w = { NULL, 0, 0, true };
+    CacheHeader header = { CONFIG_CACHE_MAGIC, CONFIG_CACHE_VERSION, key, 0 };
+    cache_put(&w, &header, sizeof(header));
+    cache_put(&w, cfg, sizeof(ModbusConfig));
+
+    for (int d = 0; d < cfg->device_count; d++) {
+        const ModbusDevice* dev = &cfg->devices[d];
+        cache_put(&w, dev, sizeof(ModbusDevice));
+        cache_put_table(&w, &dev->inputs);
+        cache_put_table(&w, &dev->outputs);
+        cache_put(&w, dev->read_plan, dev->read_block_count * sizeof(ModbusReadBlock));
+        cache_put(&w, dev->poll_groups, dev->poll_group_count * sizeof(ModbusPollGroup));
+        cache_put(&w, dev->write_order, dev->outputs.count * sizeof(int));
+        cache_put(&w, dev->write_segment, dev->outputs.count * sizeof(int));
+        cache_put_registers(&w, &dev->registers);
+        cache_put(&w, dev->register_write_order, dev->register_write_count * sizeof(int));
+        cache_put(&w, dev->quality_bindings, dev->quality_binding_count * sizeof(QualityBinding));
+    }
+    if (!w.ok) {
+        free(w.data);
+        return false;
+    }
+    ((CacheHeader*)w.data)->size = w.size;
+
+    char temp[256];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    FILE* file = fopen(temp, "wb");
+    bool ok = file && fwrite(w.data, 1, w.size, file) == w.size;
+    if (file && fclose(file) != 0) ok = false;
+    if (ok) ok = rename(temp, path) == 0;
+    if (!ok) remove(temp);
+    free(w.data);
+    return ok;
+}
+
+static bool cache_take(CacheReader* r, void* out, size_t size) {
+    if (size > r->size - r->used) return false;
+    memcpy(out, r->data + r->used, size);
+    r->used += size;
+    return true;
+}
+
+// Array of count elements is copied into a new allocation with one spare element, NULL when the cache is short
+static void* cache_take_array(CacheReader* r, int count, size_t element) {
+    if (count < 0 || (size_t)count * element > r->size - r->used) return NULL;
+    void* array = malloc(((size_t)count + 1) * element);
+    if (array) cache_take(r, array, (size_t)count * element);
+    return array;
+}
+
+static bool cache_take_table(CacheReader* r, SignalTable* table) {
+    int count;
+    if (!cache_take(r, &count, sizeof(int)) || count < 0) return false;
+
+    uint16_t* address = cache_take_array(r, count, sizeof(uint16_t));
+    int* read_offset = cache_take_array(r, count, sizeof(int));
+    SignalInfo* info = cache_take_array(r, count, sizeof(SignalInfo));
+    bool ok = address && read_offset && info;
+    for (int i = 0; i < count && ok; i++) {
+        info[i].name[SIGNAL_NAME_SIZE - 1] = '\0';
+        ok = signal_table_add(table, info[i].name, address[i]) == i;
+    }
+    if (ok && count > 0) {
+        memcpy(table->read_offset, read_offset, count * sizeof(int));
+        memcpy(table->info, info, count * sizeof(SignalInfo));
+    }
+    free(address);
+    free(read_offset);
+    free(info);
+    return ok;
+}
+
+// Register signals are added again with their layout and scaling, the embedded table is read like any other
+static bool cache_take_registers(CacheReader* r, RegisterTable* registers) {
+    SignalTable signals = { 0 };
+    if (!cache_take_table(r, &signals)) {
+        signal_table_free(&signals);
+        return false;
+    }
+    int count = signals.count;
+    RegisterFormat* format = cache_take_array(r, count, sizeof(RegisterFormat));
+    double* scale = cache_take_array(r, count, sizeof(double));
+    double* offset = cache_take_array(r, count, sizeof(double));
+    bool ok = format && scale && offset;
+    for (int i = 0; i < count && ok; i++) {
+        ok = register_table_add(registers, signals.info[i].name, signals.address[i], format[i], scale[i], offset[i]) == i;
+    }
+    if (ok && count > 0) {
+        memcpy(registers->signals.read_offset, signals.read_offset, count * sizeof(int));
+        memcpy(registers->signals.info, signals.info, count * sizeof(SignalInfo));
+    }
+    signal_table_free(&signals);
+    free(format);
+    free(scale);
+    free(offset);
+    return ok;
+}
+
+// Device image is read with every pointer replaced by a fresh copy of its array
+static bool cache_take_device(CacheReader* r, ModbusDevice* dev) {
+    if (!cache_take(r, dev, sizeof(ModbusDevice))) return false;
+    memset(&dev->inputs, 0, sizeof(SignalTable));
+    memset(&dev->outputs, 0, sizeof(SignalTable));
+    memset(&dev->registers, 0, sizeof(RegisterTable));
+    dev->read_plan = NULL;
+    dev->read_bits = NULL;
+    dev->read_regs = NULL;
+    dev->register_write_order = NULL;
+    dev->poll_groups = NULL;
+    dev->write_order = NULL;
+    dev->write_segment = NULL;
+    dev->quality_bindings = NULL;
+    int quality_binding_count = dev->quality_binding_count;
+    dev->quality_binding_count = 0;
+
+    if (!cache_take_table(r, &dev->inputs) || !cache_take_table(r, &dev->outputs)) return false;
+    dev->read_plan = cache_take_array(r, dev->read_block_count, sizeof(ModbusReadBlock));
+    if (!dev->read_plan) return false;
+
+    // Statistics and deadlines start fresh, only the layout of the groups is cached
+    ModbusPollGroup* groups = cache_take_array(r, dev->poll_group_count, sizeof(ModbusPollGroup));
+    if (!groups) return false;
+    dev->poll_groups = calloc(dev->poll_group_count + 1, sizeof(ModbusPollGroup));
+    for (int g = 0; dev->poll_groups && g < dev->poll_group_count; g++) {
+        dev->poll_groups[g].period_ms = groups[g].period_ms;
+        dev->poll_groups[g].first_block = groups[g].first_block;
+        dev->poll_groups[g].block_count = groups[g].block_count;
+    }
+    free(groups);
+    if (!dev->poll_groups) return false;
+
+    dev->read_bits = calloc(dev->read_bit_count + 1, sizeof(uint8_t));
+    dev->write_order = cache_take_array(r, dev->outputs.count, sizeof(int));
+    dev->write_segment = cache_take_array(r, dev->outputs.count, sizeof(int));
+    if (!dev->read_bits || !dev->write_order || !dev->write_segment) return false;
+    if (!cache_take_registers(r, &dev->registers)) return false;
+    dev->read_regs = calloc(dev->read_register_count + 1, sizeof(uint16_t));
+    dev->register_write_order = cache_take_array(r, dev->register_write_count, sizeof(int));
+    dev->quality_bindings = cache_take_array(r, quality_binding_count, sizeof(QualityBinding));
+    if (!dev->read_regs || !dev->register_write_order || !dev->quality_bindings) return false;
+    dev->quality_binding_count = quality_binding_count;
+    for (int q = 0; q < quality_binding_count; q++) {
+        dev->quality_bindings[q].table = NULL;
+        dev->quality_bindings[q].target = NULL;
+    }
+    return true;
+}
+
+// Compiled config of the given key, NULL when there is no cache or it was built from something else
+ModbusConfig* config_cache_load(const char* path, uint64_t key) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)(sizeof(CacheHeader) + sizeof(ModbusConfig))) {
+        close(fd);
+        return NULL;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    CacheReader r = { map, (size_t)st.st_size, 0 };
+    CacheHeader header;
+    ModbusConfig* cfg = NULL;
+    cache_take(&r, &header, sizeof(header));
+    if (header.magic == CONFIG_CACHE_MAGIC && header.version == CONFIG_CACHE_VERSION &&
+        header.key == key && header.size == r.size) {
+        cfg = malloc(sizeof(ModbusConfig));
+    }
+
+    if (cfg && cache_take(&r, cfg, sizeof(ModbusConfig))) {
+        int device_count = cfg->device_count;
+        cfg->device_count = 0;
+        cfg->devices = calloc(device_count > 0 ? device_count : 1, sizeof(ModbusDevice));
+        bool ok = device_count > 0 && cfg->devices;
+        // Devices count as loaded as soon as they are touched so free_config releases partial ones
+        for (int d = 0; d < device_count && ok; d++) {
+            cfg->device_count++;
+            ok = cache_take_device(&r, &cfg->devices[d]);
+        }
+        if (!ok || r.used != r.size) {
+            free_config(cfg);
+            cfg = NULL;
+        }
+    } else {
+        free(cfg);
+        cfg = NULL;
+    }
+    munmap(map, st.st_size);
+    return cfg;
+}
@@ -0,0 +1,18 @@
+#ifndef MODBUS_CACHE_H
+#define MODBUS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "modbus_comm.h"
+
+// Constants
+#define CONFIG_CACHE_MAGIC 0x4643424Du // "MBCF"
+#define CONFIG_CACHE_VERSION 1
+
+// Function prototypes
+uint64_t config_cache_key(const char* text, size_t size);
+bool config_cache_save(const ModbusConfig* cfg, const char* path, uint64_t key);
+ModbusConfig* config_cache_load(const char* path, uint64_t key);
+
+#endif // MODBUS_CACHE_H
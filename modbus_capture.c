@@ -0,0 +1,189 @@
+#include "modbus_capture.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define CAPTURE_RING_MASK (CAPTURE_RING_SIZE - 1)
+
+typedef struct {
+    uint8_t type;
+    uint8_t device;
+    uint16_t id;
+    uint16_t size;
+    int64_t time_ns;
+    uint8_t data[CAPTURE_DATA_SIZE];
+} CaptureSlot;
+
+// Single producer ring, the I/O thread puts records while it runs and the draw thread only while it is
+// stopped or parked, so one thread puts at a time
+static CaptureSlot* ring = NULL;
+static atomic_size_t ring_head = 0; // Next slot the producer fills
+static atomic_size_t ring_tail = 0; // Next slot the writer takes
+static atomic_ulong capture_dropped = 0;
+static atomic_bool capture_running = false;
+static pthread_t capture_thread;
+static FILE* out_file = NULL;
+
+static int64_t capture_realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int64_t capture_monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void capture_write(uint8_t type, uint8_t device, uint16_t id, const void* data, uint16_t size, int64_t time_ns) {
+    fwrite(&type, 1, 1, out_file);
+    fwrite(&device, 1, 1, out_file);
+    fwrite(&id, sizeof(id), 1, out_file);
+    fwrite(&size, sizeof(size), 1, out_file);
+    fwrite(&time_ns, sizeof(time_ns), 1, out_file);
+    if (size) fwrite(data, 1, size, out_file);
+}
+
+// Records are written in ring order, lost records are reported where they were lost
+static void capture_drain(void) {
+    size_t tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring_head, memory_order_acquire);
+    unsigned long dropped = atomic_exchange(&capture_dropped, 0);
+    if (dropped) {
+        uint32_t count = (uint32_t)dropped;
+        capture_write(CAPTURE_GAP, 0, 0, &count, sizeof(count), capture_monotonic_ns());
+    }
+    for (; tail != head; tail++) {
+        const CaptureSlot* slot = &ring[tail & CAPTURE_RING_MASK];
+        capture_write(slot->type, slot->device, slot->id, slot->data, slot->size, slot->time_ns);
+    }
+    atomic_store_explicit(&ring_tail, tail, memory_order_release);
+    if (dropped || tail != head) fflush(out_file);
+}
+
+static void* capture_thread_main(void* arg) {
+    (void)arg;
+    struct timespec ts = { 0, CAPTURE_FLUSH_MS * 1000000L };
+    while (atomic_load(&capture_running)) {
+        capture_drain();
+        nanosleep(&ts, NULL);
+    }
+    capture_drain();
+    return NULL;
+}
+
+// File is opened for append, every start adds a run record so one file can hold many runs
+bool capture_start(const char* filename) {
+    if (atomic_load(&capture_running)) return true;
+    ring = calloc(CAPTURE_RING_SIZE, sizeof(CaptureSlot));
+    out_file = ring ? fopen(filename, "ab") : NULL;
+    if (!out_file) {
+        int error = ring ? errno : ENOMEM;
+        free(ring);
+        ring = NULL;
+        errno = error;
+        return false;
+    }
+
+    uint8_t run[sizeof(CAPTURE_MAGIC) - 1 + sizeof(uint16_t) + sizeof(int64_t)];
+    uint16_t version = CAPTURE_VERSION;
+    int64_t realtime = capture_realtime_ns();
+    memcpy(run, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC) - 1);
+    memcpy(run + 4, &version, sizeof(version));
+    memcpy(run + 6, &realtime, sizeof(realtime));
+    capture_write(CAPTURE_RUN, 0, 0, run, sizeof(run), capture_monotonic_ns());
+    fflush(out_file);
+
+    atomic_store(&ring_head, 0);
+    atomic_store(&ring_tail, 0);
+    atomic_store(&capture_dropped, 0);
+    atomic_store(&capture_running, true);
+    if (pthread_create(&capture_thread, NULL, capture_thread_main, NULL) != 0) {
+        atomic_store(&capture_running, false);
+        fclose(out_file);
+        out_file = NULL;
+        free(ring);
+        ring = NULL;
+        return false;
+    }
+    return true;
+}
+
+// Never blocks, a record that does not fit into the ring is counted and reported as a gap
+void capture_put(uint8_t type, int device, uint16_t id, const void* data, int size, int64_t time_ns) {
+    if (!atomic_load_explicit(&capture_running, memory_order_relaxed)) return;
+    size_t head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    if (size > CAPTURE_DATA_SIZE || device >= CAPTURE_MAX_DEVICES ||
+        head - atomic_load_explicit(&ring_tail, memory_order_acquire) >= CAPTURE_RING_SIZE) {
+        atomic_fetch_add_explicit(&capture_dropped, 1, memory_order_relaxed);
+        return;
+    }
+    CaptureSlot* slot = &ring[head & CAPTURE_RING_MASK];
+    slot->type = type;
+    slot->device = (uint8_t)device;
+    slot->id = id;
+    slot->size = (uint16_t)size;
+    slot->time_ns = time_ns;
+    if (size > 0) memcpy(slot->data, data, size);
+    atomic_store_explicit(&ring_head, head + 1, memory_order_release);
+}
+
+// Records put so far are written before the file is closed
+void capture_stop(void) {
+    if (!atomic_exchange(&capture_running, false)) return;
+    pthread_join(capture_thread, NULL);
+    fclose(out_file);
+    out_file = NULL;
+    free(ring);
+    ring = NULL;
+}
+
+// Whole file is loaded, it has to start with a run record of a known version
+bool capture_reader_open(CaptureReader* reader, const char* filename) {
+    memset(reader, 0, sizeof(CaptureReader));
+    FILE* file = fopen(filename, "rb");
+    if (!file) return false;
+    long size = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    reader->data = size > 0 && fseek(file, 0, SEEK_SET) == 0 ? malloc(size) : NULL;
+    bool ok = reader->data && fread(reader->data, 1, size, file) == (size_t)size;
+    fclose(file);
+    reader->size = ok ? (size_t)size : 0;
+
+    CaptureRecord first;
+    uint16_t version = 0;
+    ok = ok && capture_reader_next(reader, &first) && first.type == CAPTURE_RUN && first.size >= 6 &&
+         memcmp(first.data, CAPTURE_MAGIC, 4) == 0;
+    if (ok) memcpy(&version, first.data + 4, sizeof(version));
+    if (!ok || version != CAPTURE_VERSION) {
+        capture_reader_close(reader);
+        errno = EINVAL;
+        return false;
+    }
+    reader->used = 0;
+    return true;
+}
+
+// False at the end of the file, a record cut short by a crash ends the capture there
+bool capture_reader_next(CaptureReader* reader, CaptureRecord* record) {
+    if (reader->size - reader->used < CAPTURE_HEADER_SIZE) return false;
+    const uint8_t* p = reader->data + reader->used;
+    record->type = p[0];
+    record->device = p[1];
+    memcpy(&record->id, p + 2, sizeof(record->id));
+    memcpy(&record->size, p + 4, sizeof(record->size));
+    memcpy(&record->time_ns, p + 6, sizeof(record->time_ns));
+    if (reader->size - reader->used - CAPTURE_HEADER_SIZE < record->size) return false;
+    record->data = p + CAPTURE_HEADER_SIZE;
+    reader->used += CAPTURE_HEADER_SIZE + record->size;
+    return true;
+}
+
+void capture_reader_close(CaptureReader* reader) {
+    free(reader->data);
+    memset(reader, 0, sizeof(CaptureReader));
+}
@@ -0,0 +1,53 @@
+#ifndef MODBUS_CAPTURE_H
+#define MODBUS_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Constants
+#define CAPTURE_MAGIC "MBCP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_RING_SIZE 8192 // Records, must be a power of two
+#define CAPTURE_DATA_SIZE 256 // Largest record payload, a PDU or a device description
+#define CAPTURE_FLUSH_MS 20 // Writer thread sleep when the ring is empty
+#define CAPTURE_HEADER_SIZE 14 // type, device, id, size, time_ns
+#define CAPTURE_MAX_DEVICES 256 // Device index of a record is one byte
+
+// Capture file records, host byte order. Every run of the HMI appends a CAPTURE_RUN record first.
+typedef enum {
+    CAPTURE_RUN = 1, // "MBCP", uint16 version, int64 CLOCK_REALTIME ns of the start
+    CAPTURE_DEVICE = 2, // Device name and "ip:port", NUL separated, valid until the next run or reload
+    CAPTURE_REQUEST = 3, // Request PDU, id is the MBAP transaction id
+    CAPTURE_RESPONSE = 4, // Response PDU, empty when the request timed out or its connection was lost
+    CAPTURE_CONNECT = 5,
+    CAPTURE_DISCONNECT = 6,
+    CAPTURE_GAP = 7 // uint32 records lost because the writer fell behind
+} CaptureRecordType;
+
+// One record of a capture file, data points into the reader's buffer
+typedef struct {
+    uint8_t type;
+    uint8_t device; // Index of the device in the config of the run
+    uint16_t id;
+    uint16_t size;
+    int64_t time_ns; // CLOCK_MONOTONIC
+    const uint8_t* data;
+} CaptureRecord;
+
+// Whole capture file in memory, records are read in order
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t used;
+} CaptureReader;
+
+// Function prototypes
+bool capture_start(const char* filename);
+void capture_put(uint8_t type, int device, uint16_t id, const void* data, int size, int64_t time_ns);
+void capture_stop(void);
+bool capture_reader_open(CaptureReader* reader, const char* filename);
+bool capture_reader_next(CaptureReader* reader, CaptureRecord* record);
+void capture_reader_close(CaptureReader* reader);
+
+#endif // MODBUS_CAPTURE_H
@@ -0,0 +1,97 @@
+/*
+ * Printer for capture files written with capture_file.
+ * Usage: modbus_capturedump [-s] [modbus.cap]
+ * -s only prints the number of records of each type per device.
+ * Build: gcc -o modbus_capturedump modbus_capturedump.c modbus_capture.c -lpthread
+ */
+#include "modbus_capture.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define DUMP_DEVICES 256
+#define DUMP_TYPES (CAPTURE_GAP + 1)
+
+static const char* type_names[DUMP_TYPES] = {
+    "?", "RUN", "DEVICE", "REQUEST", "RESPONSE", "CONNECT", "DISCONNECT", "GAP"
+};
+
+static char device_names[DUMP_DEVICES][64];
+static unsigned long counts[DUMP_DEVICES][DUMP_TYPES];
+
+static void print_bytes(const uint8_t* data, int size) {
+    for (int i = 0; i < size; i++) printf(" %02x", data[i]);
+}
+
+int main(int argc, char** argv) {
+    const char* path = "modbus.cap";
+    bool summary = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0) summary = true;
+        else path = argv[i];
+    }
+
+    CaptureReader reader;
+    if (!capture_reader_open(&reader, path)) {
+        fprintf(stderr, "Unable to open capture %s\n", path);
+        return 1;
+    }
+
+    CaptureRecord record;
+    int64_t run_start = 0;
+    while (capture_reader_next(&reader, &record)) {
+        int type = record.type < DUMP_TYPES ? record.type : 0;
+        counts[record.device][type]++;
+        if (type == CAPTURE_RUN) {
+            // Device indexes start over with every run
+            run_start = record.time_ns;
+            memset(device_names, 0, sizeof(device_names));
+        } else if (type == CAPTURE_DEVICE) {
+            snprintf(device_names[record.device], sizeof(device_names[0]), "%.*s",
+                     (int)strnlen((const char*)record.data, record.size), (const char*)record.data);
+        }
+        if (summary) continue;
+
+        double offset = (record.time_ns - run_start) / 1e9;
+        const char* name = device_names[record.device][0] ? device_names[record.device] : "-";
+        if (type == CAPTURE_RUN && record.size >= 14) {
+            int64_t realtime;
+            memcpy(&realtime, record.data + 6, sizeof(realtime));
+            time_t second = (time_t)(realtime / 1000000000LL);
+            struct tm tm_value;
+            char stamp[32];
+            localtime_r(&second, &tm_value);
+            strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm_value);
+            printf("RUN started %s\n", stamp);
+        } else if (type == CAPTURE_DEVICE) {
+            size_t length = strnlen((const char*)record.data, record.size);
+            printf("%12.6f %-16s DEVICE %.*s\n", offset, name,
+                   length < record.size ? (int)(record.size - length - 1) : 0, (const char*)record.data + length + 1);
+        } else if (type == CAPTURE_GAP && record.size >= 4) {
+            uint32_t lost;
+            memcpy(&lost, record.data, sizeof(lost));
+            printf("%12.6f %-16s GAP %u records lost\n", offset, "-", lost);
+        } else {
+            printf("%12.6f %-16s %-10s", offset, name, type_names[type]);
+            if (type == CAPTURE_REQUEST || type == CAPTURE_RESPONSE) printf(" id %5u", record.id);
+            if (type == CAPTURE_RESPONSE && record.size == 0) printf(" no response");
+            print_bytes(record.data, record.size);
+            printf("\n");
+        }
+    }
+
+    if (summary) {
+        printf("%-4s %10s %10s %10s %10s %10s\n", "dev", "requests", "responses", "connects", "disconnects", "gaps");
+        for (int d = 0; d < DUMP_DEVICES; d++) {
+            const unsigned long* c = counts[d];
+            if (!c[CAPTURE_REQUEST] && !c[CAPTURE_RESPONSE] && !c[CAPTURE_CONNECT] && !c[CAPTURE_DISCONNECT] &&
+                !c[CAPTURE_GAP]) continue;
+            printf("%-4d %10lu %10lu %10lu %10lu %10lu\n", d, c[CAPTURE_REQUEST], c[CAPTURE_RESPONSE],
+                   c[CAPTURE_CONNECT], c[CAPTURE_DISCONNECT], c[CAPTURE_GAP]);
+        }
+    }
+    capture_reader_close(&reader);
+    return 0;
+}
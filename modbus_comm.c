@@ -1,433 +1,4182 @@
 #include "modbus_comm.h"
+#include "modbus_cache.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <time.h>
 #include <stdarg.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <grp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+
+#define IMAGE_FRESH 4u
+#define IMAGE_INDEX_MASK 3u
+#define IO_MAX_EVENTS 64
+#define GATEWAY_WRITE_BATCH 64
+#define GATEWAY_READ_TRIES 4 // Seqlock retries before a client keeps its last image for this cycle
+#define SERVER_WRITE_BATCH 64
+#define REPLAY_WORDS (MODBUS_ADDRESS_COUNT / 64)
+
+// Snapshot of mapped values exchanged between the draw thread and the I/O thread
+typedef struct {
+    SignalWord* inputs;
+    SignalWord* outputs;
+    SignalWord* dirty; // Outputs changed and not yet seen written by the draw thread
+    unsigned long* change_seq; // Valid for dirty outputs only
+    SignalWord* input_quality;
+    SignalWord* output_quality;
+    uint32_t* registers; // Raw register values, 16-bit values in the low half
+    double* register_values; // Decoded field values, input images only
+    SignalWord* register_quality;
+    SignalWord* register_dirty; // Holding registers changed and not yet seen written, output images only
+    unsigned long* register_change_seq;
+    bool link; // Device connected when the image was published
+    unsigned long seq;
+} ModbusImage;
+
+// Lock-free triple buffer, one writer thread and one reader thread
+typedef struct {
+    ModbusImage slots[3];
+    atomic_uint middle;
+    unsigned int front;
+    unsigned int back;
+} ImageBuffer;
+
+// Request waiting for a free slot in the device window
+typedef struct {
+    int block; // Read block, -1 for a coil write run, -2 for a holding register write run, -3 for a read back
+    int first; // Positions of a write run in write_order or register_write_order
+    int last;
+} IoRequest;
+
+// Runtime state of one device, the io fields are only used by the I/O thread
+typedef struct {
+    ModbusDevice* device;
+    atomic_bool connected;
+    ModbusTcpClient client;
+    MetricsDevice* metrics;
+    long long connect_start_ns;
+    bool closing; // Transactions failed by a disconnect are not logged one by one
+    bool stable; // A request was answered since the last connect
+    int backoff_ms; // Upper bound of the next reconnect delay
+    unsigned int seed; // Reconnect jitter
+    long long retry_ns; // No connect attempt before this time
+    long long connect_deadline_ns;
+    int timeouts; // Consecutive unanswered requests
+    uint32_t events; // Registered epoll events, 0 when the socket is not registered
+    bool scheduled;
+    ImageBuffer input_buffer;   // I/O thread -> draw thread
+    ImageBuffer output_buffer;  // draw thread -> I/O thread
+    SignalWord* io_pending;
+    SignalWord* io_desired;
+    SignalWord* io_slave; // Last known coil state on the slave
+    SignalWord* io_known; // Coils whose state on the slave was read or written since the connect
+    SignalWord* io_written; // Values verified outputs were last written with
+    int* io_verify_failures; // Read backs in a row that did not match the written value
+    int* io_dirty;
+    int* io_best;
+    int* io_from;
+    uint8_t io_write_bits[MODBUS_MAX_WRITE_BITS];
+    unsigned long io_collected_seq;
+    unsigned long io_applied_seq;
+    int* poll_heap;
+    int poll_heap_size;
+    int* block_group; // Poll group of each read block
+    int* group_outstanding; // Reads of each poll group queued or in flight
+    bool* group_ok; // A read of the group's current round succeeded
+    bool* group_changed; // A read of the group's current round saw a value change
+    int* group_period_ms; // Adaptive period of each poll group before load shedding
+    int* group_activity; // Smoothed share of polls that saw a change, of POLL_ACTIVITY_ONE
+    long long rtt_ns; // Smoothed response time, 0 before the first answer
+    long long* block_ok_ns; // Last successful read of each block, 0 before the first one
+    uint8_t* read_good; // Quality of every position of the read buffer, packed like read_bits
+    uint8_t* register_good; // Quality of every position of the register read buffer
+    uint32_t* reg_slave; // Last known raw value of every holding register signal on the slave
+    SignalWord* reg_known; // Holding registers whose value on the slave was read or written since the connect
+    uint32_t* reg_desired;
+    SignalWord* reg_pending;
+    long long stale_check_ns; // Next time a good block turns stale, 0 when none is good
+    int signal_base; // Event id of the first input, outputs follow the inputs
+    SignalWord* ev_inputs; // Last image as seen by the change events
+    SignalWord* ev_input_quality;
+    SignalWord* ev_outputs;
+    SignalWord* ev_output_quality;
+    uint64_t gw_collected[GATEWAY_MAX_CLIENTS]; // Gateway server: last write seq taken from each client
+    uint64_t gw_applied[GATEWAY_MAX_CLIENTS]; // Collected writes that are on the slave
+    int writes_outstanding;
+    bool publish_due;
+    IoRequest* queue;
+    int queue_head;
+    int queue_size;
+    int queue_capacity;
+    // Draw thread state
+    unsigned long* draw_change_seq;
+    SignalWord* draw_dirty;
+    unsigned long* draw_reg_change_seq;
+    SignalWord* draw_reg_dirty;
+    SignalWord* draw_scratch;
+    SignalWord* draw_changed;
+    unsigned long draw_publish_seq;
+    bool draw_synced;
+    bool draw_link;
+    int gw_slot; // Gateway client: device in the gateway segment, -1 when the gateway does not have it
+    uint64_t gw_seq; // Seqlock value of the last image taken
+    bool gw_backlog; // Dirty outputs still have to be queued to the gateway
+    bool server_dirty; // Values changed since the last server snapshot
+    unsigned long server_version; // Change counter the server units are compared against, 0 before the first
+    uint64_t* rp_inputs; // Replay: recorded slave state by address, allocated only while replaying
+    uint64_t* rp_input_good;
+    uint64_t* rp_coils;
+    uint64_t* rp_coil_good;
+    bool rp_link;
+    bool rp_changed; // Recorded state changed since the last replay image
+    int history_base; // History ring of the first input, outputs and then registers follow
+    bool hs_primed; // Rings got the state of every signal since the last start or reload
+    SignalWord* hs_inputs; // Last image as seen by the history
+    SignalWord* hs_input_quality;
+    SignalWord* hs_outputs;
+    SignalWord* hs_output_quality;
+    uint32_t* hs_registers;
+    SignalWord* hs_register_quality;
+} DeviceIO;
+
+// Replay: request of a capture device waiting for its recorded response, data points into the capture
+typedef struct {
+    bool used;
+    uint16_t id;
+    uint16_t size;
+    const uint8_t* pdu;
+} ReplayRequest;
 
 // Global variables
-static modbus_t *ctx = NULL;
 static ModbusConfig *config = NULL;
-static FILE *log_file = NULL;
-static time_t last_read_time = 0;
-
-// Logging function
-void write_log(const char* format, ...) {
-    if (!log_file) {
-        log_file = fopen(LOG_FILE, "a");
-        if (!log_file) return;
-    }
-    
-    time_t now;
-    time(&now);
-    char timestamp[26];
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
-    
-    fprintf(log_file, "[%s] ", timestamp);
-    
+static DeviceIO *device_io = NULL;
+static int device_io_count = 0;
+
+// I/O thread state, one thread drives every device through epoll
+static pthread_t io_thread;
+static atomic_bool io_running = false;
+static int io_epoll = -1;
+static int io_wake = -1; // eventfd, the draw thread signals new outputs
+static bool io_draining = false; // A reloaded config waits, no new requests are started
+
+// Hot reload: the reload thread builds pending_config, the I/O thread lets every request finish and
+// parks, then the draw thread swaps the config in and releases the I/O thread
+static int io_inotify = -1;
+static long long reload_due_ns = 0; // Config changed, reload once the writes settle
+static pthread_t reload_thread;
+static bool reload_started = false;
+static uint64_t reload_current_key;
+static atomic_bool reload_busy = false;
+static ModbusConfig* _Atomic pending_config = NULL;
+static atomic_bool io_parked = false;
+
+// Runtime metrics, in shared memory when metrics_name allows it and in process memory otherwise
+static ModbusMetrics* metrics = NULL;
+static ModbusMetrics metrics_local;
+static char metrics_shm[METRICS_NAME_SIZE];
+
+// Gateway: a server shares the images of its devices with client processes in shared memory, a client
+// has no I/O thread and exchanges images with the server on the draw thread
+static ModbusGateway* gateway = NULL;
+static char gateway_shm[GATEWAY_NAME_SIZE];
+static int gateway_sock = -1; // Server: bound wake socket in the epoll set, client: socket that wakes the server
+static int gateway_client = -1; // Client slot in the segment
+static uint32_t gateway_generation;
+static long long gateway_retry_ns = 0; // Client: next attach attempt
+static bool gateway_missing = false; // Client: the missing gateway was logged
+static bool client_running = false;
+
+// Modbus server: other masters read the snapshot the draw thread publishes after each cycle, their coil
+// writes reach the context fields on the draw thread
+static bool server_started = false;
+static unsigned long server_version = 0;
+
+// Capture: the I/O thread appends every request, response and link change to capture_file.
+// Replay: recorded responses stand in for the devices, applied on the draw thread like a gateway client.
+static bool capture_on = false;
+static bool replay_running = false;
+static bool replay_finished = false;
+static CaptureReader replay_reader;
+static ReplayRequest (*replay_pending)[MODBUS_TCP_MAX_WINDOW] = NULL; // Window of every capture device
+static int replay_map[CAPTURE_MAX_DEVICES]; // Capture device to running device, -1 when the config has no such device
+static long long replay_start_ns; // Draw thread time the replay started
+static long long replay_first_ns; // Capture time of the first record
+static long long replay_offset_ns; // Added to record times so the runs of a capture follow each other
+static long long replay_last_ns; // Rebased time of the last applied record
+static unsigned long replay_records;
+
+// Change events: the I/O thread turns differences between consecutive input images into events,
+// the draw thread drains them or hands them to the subscribed callbacks
+typedef struct {
+    char name[SIGNAL_NAME_SIZE]; // Empty for every signal
+    ModbusChangeCallback callback; // NULL once unsubscribed
+    void* user;
+    int next; // Next subscription of the same signal, -1 at the end
+} EventSubscription;
+
+static ModbusEventQueue event_queue;
+static bool event_queue_ready = false;
+static atomic_bool events_wanted = false; // Nothing is queued before the first consumer shows up
+static int signal_total = 0;
+static EventSubscription* subscriptions = NULL;
+static int subscription_count = 0;
+static int subscription_capacity = 0;
+static int* subscription_head = NULL; // First subscription of every signal id, -1 when none
+static int subscription_all = -1; // First subscription to every signal
+static bool dispatching = false; // Callbacks are running, slots keep their index until they return
+
+// Signal history: the thread that publishes the input images records every transition into a ring per
+// signal, queries and exports read the rings without stopping it
+static ModbusHistory history;
+
+// Logging function, the line is queued for the log writer thread and never waits for the disk
+void write_log_impl(const char* format, ...) {
+    LogLevel level = LOG_LEVEL_INFO;
+    if (strncmp(format, "ERROR", 5) == 0) level = LOG_LEVEL_ERROR;
+    else if (strncmp(format, "WARNING", 7) == 0) level = LOG_LEVEL_WARN;
+
+    va_list args;
+    va_start(args, format);
+    log_vmessage(level, format, args);
+    va_end(args);
+}
+
+// Device is looked up by name, created with default connection values if asked to
+ModbusDevice* find_device(ModbusConfig* cfg, const char* name, bool create) {
+    for (int d = 0; d < cfg->device_count; d++) {
+        if (strcmp(cfg->devices[d].name, name) == 0) return &cfg->devices[d];
+    }
+    if (!create) return NULL;
+
+    ModbusDevice* devices = realloc(cfg->devices, (cfg->device_count + 1) * sizeof(ModbusDevice));
+    if (!devices) {
+        write_log("ERROR: Memory allocation failed for device %s", name);
+        return NULL;
+    }
+    cfg->devices = devices;
+
+    ModbusDevice* dev = &cfg->devices[cfg->device_count++];
+    memset(dev, 0, sizeof(ModbusDevice));
+    strncpy(dev->name, name, SIGNAL_NAME_SIZE - 1);
+    strcpy(dev->server_ip, DEFAULT_IP);
+    dev->port = DEFAULT_PORT;
+    dev->slave_id = DEFAULT_SLAVE_ID;
+    return dev;
+}
+
+// Device name of a section header like [Device:rack2], the default device when there is no name
+static bool section_device(const char* line, char* name) {
+    const char* colon = strchr(line, ':');
+    if (!colon) {
+        strcpy(name, DEFAULT_DEVICE);
+        return true;
+    }
+    int length = (int)strcspn(colon + 1, "]");
+    if (length == 0 || length >= SIGNAL_NAME_SIZE) return false;
+    memcpy(name, colon + 1, length);
+    name[length] = '\0';
+    return true;
+}
+
+// Whitespace is cut from both ends in place
+static char* trim(char* text) {
+    while (*text == ' ' || *text == '\t') text++;
+    char* end = text + strlen(text);
+    while (end > text && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) end--;
+    *end = '\0';
+    return text;
+}
+
+// Whole decimal number within [min, max], false for anything else
+static bool parse_int(const char* text, int min, int max, int* value) {
+    char* end;
+    errno = 0;
+    long v = strtol(text, &end, 10);
+    if (errno != 0 || end == text || *end != '\0' || v < min || v > max) return false;
+    *value = (int)v;
+    return true;
+}
+
+// Finite decimal number, false for anything else
+static bool parse_double(const char* text, double* value) {
+    char* end;
+    errno = 0;
+    double v = strtod(text, &end);
+    if (errno != 0 || end == text || *end != '\0' || !isfinite(v)) return false;
+    *value = v;
+    return true;
+}
+
+// Register mapping value address[:type[:order[:scale[:offset]]]], empty parts keep their default
+static bool parse_register(char* text, int function, int* address, RegisterFormat* format, double* scale, double* offset) {
+    static const char* const types[] = { "int16", "uint16", "int32", "uint32", "float32" };
+    static const char* const orders[] = { "abcd", "cdab", "badc", "dcba" };
+    char* part[5] = { text, NULL, NULL, NULL, NULL };
+    for (int k = 1; k < 5; k++) {
+        part[k] = strchr(part[k - 1], ':');
+        if (!part[k]) break;
+        *part[k]++ = '\0';
+    }
+    for (int k = 0; k < 5; k++) {
+        if (part[k]) part[k] = trim(part[k]);
+    }
+
+    format->function = (uint8_t)function;
+    format->type = REGISTER_UINT16;
+    format->order = REGISTER_ABCD;
+    *scale = 1;
+    *offset = 0;
+    if (!parse_int(part[0], 0, MODBUS_ADDRESS_COUNT - 1, address)) return false;
+    if (part[1] && part[1][0]) {
+        int t = 0;
+        while (t < 5 && strcmp(part[1], types[t]) != 0) t++;
+        if (t == 5) return false;
+        format->type = (uint8_t)t;
+    }
+    if (part[2] && part[2][0]) {
+        int o = 0;
+        while (o < 4 && strcmp(part[2], orders[o]) != 0) o++;
+        if (o == 4) return false;
+        format->order = (uint8_t)o;
+    }
+    if (part[3] && part[3][0] && (!parse_double(part[3], scale) || *scale == 0)) return false;
+    if (part[4] && part[4][0] && !parse_double(part[4], offset)) return false;
+    format->width = format->type == REGISTER_INT16 || format->type == REGISTER_UINT16 ? 1 : 2;
+    return *address + format->width <= MODBUS_ADDRESS_COUNT;
+}
+
+// Integer keys of [ModbusConfig] with their valid range
+static const struct {
+    const char* key;
+    size_t offset;
+    int min;
+    int max;
+} config_int_keys[] = {
+    { "read_gap", offsetof(ModbusConfig, read_gap), 0, MODBUS_MAX_READ_BITS },
+    { "register_gap", offsetof(ModbusConfig, register_gap), 0, MODBUS_MAX_READ_REGISTERS },
+    { "poll_ms", offsetof(ModbusConfig, poll_ms), 1, MODBUS_MAX_PERIOD_MS },
+    { "write_request_cost", offsetof(ModbusConfig, write_request_cost), 0, 1 << 20 },
+    { "verify_retries", offsetof(ModbusConfig, verify_retries), 0, 1000 },
+    { "max_in_flight", offsetof(ModbusConfig, max_in_flight), 1, MODBUS_TCP_MAX_WINDOW },
+    { "udp_retries", offsetof(ModbusConfig, udp_retries), 0, MODBUS_UDP_MAX_RETRIES },
+    { "response_timeout_ms", offsetof(ModbusConfig, response_timeout_ms), 1, MODBUS_MAX_PERIOD_MS },
+    { "reconnect_min_ms", offsetof(ModbusConfig, reconnect_min_ms), 1, MODBUS_MAX_PERIOD_MS },
+    { "reconnect_max_ms", offsetof(ModbusConfig, reconnect_max_ms), 1, MODBUS_MAX_PERIOD_MS },
+    { "stale_periods", offsetof(ModbusConfig, stale_periods), 1, 1000 },
+    { "poll_min_ms", offsetof(ModbusConfig, poll_min_ms), 1, MODBUS_MAX_PERIOD_MS },
+    { "poll_max_ms", offsetof(ModbusConfig, poll_max_ms), 1, MODBUS_MAX_PERIOD_MS },
+    { "poll_rtt_ms", offsetof(ModbusConfig, poll_rtt_ms), 1, MODBUS_MAX_PERIOD_MS },
+    { "log_rate", offsetof(ModbusConfig, log_rate), 0, 1 << 20 },
+    { "server_port", offsetof(ModbusConfig, server_port), 0, 65535 },
+    { "server_max_clients", offsetof(ModbusConfig, server_max_clients), 1, MODBUS_SERVER_MAX_CLIENTS },
+    { "replay_speed", offsetof(ModbusConfig, replay_speed), 0, MODBUS_REPLAY_MAX_SPEED },
+};
+
+// Global key of [ModbusConfig], false when the value is invalid
+static bool set_config_key(ModbusConfig* cfg, const char* k, const char* v) {
+    for (size_t i = 0; i < sizeof(config_int_keys) / sizeof(config_int_keys[0]); i++) {
+        if (strcmp(k, config_int_keys[i].key) != 0) continue;
+        return parse_int(v, config_int_keys[i].min, config_int_keys[i].max,
+                         (int*)((char*)cfg + config_int_keys[i].offset));
+    }
+    if (strcmp(k, "log_level") == 0) {
+        if (!log_parse_level(v, &cfg->log_level)) return false;
+    } else if (strcmp(k, "log_format") == 0) {
+        if (!log_parse_format(v, &cfg->log_format)) return false;
+    } else if (strcmp(k, "log_changes_only") == 0) {
+        int enabled;
+        if (!parse_int(v, 0, 1, &enabled)) return false;
+        cfg->log_changes_only = enabled != 0;
+    } else if (strcmp(k, "adaptive_poll") == 0) {
+        int enabled;
+        if (!parse_int(v, 0, 1, &enabled)) return false;
+        cfg->adaptive_poll = enabled != 0;
+    } else if (strcmp(k, "metrics_name") == 0) {
+        if (strlen(v) >= sizeof(cfg->metrics_name) || (v[0] != '/' && strcmp(v, "none") != 0)) return false;
+        strcpy(cfg->metrics_name, v);
+    } else if (strcmp(k, "gateway_mode") == 0) {
+        if (strcmp(v, "off") == 0) cfg->gateway_mode = GATEWAY_OFF;
+        else if (strcmp(v, "server") == 0) cfg->gateway_mode = GATEWAY_SERVER;
+        else if (strcmp(v, "client") == 0) cfg->gateway_mode = GATEWAY_CLIENT;
+        else return false;
+    } else if (strcmp(k, "gateway_name") == 0) {
+        if (strlen(v) >= sizeof(cfg->gateway_name) || v[0] != '/') return false;
+        strcpy(cfg->gateway_name, v);
+    } else if (strcmp(k, "gateway_group") == 0) {
+        if (strlen(v) >= sizeof(cfg->gateway_group)) return false;
+        strcpy(cfg->gateway_group, v);
+    } else if (strcmp(k, "server_bind") == 0) {
+        if (strlen(v) >= sizeof(cfg->server_bind)) return false;
+        strcpy(cfg->server_bind, v);
+    } else if (strcmp(k, "history_depth") == 0) {
+        int depth;
+        if (!parse_int(v, 0, HISTORY_MAX_DEPTH, &depth) || (depth & (depth - 1)) != 0 || depth == 1) return false;
+        cfg->history_depth = depth;
+    } else if (strcmp(k, "history_file") == 0) {
+        if (strlen(v) >= sizeof(cfg->history_file)) return false;
+        strcpy(cfg->history_file, v);
+    } else if (strcmp(k, "capture_file") == 0) {
+        if (strlen(v) >= sizeof(cfg->capture_file)) return false;
+        strcpy(cfg->capture_file, v);
+    } else if (strcmp(k, "replay_file") == 0) {
+        if (strlen(v) >= sizeof(cfg->replay_file)) return false;
+        strcpy(cfg->replay_file, v);
+    }
+    return true;
+}
+
+// server_ip, port, slave_id and transport of one device, false when the value is invalid
+static bool set_device_key(ModbusDevice* dev, const char* k, const char* v) {
+    if (strcmp(k, "server_ip") == 0) {
+        if (strlen(v) >= sizeof(dev->server_ip)) return false;
+        strcpy(dev->server_ip, v);
+        return true;
+    }
+    if (strcmp(k, "port") == 0) return parse_int(v, 1, 65535, &dev->port);
+    if (strcmp(k, "slave_id") == 0) return parse_int(v, 0, 255, &dev->slave_id);
+    if (strcmp(k, "transport") == 0) return modbus_transport_parse(v, &dev->transport);
+    return true;
+}
+
+// Rejected config line, counted so a hot reload can refuse a config with mistakes
+static void config_error(ModbusConfig* cfg, const char* format, ...) {
     va_list args;
     va_start(args, format);
-    vfprintf(log_file, format, args);
+    log_vmessage(LOG_LEVEL_ERROR, format, args);
     va_end(args);
-    
-    fprintf(log_file, "\n");
-    fflush(log_file);
+    cfg->error_count++;
+}
+
+// Index of a context field in the generated binding table, -1 and an error when the model has no such bool.
+// Register mappings take a field of any scalar type.
+static int resolve_field(ModbusConfig* cfg, const char* name, const char* kind, const char* device, int line, bool scalar) {
+    const ModbusField* field = modbus_find_field(name);
+    if (!field) {
+        config_error(cfg, "ERROR: Unknown %s field %s on device %s, line %d", kind, name, device, line);
+        return -1;
+    }
+    if (!scalar && field->type != MODBUS_FIELD_BOOL) {
+        config_error(cfg, "ERROR: %s field %s on device %s is not a bool, line %d", kind, name, device, line);
+        return -1;
+    }
+    return (int)(field - modbus_fields);
+}
+
+// Output address is taken for one device, 0 when another output already writes it, -1 without memory
+static int claim_output_address(SignalWord** taken, int* taken_devices, int device, int address) {
+    int words = SIGNAL_WORDS(MODBUS_ADDRESS_COUNT);
+    if (device >= *taken_devices) {
+        SignalWord* grown = realloc(*taken, (size_t)(device + 1) * words * sizeof(SignalWord));
+        if (!grown) return -1;
+        memset(grown + (size_t)*taken_devices * words, 0, (size_t)(device + 1 - *taken_devices) * words * sizeof(SignalWord));
+        *taken = grown;
+        *taken_devices = device + 1;
+    }
+    SignalWord* bits = *taken + (size_t)device * words;
+    if (signal_bit(bits, address)) return 0;
+    signal_bit_set(bits, address, true);
+    return 1;
+}
+
+// Whole file in memory with a terminating zero, NULL when it can not be read
+static char* read_text_file(const char* filename, size_t* size) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) return NULL;
+
+    char* text = NULL;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        long length = ftell(file);
+        if (length >= 0 && fseek(file, 0, SEEK_SET) == 0) {
+            text = malloc((size_t)length + 1);
+            if (text && fread(text, 1, (size_t)length, file) != (size_t)length) {
+                free(text);
+                text = NULL;
+            }
+            if (text) {
+                text[length] = '\0';
+                *size = (size_t)length;
+            }
+        }
+    }
+    fclose(file);
+    return text;
+}
+
+static ModbusConfig* new_config(void) {
+    ModbusConfig* cfg = calloc(1, sizeof(ModbusConfig));
+    if (!cfg) {
+        write_log("ERROR: Memory allocation failed for config");
+        return NULL;
+    }
+
+    // Initialize all values, devices are added by the sections that name them
+    cfg->read_gap = DEFAULT_READ_GAP;
+    cfg->register_gap = DEFAULT_REGISTER_GAP;
+    cfg->poll_ms = MODBUS_READ_INTERVAL;
+    cfg->write_request_cost = DEFAULT_WRITE_REQUEST_COST;
+    cfg->verify_retries = DEFAULT_VERIFY_RETRIES;
+    cfg->max_in_flight = MODBUS_TCP_DEFAULT_WINDOW;
+    cfg->udp_retries = DEFAULT_UDP_RETRIES;
+    cfg->response_timeout_ms = MODBUS_TIMEOUT / 1000;
+    cfg->reconnect_min_ms = RECONNECT_MIN_MS;
+    cfg->reconnect_max_ms = RECONNECT_MAX_MS;
+    cfg->stale_periods = DEFAULT_STALE_PERIODS;
+    cfg->poll_min_ms = DEFAULT_POLL_MIN_MS;
+    cfg->poll_max_ms = DEFAULT_POLL_MAX_MS;
+    cfg->poll_rtt_ms = DEFAULT_POLL_RTT_MS;
+    cfg->log_level = LOG_LEVEL_INFO;
+    cfg->log_format = LOG_FORMAT_TEXT;
+    cfg->log_rate = DEFAULT_LOG_RATE;
+    cfg->log_changes_only = true;
+    strcpy(cfg->metrics_name, MODBUS_METRICS_NAME);
+    cfg->gateway_mode = GATEWAY_OFF;
+    strcpy(cfg->gateway_name, MODBUS_GATEWAY_NAME);
+    cfg->server_max_clients = MODBUS_SERVER_DEFAULT_CLIENTS;
+    strcpy(cfg->server_bind, DEFAULT_SERVER_BIND);
+    cfg->replay_speed = 1;
+    cfg->history_depth = DEFAULT_HISTORY_DEPTH;
+    return cfg;
+}
+
+// INI text is parsed in one pass, bad lines are logged with their number and skipped
+static bool parse_config(ModbusConfig* cfg, char* text) {
+    int section = 0; // 0: ModbusConfig, 1: InputMappings, 2: OutputMappings, 3: Device, 4: QualityMappings,
+                     // 5: InputRegisters, 6: HoldingRegisters, -1: unknown
+    int section_poll_ms = 0; // poll_ms of the current mapping section, 0 for the default
+    bool section_verify = false; // verify of the current output section
+    char device_name[SIGNAL_NAME_SIZE];
+    ModbusDevice* dev = NULL;
+    SignalWord* taken = NULL; // Output addresses in use, one bitset per device
+    int taken_devices = 0;
+    SignalWord* taken_registers = NULL; // Holding registers in use, one bitset per device
+    int taken_register_devices = 0;
+    bool ok = true;
+    int line_number = 0;
+
+    for (char* next = text; ok && next; ) {
+        char* line = next;
+        next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+        line_number++;
+        line = trim(line);
+
+        if (line[0] == '[') {
+            if (strcmp(line, "[ModbusConfig]") == 0) section = 0;
+            else if (strncmp(line, "[InputMappings", 14) == 0) section = 1;
+            else if (strncmp(line, "[OutputMappings", 15) == 0) section = 2;
+            else if (strncmp(line, "[Device:", 8) == 0) section = 3;
+            else if (strncmp(line, "[QualityMappings", 16) == 0) section = 4;
+            else if (strncmp(line, "[InputRegisters", 15) == 0) section = 5;
+            else if (strncmp(line, "[HoldingRegisters", 17) == 0) section = 6;
+            else {
+                write_log("WARNING: Unknown section %s ignored, line %d", line, line_number);
+                section = -1;
+            }
+            section_poll_ms = 0;
+            section_verify = false;
+
+            // Mapping and device sections belong to the device named after the colon
+            dev = NULL;
+            if (section > 0) {
+                if (!section_device(line, device_name)) {
+                    config_error(cfg, "ERROR: Invalid device name in %s, line %d", line, line_number);
+                    section = -1;
+                    continue;
+                }
+                dev = find_device(cfg, device_name, true);
+                ok = dev != NULL;
+            }
+            continue;
+        }
+
+        if (line[0] == '\0' || line[0] == ';' || line[0] == '#' || section < 0) continue;
+
+        char* equals = strchr(line, '=');
+        if (!equals) {
+            config_error(cfg, "ERROR: Expected key=value, line %d", line_number);
+            continue;
+        }
+        *equals = '\0';
+        char* k = trim(line);
+        char* v = trim(equals + 1);
+        if (k[0] == '\0' || strlen(k) >= SIGNAL_NAME_SIZE || strlen(v) >= SIGNAL_NAME_SIZE) {
+            config_error(cfg, "ERROR: Key or value too long or empty, line %d", line_number);
+            continue;
+        }
+
+        switch (section) {
+            case 0: // ModbusConfig
+                // Connection keys of [ModbusConfig] describe the default device
+                if (strcmp(k, "server_ip") == 0 || strcmp(k, "port") == 0 || strcmp(k, "slave_id") == 0 ||
+                    strcmp(k, "transport") == 0) {
+                    ModbusDevice* main_dev = find_device(cfg, DEFAULT_DEVICE, true);
+                    ok = main_dev != NULL;
+                    if (ok && !set_device_key(main_dev, k, v)) {
+                        config_error(cfg, "ERROR: Invalid value for %s: %s, line %d", k, v, line_number);
+                    }
+                }
+                else if (!set_config_key(cfg, k, v)) {
+                    config_error(cfg, "ERROR: Invalid value for %s: %s, line %d", k, v, line_number);
+                }
+                break;
+
+            case 3: // Device
+                if (!set_device_key(dev, k, v)) {
+                    config_error(cfg, "ERROR: Invalid value for %s: %s, line %d", k, v, line_number);
+                }
+                break;
+
+            case 4: // QualityMappings, field=signal name or field=* for the device link
+            {
+                bool duplicate = false;
+                for (int q = 0; q < dev->quality_binding_count && !duplicate; q++) {
+                    duplicate = strcmp(dev->quality_bindings[q].field, k) == 0;
+                }
+                if (duplicate) {
+                    config_error(cfg, "ERROR: Duplicate quality mapping %s on %s, line %d", k, dev->name, line_number);
+                    break;
+                }
+
+                QualityBinding* bindings = realloc(dev->quality_bindings,
+                                                   (dev->quality_binding_count + 1) * sizeof(QualityBinding));
+                if (!bindings) {
+                    write_log("ERROR: Memory allocation failed for quality mapping %s", k);
+                    ok = false;
+                    break;
+                }
+                dev->quality_bindings = bindings;
+                QualityBinding* binding = &bindings[dev->quality_binding_count++];
+                memset(binding, 0, sizeof(QualityBinding));
+                strcpy(binding->field, k);
+                strcpy(binding->source, v);
+                binding->field_index = resolve_field(cfg, k, "quality", dev->name, line_number, false);
+                binding->signal = -1;
+                break;
+            }
+
+            case 1: // InputMappings
+            case 2: // OutputMappings
+            case 5: // InputRegisters
+            case 6: // HoldingRegisters
+            {
+                bool registers = section >= 5;
+                SignalTable* table = registers ? &dev->registers.signals : section == 1 ? &dev->inputs : &dev->outputs;
+                const char* kind = registers ? "register" : section == 1 ? "input" : "output";
+                if (strcmp(k, "poll_ms") == 0) {
+                    if (!parse_int(v, 1, MODBUS_MAX_PERIOD_MS, &section_poll_ms)) {
+                        config_error(cfg, "ERROR: Invalid value for poll_ms: %s, line %d", v, line_number);
+                        section_poll_ms = 0;
+                    }
+                    break;
+                }
+                // Outputs after verify=1 are read back after every write
+                if (section == 2 && strcmp(k, "verify") == 0) {
+                    int enabled;
+                    if (!parse_int(v, 0, 1, &enabled)) {
+                        config_error(cfg, "ERROR: Invalid value for verify: %s, line %d", v, line_number);
+                        break;
+                    }
+                    section_verify = enabled != 0;
+                    break;
+                }
+
+                // Mapping value is address or address@poll_ms, registers add :type:order:scale:offset to the address
+                int address;
+                RegisterFormat format = { 0 };
+                double scale = 1;
+                double offset = 0;
+                int poll_ms = section_poll_ms;
+                char* poll = strchr(v, '@');
+                if (poll) *poll++ = '\0';
+                bool valid = registers ? parse_register(v, section == 5 ? MODBUS_FC_READ_INPUT_REGISTERS : MODBUS_FC_READ_HOLDING_REGISTERS,
+                                                        &address, &format, &scale, &offset)
+                                       : parse_int(trim(v), 0, MODBUS_ADDRESS_COUNT - 1, &address);
+                if (!valid || (poll && !parse_int(trim(poll), 1, MODBUS_MAX_PERIOD_MS, &poll_ms))) {
+                    config_error(cfg, "ERROR: Invalid %s for %s, line %d", registers ? "register mapping" : "address", k, line_number);
+                    break;
+                }
+                if (signal_table_find(table, k) >= 0) {
+                    config_error(cfg, "ERROR: Duplicate %s mapping %s on %s, line %d", kind, k, dev->name, line_number);
+                    break;
+                }
+                // Two outputs on one coil or holding register would overwrite each other
+                if (section == 2 || section == 6) {
+                    int claimed = 1;
+                    for (int w = 0; w < (section == 6 ? format.width : 1) && claimed > 0; w++) {
+                        claimed = section == 2 ? claim_output_address(&taken, &taken_devices, (int)(dev - cfg->devices), address)
+                                               : claim_output_address(&taken_registers, &taken_register_devices,
+                                                                      (int)(dev - cfg->devices), address + w);
+                    }
+                    if (claimed == 0) {
+                        config_error(cfg, "ERROR: %s address %d of %s already mapped on %s, line %d",
+                                  section == 2 ? "Output" : "Holding register", address, k, dev->name, line_number);
+                        break;
+                    }
+                    ok = claimed > 0;
+                    if (!ok) {
+                        write_log("ERROR: Memory allocation failed for mapping %s", k);
+                        break;
+                    }
+                }
+
+                int id = registers ? register_table_add(&dev->registers, k, address, format, scale, offset)
+                                   : signal_table_add(table, k, address);
+                if (id < 0) {
+                    write_log("ERROR: Memory allocation failed for mapping %s", k);
+                    ok = false;
+                    break;
+                }
+                table->info[id].poll_ms = poll_ms;
+                table->info[id].field_index = resolve_field(cfg, k, kind, dev->name, line_number, registers);
+                table->info[id].verify = section == 2 && section_verify;
+                if (registers) break;
+                // Update max address
+                int* max_address = section == 1 ? &dev->max_input_address : &dev->max_output_address;
+                if (address > *max_address) *max_address = address;
+                break;
+            }
+        }
+    }
+
+    free(taken);
+    free(taken_registers);
+    if (ok && cfg->device_count == 0) ok = find_device(cfg, DEFAULT_DEVICE, true) != NULL;
+    return ok;
+}
+
+// Names the model does not know are reported again when the config comes from the cache
+static void log_unbound_fields(const ModbusConfig* cfg) {
+    for (int d = 0; d < cfg->device_count; d++) {
+        const ModbusDevice* dev = &cfg->devices[d];
+        for (int i = 0; i < dev->inputs.count; i++) {
+            if (dev->inputs.info[i].field_index < 0) write_log("ERROR: Unknown input field %s on device %s", dev->inputs.info[i].name, dev->name);
+        }
+        for (int i = 0; i < dev->outputs.count; i++) {
+            if (dev->outputs.info[i].field_index < 0) write_log("ERROR: Unknown output field %s on device %s", dev->outputs.info[i].name, dev->name);
+        }
+        for (int i = 0; i < dev->registers.signals.count; i++) {
+            if (dev->registers.signals.info[i].field_index < 0) write_log("ERROR: Unknown register field %s on device %s", dev->registers.signals.info[i].name, dev->name);
+        }
+        for (int q = 0; q < dev->quality_binding_count; q++) {
+            if (dev->quality_bindings[q].field_index < 0) write_log("ERROR: Unknown quality field %s on device %s", dev->quality_bindings[q].field, dev->name);
+        }
+    }
+}
+
+// Config file loaded, from the compiled cache when the INI and the bindings did not change
+ModbusConfig* load_config(const char* filename) {
+    size_t size = 0;
+    char* text = read_text_file(filename, &size);
+
+    // If no config file, return with default values
+    if (!text) {
+        ModbusConfig* cfg = new_config();
+        if (!cfg) return NULL;
+        FILE* new_file = fopen(filename, "w");
+        if (new_file) {
+            fprintf(new_file, "[ModbusConfig]\nserver_ip=%s\nport=%d\nslave_id=%d\n\n",
+                    DEFAULT_IP, DEFAULT_PORT, DEFAULT_SLAVE_ID);
+            fclose(new_file);
+            write_log("Default config file created");
+        } else {
+            write_log("ERROR: Unable to create default config file");
+        }
+        if (!find_device(cfg, DEFAULT_DEVICE, true) || !build_read_plan(cfg) || !build_write_plan(cfg)) {
+            free_config(cfg);
+            return NULL;
+        }
+        return cfg;
+    }
+
+    uint64_t key = config_cache_key(text, size);
+    ModbusConfig* cfg = config_cache_load(CONFIG_CACHE_FILE, key);
+    if (cfg) {
+        free(text);
+        cfg->source_key = key;
+        log_unbound_fields(cfg);
+        write_log("Config loaded from %s, %d devices.", CONFIG_CACHE_FILE, cfg->device_count);
+        return cfg;
+    }
+
+    cfg = new_config();
+    bool ok = cfg && parse_config(cfg, text);
+    if (ok && cfg->reconnect_max_ms < cfg->reconnect_min_ms) cfg->reconnect_max_ms = cfg->reconnect_min_ms;
+    free(text);
+    if (!cfg) return NULL;
+    cfg->source_key = key;
+    if (!ok || !build_read_plan(cfg) || !build_write_plan(cfg)) {
+        free_config(cfg);
+        return NULL;
+    }
+
+    for (int d = 0; d < cfg->device_count; d++) {
+        const ModbusDevice* dev = &cfg->devices[d];
+        write_log("Device %s at %s:%d over %s, %d inputs, %d outputs, %d registers, %d quality fields", dev->name,
+                  dev->server_ip, dev->port, modbus_transport_name(dev->transport), dev->inputs.count, dev->outputs.count, dev->registers.signals.count, dev->quality_binding_count);
+    }
+    if (!config_cache_save(cfg, CONFIG_CACHE_FILE, key)) {
+        write_log("WARNING: Unable to write %s, next start parses %s again", CONFIG_CACHE_FILE, filename);
+    }
+    write_log("Config loaded successfully, %d devices.", cfg->device_count);
+    return cfg;
+}
+
+// Config and every device, table and plan owned by it are freed
+void free_config(ModbusConfig* cfg) {
+    if (!cfg) return;
+    for (int d = 0; d < cfg->device_count; d++) {
+        ModbusDevice* dev = &cfg->devices[d];
+        signal_table_free(&dev->inputs);
+        signal_table_free(&dev->outputs);
+        free(dev->read_plan);
+        free(dev->read_bits);
+        free(dev->poll_groups);
+        free(dev->write_order);
+        free(dev->write_segment);
+        register_table_free(&dev->registers);
+        free(dev->read_regs);
+        free(dev->register_write_order);
+        free(dev->quality_bindings);
+    }
+    free(cfg->devices);
+    free(cfg);
+}
+
+static int compare_int(const void* a, const void* b) {
+    return (*(const int*)a > *(const int*)b) - (*(const int*)a < *(const int*)b);
+}
+
+static const uint16_t* sort_addresses = NULL;
+
+static int compare_signal_address(const void* a, const void* b) {
+    int x = sort_addresses[*(const int*)a];
+    int y = sort_addresses[*(const int*)b];
+    return (x > y) - (x < y);
+}
+
+static int signal_period(const ModbusConfig* cfg, const SignalTable* table, int i) {
+    return table->info[i].poll_ms > 0 ? table->info[i].poll_ms : cfg->poll_ms;
+}
+
+static int compare_read_block(const void* a, const void* b) {
+    const ModbusReadBlock* x = a;
+    const ModbusReadBlock* y = b;
+    if (x->period_ms != y->period_ms) return (x->period_ms > y->period_ms) - (x->period_ms < y->period_ms);
+    if (x->function != y->function) return (x->function > y->function) - (x->function < y->function);
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+// Signal is read by the blocks of this function and period, format is NULL for bit tables
+static bool signal_planned(const ModbusConfig* cfg, const SignalTable* table, const RegisterFormat* format,
+                           int function, int period_ms, int i) {
+    return signal_period(cfg, table, i) == period_ms && (!format || format[i].function == function);
+}
+
+// Sorted address spans of one poll period are grouped into as few requests as the gap threshold and PDU limit allow.
+// A bit covers one address, a register value one or two, and a value never straddles two blocks.
+static bool plan_read_blocks(const ModbusConfig* cfg, ModbusDevice* dev, int function, SignalTable* table,
+                             const RegisterFormat* format, int period_ms) {
+    int gap = format ? cfg->register_gap : cfg->read_gap;
+    int limit = format ? MODBUS_MAX_READ_REGISTERS : MODBUS_MAX_READ_BITS;
+    int* buffer_size = format ? &dev->read_register_count : &dev->read_bit_count;
+    int count = 0;
+    int* spans = malloc((2 * table->count + 2) * sizeof(int)); // First and last address of every signal
+    if (!spans) {
+        write_log("ERROR: Memory allocation failed for read plan");
+        return false;
+    }
+    for (int i = 0; i < table->count; i++) {
+        if (!signal_planned(cfg, table, format, function, period_ms, i)) continue;
+        spans[2 * count] = table->address[i];
+        spans[2 * count + 1] = table->address[i] + (format ? format[i].width - 1 : 0);
+        count++;
+    }
+    qsort(spans, count, 2 * sizeof(int), compare_int);
+
+    int first_block = dev->read_block_count;
+    ModbusReadBlock* block = NULL;
+    int last = -1;
+    for (int i = 0; i < count; i++) {
+        int addr = spans[2 * i];
+        int end = spans[2 * i + 1];
+        if (block && end <= last) continue;
+
+        if (block && addr - last - 1 <= gap && end - block->start + 1 <= limit) {
+            block->count = end - block->start + 1;
+        } else {
+            block = &dev->read_plan[dev->read_block_count++];
+            block->function = function;
+            block->start = addr;
+            block->count = end - addr + 1;
+            block->period_ms = period_ms;
+        }
+        last = end;
+    }
+    free(spans);
+
+    for (int b = first_block; b < dev->read_block_count; b++) {
+        dev->read_plan[b].offset = *buffer_size;
+        *buffer_size += dev->read_plan[b].count;
+    }
+
+    // Each signal gets its position in the device read buffer, blocks of this period are sorted by start
+    for (int i = 0; i < table->count; i++) {
+        if (!signal_planned(cfg, table, format, function, period_ms, i)) continue;
+        int low = first_block, high = dev->read_block_count - 1;
+        while (low < high) {
+            int mid = (low + high + 1) / 2;
+            if (dev->read_plan[mid].start <= table->address[i]) low = mid;
+            else high = mid - 1;
+        }
+        ModbusReadBlock* rb = &dev->read_plan[low];
+        table->read_offset[i] = rb->offset + (table->address[i] - rb->start);
+    }
+    return true;
+}
+
+// Every distinct poll period of a table is planned separately
+static bool plan_table_periods(const ModbusConfig* cfg, ModbusDevice* dev, int function, SignalTable* table,
+                               const RegisterFormat* format) {
+    int planned_count = 0;
+    int* planned = malloc((table->count + 1) * sizeof(int));
+    if (!planned) {
+        write_log("ERROR: Memory allocation failed for read plan");
+        return false;
+    }
+
+    bool ok = true;
+    for (int i = 0; i < table->count && ok; i++) {
+        if (format && format[i].function != function) continue;
+        int period_ms = signal_period(cfg, table, i);
+        bool seen = false;
+        for (int p = 0; p < planned_count && !seen; p++) seen = planned[p] == period_ms;
+        if (seen) continue;
+
+        planned[planned_count++] = period_ms;
+        ok = plan_read_blocks(cfg, dev, function, table, format, period_ms);
+    }
+    free(planned);
+    return ok;
+}
+
+static bool build_device_read_plan(const ModbusConfig* cfg, ModbusDevice* dev) {
+    dev->read_block_count = 0;
+    dev->read_bit_count = 0;
+    dev->read_register_count = 0;
+    dev->poll_group_count = 0;
+    free(dev->read_plan);
+    free(dev->read_bits);
+    free(dev->read_regs);
+    free(dev->poll_groups);
+    dev->read_bits = NULL;
+    dev->read_regs = NULL;
+    dev->poll_groups = NULL;
+
+    // Every mapping opens at most one block
+    RegisterTable* registers = &dev->registers;
+    dev->read_plan = malloc((dev->inputs.count + dev->outputs.count + registers->signals.count + 1) * sizeof(ModbusReadBlock));
+    if (!dev->read_plan) {
+        write_log("ERROR: Memory allocation failed for read plan");
+        return false;
+    }
+    if (!plan_table_periods(cfg, dev, MODBUS_FC_READ_DISCRETE_INPUTS, &dev->inputs, NULL)) return false;
+    if (!plan_table_periods(cfg, dev, MODBUS_FC_READ_COILS, &dev->outputs, NULL)) return false;
+    if (!plan_table_periods(cfg, dev, MODBUS_FC_READ_INPUT_REGISTERS, &registers->signals, registers->format)) return false;
+    if (!plan_table_periods(cfg, dev, MODBUS_FC_READ_HOLDING_REGISTERS, &registers->signals, registers->format)) return false;
+
+    // Blocks of one period become consecutive, each run is a poll group. Adaptive polling paces every
+    // block on its own, so each block is a group.
+    qsort(dev->read_plan, dev->read_block_count, sizeof(ModbusReadBlock), compare_read_block);
+    dev->poll_groups = calloc(dev->read_block_count + 1, sizeof(ModbusPollGroup));
+    if (!dev->poll_groups) {
+        write_log("ERROR: Memory allocation failed for poll groups");
+        return false;
+    }
+    for (int b = 0; b < dev->read_block_count; b++) {
+        int period_ms = dev->read_plan[b].period_ms;
+        if (cfg->adaptive_poll || dev->poll_group_count == 0 ||
+            dev->poll_groups[dev->poll_group_count - 1].period_ms != period_ms) {
+            ModbusPollGroup* group = &dev->poll_groups[dev->poll_group_count++];
+            group->period_ms = period_ms;
+            group->first_block = b;
+        }
+        dev->poll_groups[dev->poll_group_count - 1].block_count++;
+    }
+
+    // Read buffers are allocated once and reused by every poll
+    dev->read_bits = calloc(dev->read_bit_count + 1, sizeof(uint8_t));
+    dev->read_regs = calloc(dev->read_register_count + 1, sizeof(uint16_t));
+    if (!dev->read_bits || !dev->read_regs) {
+        write_log("ERROR: Memory allocation failed for read buffer");
+        return false;
+    }
+
+    write_log("Read plan built for %s: %d requests, %d bits, %d registers, %d poll groups",
+              dev->name, dev->read_block_count, dev->read_bit_count, dev->read_register_count, dev->poll_group_count);
+    return true;
+}
+
+// Read plans are built once per config, the poll loops only run these blocks
+bool build_read_plan(ModbusConfig* cfg) {
+    if (cfg->read_gap < 0) cfg->read_gap = 0;
+    if (cfg->register_gap < 0) cfg->register_gap = 0;
+    if (cfg->poll_ms <= 0) cfg->poll_ms = MODBUS_READ_INTERVAL;
+    if (cfg->poll_max_ms < cfg->poll_min_ms) {
+        write_log("WARNING: poll_max_ms %d is below poll_min_ms %d, using %d", cfg->poll_max_ms, cfg->poll_min_ms,
+                  cfg->poll_min_ms);
+        cfg->poll_max_ms = cfg->poll_min_ms;
+    }
+
+    for (int d = 0; d < cfg->device_count; d++) {
+        if (!build_device_read_plan(cfg, &cfg->devices[d])) return false;
+    }
+    return true;
+}
+
+// Outputs are ordered by address once so the write engine can merge dirty runs without searching
+static bool build_device_write_plan(ModbusDevice* dev) {
+    int count = dev->outputs.count;
+
+    free(dev->write_order);
+    free(dev->write_segment);
+    dev->write_order = malloc((count + 1) * sizeof(int));
+    dev->write_segment = malloc((count + 1) * sizeof(int));
+    if (!dev->write_order || !dev->write_segment) {
+        write_log("ERROR: Memory allocation failed for write plan");
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) dev->write_order[i] = i;
+    sort_addresses = dev->outputs.address;
+    qsort(dev->write_order, count, sizeof(int), compare_signal_address);
+    sort_addresses = NULL;
+
+    // A segment ends at the first unmapped address, coils we do not own are never rewritten. A verified
+    // output is a segment of its own, so it is only written when it changed and its read back covers one coil.
+    int segment = 0;
+    for (int p = 0; p < count; p++) {
+        if (p > 0) {
+            int prev = dev->outputs.address[dev->write_order[p - 1]];
+            if (dev->outputs.address[dev->write_order[p]] > prev + 1 || dev->outputs.info[dev->write_order[p]].verify ||
+                dev->outputs.info[dev->write_order[p - 1]].verify) segment++;
+        }
+        dev->write_segment[p] = segment;
+    }
+
+    // Holding registers are written in address order, input registers are read only
+    const RegisterTable* registers = &dev->registers;
+    free(dev->register_write_order);
+    dev->register_write_order = malloc((registers->signals.count + 1) * sizeof(int));
+    if (!dev->register_write_order) {
+        write_log("ERROR: Memory allocation failed for write plan");
+        return false;
+    }
+    dev->register_write_count = 0;
+    for (int i = 0; i < registers->signals.count; i++) {
+        if (registers->format[i].function == MODBUS_FC_READ_HOLDING_REGISTERS) dev->register_write_order[dev->register_write_count++] = i;
+    }
+    sort_addresses = registers->signals.address;
+    qsort(dev->register_write_order, dev->register_write_count, sizeof(int), compare_signal_address);
+    sort_addresses = NULL;
+    return true;
+}
+
+bool build_write_plan(ModbusConfig* cfg) {
+    if (cfg->write_request_cost < 0) cfg->write_request_cost = 0;
+
+    for (int d = 0; d < cfg->device_count; d++) {
+        if (!build_device_write_plan(&cfg->devices[d])) return false;
+    }
+    return true;
+}
+
+// Bound context field of a resolved binding table index
+static SGLbool* context_field(CONTEXT_STRUCT_NAME *context, int field_index) {
+    if (field_index < 0) return NULL;
+    return (SGLbool*)((char*)context + modbus_fields[field_index].offset);
+}
+
+static double saturate(double value, double low, double high) {
+    if (isnan(value)) return 0;
+    value = nearbyint(value);
+    return value < low ? low : value > high ? high : value;
+}
+
+// Scalar context field of a register mapping as a double
+static double load_field(const void* target, int type) {
+    switch (type) {
+        case MODBUS_FIELD_BOOL: return *(const SGLbool*)target != 0;
+        case MODBUS_FIELD_INT8: return *(const int8_t*)target;
+        case MODBUS_FIELD_UINT8: return *(const uint8_t*)target;
+        case MODBUS_FIELD_INT16: return *(const int16_t*)target;
+        case MODBUS_FIELD_UINT16: return *(const uint16_t*)target;
+        case MODBUS_FIELD_INT32: return *(const int32_t*)target;
+        case MODBUS_FIELD_UINT32: return *(const uint32_t*)target;
+        case MODBUS_FIELD_FLOAT: return *(const float*)target;
+        default: return *(const double*)target;
+    }
+}
+
+// Register value is stored into a scalar context field, integer fields are rounded and saturated
+static void store_field(void* target, int type, double value) {
+    switch (type) {
+        case MODBUS_FIELD_BOOL: *(SGLbool*)target = saturate(value, 0, 1) != 0; break;
+        case MODBUS_FIELD_INT8: *(int8_t*)target = (int8_t)saturate(value, INT8_MIN, INT8_MAX); break;
+        case MODBUS_FIELD_UINT8: *(uint8_t*)target = (uint8_t)saturate(value, 0, UINT8_MAX); break;
+        case MODBUS_FIELD_INT16: *(int16_t*)target = (int16_t)saturate(value, INT16_MIN, INT16_MAX); break;
+        case MODBUS_FIELD_UINT16: *(uint16_t*)target = (uint16_t)saturate(value, 0, UINT16_MAX); break;
+        case MODBUS_FIELD_INT32: *(int32_t*)target = (int32_t)saturate(value, INT32_MIN, INT32_MAX); break;
+        case MODBUS_FIELD_UINT32: *(uint32_t*)target = (uint32_t)saturate(value, 0, UINT32_MAX); break;
+        case MODBUS_FIELD_FLOAT: *(float*)target = (float)value; break;
+        default: *(double*)target = value; break;
+    }
+}
+
+static int register_field_type(const RegisterTable* registers, int i) {
+    return modbus_fields[registers->signals.info[i].field_index].type;
+}
+
+// Modbus names and adresses of every device are matched with program variables
+static void bind_config(ModbusConfig* cfg, CONTEXT_STRUCT_NAME *context) {
+    for (int d = 0; d < cfg->device_count; d++) {
+        ModbusDevice* dev = &cfg->devices[d];
+        SignalTable* inputs = &dev->inputs;
+        SignalTable* outputs = &dev->outputs;
+
+        for (int i = 0; i < inputs->count; i++) {
+            // Max adress value is found
+            if(inputs->address[i] > dev->max_input_address) dev->max_input_address = inputs->address[i];
+            inputs->target[i] = context_field(context, inputs->info[i].field_index);
+        }
+
+        for (int i = 0; i < outputs->count; i++) {
+            // Max adress value is found
+            if(outputs->address[i] > dev->max_output_address) dev->max_output_address = outputs->address[i];
+            outputs->target[i] = context_field(context, outputs->info[i].field_index);
+        }
+
+        RegisterTable* registers = &dev->registers;
+        for (int i = 0; i < registers->signals.count; i++) {
+            registers->target[i] = context_field(context, registers->signals.info[i].field_index);
+        }
+
+        // Quality fields are model inputs like the input mappings
+        for (int q = 0; q < dev->quality_binding_count; q++) {
+            QualityBinding* binding = &dev->quality_bindings[q];
+            binding->target = context_field(context, binding->field_index);
+            binding->table = NULL;
+            binding->signal = -1;
+            if (strcmp(binding->source, "*") == 0) continue;
+
+            binding->table = inputs;
+            binding->signal = signal_table_find(inputs, binding->source);
+            if (binding->signal < 0) {
+                binding->table = outputs;
+                binding->signal = signal_table_find(outputs, binding->source);
+            }
+            if (binding->signal < 0) {
+                binding->table = &registers->signals;
+                binding->signal = signal_table_find(&registers->signals, binding->source);
+            }
+            if (binding->signal < 0) {
+                write_log("ERROR: Unknown signal %s for quality field %s", binding->source, binding->field);
+                binding->target = NULL;
+            }
+        }
+    }
+}
+
+void init_mappings(CONTEXT_STRUCT_NAME *context) {
+    bind_config(config, context);
+    write_log("Modbus Input and Output Mappings initialized.");
+}
+
+// Triple buffer helpers. Writer fills back slot and publishes it, reader takes the latest published slot.
+static bool image_buffer_init(ImageBuffer* tb, int input_count, int output_count, int register_count) {
+    memset(tb->slots, 0, sizeof(tb->slots));
+    for (int s = 0; s < 3; s++) {
+        ModbusImage* image = &tb->slots[s];
+        image->inputs = signal_bitset_alloc(input_count);
+        image->outputs = signal_bitset_alloc(output_count);
+        image->dirty = signal_bitset_alloc(output_count);
+        image->change_seq = calloc(output_count + 1, sizeof(unsigned long));
+        image->input_quality = signal_bitset_alloc(input_count);
+        image->output_quality = signal_bitset_alloc(output_count);
+        image->registers = calloc(register_count + 1, sizeof(uint32_t));
+        image->register_values = calloc(register_count + 1, sizeof(double));
+        image->register_quality = signal_bitset_alloc(register_count);
+        image->register_dirty = signal_bitset_alloc(register_count);
+        image->register_change_seq = calloc(register_count + 1, sizeof(unsigned long));
+        if (!image->inputs || !image->outputs || !image->dirty || !image->change_seq ||
+            !image->input_quality || !image->output_quality || !image->registers || !image->register_values ||
+            !image->register_quality || !image->register_dirty || !image->register_change_seq) return false;
+    }
+    tb->front = 0;
+    tb->back = 2;
+    atomic_init(&tb->middle, 1u);
+    return true;
+}
+
+static void image_buffer_free(ImageBuffer* tb) {
+    for (int s = 0; s < 3; s++) {
+        free(tb->slots[s].inputs);
+        free(tb->slots[s].outputs);
+        free(tb->slots[s].dirty);
+        free(tb->slots[s].change_seq);
+        free(tb->slots[s].input_quality);
+        free(tb->slots[s].output_quality);
+        free(tb->slots[s].registers);
+        free(tb->slots[s].register_values);
+        free(tb->slots[s].register_quality);
+        free(tb->slots[s].register_dirty);
+        free(tb->slots[s].register_change_seq);
+    }
+    memset(tb->slots, 0, sizeof(tb->slots));
+}
+
+static ModbusImage* image_buffer_back(ImageBuffer* tb) {
+    return &tb->slots[tb->back];
+}
+
+static void image_buffer_publish(ImageBuffer* tb) {
+    unsigned int prev = atomic_exchange_explicit(&tb->middle, tb->back | IMAGE_FRESH, memory_order_acq_rel);
+    tb->back = prev & IMAGE_INDEX_MASK;
+}
+
+static ModbusImage* image_buffer_latest(ImageBuffer* tb) {
+    if (!(atomic_load_explicit(&tb->middle, memory_order_relaxed) & IMAGE_FRESH)) return NULL;
+    unsigned int prev = atomic_exchange_explicit(&tb->middle, tb->front, memory_order_acq_rel);
+    tb->front = prev & IMAGE_INDEX_MASK;
+    return &tb->slots[tb->front];
+}
+
+// Cycle buffers of a device are sized once for its loaded mappings
+static bool alloc_cycle_buffers(DeviceIO* io) {
+    ModbusDevice* dev = io->device;
+    int inputs = dev->inputs.count;
+    int outputs = dev->outputs.count;
+    int registers = dev->registers.signals.count;
+
+    io->io_pending = signal_bitset_alloc(outputs);
+    io->io_desired = signal_bitset_alloc(outputs);
+    io->io_slave = signal_bitset_alloc(outputs);
+    io->io_known = signal_bitset_alloc(outputs);
+    io->io_written = signal_bitset_alloc(outputs);
+    io->io_verify_failures = calloc(outputs + 1, sizeof(int));
+    io->io_dirty = malloc((outputs + 1) * sizeof(int));
+    io->io_best = malloc((outputs + 1) * sizeof(int));
+    io->io_from = malloc((outputs + 1) * sizeof(int));
+    io->poll_heap = malloc((dev->poll_group_count + 1) * sizeof(int));
+    io->block_group = malloc((dev->read_block_count + 1) * sizeof(int));
+    io->group_outstanding = calloc(dev->poll_group_count + 1, sizeof(int));
+    io->group_ok = calloc(dev->poll_group_count + 1, sizeof(bool));
+    io->group_changed = calloc(dev->poll_group_count + 1, sizeof(bool));
+    io->group_period_ms = malloc((dev->poll_group_count + 1) * sizeof(int));
+    io->group_activity = calloc(dev->poll_group_count + 1, sizeof(int));
+    io->block_ok_ns = calloc(dev->read_block_count + 1, sizeof(long long));
+    io->read_good = calloc(dev->read_bit_count + 1, sizeof(uint8_t));
+    io->register_good = calloc(dev->read_register_count + 1, sizeof(uint8_t));
+    io->reg_slave = calloc(registers + 1, sizeof(uint32_t));
+    io->reg_known = signal_bitset_alloc(registers);
+    io->reg_desired = calloc(registers + 1, sizeof(uint32_t));
+    io->reg_pending = signal_bitset_alloc(registers);
+    // Every block, every output and every holding register is queued at most once at a time
+    io->queue_capacity = dev->read_block_count + outputs + dev->register_write_count + 1;
+    io->queue = malloc(io->queue_capacity * sizeof(IoRequest));
+    io->draw_change_seq = calloc(outputs + 1, sizeof(unsigned long));
+    io->draw_dirty = signal_bitset_alloc(outputs);
+    io->draw_reg_change_seq = calloc(registers + 1, sizeof(unsigned long));
+    io->draw_reg_dirty = signal_bitset_alloc(registers);
+    io->draw_scratch = signal_bitset_alloc(inputs > outputs ? inputs : outputs);
+    io->draw_changed = signal_bitset_alloc(inputs > outputs ? inputs : outputs);
+    io->ev_inputs = signal_bitset_alloc(inputs);
+    io->ev_input_quality = signal_bitset_alloc(inputs);
+    io->ev_outputs = signal_bitset_alloc(outputs);
+    io->ev_output_quality = signal_bitset_alloc(outputs);
+    io->hs_inputs = signal_bitset_alloc(inputs);
+    io->hs_input_quality = signal_bitset_alloc(inputs);
+    io->hs_outputs = signal_bitset_alloc(outputs);
+    io->hs_output_quality = signal_bitset_alloc(outputs);
+    io->hs_registers = calloc(registers + 1, sizeof(uint32_t));
+    io->hs_register_quality = signal_bitset_alloc(registers);
+
+    if (!io->ev_inputs || !io->ev_input_quality || !io->ev_outputs || !io->ev_output_quality) return false;
+    if (!io->hs_inputs || !io->hs_input_quality || !io->hs_outputs || !io->hs_output_quality || !io->hs_registers ||
+        !io->hs_register_quality) return false;
+    if (!io->register_good || !io->reg_slave || !io->reg_known || !io->reg_desired || !io->reg_pending ||
+        !io->draw_reg_change_seq || !io->draw_reg_dirty) return false;
+    if (!io->io_pending || !io->io_desired || !io->io_slave || !io->io_dirty || !io->io_best || !io->io_from ||
+        !io->io_known || !io->io_written || !io->io_verify_failures ||
+        !io->poll_heap || !io->block_group || !io->group_outstanding || !io->group_ok || !io->queue ||
+        !io->group_changed || !io->group_period_ms || !io->group_activity ||
+        !io->block_ok_ns || !io->read_good ||
+        !io->draw_change_seq || !io->draw_dirty || !io->draw_scratch || !io->draw_changed) return false;
+
+    for (int g = 0; g < dev->poll_group_count; g++) {
+        ModbusPollGroup* group = &dev->poll_groups[g];
+        for (int b = group->first_block; b < group->first_block + group->block_count; b++) io->block_group[b] = g;
+        io->group_period_ms[g] = group->period_ms;
+        atomic_store_explicit(&group->stats.interval_ms, group->period_ms, memory_order_relaxed);
+    }
+    return image_buffer_init(&io->input_buffer, inputs, outputs, registers) &&
+           image_buffer_init(&io->output_buffer, inputs, outputs, registers);
+}
+
+static void free_cycle_buffers(DeviceIO* io) {
+    free(io->io_pending);
+    free(io->io_desired);
+    free(io->io_slave);
+    free(io->io_known);
+    free(io->io_written);
+    free(io->io_verify_failures);
+    free(io->io_dirty);
+    free(io->io_best);
+    free(io->io_from);
+    free(io->poll_heap);
+    free(io->block_group);
+    free(io->group_outstanding);
+    free(io->group_ok);
+    free(io->group_changed);
+    free(io->group_period_ms);
+    free(io->group_activity);
+    free(io->block_ok_ns);
+    free(io->read_good);
+    free(io->register_good);
+    free(io->reg_slave);
+    free(io->reg_known);
+    free(io->reg_desired);
+    free(io->reg_pending);
+    free(io->queue);
+    free(io->draw_change_seq);
+    free(io->draw_dirty);
+    free(io->draw_reg_change_seq);
+    free(io->draw_reg_dirty);
+    free(io->draw_scratch);
+    free(io->draw_changed);
+    free(io->ev_inputs);
+    free(io->ev_input_quality);
+    free(io->ev_outputs);
+    free(io->ev_output_quality);
+    free(io->hs_inputs);
+    free(io->hs_input_quality);
+    free(io->hs_outputs);
+    free(io->hs_output_quality);
+    free(io->hs_registers);
+    free(io->hs_register_quality);
+    free(io->rp_inputs); // Also holds the other replay bitsets
+    image_buffer_free(&io->input_buffer);
+    image_buffer_free(&io->output_buffer);
+}
+
+// Read buffer bytes are packed into a bitset, one word of 64 signals at a time
+static void pack_read_bits(const uint8_t* bytes, const SignalTable* table, SignalWord* bits) {
+    int words = SIGNAL_WORDS(table->count);
+    for (int w = 0; w < words; w++) {
+        const int* offsets = table->read_offset + w * SIGNAL_WORD_BITS;
+        int n = table->count - w * SIGNAL_WORD_BITS;
+        if (n > SIGNAL_WORD_BITS) n = SIGNAL_WORD_BITS;
+
+        SignalWord word = 0;
+        for (int b = 0; b < n; b++) word |= (SignalWord)(bytes[offsets[b]] & 1) << b;
+        bits[w] = word;
+    }
+}
+
+static long long io_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static bool any_bit_set(const SignalWord* bits, int words) {
+    for (int w = 0; w < words; w++) {
+        if (bits[w]) return true;
+    }
+    return false;
+}
+
+// Socket interest follows the connection state, writable is only watched while requests wait in the send buffer
+static void io_watch(DeviceIO* io) {
+    const ModbusTcpClient* client = &io->client;
+    if (client->fd < 0) return;
+
+    uint32_t events = client->state == MODBUS_TCP_CONNECTING ? EPOLLOUT : EPOLLIN;
+    if (client->state == MODBUS_TCP_CONNECTED && client->tx_size > 0) events |= EPOLLOUT;
+    if (events == io->events) return;
+
+    struct epoll_event ev = { .events = events, .data.ptr = io };
+    epoll_ctl(io_epoll, io->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, client->fd, &ev);
+    io->events = events;
+}
+
+static void io_queue(DeviceIO* io, int block, int first, int last) {
+    IoRequest* r = &io->queue[(io->queue_head + io->queue_size++) % io->queue_capacity];
+    r->block = block;
+    r->first = first;
+    r->last = last;
+}
+
+// Image sequence moves on once every collected output is on the slave
+static void io_update_applied(DeviceIO* io) {
+    if (io->writes_outstanding == 0 && !any_bit_set(io->io_pending, SIGNAL_WORDS(io->device->outputs.count)) &&
+        !any_bit_set(io->reg_pending, SIGNAL_WORDS(io->device->registers.signals.count))) {
+        io->io_applied_seq = io->io_collected_seq;
+        // Gateway clients learn from the next image that their writes are done
+        if (memcmp(io->gw_applied, io->gw_collected, sizeof(io->gw_applied)) != 0) {
+            memcpy(io->gw_applied, io->gw_collected, sizeof(io->gw_applied));
+            io->publish_due = true;
+        }
+    }
+}
+
+static void io_on_response(void* user, const ModbusTransaction* t, const uint8_t* pdu, int pdu_size);
+
+static void io_capture(const DeviceIO* io, uint8_t type, uint16_t id, const uint8_t* pdu, int size, long long now) {
+    if (capture_on) capture_put(type, (int)(io - device_io), id, pdu, size, now);
+}
+
+// Next connect attempt is drawn from [backoff/2, backoff] so HMIs that lost the same PLC do not
+// come back in step, the bound doubles up to the configured maximum
+static int io_schedule_retry(DeviceIO* io, long long now) {
+    int half = io->backoff_ms / 2;
+    int delay = half + (int)(rand_r(&io->seed) % (unsigned int)(io->backoff_ms - half + 1));
+    io->retry_ns = now + delay * 1000000LL;
+    io->backoff_ms = io->backoff_ms > config->reconnect_max_ms / 2 ? config->reconnect_max_ms : io->backoff_ms * 2;
+    return delay;
+}
+
+// Connection is lost, every queued and in-flight request is dropped and the device waits for a reconnect
+static void io_disconnect(DeviceIO* io, const char* reason) {
+    bool was_connected = atomic_load(&io->connected);
+    io->closing = true;
+    modbus_tcp_close(&io->client, io_on_response, io);
+    io->closing = false;
+    if (was_connected) io_capture(io, CAPTURE_DISCONNECT, 0, NULL, 0, io_now_ns());
+
+    for (; io->queue_size > 0; io->queue_size--) {
+        IoRequest* r = &io->queue[io->queue_head];
+        if (r->block >= 0) io->group_outstanding[io->block_group[r->block]]--;
+        else io->writes_outstanding--;
+        io->queue_head = (io->queue_head + 1) % io->queue_capacity;
+    }
+    io->queue_head = 0;
+    io->events = 0;
+    io->scheduled = false;
+    io->stable = false;
+    io->timeouts = 0;
+    atomic_store(&io->connected, false);
+    // Slave may change while the link is down, outputs waiting for their read back stay pending
+    memset(io->io_known, 0, SIGNAL_WORDS(io->device->outputs.count) * sizeof(SignalWord));
+    memset(io->reg_known, 0, SIGNAL_WORDS(io->device->registers.signals.count) * sizeof(SignalWord));
+    metrics_add(was_connected ? &io->metrics->disconnects : &io->metrics->connect_failures, 1);
+
+    // Quality of every signal of the device drops in the next image
+    io->publish_due = true;
+    int delay = io_schedule_retry(io, io_now_ns());
+    write_log("ERROR: Connection to %s %s: %s, retry in %d ms",
+              io->device->name, was_connected ? "lost" : "failed", reason, delay);
+}
+
+static void io_on_connected(DeviceIO* io) {
+    ModbusDevice* dev = io->device;
+    atomic_store(&io->connected, true);
+    metrics_record(&io->metrics->connect, (uint64_t)(io_now_ns() - io->connect_start_ns));
+    if (atomic_load_explicit(&io->metrics->connects, memory_order_relaxed) > 0) metrics_add(&io->metrics->reconnects, 1);
+    metrics_add(&io->metrics->connects, 1);
+    io_capture(io, CAPTURE_CONNECT, 0, NULL, 0, io_now_ns());
+    write_log("Connected to Modbus server %s at %s:%d over %s", dev->name, dev->server_ip, dev->port,
+              modbus_transport_name(dev->transport));
+}
+
+// Non-blocking connect is started once the backoff delay is over, completion is reported by epoll
+static void io_connect(DeviceIO* io, long long now) {
+    ModbusDevice* dev = io->device;
+    if (now < io->retry_ns) return;
+
+    io->connect_start_ns = now;
+    if (!modbus_tcp_connect(&io->client, dev->server_ip, dev->port)) {
+        metrics_add(&io->metrics->connect_failures, 1);
+        int delay = io_schedule_retry(io, now);
+        write_log("ERROR: Connection to %s failed: %s, retry in %d ms", dev->name, strerror(errno), delay);
+        return;
+    }
+    io->connect_deadline_ns = now + MODBUS_CONNECT_TIMEOUT_MS * 1000000LL;
+    io->events = 0;
+    io_watch(io);
+    if (io->client.state == MODBUS_TCP_CONNECTED) io_on_connected(io);
+}
+
+// Takes the latest output image from the draw thread and marks changed outputs as pending
+static void io_collect_outputs(DeviceIO* io) {
+    ModbusImage* image = image_buffer_latest(&io->output_buffer);
+    if (!image) return;
+
+    int words = SIGNAL_WORDS(io->device->outputs.count);
+    for (int i = signal_bitset_next(image->dirty, words, 0); i >= 0;
+         i = signal_bitset_next(image->dirty, words, i + 1)) {
+        if (image->change_seq[i] <= io->io_collected_seq) continue;
+
+        // An output changed back to the value already on the slave needs no write, unless that value is unknown
+        bool value = signal_bit(image->outputs, i);
+        signal_bit_set(io->io_desired, i, value);
+        signal_bit_set(io->io_pending, i, !signal_bit(io->io_known, i) || value != signal_bit(io->io_slave, i));
+        io->io_verify_failures[i] = 0;
+    }
+
+    int register_words = SIGNAL_WORDS(io->device->registers.signals.count);
+    for (int i = signal_bitset_next(image->register_dirty, register_words, 0); i >= 0;
+         i = signal_bitset_next(image->register_dirty, register_words, i + 1)) {
+        if (image->register_change_seq[i] <= io->io_collected_seq) continue;
+        io->reg_desired[i] = image->registers[i];
+        signal_bit_set(io->reg_pending, i, !signal_bit(io->reg_known, i) || image->registers[i] != io->reg_slave[i]);
+    }
+    io->io_collected_seq = image->seq;
+}
+
+// Wire cost of one write request covering span coils
+static int write_cost(int span) {
+    if (span == 1) return config->write_request_cost + WRITE_SINGLE_BYTES;
+    return config->write_request_cost + WRITE_MULTIPLE_BYTES + (span + 7) / 8;
+}
+
+// Clean outputs between two positions of write_order have a known state on the slave
+static bool io_known_between(const DeviceIO* io, int first, int end) {
+    for (int p = first; p < end; p++) {
+        if (!signal_bit(io->io_known, io->device->write_order[p])) return false;
+    }
+    return true;
+}
+
+// Dirty outputs are split into the cheapest mix of FC05 and FC15 requests, returns the number of runs queued
+static int io_plan_coil_writes(DeviceIO* io) {
+    const ModbusDevice* dev = io->device;
+    int* dirty = io->io_dirty;
+    int* best = io->io_best;
+    int* from = io->io_from;
+    int count = 0;
+    for (int p = 0; p < dev->outputs.count; p++) {
+        if (signal_bit(io->io_pending, dev->write_order[p])) dirty[count++] = p;
+    }
+
+    // best[j] is the cheapest cost of writing the first j dirty outputs, a run may only cover consecutive
+    // mapped addresses, has to fit in one FC15 request and rewrites clean outputs only with a known state
+    best[0] = 0;
+    for (int j = 1; j <= count; j++) {
+        int last = dirty[j - 1];
+        int last_addr = dev->outputs.address[dev->write_order[last]];
+        best[j] = -1;
+        for (int i = j; i >= 1; i--) {
+            int first = dirty[i - 1];
+            if (dev->write_segment[first] != dev->write_segment[last]) break;
+            int span = last_addr - dev->outputs.address[dev->write_order[first]] + 1;
+            if (span > MODBUS_MAX_WRITE_BITS) break;
+            if (i < j && !io_known_between(io, dirty[i - 1] + 1, dirty[i])) break;
+
+            int cost = best[i - 1] + write_cost(i == j ? 1 : span);
+            if (best[j] < 0 || cost < best[j]) {
+                best[j] = cost;
+                from[j] = i - 1;
+            }
+        }
+    }
+
+    // Runs are recovered back to front into best, then queued in address order
+    int runs = 0;
+    for (int j = count; j > 0; j = from[j]) best[runs++] = j;
+
+    for (int r = runs - 1; r >= 0; r--) {
+        int j = best[r];
+        io_queue(io, -1, dirty[from[j]], dirty[j - 1]);
+    }
+    return runs;
+}
+
+// Dirty holding registers are sent as FC16 runs, a run grows over clean registers of the same contiguous
+// mapping while rewriting them costs less than another request. Returns the number of runs queued.
+static int io_plan_register_writes(DeviceIO* io) {
+    const ModbusDevice* dev = io->device;
+    const RegisterTable* registers = &dev->registers;
+    const uint16_t* address = registers->signals.address;
+    const int* order = dev->register_write_order;
+    int runs = 0;
+    int first = -1; // Positions of the open run in register_write_order
+    int last = -1;
+    for (int p = 0; p < dev->register_write_count; p++) {
+        int i = order[p];
+        if (!signal_bit(io->reg_pending, i)) continue;
+        if (first >= 0) {
+            bool contiguous = true;
+            // Clean registers in between are rewritten with their slave value, which has to be known
+            for (int q = last + 1; q <= p && contiguous; q++) {
+                contiguous = address[order[q]] == address[order[q - 1]] + registers->format[order[q - 1]].width &&
+                             (q == p || signal_bit(io->reg_known, order[q]));
+            }
+            int gap = address[i] - address[order[last]] - registers->format[order[last]].width;
+            int span = address[i] + registers->format[i].width - address[order[first]];
+            if (contiguous && span <= MODBUS_MAX_WRITE_REGISTERS && 2 * gap < config->write_request_cost + WRITE_MULTIPLE_BYTES) {
+                last = p;
+                continue;
+            }
+            io_queue(io, -2, first, last);
+            runs++;
+        }
+        first = last = p;
+    }
+    if (first >= 0) {
+        io_queue(io, -2, first, last);
+        runs++;
+    }
+    return runs;
+}
+
+// Runs of one batch are sent back to back and the next batch is planned once all of them are answered
+static void io_plan_writes(DeviceIO* io) {
+    const ModbusDevice* dev = io->device;
+    bool coils = any_bit_set(io->io_pending, SIGNAL_WORDS(dev->outputs.count));
+    bool registers = any_bit_set(io->reg_pending, SIGNAL_WORDS(dev->registers.signals.count));
+    if (!coils && !registers) {
+        io_update_applied(io);
+        return;
+    }
+    if (coils) io->writes_outstanding += io_plan_coil_writes(io);
+    if (registers) io->writes_outstanding += io_plan_register_writes(io);
+}
+
+// FC05 or FC15 request for the outputs between two positions of write_order, values are taken at send time
+static int io_encode_write(DeviceIO* io, int first, int last, uint8_t* pdu) {
+    const ModbusDevice* dev = io->device;
+    const SignalTable* outputs = &dev->outputs;
+    int start = outputs->address[dev->write_order[first]];
+    int span = outputs->address[dev->write_order[last]] - start + 1;
+
+    if (first == last) {
+        return modbus_pdu_write_bit(pdu, start, signal_bit(io->io_desired, dev->write_order[first]));
+    }
+    for (int p = first; p <= last; p++) {
+        int i = dev->write_order[p];
+        bool value = signal_bit(io->io_pending, i) ? signal_bit(io->io_desired, i) : signal_bit(io->io_slave, i);
+        io->io_write_bits[outputs->address[i] - start] = value ? 1 : 0;
+    }
+    return modbus_pdu_write_bits(pdu, start, span, io->io_write_bits);
+}
+
+// FC16 request for the holding registers between two positions of register_write_order, clean registers
+// inside the run get the value already on the slave
+static int io_encode_register_write(DeviceIO* io, int first, int last, uint8_t* pdu) {
+    const ModbusDevice* dev = io->device;
+    const RegisterTable* registers = &dev->registers;
+    uint16_t words[MODBUS_MAX_WRITE_REGISTERS];
+    int start = registers->signals.address[dev->register_write_order[first]];
+    int end = start;
+    for (int p = first; p <= last; p++) {
+        int i = dev->register_write_order[p];
+        uint32_t raw = signal_bit(io->reg_pending, i) ? io->reg_desired[i] : io->reg_slave[i];
+        register_scatter(raw, registers->format[i], words + registers->signals.address[i] - start);
+        end = registers->signals.address[i] + registers->format[i].width;
+    }
+    return modbus_pdu_write_registers(pdu, start, end - start, words);
+}
+
+// Queued requests are framed as long as the device window has room
+static void io_send_queued(DeviceIO* io, long long now) {
+    uint8_t pdu[MODBUS_TCP_MAX_PDU];
+    while (io->queue_size > 0 && modbus_tcp_ready(&io->client)) {
+        IoRequest* r = &io->queue[io->queue_head];
+        int size;
+        if (r->block >= 0) {
+            const ModbusReadBlock* block = &io->device->read_plan[r->block];
+            size = modbus_pdu_read_bits(pdu, block->function, block->start, block->count);
+        } else if (r->block == -2) {
+            size = io_encode_register_write(io, r->first, r->last, pdu);
+        } else if (r->block == -3) {
+            const ModbusDevice* dev = io->device;
+            size = modbus_pdu_read_bits(pdu, MODBUS_FC_READ_COILS, dev->outputs.address[dev->write_order[r->first]], 1);
+        } else {
+            size = io_encode_write(io, r->first, r->last, pdu);
+        }
+        modbus_tcp_request(&io->client, pdu, size, r->block, now);
+        io_capture(io, CAPTURE_REQUEST, (uint16_t)(io->client.next_id - 1), pdu, size, now);
+        metrics_add(&io->metrics->requests, 1);
+        metrics_add(&io->metrics->bytes_sent, modbus_tcp_overhead(&io->client) + size);
+        io->queue_head = (io->queue_head + 1) % io->queue_capacity;
+        io->queue_size--;
+    }
+}
+
+// Reason a transaction failed, NULL when the response answers the request
+static const char* io_response_error(const ModbusTransaction* t, const uint8_t* pdu, int pdu_size) {
+    if (!pdu) return "Response timeout";
+    if (pdu[0] == (t->pdu[0] | MODBUS_EXCEPTION_FLAG)) {
+        return pdu_size >= 2 ? modbus_exception_string(pdu[1]) : "Malformed exception";
+    }
+    if (pdu[0] != t->pdu[0]) return "Unexpected function code";
+    // Write acks echo the address and the quantity, or the value of FC05/FC06, the shadow image trusts them
+    switch (pdu[0]) {
+        case MODBUS_FC_WRITE_SINGLE_COIL:
+        case MODBUS_FC_WRITE_SINGLE_REGISTER:
+        case MODBUS_FC_WRITE_MULTIPLE_COILS:
+        case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+            if (pdu_size != 5 || memcmp(pdu + 1, t->pdu + 1, 4) != 0) return "Response does not match request";
+            break;
+        default:
+            break;
+    }
+    return NULL;
+}
+
+static bool register_block(const ModbusReadBlock* block) {
+    return block->function == MODBUS_FC_READ_HOLDING_REGISTERS || block->function == MODBUS_FC_READ_INPUT_REGISTERS;
+}
+
+static const char* block_kind(const ModbusReadBlock* block) {
+    switch (block->function) {
+        case MODBUS_FC_READ_DISCRETE_INPUTS: return "input bits";
+        case MODBUS_FC_READ_COILS: return "output bits";
+        case MODBUS_FC_READ_INPUT_REGISTERS: return "input registers";
+        default: return "holding registers";
+    }
+}
+
+// Min-heap of poll groups ordered by deadline
+static void poll_heap_swap(DeviceIO* io, int a, int b) {
+    int t = io->poll_heap[a];
+    io->poll_heap[a] = io->poll_heap[b];
+    io->poll_heap[b] = t;
+}
+
+static long long poll_heap_deadline(const DeviceIO* io, int i) {
+    return io->device->poll_groups[io->poll_heap[i]].deadline_ns;
+}
+
+static void poll_heap_down(DeviceIO* io, int i) {
+    for (;;) {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < io->poll_heap_size && poll_heap_deadline(io, left) < poll_heap_deadline(io, smallest)) smallest = left;
+        if (right < io->poll_heap_size && poll_heap_deadline(io, right) < poll_heap_deadline(io, smallest)) smallest = right;
+        if (smallest == i) return;
+        poll_heap_swap(io, i, smallest);
+        i = smallest;
+    }
+}
+
+static void poll_heap_init(DeviceIO* io, long long now) {
+    io->poll_heap_size = io->device->poll_group_count;
+    for (int g = 0; g < io->poll_heap_size; g++) {
+        io->device->poll_groups[g].deadline_ns = now;
+        io->poll_heap[g] = g;
+    }
+}
+
+// Adaptive pacing of a poll group after a successful round: a change halves its period and a group that
+// stays quiet backs off by a quarter, within poll_min_ms and poll_max_ms or the configured period when
+// that is outside them. A link that answers slower than poll_rtt_ms stretches every group by the same factor.
+static void io_adapt_group(DeviceIO* io, int g, bool changed, long long now) {
+    ModbusPollGroup* group = &io->device->poll_groups[g];
+    int lo = group->period_ms < config->poll_min_ms ? group->period_ms : config->poll_min_ms;
+    int hi = group->period_ms > config->poll_max_ms ? group->period_ms : config->poll_max_ms;
+    int period = io->group_period_ms[g];
+
+    io->group_activity[g] += ((changed ? POLL_ACTIVITY_ONE : 0) - io->group_activity[g]) / 8;
+    if (changed) period = period / 2 > lo ? period / 2 : lo;
+    else if (io->group_activity[g] < POLL_ACTIVITY_QUIET) period = period + period / 4 + 1 < hi ? period + period / 4 + 1 : hi;
+    io->group_period_ms[g] = period;
+
+    long long interval = period;
+    long long rtt_limit_ns = config->poll_rtt_ms * 1000000LL;
+    if (io->rtt_ns > rtt_limit_ns) interval = interval * io->rtt_ns / rtt_limit_ns;
+    if (interval > hi) interval = hi;
+
+    // Next deadline was set with the old interval when the round started
+    int old = atomic_load_explicit(&group->stats.interval_ms, memory_order_relaxed);
+    if (interval == old) return;
+    atomic_store_explicit(&group->stats.interval_ms, (int)interval, memory_order_relaxed);
+    if (!io->scheduled) return;
+    group->deadline_ns += (interval - old) * 1000000LL;
+    if (group->deadline_ns < now) group->deadline_ns = now;
+    for (int i = io->poll_heap_size / 2 - 1; i >= 0; i--) poll_heap_down(io, i);
+}
+
+static void io_read_done(DeviceIO* io, const ModbusTransaction* t, const uint8_t* pdu, int pdu_size) {
+    const ModbusDevice* dev = io->device;
+    const ModbusReadBlock* block = &dev->read_plan[t->tag];
+    int g = io->block_group[t->tag];
+    bool registers = register_block(block);
+
+    uint8_t bits[MODBUS_MAX_READ_BITS];
+    uint16_t words[MODBUS_MAX_READ_REGISTERS];
+    const char* error = io_response_error(t, pdu, pdu_size);
+    if (!error && !(registers ? modbus_pdu_unpack_registers(pdu, pdu_size, block->count, words)
+                              : modbus_pdu_unpack_bits(pdu, pdu_size, block->count, bits))) {
+        error = "Malformed response";
+    }
+    if (!error && registers) {
+        uint16_t* current = dev->read_regs + block->offset;
+        if (io->block_ok_ns[t->tag]) {
+            uint64_t changes = 0;
+            for (int k = 0; k < block->count; k++) changes += current[k] != words[k];
+            metrics_add(&io->metrics->input_changes, changes);
+            if (changes) io->group_changed[g] = true;
+        }
+        memcpy(current, words, block->count * sizeof(uint16_t));
+    } else if (!error) {
+        // Changes are only counted against an earlier read, the first one just fills the buffer
+        uint8_t* current = dev->read_bits + block->offset;
+        if (io->block_ok_ns[t->tag]) {
+            uint64_t changes = 0;
+            for (int k = 0; k < block->count; k++) changes += current[k] != bits[k];
+            metrics_add(&io->metrics->input_changes, changes);
+            if (changes) io->group_changed[g] = true;
+        }
+        memcpy(current, bits, block->count);
+    } else {
+        metrics_add(&io->metrics->read_errors, 1);
+    }
+    if (error && !io->closing) {
+        write_log("ERROR: Failed to read %s %d..%d on %s: %s",
+                 block_kind(block), block->start, block->start + block->count - 1, dev->name, error);
+    }
+    if (!error) {
+        io->group_ok[g] = true;
+        io->block_ok_ns[t->tag] = io_now_ns();
+    }
+
+    // A poll group is published once all of its blocks are answered
+    if (--io->group_outstanding[g] == 0) {
+        if (io->group_ok[g]) io->publish_due = true;
+        if (io->group_ok[g] && config->adaptive_poll) io_adapt_group(io, g, io->group_changed[g], io_now_ns());
+        io->group_ok[g] = false;
+        io->group_changed[g] = false;
+    }
+}
+
+// First position in write_order whose address is not below address
+static int write_order_lower_bound(const ModbusDevice* dev, int address) {
+    int lo = 0;
+    int hi = dev->outputs.count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (dev->outputs.address[dev->write_order[mid]] < address) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Acknowledged coil values are the new slave state, the read buffer is patched so the next image agrees
+static void io_write_done(DeviceIO* io, const ModbusTransaction* t, const uint8_t* pdu, int pdu_size) {
+    const ModbusDevice* dev = io->device;
+    const SignalTable* outputs = &dev->outputs;
+    int start = modbus_get_u16(t->pdu + 1);
+    int count = t->pdu[0] == MODBUS_FC_WRITE_SINGLE_COIL ? 1 : modbus_get_u16(t->pdu + 3);
+    io->writes_outstanding--;
+
+    const char* error = io_response_error(t, pdu, pdu_size);
+    if (error) {
+        metrics_add(&io->metrics->write_errors, 1);
+        // Outputs stay pending and go out with the next batch
+        if (!io->closing) {
+            write_log("ERROR: Failed to write outputs %d..%d on %s: %s", start, start + count - 1, dev->name, error);
+        }
+        return;
+    }
+
+    for (int p = write_order_lower_bound(dev, start); p < outputs->count; p++) {
+        int i = dev->write_order[p];
+        int address = outputs->address[i];
+        if (address >= start + count) break;
+
+        bool value = count == 1 ? t->pdu[3] == 0xFF : (t->pdu[6 + (address - start) / 8] >> ((address - start) % 8)) & 1u;
+        if (outputs->info[i].verify) {
+            // Slave state of a verified output is only taken from its read back
+            signal_bit_set(io->io_written, i, value);
+            signal_bit_set(io->io_known, i, false);
+            io_queue(io, -3, p, p);
+            io->writes_outstanding++;
+            continue;
+        }
+        if (value != signal_bit(io->io_slave, i)) {
+            write_log("Updated %s: %d -> %d at address %d", outputs->info[i].name, !value, value, address);
+        }
+        signal_bit_set(io->io_slave, i, value);
+        signal_bit_set(io->io_known, i, true);
+        signal_bit_set(io->io_pending, i, value != signal_bit(io->io_desired, i));
+        dev->read_bits[outputs->read_offset[i]] = value;
+    }
+    io_update_applied(io);
+}
+
+// Read back of a verified output, its write is done once the slave reports the written value
+static void io_verify_done(DeviceIO* io, const ModbusTransaction* t, const uint8_t* pdu, int pdu_size) {
+    const ModbusDevice* dev = io->device;
+    const SignalTable* outputs = &dev->outputs;
+    int address = modbus_get_u16(t->pdu + 1);
+    int i = dev->write_order[write_order_lower_bound(dev, address)];
+    io->writes_outstanding--;
+
+    uint8_t bit = 0;
+    const char* error = io_response_error(t, pdu, pdu_size);
+    if (!error && !modbus_pdu_unpack_bits(pdu, pdu_size, 1, &bit)) error = "Malformed response";
+    if (error) {
+        metrics_add(&io->metrics->write_errors, 1);
+        // Output is still pending and is written again after the reconnect
+        if (io->closing) return;
+        write_log("ERROR: Failed to read back output %s at address %d on %s: %s", outputs->info[i].name, address, dev->name, error);
+    } else {
+        bool value = bit != 0;
+        bool written = signal_bit(io->io_written, i);
+        if (value == written && value != signal_bit(io->io_slave, i)) {
+            write_log("Updated %s: %d -> %d at address %d", outputs->info[i].name, !value, value, address);
+        }
+        signal_bit_set(io->io_slave, i, value);
+        signal_bit_set(io->io_known, i, true);
+        signal_bit_set(io->io_pending, i, value != signal_bit(io->io_desired, i));
+        dev->read_bits[outputs->read_offset[i]] = value;
+        if (value == written) {
+            io->io_verify_failures[i] = 0;
+            io_update_applied(io);
+            return;
+        }
+        metrics_add(&io->metrics->write_errors, 1);
+        write_log("ERROR: Output %s at address %d on %s reads %d after writing %d", outputs->info[i].name, address,
+                  dev->name, value, written);
+    }
+
+    // A pending output is written and read back again with the next batch, once verify_retries are used up
+    // it keeps the state the slave reports
+    if (++io->io_verify_failures[i] > config->verify_retries) {
+        write_log("ERROR: Giving up on output %s on %s after %d failed read backs", outputs->info[i].name, dev->name,
+                  io->io_verify_failures[i]);
+        io->io_verify_failures[i] = 0;
+        signal_bit_set(io->io_desired, i, signal_bit(io->io_slave, i));
+        signal_bit_set(io->io_pending, i, false);
+    }
+    io_update_applied(io);
+}
+
+// First position in register_write_order whose address is not below address
+static int register_order_lower_bound(const ModbusDevice* dev, int address) {
+    int lo = 0;
+    int hi = dev->register_write_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (dev->registers.signals.address[dev->register_write_order[mid]] < address) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Acknowledged holding register values are the new slave state, the read buffer is patched so the next image agrees
+static void io_register_write_done(DeviceIO* io, const ModbusTransaction* t, const uint8_t* pdu, int pdu_size) {
+    const ModbusDevice* dev = io->device;
+    const RegisterTable* registers = &dev->registers;
+    int start = modbus_get_u16(t->pdu + 1);
+    int count = modbus_get_u16(t->pdu + 3);
+    io->writes_outstanding--;
+
+    const char* error = io_response_error(t, pdu, pdu_size);
+    if (error) {
+        metrics_add(&io->metrics->write_errors, 1);
+        // Registers stay pending and go out with the next batch
+        if (!io->closing) {
+            write_log("ERROR: Failed to write holding registers %d..%d on %s: %s", start, start + count - 1, dev->name, error);
+        }
+        return;
+    }
+
+    uint16_t words[MODBUS_MAX_WRITE_REGISTERS];
+    for (int k = 0; k < count; k++) words[k] = modbus_get_u16(t->pdu + 6 + 2 * k);
+    for (int p = register_order_lower_bound(dev, start); p < dev->register_write_count; p++) {
+        int i = dev->register_write_order[p];
+        int address = registers->signals.address[i];
+        if (address >= start + count) break;
+
+        int offset = address - start;
+        RegisterFormat format = registers->format[i];
+        uint32_t raw;
+        register_gather(words, &offset, 1, format, &raw);
+        if (raw != io->reg_slave[i]) {
+            double value;
+            register_convert(&raw, &registers->scale[i], &registers->offset[i], 1, format.type, &value);
+            write_log("Updated %s to %g at register %d", registers->signals.info[i].name, value, address);
+        }
+        io->reg_slave[i] = raw;
+        signal_bit_set(io->reg_known, i, true);
+        signal_bit_set(io->reg_pending, i, raw != io->reg_desired[i]);
+        memcpy(dev->read_regs + registers->signals.read_offset[i], words + offset, format.width * sizeof(uint16_t));
+    }
+    io_update_applied(io);
+}
+
+// Smoothed like TCP SRTT, an unanswered request counts as a response at its timeout
+static void io_track_rtt(DeviceIO* io, long long rtt_ns) {
+    io->rtt_ns = io->rtt_ns ? io->rtt_ns + (rtt_ns - io->rtt_ns) / 8 : rtt_ns;
+}
+
+static void io_on_response(void* user, const ModbusTransaction* t, const uint8_t* pdu, int pdu_size) {
+    DeviceIO* io = user;
+    io_capture(io, CAPTURE_RESPONSE, t->id, pdu, pdu ? pdu_size : 0, io_now_ns());
+
+    // Any answer proves the link, the backoff starts over only once the new connection works
+    if (pdu) {
+        uint64_t rtt_ns = (uint64_t)(io_now_ns() - t->sent_ns);
+        metrics_record(t->tag >= 0 ? &io->metrics->read : &io->metrics->write, rtt_ns);
+        io_track_rtt(io, (long long)rtt_ns);
+        metrics_add(&io->metrics->responses, 1);
+        metrics_add(&io->metrics->bytes_received, modbus_tcp_overhead(&io->client) + pdu_size);
+        io->timeouts = 0;
+        if (!io->stable) io->backoff_ms = config->reconnect_min_ms;
+        io->stable = true;
+    } else if (!io->closing) {
+        io->timeouts++;
+        metrics_add(&io->metrics->timeouts, 1);
+        io_track_rtt(io, io->client.timeout_ns);
+    }
+    if (t->tag >= 0) io_read_done(io, t, pdu, pdu_size);
+    else if (t->tag == -2) io_register_write_done(io, t, pdu, pdu_size);
+    else if (t->tag == -3) io_verify_done(io, t, pdu, pdu_size);
+    else io_write_done(io, t, pdu, pdu_size);
+}
+
+// A block is good while the device is connected and its last read is younger than stale_periods polls,
+// returns the next time a good block turns stale
+static long long io_update_quality(DeviceIO* io, long long now) {
+    const ModbusDevice* dev = io->device;
+    bool link = atomic_load(&io->connected);
+    int periods = config->stale_periods > 0 ? config->stale_periods : 1;
+    long long next = 0;
+
+    for (int b = 0; b < dev->read_block_count; b++) {
+        const ModbusReadBlock* block = &dev->read_plan[b];
+        int interval_ms = atomic_load_explicit(&dev->poll_groups[io->block_group[b]].stats.interval_ms, memory_order_relaxed);
+        long long stale_ns = io->block_ok_ns[b] + (long long)periods * interval_ms * 1000000LL;
+        bool good = link && io->block_ok_ns[b] && now < stale_ns;
+        memset((register_block(block) ? io->register_good : io->read_good) + block->offset, good, block->count);
+        if (good && (next == 0 || stale_ns < next)) next = stale_ns;
+    }
+    return next;
+}
+
+// Values and quality that differ from the last image become change events, ids start at base
+static void io_table_events(int base, int count, const SignalWord* value, const SignalWord* quality,
+                            SignalWord* last_value, SignalWord* last_quality, bool emit, long long now) {
+    for (int w = 0; w < SIGNAL_WORDS(count); w++) {
+        SignalWord changed = (value[w] ^ last_value[w]) | (quality[w] ^ last_quality[w]);
+        for (; emit && changed; changed &= changed - 1) {
+            int b = __builtin_ctzll(changed);
+            SignalWord mask = (SignalWord)1 << b;
+            ModbusChangeEvent event = {
+                base + w * SIGNAL_WORD_BITS + b,
+                (last_value[w] & mask) != 0, (value[w] & mask) != 0,
+                (last_quality[w] & mask) != 0, (quality[w] & mask) != 0,
+                now,
+            };
+            event_queue_put(&event_queue, &event);
+        }
+        last_value[w] = value[w];
+        last_quality[w] = quality[w];
+    }
+}
+
+static void io_emit_events(DeviceIO* io, const ModbusImage* image, long long now) {
+    const ModbusDevice* dev = io->device;
+    bool emit = event_queue_ready && atomic_load_explicit(&events_wanted, memory_order_relaxed);
+    io_table_events(io->signal_base, dev->inputs.count, image->inputs, image->input_quality,
+                    io->ev_inputs, io->ev_input_quality, emit, now);
+    io_table_events(io->signal_base + dev->inputs.count, dev->outputs.count, image->outputs, image->output_quality,
+                    io->ev_outputs, io->ev_output_quality, emit, now);
+    if (emit) event_queue_commit(&event_queue, now);
+}
+
+// History entry of a ring is skipped when the ring already ends with the same value, NAN included
+static void io_history_put(int ring, int64_t time_ns, double value, bool primed) {
+    double last;
+    if (!primed && history_value_at(&history, ring, INT64_MAX, &last) &&
+        (last == value || (isnan(last) && isnan(value)))) return;
+    history_record(&history, ring, time_ns, value);
+}
+
+// Value and quality bits that differ from the last image become transitions, a value that changes while
+// the quality stays bad does not
+static void io_history_table(int ring, int count, const SignalWord* value, const SignalWord* quality,
+                             SignalWord* last_value, SignalWord* last_quality, bool primed, int64_t time_ns) {
+    for (int w = 0; w < SIGNAL_WORDS(count); w++) {
+        SignalWord changed = ((value[w] ^ last_value[w]) | (quality[w] ^ last_quality[w])) & (quality[w] | last_quality[w]);
+        if (!primed) {
+            int n = count - w * SIGNAL_WORD_BITS;
+            changed = n >= SIGNAL_WORD_BITS ? ~(SignalWord)0 : ((SignalWord)1 << n) - 1;
+        }
+        for (; changed; changed &= changed - 1) {
+            int b = __builtin_ctzll(changed);
+            SignalWord mask = (SignalWord)1 << b;
+            double v = (quality[w] & mask) ? (double)((value[w] & mask) != 0) : NAN;
+            io_history_put(ring + w * SIGNAL_WORD_BITS + b, time_ns, v, primed);
+        }
+        last_value[w] = value[w];
+        last_quality[w] = quality[w];
+    }
+}
+
+static void io_record_history(DeviceIO* io, const ModbusImage* image) {
+    if (!history.header) return;
+    const ModbusDevice* dev = io->device;
+    int64_t now = history_now_ns();
+    int ring = io->history_base;
+    bool primed = io->hs_primed;
+    io_history_table(ring, dev->inputs.count, image->inputs, image->input_quality,
+                     io->hs_inputs, io->hs_input_quality, primed, now);
+    ring += dev->inputs.count;
+    io_history_table(ring, dev->outputs.count, image->outputs, image->output_quality,
+                     io->hs_outputs, io->hs_output_quality, primed, now);
+    ring += dev->outputs.count;
+    for (int i = 0; i < dev->registers.signals.count; i++) {
+        bool good = signal_bit(image->register_quality, i);
+        bool was_good = signal_bit(io->hs_register_quality, i);
+        if (primed && good == was_good && (!good || image->registers[i] == io->hs_registers[i])) continue;
+        io_history_put(ring + i, now, good ? image->register_values[i] : NAN, primed);
+        io->hs_registers[i] = image->registers[i];
+        signal_bit_set(io->hs_register_quality, i, good);
+    }
+    io->hs_primed = true;
+}
+
+// Server: image of a device goes into its gateway slot by address, clients copy it under the seqlock
+static void gateway_publish(DeviceIO* io, const ModbusImage* image) {
+    int index = (int)(io - device_io);
+    if (!gateway || index >= GATEWAY_MAX_DEVICES) return;
+    const ModbusDevice* dev = io->device;
+    GatewayDevice* slot = &gateway->devices[index];
+
+    gateway_write_begin(slot);
+    for (int i = 0; i < dev->inputs.count; i++) {
+        gateway_bit_set(slot->inputs, dev->inputs.address[i], signal_bit(image->inputs, i));
+        gateway_bit_set(slot->input_quality, dev->inputs.address[i], signal_bit(image->input_quality, i));
+    }
+    for (int i = 0; i < dev->outputs.count; i++) {
+        gateway_bit_set(slot->coils, dev->outputs.address[i], signal_bit(image->outputs, i));
+        gateway_bit_set(slot->coil_quality, dev->outputs.address[i], signal_bit(image->output_quality, i));
+    }
+    atomic_store_explicit(&slot->link, image->link, memory_order_relaxed);
+    for (int c = 0; c < GATEWAY_MAX_CLIENTS; c++) {
+        atomic_store_explicit(&slot->applied[c], io->gw_applied[c], memory_order_relaxed);
+    }
+    gateway_write_end(slot);
+}
+
+// Server: coil write of a client becomes a pending output, like a change made by the local draw thread
+static void gateway_apply_write(int client, const GatewayWrite* write, uint32_t generation) {
+    // Writes queued for an older config are queued again by the client once it sees the new one
+    if (write->generation != generation || write->device >= device_io_count) return;
+    DeviceIO* io = &device_io[write->device];
+    const ModbusDevice* dev = io->device;
+    int p = write_order_lower_bound(dev, write->address);
+    if (p >= dev->outputs.count || dev->outputs.address[dev->write_order[p]] != write->address) {
+        write_log("WARNING: Gateway client %d wrote coil %d on %s, which is not mapped here", client, write->address, dev->name);
+        return;
+    }
+    int i = dev->write_order[p];
+    signal_bit_set(io->io_desired, i, write->value);
+    signal_bit_set(io->io_pending, i, !signal_bit(io->io_known, i) || write->value != signal_bit(io->io_slave, i));
+    io->io_verify_failures[i] = 0;
+    if (write->seq > io->gw_collected[client]) io->gw_collected[client] = write->seq;
+}
+
+// Server: write queues of every attached client are drained by the I/O thread
+static void gateway_collect_writes(void) {
+    GatewayWrite writes[GATEWAY_WRITE_BATCH];
+    uint32_t generation = atomic_load_explicit(&gateway->generation, memory_order_relaxed);
+    for (int c = 0; c < GATEWAY_MAX_CLIENTS; c++) {
+        GatewayClient* client = &gateway->clients[c];
+        if (atomic_load_explicit(&client->pid, memory_order_relaxed) == 0) continue;
+        int n;
+        do {
+            n = gateway_take_writes(client, writes, GATEWAY_WRITE_BATCH);
+            for (int w = 0; w < n; w++) gateway_apply_write(c, &writes[w], generation);
+        } while (n == GATEWAY_WRITE_BATCH);
+    }
+}
+
+// Register read buffer is decoded into the image in runs of signals with the same layout, so each run is
+// one branch free gather and convert loop
+static void io_decode_registers(const DeviceIO* io, ModbusImage* image) {
+    const RegisterTable* registers = &io->device->registers;
+    int count = registers->signals.count;
+    int last;
+    for (int first = 0; first < count; first = last) {
+        RegisterFormat format = registers->format[first];
+        for (last = first + 1; last < count && register_same_layout(registers->format[last], format); last++) continue;
+        register_gather(io->device->read_regs, registers->signals.read_offset + first, last - first, format,
+                        image->registers + first);
+        register_convert(image->registers + first, registers->scale + first, registers->offset + first, last - first,
+                         format.type, image->register_values + first);
+    }
+}
+
+// Read buffer is published as a new input image, blocks not polled this cycle keep their last values
+static void io_publish_inputs(DeviceIO* io, long long now) {
+    const ModbusDevice* dev = io->device;
+    ModbusImage* image = image_buffer_back(&io->input_buffer);
+    pack_read_bits(dev->read_bits, &dev->inputs, image->inputs);
+    pack_read_bits(dev->read_bits, &dev->outputs, image->outputs);
+    io_decode_registers(io, image);
+
+    io->stale_check_ns = io_update_quality(io, now);
+    pack_read_bits(io->read_good, &dev->inputs, image->input_quality);
+    pack_read_bits(io->read_good, &dev->outputs, image->output_quality);
+    pack_read_bits(io->register_good, &dev->registers.signals, image->register_quality);
+    image->link = atomic_load(&io->connected);
+
+    // Coils and holding registers read from the slave are the new reference for the next writes, also when the
+    // slave changed them itself
+    int words = SIGNAL_WORDS(dev->outputs.count);
+    for (int w = 0; w < words; w++) {
+        SignalWord read = image->output_quality[w] & ~io->io_pending[w];
+        io->io_slave[w] = (image->outputs[w] & read) | (io->io_slave[w] & ~read);
+        io->io_known[w] |= read;
+    }
+    for (int p = 0; p < dev->register_write_count; p++) {
+        int i = dev->register_write_order[p];
+        if (signal_bit(io->reg_pending, i) || !signal_bit(image->register_quality, i)) continue;
+        io->reg_slave[i] = image->registers[i];
+        signal_bit_set(io->reg_known, i, true);
+    }
+    image->seq = io->io_applied_seq;
+    io_emit_events(io, image, now);
+    io_record_history(io, image);
+    gateway_publish(io, image);
+    image_buffer_publish(&io->input_buffer);
+}
+
+// Blocks of due groups are queued together, a late group skips the deadlines it already missed
+// and a group whose previous reads are still unanswered skips this one
+static void io_run_due_polls(DeviceIO* io, long long now) {
+    while (io->poll_heap_size > 0 && poll_heap_deadline(io, 0) <= now) {
+        int g = io->poll_heap[0];
+        ModbusPollGroup* group = &io->device->poll_groups[g];
+        long long period_ns = atomic_load_explicit(&group->stats.interval_ms, memory_order_relaxed) * 1000000LL;
+        long long late_ns = now - group->deadline_ns;
+        long long missed = late_ns / period_ns;
+
+        if (io->group_outstanding[g] > 0) {
+            missed++;
+        } else {
+            for (int b = group->first_block; b < group->first_block + group->block_count; b++) io_queue(io, b, 0, 0);
+            io->group_outstanding[g] = group->block_count;
+
+            long jitter_us = (long)(late_ns / 1000);
+            atomic_fetch_add_explicit(&group->stats.polls, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&group->stats.jitter_sum_us, jitter_us, memory_order_relaxed);
+            if (jitter_us > atomic_load_explicit(&group->stats.jitter_max_us, memory_order_relaxed)) {
+                atomic_store_explicit(&group->stats.jitter_max_us, jitter_us, memory_order_relaxed);
+            }
+        }
+
+        if (missed > 0) {
+            atomic_fetch_add_explicit(&group->stats.skipped, (unsigned long)missed, memory_order_relaxed);
+            metrics_add(&io->metrics->poll_misses, (uint64_t)missed);
+        }
+        group->deadline_ns += (missed + 1) * period_ns;
+        poll_heap_down(io, 0);
+    }
+}
+
+static void poll_report(const ModbusDevice* dev, const ModbusPollGroup* group, ModbusPollReport* report) {
+    report->device = dev->name;
+    report->period_ms = group->period_ms;
+    report->interval_ms = atomic_load_explicit(&group->stats.interval_ms, memory_order_relaxed);
+    report->polls = atomic_load_explicit(&group->stats.polls, memory_order_relaxed);
+    report->skipped = atomic_load_explicit(&group->stats.skipped, memory_order_relaxed);
+    report->jitter_max_us = atomic_load_explicit(&group->stats.jitter_max_us, memory_order_relaxed);
+    long sum = atomic_load_explicit(&group->stats.jitter_sum_us, memory_order_relaxed);
+    report->jitter_avg_us = report->polls ? sum / (long)report->polls : 0;
+}
+
+static void io_log_poll_stats(const DeviceIO* io) {
+    ModbusPollReport report;
+    for (int g = 0; g < io->device->poll_group_count; g++) {
+        poll_report(io->device, &io->device->poll_groups[g], &report);
+        write_log("Poll group %s %d ms: %lu polls, %lu skipped, jitter avg %ld us, max %ld us, polled every %d ms",
+                  report.device, report.period_ms, report.polls, report.skipped,
+                  report.jitter_avg_us, report.jitter_max_us, report.interval_ms);
+    }
+    if (config->adaptive_poll) write_log("Device %s response time %lld us", io->device->name, io->rtt_ns / 1000);
+}
+
+// Requests of a connected device: queue writes and due reads, expire late answers and fill the window
+static void io_exchange(DeviceIO* io, long long now) {
+    ModbusTcpClient* client = &io->client;
+    if (!io->scheduled) {
+        poll_heap_init(io, now);
+        io->scheduled = true;
+    }
+
+    io_collect_outputs(io);
+    if (!io_draining) {
+        if (io->writes_outstanding == 0) io_plan_writes(io);
+        io_run_due_polls(io, now);
+    }
+    modbus_tcp_expire(client, now, io_on_response, io);
+    if (client->resent) {
+        metrics_add(&io->metrics->retransmits, client->resent);
+        client->resent = 0;
+    }
+
+    // A socket that still accepts requests but stopped answering is half-open
+    if (io->timeouts >= MODBUS_MAX_TIMEOUTS) {
+        io_disconnect(io, "No response, connection half-open");
+        return;
+    }
+
+    io_send_queued(io, now);
+    if (!modbus_tcp_flush(client)) {
+        io_disconnect(io, strerror(errno));
+        return;
+    }
+    io_watch(io);
+}
+
+// One pass over a device through its connection states, then the new image if anything changed
+static void io_service(DeviceIO* io, long long now) {
+    ModbusTcpClient* client = &io->client;
+    if (client->state == MODBUS_TCP_CLOSED) io_connect(io, now);
+    if (client->state == MODBUS_TCP_CONNECTING && now >= io->connect_deadline_ns) io_disconnect(io, "Connect timeout");
+    if (client->state == MODBUS_TCP_CONNECTED) io_exchange(io, now);
+
+    if (io->stale_check_ns && now >= io->stale_check_ns) io->publish_due = true;
+    if (io->publish_due) {
+        io_publish_inputs(io, now);
+        io->publish_due = false;
+    }
+}
+
+// Socket events of one device
+static void io_handle_event(DeviceIO* io, uint32_t events) {
+    ModbusTcpClient* client = &io->client;
+    if (client->state == MODBUS_TCP_CONNECTING) {
+        if (!modbus_tcp_finish_connect(client)) {
+            io_disconnect(io, strerror(errno));
+            return;
+        }
+        io_on_connected(io);
+        io_watch(io);
+        return;
+    }
+    if (client->state != MODBUS_TCP_CONNECTED) return;
+
+    if ((events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && !modbus_tcp_receive(client, io_on_response, io)) {
+        io_disconnect(io, strerror(errno));
+        return;
+    }
+    if ((events & EPOLLOUT) && !modbus_tcp_flush(client)) {
+        io_disconnect(io, strerror(errno));
+        return;
+    }
+    io_watch(io);
+}
+
+// Earliest poll, response or connect deadline of all devices, capped at one tick
+static int io_wait_ms(long long now) {
+    long long next = now + MODBUS_IO_TICK_MS * 1000000LL;
+    if (reload_due_ns && reload_due_ns < next) next = reload_due_ns;
+    for (int d = 0; d < device_io_count; d++) {
+        const DeviceIO* io = &device_io[d];
+        if (io->stale_check_ns && io->stale_check_ns < next) next = io->stale_check_ns;
+        if (io->client.state == MODBUS_TCP_CLOSED && io->retry_ns < next) next = io->retry_ns;
+        if (io->client.state == MODBUS_TCP_CONNECTING && io->connect_deadline_ns < next) next = io->connect_deadline_ns;
+        if (io->client.state != MODBUS_TCP_CONNECTED) continue;
+        if (!io_draining && io->poll_heap_size > 0 && poll_heap_deadline(io, 0) < next) next = poll_heap_deadline(io, 0);
+        long long response = modbus_tcp_next_deadline(&io->client);
+        if (response && response < next) next = response;
+    }
+    if (next <= now) return 0;
+    return (int)((next - now + 999999LL) / 1000000LL);
+}
+
+// Nothing of the device is queued, in flight or waiting in the send buffer
+static bool io_quiet(const DeviceIO* io) {
+    return io->queue_size == 0 && io->client.in_flight == 0 && io->client.tx_size == 0;
+}
+
+// Every device is idle, the draw thread swaps in the pending config while this thread touches nothing
+static void io_park(void) {
+    atomic_store(&io_parked, true);
+    struct pollfd wake = { .fd = io_wake, .events = POLLIN };
+    while (atomic_load(&io_parked) && atomic_load(&io_running)) {
+        uint64_t count;
+        if (poll(&wake, 1, MODBUS_IO_TICK_MS) > 0 && read(io_wake, &count, sizeof(count)) < 0) continue;
+    }
+}
+
+static const char* config_file_name(void) {
+    const char* slash = strrchr(CONFIG_FILE, '/');
+    return slash ? slash + 1 : CONFIG_FILE;
+}
+
+// Editors replace the file instead of writing it, so the directory of the config is watched
+static bool io_watch_config(void) {
+    static const char path[] = CONFIG_FILE;
+    char dir[256] = ".";
+    const char* slash = strrchr(path, '/');
+    if (slash) {
+        size_t length = (size_t)(slash - path);
+        if (length == 0) length = 1;
+        if (length >= sizeof(dir)) return false;
+        memcpy(dir, path, length);
+        dir[length] = '\0';
+    }
+
+    io_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &io_inotify };
+    return io_inotify >= 0 && inotify_add_watch(io_inotify, dir, IN_CLOSE_WRITE | IN_MOVED_TO) >= 0 &&
+           epoll_ctl(io_epoll, EPOLL_CTL_ADD, io_inotify, &ev) == 0;
+}
+
+// A burst of writes to the config becomes one reload after the file is quiet for a moment
+static void io_config_changed(long long now) {
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const char* name = config_file_name();
+    ssize_t n;
+    while ((n = read(io_inotify, buffer, sizeof(buffer))) > 0) {
+        for (char* p = buffer; p < buffer + n; ) {
+            const struct inotify_event* event = (const struct inotify_event*)p;
+            if (event->len && strcmp(event->name, name) == 0) reload_due_ns = now + RELOAD_DEBOUNCE_MS * 1000000LL;
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+// Config is rebuilt off the I/O thread, only a valid and changed result becomes pending_config
+static void* reload_thread_main(void* arg) {
+    (void)arg;
+    if (access(CONFIG_FILE, R_OK) == 0) {
+        ModbusConfig* next = load_config(CONFIG_FILE);
+        if (!next) {
+            write_log("ERROR: Reload of %s failed, keeping the running config", CONFIG_FILE);
+        } else if (next->source_key == reload_current_key) {
+            free_config(next);
+        } else if (next->error_count > 0) {
+            write_log("ERROR: %s has %d errors, keeping the running config", CONFIG_FILE, next->error_count);
+            free_config(next);
+        } else {
+            atomic_store(&pending_config, next);
+        }
+    }
+    atomic_store(&reload_busy, false);
+
+    uint64_t one = 1;
+    if (write(io_wake, &one, sizeof(one)) < 0) write_log("ERROR: Unable to wake Modbus I/O thread");
+    return NULL;
+}
+
+static void io_start_reload(long long now) {
+    if (atomic_load(&reload_busy)) {
+        reload_due_ns = now + RELOAD_DEBOUNCE_MS * 1000000LL;
+        return;
+    }
+    if (reload_started) pthread_join(reload_thread, NULL);
+    reload_started = false;
+    reload_due_ns = 0;
+    reload_current_key = config->source_key;
+
+    atomic_store(&reload_busy, true);
+    if (pthread_create(&reload_thread, NULL, reload_thread_main, NULL) != 0) {
+        atomic_store(&reload_busy, false);
+        write_log("ERROR: Failed to start config reload thread");
+        return;
+    }
+    reload_started = true;
+}
+
+// One I/O thread drives every device connection through epoll, requests of all devices are in
+// flight at the same time so a cycle takes about one round trip of the slowest healthy device
+static void* io_thread_main(void* arg) {
+    (void)arg;
+    struct epoll_event events[IO_MAX_EVENTS];
+    long long next_stats_ns = io_now_ns() + MODBUS_STATS_INTERVAL * 1000000000LL;
+
+    while (atomic_load(&io_running)) {
+        long long now = io_now_ns();
+        io_draining = atomic_load(&pending_config) != NULL;
+        if (gateway) {
+            atomic_store_explicit(&gateway->heartbeat_ns, now, memory_order_relaxed);
+            if (!io_draining) gateway_collect_writes();
+        }
+        for (int d = 0; d < device_io_count; d++) io_service(&device_io[d], now);
+
+        // A reloaded config is swapped in between poll cycles, once no request is outstanding
+        if (io_draining) {
+            bool quiet = true;
+            for (int d = 0; d < device_io_count && quiet; d++) quiet = io_quiet(&device_io[d]);
+            if (quiet) {
+                io_park();
+                continue;
+            }
+        } else if (reload_due_ns && now >= reload_due_ns) {
+            io_start_reload(now);
+        }
+
+        if (now >= next_stats_ns) {
+            for (int d = 0; d < device_io_count; d++) io_log_poll_stats(&device_io[d]);
+            next_stats_ns = now + MODBUS_STATS_INTERVAL * 1000000000LL;
+        }
+
+        int n = epoll_wait(io_epoll, events, IO_MAX_EVENTS, io_wait_ms(now));
+        for (int e = 0; e < n; e++) {
+            if (events[e].data.ptr == NULL) {
+                uint64_t count;
+                if (read(io_wake, &count, sizeof(count)) < 0) continue;
+            } else if (events[e].data.ptr == &io_inotify) {
+                io_config_changed(now);
+            } else if (events[e].data.ptr == &gateway_sock) {
+                // Client writes are collected at the top of the next pass
+                char wake[64];
+                while (recv(gateway_sock, wake, sizeof(wake), 0) > 0) continue;
+            } else {
+                io_handle_event(events[e].data.ptr, events[e].events);
+            }
+        }
+    }
+    return NULL;
+}
+
+// Server: segment and wake socket are created once per start, a reload keeps them
+static void gateway_start_server(void) {
+    gid_t group = (gid_t)-1;
+    if (config->gateway_group[0]) {
+        struct group* entry = getgrnam(config->gateway_group);
+        if (!entry) {
+            write_log("ERROR: Unable to create gateway %s: unknown group %s", config->gateway_name, config->gateway_group);
+            return;
+        }
+        group = entry->gr_gid;
+    }
+    gateway = gateway_create(config->gateway_name, group);
+    if (!gateway) {
+        write_log("ERROR: Unable to create gateway %s: %s", config->gateway_name, strerror(errno));
+        return;
+    }
+    strcpy(gateway_shm, config->gateway_name);
+    atomic_store(&gateway->heartbeat_ns, io_now_ns());
+
+    gateway_sock = gateway_wake_open(gateway_shm, true);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &gateway_sock };
+    if (gateway_sock < 0 || epoll_ctl(io_epoll, EPOLL_CTL_ADD, gateway_sock, &ev) != 0) {
+        write_log("WARNING: No wake socket for gateway %s, client writes wait up to %d ms: %s",
+                  gateway_shm, MODBUS_IO_TICK_MS, strerror(errno));
+    }
+    write_log("Gateway %s started", gateway_shm);
+}
+
+// Server: slots follow the device order, only while the I/O thread is stopped or parked
+static void gateway_assign_devices(void) {
+    if (!gateway || gateway_client >= 0) return;
+    int count = device_io_count < GATEWAY_MAX_DEVICES ? device_io_count : GATEWAY_MAX_DEVICES;
+    for (int d = 0; d < count; d++) {
+        const ModbusDevice* dev = device_io[d].device;
+        GatewayDevice* slot = &gateway->devices[d];
+        gateway_write_begin(slot);
+        snprintf(slot->name, sizeof(slot->name), "%s", dev->name);
+        snprintf(slot->server, sizeof(slot->server), "%s:%d", dev->server_ip, dev->port);
+        for (int w = 0; w < GATEWAY_WORDS; w++) {
+            atomic_store_explicit(&slot->input_quality[w], 0, memory_order_relaxed);
+            atomic_store_explicit(&slot->coil_quality[w], 0, memory_order_relaxed);
+        }
+        atomic_store_explicit(&slot->link, 0, memory_order_relaxed);
+        gateway_write_end(slot);
+        device_io[d].publish_due = true;
+    }
+    atomic_store(&gateway->device_count, count);
+    atomic_fetch_add_explicit(&gateway->generation, 1, memory_order_release);
+    if (device_io_count > count) write_log("WARNING: Gateway %s only shares the first %d devices", gateway_shm, count);
+}
+
+// Segment is removed by the server and released by a client, either way the process stops sharing
+static void gateway_stop(void) {
+    if (gateway && gateway_client >= 0) {
+        gateway_release_client(gateway, gateway_client);
+        gateway_detach(gateway);
+    } else if (gateway) {
+        gateway_destroy(gateway, gateway_shm);
+    }
+    gateway = NULL;
+    gateway_client = -1;
+    gateway_missing = false;
+    if (gateway_sock >= 0) close(gateway_sock);
+    gateway_sock = -1;
+}
+
+// I/O thread is stopped and every device connection and buffer is released
+static void stop_devices(void) {
+    if (atomic_load(&io_running)) {
+        atomic_store(&io_running, false);
+        uint64_t one = 1;
+        if (write(io_wake, &one, sizeof(one)) < 0) write_log("ERROR: Unable to wake Modbus I/O thread");
+        pthread_join(io_thread, NULL);
+    }
+    if (reload_started) pthread_join(reload_thread, NULL);
+    reload_started = false;
+    reload_due_ns = 0;
+    client_running = false;
+    replay_running = false;
+    capture_reader_close(&replay_reader);
+    free(replay_pending);
+    replay_pending = NULL;
+    gateway_stop();
+    free_config(atomic_exchange(&pending_config, NULL));
+    atomic_store(&io_parked, false);
+    for (int d = 0; d < device_io_count; d++) {
+        DeviceIO* io = &device_io[d];
+        if (io->client.fd >= 0) {
+            modbus_tcp_close(&io->client, NULL, NULL);
+            write_log("Modbus connection to %s closed", io->device->name);
+        }
+        free_cycle_buffers(io);
+    }
+    free(device_io);
+    device_io = NULL;
+    device_io_count = 0;
+    history_mark_gap(&history, history_now_ns());
+    history_close(&history);
+    if (io_epoll >= 0) close(io_epoll);
+    if (io_wake >= 0) close(io_wake);
+    if (io_inotify >= 0) close(io_inotify);
+    io_epoll = io_wake = io_inotify = -1;
+}
+
+// Metrics slot of a device, counters start over when the slot was used by another device
+static MetricsDevice* metrics_device(int index, const ModbusDevice* dev) {
+    if (index >= METRICS_MAX_DEVICES) return &metrics->devices[METRICS_MAX_DEVICES - 1];
+    MetricsDevice* slot = &metrics->devices[index];
+    char server[METRICS_NAME_SIZE];
+    snprintf(server, sizeof(server), "%s:%d", dev->server_ip, dev->port);
+    if (strcmp(slot->name, dev->name) != 0 || strcmp(slot->server, server) != 0) {
+        memset(slot, 0, sizeof(MetricsDevice));
+        snprintf(slot->name, sizeof(slot->name), "%s", dev->name);
+        strcpy(slot->server, server);
+        metrics_add(&metrics->generation, 1);
+    }
+    if ((uint32_t)index >= atomic_load(&metrics->device_count)) atomic_store(&metrics->device_count, index + 1);
+    return slot;
+}
+
+// Segment is created once per process, a reload does not move it
+static void metrics_start(const ModbusConfig* cfg) {
+    if (metrics) return;
+    if (strcmp(cfg->metrics_name, "none") != 0) {
+        metrics = metrics_create(cfg->metrics_name);
+        if (metrics) {
+            strcpy(metrics_shm, cfg->metrics_name);
+        } else if (errno == EBUSY) {
+            write_log("WARNING: Metrics segment %s belongs to another running HMI, metrics stay private", cfg->metrics_name);
+        } else {
+            write_log("WARNING: Unable to create metrics segment %s: %s", cfg->metrics_name, strerror(errno));
+        }
+    }
+    if (!metrics) {
+        metrics = &metrics_local;
+        metrics_init(metrics);
+    }
+}
+
+static void metrics_stop(void) {
+    if (metrics && metrics != &metrics_local) metrics_destroy(metrics, metrics_shm);
+    metrics = NULL;
+}
+
+// Server: started once per process like the metrics, a reload keeps the listening socket
+static void server_start(const ModbusConfig* cfg) {
+    if (server_started || cfg->server_port == 0) return;
+    if (!modbus_server_start(cfg->server_bind, cfg->server_port, cfg->server_max_clients)) {
+        write_log("ERROR: Unable to start Modbus server on %s:%d: %s", cfg->server_bind, cfg->server_port, strerror(errno));
+        return;
+    }
+    server_started = true;
+    write_log("Modbus server listening on %s:%d for up to %d clients", cfg->server_bind, cfg->server_port,
+              cfg->server_max_clients);
+    if (cfg->device_count > MODBUS_SERVER_MAX_UNITS) {
+        write_log("WARNING: Modbus server only serves the first %d devices", MODBUS_SERVER_MAX_UNITS);
+    }
+}
+
+static void server_stop(void) {
+    if (!server_started) return;
+    modbus_server_stop();
+    server_started = false;
+    write_log("Modbus server stopped");
+}
+
+// Capture: file is opened once per process, a reload only describes the devices again
+static void capture_begin(const ModbusConfig* cfg) {
+    if (capture_on || cfg->capture_file[0] == '\0') return;
+    if (!capture_start(cfg->capture_file)) {
+        write_log("ERROR: Unable to open capture file %s: %s", cfg->capture_file, strerror(errno));
+        return;
+    }
+    capture_on = true;
+    write_log("Capturing Modbus traffic to %s", cfg->capture_file);
+    if (cfg->device_count > CAPTURE_MAX_DEVICES) {
+        write_log("WARNING: Capture only records the first %d devices", CAPTURE_MAX_DEVICES);
+    }
+}
+
+static void capture_end(void) {
+    if (!capture_on) return;
+    capture_stop();
+    capture_on = false;
+    write_log("Capture closed");
+}
+
+// Capture: name and server of every device, a replay matches the records to its own devices by name.
+// Only while the I/O thread is stopped or parked.
+static void capture_devices(void) {
+    if (!capture_on) return;
+    long long now = io_now_ns();
+    for (int d = 0; d < device_io_count; d++) {
+        const ModbusDevice* dev = device_io[d].device;
+        char text[CAPTURE_DATA_SIZE];
+        int name = snprintf(text, sizeof(text), "%s", dev->name) + 1;
+        int size = name + snprintf(text + name, sizeof(text) - name, "%s:%d", dev->server_ip, dev->port) + 1;
+        capture_put(CAPTURE_DEVICE, d, 0, text, size, now);
+        if (atomic_load(&device_io[d].connected)) capture_put(CAPTURE_CONNECT, d, 0, NULL, 0, now);
+    }
+}
+
+// Client and cycle buffers of one device, the connection is opened later by the I/O thread
+static bool init_device_io(DeviceIO* io, const ModbusConfig* cfg, ModbusDevice* dev, int index) {
+    io->device = dev;
+    io->metrics = metrics_device(index, dev);
+    modbus_tcp_init(&io->client, dev->transport, dev->slave_id, cfg->max_in_flight, cfg->response_timeout_ms * 1000L,
+                    cfg->udp_retries);
+    io->backoff_ms = cfg->reconnect_min_ms;
+    io->seed = (unsigned int)io_now_ns() ^ (unsigned int)(index * 2654435761u);
+    return alloc_cycle_buffers(io);
+}
+
+// Bit or register read buffer position to read block, so signal state can follow a signal into a new read plan
+static int* read_block_index(const ModbusDevice* dev, bool registers) {
+    int* block_of = malloc(((registers ? dev->read_register_count : dev->read_bit_count) + 1) * sizeof(int));
+    if (!block_of) return NULL;
+    for (int b = 0; b < dev->read_block_count; b++) {
+        const ModbusReadBlock* block = &dev->read_plan[b];
+        if (register_block(block) != registers) continue;
+        for (int k = 0; k < block->count; k++) block_of[block->offset + k] = b;
+    }
+    return block_of;
+}
+
+// Last read of a signal is taken over from the running device, a block counts as read when all
+// of its signals were read, at the time of the oldest of those reads
+static void adopt_read(DeviceIO* io, const DeviceIO* old, const int* block_of, const int* old_block_of,
+                       int offset, int old_offset, bool registers) {
+    int b = block_of[offset];
+    long long ok_ns = 0;
+    if (old_offset >= 0 && registers) {
+        io->device->read_regs[offset] = old->device->read_regs[old_offset];
+        io->register_good[offset] = old->register_good[old_offset];
+    } else if (old_offset >= 0) {
+        io->device->read_bits[offset] = old->device->read_bits[old_offset];
+        io->read_good[offset] = old->read_good[old_offset];
+    }
+    if (old_offset >= 0) {
+        ok_ns = old->block_ok_ns[old_block_of[old_offset]];
+    }
+    if (io->block_ok_ns[b] < 0 || ok_ns < io->block_ok_ns[b]) io->block_ok_ns[b] = ok_ns;
+}
+
+// Same signal name at the same address in the running device, -1 when it is new or moved
+static int adopted_signal(const SignalTable* table, const SignalTable* old_table, int i) {
+    int j = signal_table_find(old_table, table->info[i].name);
+    return j >= 0 && old_table->address[j] == table->address[i] ? j : -1;
+}
+
+// Values, quality and pending writes of every signal that kept its name and address move to the reloaded device
+static void adopt_signals(DeviceIO* io, const DeviceIO* old) {
+    ModbusDevice* dev = io->device;
+    const ModbusDevice* prev = old->device;
+    int* block_of = read_block_index(dev, false);
+    int* old_block_of = read_block_index(prev, false);
+    int* register_block_of = read_block_index(dev, true);
+    int* old_register_block_of = read_block_index(prev, true);
+    if (!block_of || !old_block_of || !register_block_of || !old_register_block_of) {
+        free(block_of);
+        free(old_block_of);
+        free(register_block_of);
+        free(old_register_block_of);
+        return;
+    }
+    for (int b = 0; b < dev->read_block_count; b++) io->block_ok_ns[b] = -1;
+
+    for (int i = 0; i < dev->inputs.count; i++) {
+        int j = adopted_signal(&dev->inputs, &prev->inputs, i);
+        adopt_read(io, old, block_of, old_block_of, dev->inputs.read_offset[i], j >= 0 ? prev->inputs.read_offset[j] : -1, false);
+        if (j < 0) continue;
+        signal_bit_set(dev->inputs.value, i, signal_bit(prev->inputs.value, j));
+        signal_bit_set(dev->inputs.quality, i, signal_bit(prev->inputs.quality, j));
+        signal_bit_set(io->ev_inputs, i, signal_bit(old->ev_inputs, j));
+        signal_bit_set(io->ev_input_quality, i, signal_bit(old->ev_input_quality, j));
+    }
+
+    bool dirty = false;
+    for (int i = 0; i < dev->outputs.count; i++) {
+        int j = adopted_signal(&dev->outputs, &prev->outputs, i);
+        adopt_read(io, old, block_of, old_block_of, dev->outputs.read_offset[i], j >= 0 ? prev->outputs.read_offset[j] : -1, false);
+        if (j < 0) continue;
+
+        bool value = signal_bit(prev->outputs.value, j);
+        bool slave = signal_bit(old->io_slave, j);
+        signal_bit_set(dev->outputs.value, i, value);
+        signal_bit_set(dev->outputs.quality, i, signal_bit(prev->outputs.quality, j));
+        signal_bit_set(io->io_slave, i, slave);
+        signal_bit_set(io->io_known, i, signal_bit(old->io_known, j));
+        signal_bit_set(io->ev_outputs, i, signal_bit(old->ev_outputs, j));
+        signal_bit_set(io->ev_output_quality, i, signal_bit(old->ev_output_quality, j));
+
+        // An output the draw thread changed and the slave has not confirmed yet is written again
+        if (signal_bit(old->draw_dirty, j)) {
+            signal_bit_set(io->draw_dirty, i, true);
+            io->draw_change_seq[i] = 1;
+            signal_bit_set(io->io_desired, i, value);
+            signal_bit_set(io->io_pending, i, !signal_bit(io->io_known, i) || value != slave);
+            dirty = true;
+        }
+    }
+
+    // Registers also have to keep their function, layout and scaling
+    RegisterTable* registers = &dev->registers;
+    const RegisterTable* old_registers = &prev->registers;
+    for (int i = 0; i < registers->signals.count; i++) {
+        int j = adopted_signal(&registers->signals, &old_registers->signals, i);
+        if (j >= 0 && (registers->format[i].function != old_registers->format[j].function ||
+                       !register_same_layout(registers->format[i], old_registers->format[j]) ||
+                       registers->scale[i] != old_registers->scale[j] || registers->offset[i] != old_registers->offset[j])) j = -1;
+        for (int k = 0; k < registers->format[i].width; k++) {
+            adopt_read(io, old, register_block_of, old_register_block_of, registers->signals.read_offset[i] + k,
+                       j >= 0 ? old_registers->signals.read_offset[j] + k : -1, true);
+        }
+        if (j < 0) continue;
+
+        registers->raw[i] = old_registers->raw[j];
+        registers->value[i] = old_registers->value[j];
+        signal_bit_set(registers->signals.quality, i, signal_bit(old_registers->signals.quality, j));
+        io->reg_slave[i] = old->reg_slave[j];
+        signal_bit_set(io->reg_known, i, signal_bit(old->reg_known, j));
+        if (signal_bit(old->draw_reg_dirty, j)) {
+            signal_bit_set(io->draw_reg_dirty, i, true);
+            io->draw_reg_change_seq[i] = 1;
+            io->reg_desired[i] = registers->raw[i];
+            signal_bit_set(io->reg_pending, i, !signal_bit(io->reg_known, i) || registers->raw[i] != io->reg_slave[i]);
+            dirty = true;
+        }
+    }
+    if (dirty) io->draw_publish_seq = io->io_collected_seq = 1;
+
+    for (int b = 0; b < dev->read_block_count; b++) {
+        if (io->block_ok_ns[b] < 0) io->block_ok_ns[b] = 0;
+    }
+    io->draw_link = old->draw_link;
+    free(block_of);
+    free(old_block_of);
+    free(register_block_of);
+    free(old_register_block_of);
+}
+
+// Open connection of the running device is kept by its reloaded version, in_flight is 0 at this point
+static void adopt_connection(DeviceIO* io, DeviceIO* old) {
+    int window = io->client.window;
+    long long timeout_ns = io->client.timeout_ns;
+    int retries = io->client.retries;
+    io->client = old->client;
+    io->client.window = window;
+    io->client.timeout_ns = timeout_ns;
+    io->client.retries = retries;
+    old->client.fd = -1;
+    old->client.state = MODBUS_TCP_CLOSED;
+
+    atomic_store(&io->connected, atomic_load(&old->connected));
+    io->stable = old->stable;
+    io->backoff_ms = old->backoff_ms;
+    io->seed = old->seed;
+    io->retry_ns = old->retry_ns;
+    io->connect_deadline_ns = old->connect_deadline_ns;
+    io->timeouts = old->timeouts;
+    io->events = old->events;
+    if (io->events) {
+        struct epoll_event ev = { .events = io->events, .data.ptr = io };
+        epoll_ctl(io_epoll, EPOLL_CTL_MOD, io->client.fd, &ev);
+    }
+    memcpy(io->gw_collected, old->gw_collected, sizeof(io->gw_collected));
+    memcpy(io->gw_applied, old->gw_applied, sizeof(io->gw_applied));
+    adopt_signals(io, old);
+    io->publish_due = true;
+}
+
+static DeviceIO* find_device_io(const char* name) {
+    for (int d = 0; d < device_io_count; d++) {
+        if (strcmp(device_io[d].device->name, name) == 0) return &device_io[d];
+    }
+    return NULL;
+}
+
+// Event ids number the inputs and then the outputs of every device in config order
+static void assign_signal_ids(void) {
+    signal_total = 0;
+    for (int d = 0; d < device_io_count; d++) {
+        device_io[d].signal_base = signal_total;
+        signal_total += device_io[d].device->inputs.count + device_io[d].device->outputs.count;
+    }
+}
+
+// Table and index of an event id, false for ids outside the current config
+static bool signal_of_id(int signal, const SignalTable** table, int* index) {
+    for (int d = 0; d < device_io_count; d++) {
+        const ModbusDevice* dev = device_io[d].device;
+        int i = signal - device_io[d].signal_base;
+        if (i >= 0 && i < dev->inputs.count) {
+            *table = &dev->inputs;
+            *index = i;
+            return true;
+        }
+        i -= dev->inputs.count;
+        if (i >= 0 && i < dev->outputs.count) {
+            *table = &dev->outputs;
+            *index = i;
+            return true;
+        }
+    }
+    return false;
 }
 
-// Config file loaded
-ModbusConfig* load_config(const char* filename) {
-    FILE* file = fopen(filename, "r");
-    ModbusConfig* cfg = malloc(sizeof(ModbusConfig));
-    if (!cfg) {
-        write_log("ERROR: Memory allocation failed for config");
-        if (file) fclose(file);
-        return NULL;
+// Event id of a mapped signal, -1 for unknown names. Ids stay valid until the next config reload.
+int modbus_signal_id(const char* name) {
+    for (int d = 0; d < device_io_count; d++) {
+        const ModbusDevice* dev = device_io[d].device;
+        int i = signal_table_find(&dev->inputs, name);
+        if (i >= 0) return device_io[d].signal_base + i;
+        i = signal_table_find(&dev->outputs, name);
+        if (i >= 0) return device_io[d].signal_base + dev->inputs.count + i;
     }
+    return -1;
+}
 
-    // Initialize all values including max addresses
-    memset(cfg, 0, sizeof(ModbusConfig));
-    strcpy(cfg->server_ip, DEFAULT_IP);
-    cfg->port = DEFAULT_PORT;
-    cfg->slave_id = DEFAULT_SLAVE_ID;
-    cfg->max_input_address = 0;
-    cfg->max_output_address = 0;
+const char* modbus_signal_name(int signal) {
+    const SignalTable* table;
+    int i;
+    return signal_of_id(signal, &table, &i) ? table->info[i].name : NULL;
+}
 
-    // If no config file, return with default values
-    if (!file) {
-        FILE* new_file = fopen(filename, "w");
-        if (new_file) {
-            fprintf(new_file, "[ModbusConfig]\nserver_ip=%s\nport=%d\nslave_id=%d\n\n", 
-                    DEFAULT_IP, DEFAULT_PORT, DEFAULT_SLAVE_ID);
-            fclose(new_file);
-            write_log("Default config file created");
-        } else {
-            write_log("ERROR: Unable to create default config file");
-        }
-        return cfg;
+int modbus_signal_count(void) {
+    return signal_total;
+}
+
+// History ring of a mapping, valid until the next config reload, -1 when the history is off or there is no such name
+int modbus_history_id(const char* name) {
+    if (!history.header) return -1;
+    for (int d = 0; d < device_io_count; d++) {
+        const ModbusDevice* dev = device_io[d].device;
+        int i = signal_table_find(&dev->inputs, name);
+        if (i >= 0) return device_io[d].history_base + i;
+        i = signal_table_find(&dev->outputs, name);
+        if (i >= 0) return device_io[d].history_base + dev->inputs.count + i;
+        i = signal_table_find(&dev->registers.signals, name);
+        if (i >= 0) return device_io[d].history_base + dev->inputs.count + dev->outputs.count + i;
     }
+    return -1;
+}
 
-    char line[MAX_LINE];
-    int section = 0; // 0: ModbusConfig, 1: InputMappings, 2: OutputMappings
+// Value of a signal at a CLOCK_REALTIME time, NAN while its quality was bad. False when the history does
+// not go back that far.
+bool modbus_history_value(int id, long long time_ns, double* value) {
+    return history_value_at(&history, id, time_ns, value);
+}
 
-    while (fgets(line, MAX_LINE, file)) {
-        line[strcspn(line, "\r\n")] = 0;
-        
-        if (line[0] == '[') {
-            if (strstr(line, "[ModbusConfig]")) section = 0;
-            else if (strstr(line, "[InputMappings]")) section = 1;
-            else if (strstr(line, "[OutputMappings]")) section = 2;
+// Transitions of a signal between two CLOCK_REALTIME times, oldest first, returns the number copied
+int modbus_history_window(int id, long long from_ns, long long to_ns, HistoryEntry* entries, int max_entries) {
+    return history_window(&history, id, from_ns, to_ns, entries, max_entries);
+}
+
+// Value and quality of a signal as last applied by the draw thread, false for unknown ids
+bool modbus_signal_value(int signal, bool* value, bool* quality) {
+    const SignalTable* table;
+    int i;
+    if (!signal_of_id(signal, &table, &i)) return false;
+    if (value) *value = signal_bit(table->value, i);
+    if (quality) *quality = signal_bit(table->quality, i);
+    return true;
+}
+
+// Subscriptions are linked to the current ids again, names unknown to this config wait for a reload
+static void link_subscriptions(void) {
+    int* heads = realloc(subscription_head, (signal_total + 1) * sizeof(int));
+    if (!heads) {
+        write_log("ERROR: Memory allocation failed for event subscriptions");
+        return;
+    }
+    subscription_head = heads;
+    for (int i = 0; i < signal_total; i++) heads[i] = -1;
+    subscription_all = -1;
+
+    // Linked back to front so callbacks of one signal run in the order they subscribed
+    for (int s = subscription_count - 1; s >= 0; s--) {
+        EventSubscription* sub = &subscriptions[s];
+        sub->next = -1;
+        if (!sub->callback) continue;
+        if (!sub->name[0]) {
+            sub->next = subscription_all;
+            subscription_all = s;
             continue;
         }
+        int id = modbus_signal_id(sub->name);
+        if (id < 0) continue;
+        sub->next = heads[id];
+        heads[id] = s;
+    }
+}
+
+// Callback for changes of one signal, or of every signal when name is NULL. Callbacks run on the draw
+// thread from update_modbus_values, read_modbus_values or modbus_dispatch_events.
+bool modbus_subscribe(const char* name, ModbusChangeCallback callback, void* user) {
+    if (!callback || (name && strlen(name) >= SIGNAL_NAME_SIZE)) return false;
+    if (subscription_count == subscription_capacity) {
+        int capacity = subscription_capacity ? subscription_capacity * 2 : SIGNAL_MIN_CAPACITY;
+        EventSubscription* grown = realloc(subscriptions, capacity * sizeof(EventSubscription));
+        if (!grown) {
+            write_log("ERROR: Memory allocation failed for event subscriptions");
+            return false;
+        }
+        subscriptions = grown;
+        subscription_capacity = capacity;
+    }
 
-        if (line[0] == '\0' || line[0] == ';') continue;
+    EventSubscription* sub = &subscriptions[subscription_count++];
+    strcpy(sub->name, name ? name : "");
+    sub->callback = callback;
+    sub->user = user;
+    sub->next = -1;
+    if (config && name && modbus_signal_id(name) < 0) write_log("WARNING: Subscription to unknown signal %s", name);
+    link_subscriptions();
+    return true;
+}
 
-        char key[50], value[50];
-        if (sscanf(line, "%[^=]=%[^\n]", key, value) == 2) {
-            char* k = key;
-            while (*k == ' ') k++;
-            char* v = value;
-            while (*v == ' ') v++;
+// Cleared slots are dropped and the rest keep their order, false when there was none
+static bool compact_subscriptions(void) {
+    int kept = 0;
+    for (int s = 0; s < subscription_count; s++) {
+        if (subscriptions[s].callback) subscriptions[kept++] = subscriptions[s];
+    }
+    bool dropped = kept < subscription_count;
+    subscription_count = kept;
+    return dropped;
+}
 
-            switch(section) {
-                case 0: // ModbusConfig
-                    if (strcmp(k, "server_ip") == 0) strcpy(cfg->server_ip, v);
-                    else if (strcmp(k, "port") == 0) cfg->port = atoi(v);
-                    else if (strcmp(k, "slave_id") == 0) cfg->slave_id = atoi(v);
-                    break;
- 
-                case 1: // InputMappings
-                    if (cfg->input_count < MAX_MAPPINGS) {
-                        int address = atoi(v);
-                        strcpy(cfg->input_mappings[cfg->input_count].name, k);
-                        cfg->input_mappings[cfg->input_count].address = address;
-                        // Update max input address
-                        if (address > cfg->max_input_address) {
-                            cfg->max_input_address = address;
-                        }
-                        write_log("Added input mapping: %s = %d", k, address);
-                        cfg->input_count++;
-                    }
-                    break;
+// A callback may unsubscribe, its slot is then only cleared and dropped once the dispatch is over
+void modbus_unsubscribe(const char* name, ModbusChangeCallback callback, void* user) {
+    for (int s = 0; s < subscription_count; s++) {
+        EventSubscription* sub = &subscriptions[s];
+        if (sub->callback == callback && sub->user == user && strcmp(sub->name, name ? name : "") == 0) {
+            sub->callback = NULL;
+        }
+    }
+    if (!dispatching) compact_subscriptions();
+    link_subscriptions();
+}
 
-                case 2: // OutputMappings
-                    if (cfg->output_count < MAX_MAPPINGS) {
-                        int address = atoi(v);
-                        strcpy(cfg->output_mappings[cfg->output_count].name, k);
-                        cfg->output_mappings[cfg->output_count].address = address;
-                        // Update max output address
-                        if (address > cfg->max_output_address) {
-                            cfg->max_output_address = address;
-                        }
-                        write_log("Added output mapping: %s = %d", k, address);
-                        cfg->output_count++;
-                    }
-                    break;
+// Queued change events are copied out, the first call turns events on and starts with a resync
+int modbus_poll_events(ModbusChangeEvent* events, int max_events) {
+    if (!event_queue_ready || max_events <= 0) return 0;
+    int n = 0;
+    if (!atomic_exchange(&events_wanted, true)) {
+        ModbusChangeEvent resync = { MODBUS_EVENT_RESYNC, false, false, false, false, io_now_ns() };
+        events[n++] = resync;
+    }
+    return n + event_queue_take(&event_queue, events + n, max_events - n);
+}
+
+static void dispatch_event(const ModbusChangeEvent* event) {
+    // A resync goes to every subscriber, each one reads back the signals it follows
+    if (event->signal == MODBUS_EVENT_RESYNC) {
+        for (int s = 0; s < subscription_count; s++) {
+            if (subscriptions[s].callback) subscriptions[s].callback(event, subscriptions[s].user);
+        }
+        return;
+    }
+    // The next link is taken before the callback, which may unsubscribe and relink the lists
+    for (int s = subscription_all, next; s >= 0; s = next) {
+        next = subscriptions[s].next;
+        if (subscriptions[s].callback) subscriptions[s].callback(event, subscriptions[s].user);
+    }
+    if (event->signal >= signal_total) return;
+    for (int s = subscription_head[event->signal], next; s >= 0; s = next) {
+        next = subscriptions[s].next;
+        if (subscriptions[s].callback) subscriptions[s].callback(event, subscriptions[s].user);
+    }
+}
+
+// Queued events are handed to the subscribed callbacks, returns the number of events
+int modbus_dispatch_events(void) {
+    ModbusChangeEvent batch[MODBUS_EVENT_BATCH];
+    int total = 0;
+    int n;
+    bool outer = dispatching;
+    dispatching = true;
+    do {
+        n = modbus_poll_events(batch, MODBUS_EVENT_BATCH);
+        for (int i = 0; i < n; i++) dispatch_event(&batch[i]);
+        total += n;
+    } while (n == MODBUS_EVENT_BATCH);
+    dispatching = outer;
+    if (!dispatching && compact_subscriptions()) link_subscriptions();
+    return total;
+}
+
+// History rings follow the devices in config order, inputs, outputs and registers of each. Rings of
+// previous, or of the history file when previous is NULL, carry their entries over by name.
+static void history_begin(const ModbusHistory* previous) {
+    if (config->history_depth == 0) return;
+    int total = 0;
+    for (int d = 0; d < device_io_count; d++) {
+        const ModbusDevice* dev = device_io[d].device;
+        device_io[d].history_base = total;
+        total += dev->inputs.count + dev->outputs.count + dev->registers.signals.count;
+    }
+    HistoryRing* rings = calloc(total + 1, sizeof(HistoryRing));
+    if (!rings) {
+        write_log("ERROR: Memory allocation failed for history");
+        return;
+    }
+    for (int d = 0; d < device_io_count; d++) {
+        const ModbusDevice* dev = device_io[d].device;
+        const SignalTable* tables[] = { &dev->inputs, &dev->outputs, &dev->registers.signals };
+        HistoryRing* ring = &rings[device_io[d].history_base];
+        for (int t = 0; t < 3; t++) {
+            for (int i = 0; i < tables[t]->count; i++, ring++) {
+                snprintf(ring->device, sizeof(ring->device), "%s", dev->name);
+                snprintf(ring->name, sizeof(ring->name), "%s", tables[t]->info[i].name);
+                ring->kind = t;
+                ring->address = tables[t]->address[i];
             }
         }
     }
 
-    fclose(file);
-    write_log("Config loaded successfully.");
-    return cfg;
+    if (!history_open(&history, config->history_file, rings, total, config->history_depth, previous)) {
+        write_log("ERROR: Unable to open history %s: %s", config->history_file[0] ? config->history_file : "in memory",
+                  strerror(errno));
+    } else {
+        write_log("History of %d signals, %d transitions each, %s", total, config->history_depth,
+                  config->history_file[0] ? config->history_file : "in memory");
+    }
+    free(rings);
 }
 
-// Modbus names and adresses are matched with program variables
-void init_mappings(CONTEXT_STRUCT_NAME *context) {
-    for (int i = 0; i < config->input_count; i++) {
-        // Max adress value is found
-        if(config->input_mappings[i].address > config->max_input_address) config->max_input_address = config->input_mappings[i].address;
-        // Modbus Input Mappings Adress and Name Pointer Assignments
-        if (strcmp(config->input_mappings[i].name, "out_RT01_Accept") == 0) config->input_mappings[i].struct_ptr = &context->out_RT01_Accept;
-        if (strcmp(config->input_mappings[i].name, "out_RT01_Reject") == 0) config->input_mappings[i].struct_ptr = &context->out_RT01_Reject;
-        if (strcmp(config->input_mappings[i].name, "out_RT01_RejectAck") == 0) config->input_mappings[i].struct_ptr = &context->out_RT01_RejectAck;
-        if (strcmp(config->input_mappings[i].name, "out_RT01_Request") == 0) config->input_mappings[i].struct_ptr = &context->out_RT01_Request;
-        if (strcmp(config->input_mappings[i].name, "out_RT01_Reserve") == 0) config->input_mappings[i].struct_ptr = &context->out_RT01_Reserve;
-    }
-    
-    for (int i = 0; i < config->output_count; i++) {
-        // Max adress value is found
-        if(config->output_mappings[i].address > config->max_output_address) config->max_output_address = config->output_mappings[i].address;
-        //Modbus Output Mappings Adress and Name Pointer Assignments
-        if (strcmp(config->output_mappings[i].name, "in_RT01_RejectAck") == 0) config->output_mappings[i].struct_ptr = &context->in_RT01_RejectAck;
-        if (strcmp(config->output_mappings[i].name, "in_RT01_Request") == 0) config->output_mappings[i].struct_ptr = &context->in_RT01_Request;
-        if (strcmp(config->output_mappings[i].name, "in_TC03_I_Occupied_hws") == 0) config->output_mappings[i].struct_ptr = &context->in_TC03_I_Occupied_hws;
-        if (strcmp(config->output_mappings[i].name, "in_RT02_RejectAck") == 0) config->output_mappings[i].struct_ptr = &context->in_RT02_RejectAck;
-        if (strcmp(config->output_mappings[i].name, "in_RT02_Request") == 0) config->output_mappings[i].struct_ptr = &context->in_RT02_Request;
+// Pending config replaces the running one while the I/O thread is parked, devices whose server did not
+// change keep their connection
+static void swap_config(CONTEXT_STRUCT_NAME *context) {
+    ModbusConfig* next = atomic_load(&pending_config);
+    DeviceIO* next_io = calloc(next->device_count, sizeof(DeviceIO));
+    bool ok = next_io != NULL;
+    for (int d = 0; d < next->device_count && ok; d++) {
+        ok = init_device_io(&next_io[d], next, &next->devices[d], d);
     }
-    write_log("Modbus Input and Output Mappings initialized.");
+
+    if (!ok) {
+        write_log("ERROR: Memory allocation failed for reloaded config, keeping the running config");
+        for (int d = 0; next_io && d < next->device_count; d++) free_cycle_buffers(&next_io[d]);
+        free(next_io);
+        free_config(next);
+    } else {
+        if (next->gateway_mode != config->gateway_mode || strcmp(next->gateway_name, config->gateway_name) != 0) {
+            write_log("WARNING: gateway_mode and gateway_name changes need a restart");
+            next->gateway_mode = config->gateway_mode;
+            strcpy(next->gateway_name, config->gateway_name);
+        }
+        if (next->server_port != config->server_port || next->server_max_clients != config->server_max_clients ||
+            strcmp(next->server_bind, config->server_bind) != 0) {
+            write_log("WARNING: server_port, server_bind and server_max_clients changes need a restart");
+            next->server_port = config->server_port;
+            next->server_max_clients = config->server_max_clients;
+            strcpy(next->server_bind, config->server_bind);
+        }
+        if (strcmp(next->capture_file, config->capture_file) != 0 || strcmp(next->replay_file, config->replay_file) != 0 ||
+            next->replay_speed != config->replay_speed) {
+            write_log("WARNING: capture_file, replay_file and replay_speed changes need a restart");
+            strcpy(next->capture_file, config->capture_file);
+            strcpy(next->replay_file, config->replay_file);
+            next->replay_speed = config->replay_speed;
+        }
+        bind_config(next, context);
+        atomic_store(&metrics->device_count, next->device_count < METRICS_MAX_DEVICES ? next->device_count : METRICS_MAX_DEVICES);
+        int kept = 0;
+        for (int d = 0; d < next->device_count; d++) {
+            const ModbusDevice* dev = &next->devices[d];
+            DeviceIO* old = find_device_io(dev->name);
+            if (!old || strcmp(old->device->server_ip, dev->server_ip) != 0 ||
+                old->device->port != dev->port || old->device->slave_id != dev->slave_id ||
+                old->device->transport != dev->transport) continue;
+            adopt_connection(&next_io[d], old);
+            kept++;
+        }
+
+        for (int d = 0; d < device_io_count; d++) {
+            DeviceIO* io = &device_io[d];
+            if (io->client.fd >= 0) {
+                modbus_tcp_close(&io->client, NULL, NULL);
+                write_log("Modbus connection to %s closed", io->device->name);
+            }
+            free_cycle_buffers(io);
+        }
+        free(device_io);
+        free_config(config);
+        config = next;
+        device_io = next_io;
+        device_io_count = next->device_count;
+        log_configure(config->log_level, config->log_format, config->log_rate);
+
+        // Event ids follow the new mappings, consumers start over from a resync
+        assign_signal_ids();
+        link_subscriptions();
+        if (event_queue_ready) event_queue_reset(&event_queue, io_now_ns());
+        ModbusHistory previous = history;
+        history_begin(&previous);
+        history_close(&previous);
+        gateway_assign_devices();
+        capture_devices();
+        write_log("Config reloaded, %d devices, %d connections kept", device_io_count, kept);
+    }
+
+    atomic_store(&pending_config, NULL);
+    atomic_store(&io_parked, false);
+    uint64_t one = 1;
+    if (write(io_wake, &one, sizeof(one)) < 0) write_log("ERROR: Unable to wake Modbus I/O thread");
 }
 
-// Modbus connection is established
-bool init_modbus_communication(CONTEXT_STRUCT_NAME *context) {
-    // Check if we should skip connection attempt
-    time_t current_time = time(NULL);
-    if (connection_failed && (current_time - last_connection_attempt < CONNECTION_RETRY_INTERVAL)) {
+// Client: gateway slot of every device, looked up by name whenever the gateway config changes
+static void gateway_resolve_devices(void) {
+    gateway_generation = atomic_load_explicit(&gateway->generation, memory_order_acquire);
+    int count = (int)atomic_load(&gateway->device_count);
+    if (count > GATEWAY_MAX_DEVICES) count = GATEWAY_MAX_DEVICES;
+    for (int d = 0; d < device_io_count; d++) {
+        DeviceIO* io = &device_io[d];
+        io->gw_slot = -1;
+        for (int g = 0; g < count && io->gw_slot < 0; g++) {
+            if (strncmp(gateway->devices[g].name, io->device->name, GATEWAY_NAME_SIZE) == 0) io->gw_slot = g;
+        }
+        if (io->gw_slot < 0) write_log("WARNING: Gateway %s has no device %s", gateway_shm, io->device->name);
+        io->gw_seq = 1; // Odd, never equal to the seq of a finished image
+        io->gw_backlog = true;
+    }
+}
+
+// Client: segment is attached and a write queue taken, tried again every GATEWAY_TIMEOUT_MS while the gateway is missing
+static bool gateway_client_attach(long long now) {
+    if (now < gateway_retry_ns) return false;
+    gateway_retry_ns = now + GATEWAY_TIMEOUT_MS * 1000000LL;
+
+    gateway = gateway_attach(config->gateway_name);
+    int err = gateway ? 0 : errno;
+    if (gateway && now - atomic_load(&gateway->heartbeat_ns) > GATEWAY_TIMEOUT_MS * 1000000LL) {
+        gateway_detach(gateway);
+        gateway = NULL;
+    }
+    if (!gateway) {
+        if (!gateway_missing && err == EACCES) {
+            write_log("WARNING: No access to gateway %s, signals stay bad; the user must be in its gateway_group",
+                      config->gateway_name);
+        } else if (!gateway_missing) {
+            write_log("WARNING: No gateway running at %s, signals stay bad", config->gateway_name);
+        }
+        gateway_missing = true;
         return false;
     }
+    gateway_client = gateway_claim_client(gateway);
+    if (gateway_client < 0) {
+        write_log("ERROR: Gateway %s has no free client slot", config->gateway_name);
+        gateway_detach(gateway);
+        gateway = NULL;
+        return false;
+    }
+    strcpy(gateway_shm, config->gateway_name);
+    if (gateway_sock < 0) gateway_sock = gateway_wake_open(gateway_shm, false);
 
-    if (config == NULL) {
-        config = load_config(CONFIG_FILE);
-        if (config == NULL) {
-            write_log("ERROR: Failed to load config");
-            return false;
+    // Write seqs continue after those of the slot's last owner, which the gateway may still count as applied
+    uint64_t next_seq = atomic_load(&gateway->clients[gateway_client].next_seq);
+    for (int d = 0; d < device_io_count; d++) {
+        if (device_io[d].draw_publish_seq < next_seq) device_io[d].draw_publish_seq = next_seq;
+    }
+    gateway_resolve_devices();
+    gateway_missing = false;
+    write_log("Attached to gateway %s as client %d", gateway_shm, gateway_client);
+    return true;
+}
+
+// Client: outputs in bits are queued as coil writes, a full queue leaves them for the next cycle
+static bool gateway_queue_writes(DeviceIO* io, const SignalWord* bits) {
+    const SignalTable* outputs = &io->device->outputs;
+    int words = SIGNAL_WORDS(outputs->count);
+    GatewayClient* client = &gateway->clients[gateway_client];
+    bool queued = false;
+    io->gw_backlog = false;
+    for (int i = signal_bitset_next(bits, words, 0); i >= 0; i = signal_bitset_next(bits, words, i + 1)) {
+        GatewayWrite write = { gateway_generation, (uint16_t)io->gw_slot, outputs->address[i],
+                               io->draw_change_seq[i], signal_bit(outputs->value, i) };
+        if (!gateway_push_write(client, &write)) {
+            io->gw_backlog = true;
+            break;
         }
+        queued = true;
+    }
+    return queued;
+}
+
+// Client: the gateway is checked once per cycle, attached again after a restart and followed through reloads
+static void gateway_client_sync(long long now) {
+    if (gateway && now - atomic_load_explicit(&gateway->heartbeat_ns, memory_order_relaxed) > GATEWAY_TIMEOUT_MS * 1000000LL) {
+        write_log("ERROR: Gateway %s stopped, signals are bad until it is back", gateway_shm);
+        gateway_release_client(gateway, gateway_client);
+        gateway_detach(gateway);
+        gateway = NULL;
+        gateway_client = -1;
+        gateway_missing = true;
+        gateway_retry_ns = now;
+    }
+    if (!gateway && !gateway_client_attach(now)) return;
+    if (atomic_load_explicit(&gateway->generation, memory_order_acquire) != gateway_generation) gateway_resolve_devices();
+
+    bool queued = false;
+    for (int d = 0; d < device_io_count; d++) {
+        DeviceIO* io = &device_io[d];
+        if (io->gw_backlog && io->gw_slot >= 0 && gateway_queue_writes(io, io->draw_dirty)) queued = true;
     }
+    if (queued) gateway_wake(gateway_sock, gateway_shm);
+}
 
-    if (ctx != NULL) return true;  // Zaten bağlı
+// Client: address bits of a gateway slot are packed into signal order
+static void gateway_pack(const GatewayWord* bits, const SignalTable* table, SignalWord* out) {
+    int words = SIGNAL_WORDS(table->count);
+    for (int w = 0; w < words; w++) {
+        const uint16_t* address = table->address + w * SIGNAL_WORD_BITS;
+        int n = table->count - w * SIGNAL_WORD_BITS;
+        if (n > SIGNAL_WORD_BITS) n = SIGNAL_WORD_BITS;
 
-    ctx = modbus_new_tcp(config->server_ip, config->port);
-    if (ctx == NULL) {
-        connection_failed = true;
-        last_connection_attempt = current_time;
-        write_log("ERROR: Failed to create modbus context");
-        return false;
+        SignalWord word = 0;
+        for (int b = 0; b < n; b++) word |= (SignalWord)gateway_bit(bits, address[b]) << b;
+        out[w] = word;
+    }
+}
+
+// Client: newest gateway image of a device becomes its next input image, as if the I/O thread had published it
+static void gateway_client_pull(DeviceIO* io, long long now) {
+    const ModbusDevice* dev = io->device;
+    ModbusImage* image = image_buffer_back(&io->input_buffer);
+    const GatewayDevice* slot = gateway && io->gw_slot >= 0 ? &gateway->devices[io->gw_slot] : NULL;
+
+    if (!slot) {
+        // Without a gateway every signal turns bad once and keeps its last value
+        if (io->gw_seq == 0) return;
+        memcpy(image->inputs, dev->inputs.value, SIGNAL_WORDS(dev->inputs.count) * sizeof(SignalWord));
+        memcpy(image->outputs, dev->outputs.value, SIGNAL_WORDS(dev->outputs.count) * sizeof(SignalWord));
+        memset(image->input_quality, 0, SIGNAL_WORDS(dev->inputs.count) * sizeof(SignalWord));
+        memset(image->output_quality, 0, SIGNAL_WORDS(dev->outputs.count) * sizeof(SignalWord));
+        image->link = false;
+        image->seq = 0;
+        io->gw_seq = 0;
+    } else {
+        uint64_t seq = gateway_read_begin(slot);
+        if (seq == io->gw_seq) return;
+        int tries = 0;
+        do {
+            if (tries++ == GATEWAY_READ_TRIES) return;
+            seq = gateway_read_begin(slot);
+            gateway_pack(slot->inputs, &dev->inputs, image->inputs);
+            gateway_pack(slot->input_quality, &dev->inputs, image->input_quality);
+            gateway_pack(slot->coils, &dev->outputs, image->outputs);
+            gateway_pack(slot->coil_quality, &dev->outputs, image->output_quality);
+            image->link = atomic_load_explicit(&slot->link, memory_order_relaxed) != 0;
+            image->seq = atomic_load_explicit(&slot->applied[gateway_client], memory_order_relaxed);
+        } while (gateway_read_retry(slot, seq));
+        io->gw_seq = seq;
+    }
+    atomic_store(&io->connected, image->link);
+    io_emit_events(io, image, now);
+    io_record_history(io, image);
+    image_buffer_publish(&io->input_buffer);
+}
+
+static bool replay_bit(const uint64_t* bits, int address) {
+    return (bits[address / 64] >> (address % 64)) & 1u;
+}
+
+// Replay: recorded values of a range of addresses, they turn good and a change is published with the next image
+static void replay_store(DeviceIO* io, uint64_t* bits, uint64_t* good, int start, int count, const uint8_t* values) {
+    for (int k = 0; k < count && start + k < MODBUS_ADDRESS_COUNT; k++) {
+        int address = start + k;
+        uint64_t mask = (uint64_t)1 << (address % 64);
+        uint64_t value = values[k] ? mask : 0;
+        if ((bits[address / 64] & mask) != value || !(good[address / 64] & mask)) io->rp_changed = true;
+        bits[address / 64] = (bits[address / 64] & ~mask) | value;
+        good[address / 64] |= mask;
+    }
+}
+
+// Replay: answered request becomes the slave state, exceptions and unanswered requests change nothing
+static void replay_response(DeviceIO* io, const ReplayRequest* request, const uint8_t* pdu, int pdu_size) {
+    const uint8_t* req = request->pdu;
+    if (pdu_size == 0 || request->size < 5 || pdu[0] != req[0]) return;
+    int start = modbus_get_u16(req + 1);
+    int count = modbus_get_u16(req + 3);
+    uint8_t bits[MODBUS_MAX_READ_BITS];
+
+    switch (req[0]) {
+        case MODBUS_FC_READ_DISCRETE_INPUTS:
+        case MODBUS_FC_READ_COILS:
+            if (count > MODBUS_MAX_READ_BITS || !modbus_pdu_unpack_bits(pdu, pdu_size, count, bits)) return;
+            if (req[0] == MODBUS_FC_READ_COILS) replay_store(io, io->rp_coils, io->rp_coil_good, start, count, bits);
+            else replay_store(io, io->rp_inputs, io->rp_input_good, start, count, bits);
+            break;
+        case MODBUS_FC_WRITE_SINGLE_COIL:
+            bits[0] = req[3] == 0xFF;
+            replay_store(io, io->rp_coils, io->rp_coil_good, start, 1, bits);
+            break;
+        case MODBUS_FC_WRITE_MULTIPLE_COILS:
+            if (count > MODBUS_MAX_WRITE_BITS || request->size < 6 + (count + 7) / 8) return;
+            for (int k = 0; k < count; k++) bits[k] = (req[6 + k / 8] >> (k % 8)) & 1u;
+            replay_store(io, io->rp_coils, io->rp_coil_good, start, count, bits);
+            break;
+        default:
+            return;
+    }
+    if (!io->rp_link) io->rp_link = io->rp_changed = true;
+}
+
+// Replay: a lost link turns every recorded value bad until it is read again
+static void replay_link(DeviceIO* io, bool link) {
+    io->rp_link = link;
+    io->rp_changed = true;
+    if (link) return;
+    memset(io->rp_input_good, 0, REPLAY_WORDS * sizeof(uint64_t));
+    memset(io->rp_coil_good, 0, REPLAY_WORDS * sizeof(uint64_t));
+}
+
+// Replay: one record is applied, true when it was a recorded answer
+static bool replay_apply(const CaptureRecord* record) {
+    int c = record->device;
+    DeviceIO* io = replay_map[c] >= 0 ? &device_io[replay_map[c]] : NULL;
+    ReplayRequest* request = &replay_pending[c][record->id % MODBUS_TCP_MAX_WINDOW];
+
+    switch (record->type) {
+        case CAPTURE_RUN:
+            // Devices of a new run start disconnected and are described again
+            for (int d = 0; d < CAPTURE_MAX_DEVICES; d++) replay_map[d] = -1;
+            memset(replay_pending, 0, CAPTURE_MAX_DEVICES * sizeof(replay_pending[0]));
+            for (int d = 0; d < device_io_count; d++) {
+                if (device_io[d].rp_link) replay_link(&device_io[d], false);
+            }
+            break;
+        case CAPTURE_DEVICE: {
+            char name[SIGNAL_NAME_SIZE];
+            snprintf(name, sizeof(name), "%.*s", (int)strnlen((const char*)record->data, record->size),
+                     (const char*)record->data);
+            DeviceIO* found = find_device_io(name);
+            replay_map[c] = found ? (int)(found - device_io) : -1;
+            memset(replay_pending[c], 0, sizeof(replay_pending[c]));
+            break;
+        }
+        case CAPTURE_REQUEST:
+            request->used = true;
+            request->id = record->id;
+            request->size = record->size;
+            request->pdu = record->data;
+            break;
+        case CAPTURE_RESPONSE:
+            if (!request->used || request->id != record->id) break;
+            request->used = false;
+            if (io) replay_response(io, request, record->data, record->size);
+            return true;
+        case CAPTURE_CONNECT:
+            if (io) replay_link(io, true);
+            break;
+        case CAPTURE_DISCONNECT:
+            memset(replay_pending[c], 0, sizeof(replay_pending[c]));
+            if (io) replay_link(io, false);
+            break;
+        case CAPTURE_GAP: {
+            uint32_t lost = 0;
+            if (record->size >= sizeof(lost)) memcpy(&lost, record->data, sizeof(lost));
+            write_log("WARNING: Replay of %s skips %u records the capture lost", config->replay_file, lost);
+            break;
+        }
+    }
+    return false;
+}
+
+// Replay: records up to the replay clock are applied, at speed 0 up to the next recorded answer
+static void replay_advance(long long now) {
+    if (replay_finished) return;
+    long long clock = replay_first_ns + (now - replay_start_ns) * config->replay_speed;
+    CaptureRecord record;
+    for (;;) {
+        size_t used = replay_reader.used;
+        if (!capture_reader_next(&replay_reader, &record)) {
+            replay_finished = true;
+            write_log("Replay of %s finished after %lu records", config->replay_file, replay_records);
+            return;
+        }
+        // Every run of the capture continues right after the last record of the run before
+        if (record.type == CAPTURE_RUN) replay_offset_ns = replay_last_ns - record.time_ns;
+        long long at = record.time_ns + replay_offset_ns;
+        if (config->replay_speed > 0 && at > clock) {
+            replay_reader.used = used;
+            return;
+        }
+        if (at > replay_last_ns) replay_last_ns = at;
+        replay_records++;
+        if (replay_apply(&record) && config->replay_speed == 0) return;
+    }
+}
+
+// Replay: recorded address bits are packed into signal order
+static void replay_pack(const uint64_t* bits, const SignalTable* table, SignalWord* out) {
+    int words = SIGNAL_WORDS(table->count);
+    for (int w = 0; w < words; w++) {
+        const uint16_t* address = table->address + w * SIGNAL_WORD_BITS;
+        int n = table->count - w * SIGNAL_WORD_BITS;
+        if (n > SIGNAL_WORD_BITS) n = SIGNAL_WORD_BITS;
+
+        SignalWord word = 0;
+        for (int b = 0; b < n; b++) word |= (SignalWord)replay_bit(bits, address[b]) << b;
+        out[w] = word;
     }
+}
 
-    modbus_set_response_timeout(ctx, 0, MODBUS_TIMEOUT);
-    modbus_set_slave(ctx, config->slave_id);
+// Replay: recorded state of a device becomes its next input image, as if the I/O thread had published it.
+// Outputs follow the recording, changes made on the display are not sent anywhere.
+static void replay_pull(DeviceIO* io, long long now) {
+    if (!io->rp_changed) return;
+    const ModbusDevice* dev = io->device;
+    ModbusImage* image = image_buffer_back(&io->input_buffer);
+    replay_pack(io->rp_inputs, &dev->inputs, image->inputs);
+    replay_pack(io->rp_input_good, &dev->inputs, image->input_quality);
+    replay_pack(io->rp_coils, &dev->outputs, image->outputs);
+    replay_pack(io->rp_coil_good, &dev->outputs, image->output_quality);
+    image->link = io->rp_link;
+    image->seq = io->draw_publish_seq;
+    io->rp_changed = false;
+    atomic_store(&io->connected, image->link);
+    io_emit_events(io, image, now);
+    io_record_history(io, image);
+    image_buffer_publish(&io->input_buffer);
+}
 
-    if (modbus_connect(ctx) == -1) {
-        write_log("ERROR: Connection failed: %s", modbus_strerror(errno));
-        modbus_free(ctx);
-        ctx = NULL;
-        connection_failed = true;
-        last_connection_attempt = current_time;
+// Runtime state of every device of the running config, the I/O thread is not started here
+static bool start_device_io(void) {
+    device_io = calloc(config->device_count, sizeof(DeviceIO));
+    if (!device_io) {
+        write_log("ERROR: Memory allocation failed for devices");
+        stop_devices();
         return false;
     }
+    device_io_count = config->device_count;
+    for (int d = 0; d < device_io_count; d++) {
+        if (!init_device_io(&device_io[d], config, &config->devices[d], d)) {
+            write_log("ERROR: Memory allocation failed for cycle buffers");
+            stop_devices();
+            return false;
+        }
+    }
 
-    // Connection successful, reset failure flag
-    connection_failed = false;
+    if (!event_queue_ready) event_queue_ready = event_queue_init(&event_queue);
+    if (!event_queue_ready) write_log("ERROR: Memory allocation failed for change events");
+    assign_signal_ids();
+    link_subscriptions();
+    history_begin(NULL);
+    return true;
+}
 
-    // Add context parameter when calling init_mappings
-    init_mappings(context);
+// Register mappings only work with an I/O thread of this process
+static void warn_registers(const char* mode) {
+    for (int d = 0; d < config->device_count; d++) {
+        if (config->devices[d].registers.signals.count == 0) continue;
+        write_log("WARNING: Register mappings are not carried by the %s, they stay bad", mode);
+        return;
+    }
+}
 
-    write_log("Connected to Modbus server at %s:%d", config->server_ip, config->port);
+// Client has no I/O thread and no connection, its images come from the gateway on the draw thread
+static bool start_gateway_client(void) {
+    metrics_start(config);
+    server_start(config);
+    if (!start_device_io()) return false;
+    warn_registers("gateway");
+    client_running = true;
+    gateway_retry_ns = 0;
+    gateway_client_attach(io_now_ns());
+    write_log("Modbus gateway client started for %d devices", device_io_count);
     return true;
 }
 
+// Replay has no I/O thread and no connection, its images come from the capture on the draw thread
+static bool start_replay(void) {
+    metrics_start(config);
+    server_start(config);
+    if (!capture_reader_open(&replay_reader, config->replay_file)) {
+        write_log("ERROR: Unable to open replay file %s: %s", config->replay_file, strerror(errno));
+        return false;
+    }
+    if (!start_device_io()) return false;
 
-// Modbus values readed and assigned into struct
-bool read_modbus_values(CONTEXT_STRUCT_NAME *context) {
-    time_t current_time = time(NULL);
-    
-    // Check if 1 second has passed
-    if (current_time - last_read_time < 1) {
-        return true; // Use existing values
+    replay_pending = calloc(CAPTURE_MAX_DEVICES, sizeof(replay_pending[0]));
+    bool ok = replay_pending != NULL;
+    for (int d = 0; d < device_io_count && ok; d++) {
+        DeviceIO* io = &device_io[d];
+        io->rp_inputs = calloc(4 * REPLAY_WORDS, sizeof(uint64_t));
+        ok = io->rp_inputs != NULL;
+        if (!ok) break;
+        io->rp_input_good = io->rp_inputs + REPLAY_WORDS;
+        io->rp_coils = io->rp_inputs + 2 * REPLAY_WORDS;
+        io->rp_coil_good = io->rp_inputs + 3 * REPLAY_WORDS;
     }
-    
-    if (!init_modbus_communication(context)) return false;
-    if (!context || !config) {
-        write_log("ERROR: Null context or config in read_modbus_values");
+    if (!ok) {
+        write_log("ERROR: Memory allocation failed for replay");
+        stop_devices();
         return false;
     }
 
-    // Allocate buffers for input and output bits
-    uint8_t* input_bits = calloc(config->max_input_address + 1, sizeof(uint8_t));
-    uint8_t* output_bits = calloc(config->max_output_address + 1, sizeof(uint8_t));
-    
-    if (!input_bits || !output_bits) {
-        write_log("ERROR: Memory allocation failed");
-        free(input_bits);
-        free(output_bits);
-        return false;
+    // Replay clock starts at the first record, the reader was checked to start with a run
+    CaptureRecord first;
+    capture_reader_next(&replay_reader, &first);
+    replay_reader.used = 0;
+    replay_first_ns = replay_last_ns = first.time_ns;
+    replay_offset_ns = 0;
+    replay_records = 0;
+    replay_finished = false;
+    for (int d = 0; d < CAPTURE_MAX_DEVICES; d++) replay_map[d] = -1;
+    replay_running = true;
+    replay_start_ns = io_now_ns();
+    if (config->capture_file[0]) write_log("WARNING: capture_file is ignored while replaying");
+    warn_registers("replay");
+    write_log("Modbus replay of %s started for %d devices at speed %d", config->replay_file, device_io_count,
+              config->replay_speed);
+    return true;
+}
+
+// Config and mappings are loaded and the I/O thread is started, nothing here blocks on the network.
+// Once running, a reloaded config is swapped in here while the I/O thread waits for it.
+bool init_modbus_communication(CONTEXT_STRUCT_NAME *context) {
+    if (atomic_load(&io_running)) {
+        if (atomic_load(&io_parked) && context) swap_config(context);
+        return true;
+    }
+    if (client_running || replay_running) return true;
+
+    if (config == NULL) {
+        config = load_config(CONFIG_FILE);
+        if (config == NULL) {
+            write_log("ERROR: Failed to load config");
+            return false;
+        }
+        log_configure(config->log_level, config->log_format, config->log_rate);
     }
 
-    // Read all input bits in one request
-    if (modbus_read_input_bits(ctx, 0, config->max_input_address + 1, input_bits) == -1) {
-        write_log("ERROR: Failed to read input bits: %s", modbus_strerror(errno));
-        free(input_bits);
-        free(output_bits);
+    // Add context parameter when calling init_mappings
+    init_mappings(context);
+
+    stop_devices();
+    if (config->replay_file[0]) return start_replay();
+    if (config->gateway_mode == GATEWAY_CLIENT) return start_gateway_client();
+    io_epoll = epoll_create1(EPOLL_CLOEXEC);
+    io_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event wake = { .events = EPOLLIN, .data.ptr = NULL };
+    if (io_epoll < 0 || io_wake < 0 || epoll_ctl(io_epoll, EPOLL_CTL_ADD, io_wake, &wake) == -1) {
+        write_log("ERROR: Unable to create Modbus event loop: %s", strerror(errno));
+        stop_devices();
         return false;
     }
+    if (!io_watch_config()) {
+        write_log("WARNING: Unable to watch %s, changes need a restart: %s", CONFIG_FILE, strerror(errno));
+    }
+    metrics_start(config);
+    server_start(config);
+    capture_begin(config);
+    if (config->gateway_mode == GATEWAY_SERVER) gateway_start_server();
+    if (!start_device_io()) return false;
+    gateway_assign_devices();
+    capture_devices();
 
-    // Read all output bits in one request
-    if (modbus_read_bits(ctx, 0, config->max_output_address + 1, output_bits) == -1) {
-        write_log("ERROR: Failed to read output bits: %s", modbus_strerror(errno));
-        free(input_bits);
-        free(output_bits);
+    atomic_store(&io_running, true);
+    if (pthread_create(&io_thread, NULL, io_thread_main, NULL) != 0) {
+        atomic_store(&io_running, false);
+        write_log("ERROR: Failed to start Modbus I/O thread");
+        stop_devices();
         return false;
     }
+    write_log("Modbus I/O thread started for %d devices", device_io_count);
+    return true;
+}
+
+// Quality fields of a device follow its signal quality or its link state
+static void apply_quality(const DeviceIO* io) {
+    const ModbusDevice* dev = io->device;
+    for (int q = 0; q < dev->quality_binding_count; q++) {
+        const QualityBinding* binding = &dev->quality_bindings[q];
+        if (!binding->target) continue;
+        bool good = binding->table ? signal_bit(binding->table->quality, binding->signal) : io->draw_link;
+        if (*(binding->target) == good) continue;
+        *(binding->target) = good;
+        write_log("Quality %s = %d for %s on %s", binding->field, good, binding->source, dev->name);
+    }
+}
 
-    // Update input mappings
-    for (int i = 0; i < config->input_count; i++) {
-        int addr = config->input_mappings[i].address;
-        bool value = input_bits[addr];
-        
-        config->input_mappings[i].prev_value = config->input_mappings[i].value;
-        config->input_mappings[i].value = value;
-        
-        if (config->input_mappings[i].struct_ptr) {
-            *(config->input_mappings[i].struct_ptr) = value;
-            write_log("Read input %s = %d from address %d", 
-                     config->input_mappings[i].name, value, addr);
-        }
+// Next signal read_device_values visits, the changed ones, or every one when log_changes_only is off
+static int draw_next(const SignalWord* changed, int words, int count, int from, bool log_all) {
+    if (!log_all) return signal_bitset_next(changed, words, from);
+    return from < count ? from : -1;
+}
+
+// Latest input image of one device is applied, only changed values are assigned into struct
+static bool read_device_values(DeviceIO* io) {
+    ModbusImage* image = image_buffer_latest(&io->input_buffer);
+    if (!image) return atomic_load(&io->connected); // Use existing values
+
+    // Update input signals, the first image is assigned as a whole
+    SignalTable* inputs = &io->device->inputs;
+    SignalWord* changed = io->draw_changed;
+    bool all = !io->draw_synced;
+    bool log_all = !config->log_changes_only; // Only widens the logging, never the assignment
+    int words = SIGNAL_WORDS(inputs->count);
+    memcpy(inputs->prev_value, inputs->value, words * sizeof(SignalWord));
+    memcpy(inputs->value, image->inputs, words * sizeof(SignalWord));
+    if (all) memset(changed, 0xFF, words * sizeof(SignalWord));
+    else signal_bitset_diff(inputs->value, inputs->prev_value, changed, words);
+
+    for (int i = draw_next(changed, words, inputs->count, 0, log_all); i >= 0 && i < inputs->count;
+         i = draw_next(changed, words, inputs->count, i + 1, log_all)) {
+        if (!inputs->target[i]) continue;
+        bool value = signal_bit(inputs->value, i);
+        if (signal_bit(changed, i)) *(inputs->target[i]) = value;
+        write_log("Read input %s = %d from address %d", inputs->info[i].name, value, inputs->address[i]);
+    }
+
+    // Outputs written by the I/O thread are no longer dirty, the rest keep their struct value
+    SignalTable* outputs = &io->device->outputs;
+    words = SIGNAL_WORDS(outputs->count);
+    memcpy(io->draw_scratch, image->outputs, words * sizeof(SignalWord));
+    for (int i = signal_bitset_next(io->draw_dirty, words, 0); i >= 0;
+         i = signal_bitset_next(io->draw_dirty, words, i + 1)) {
+        if (io->draw_change_seq[i] <= image->seq) signal_bit_set(io->draw_dirty, i, false);
+        else signal_bit_set(io->draw_scratch, i, signal_bit(outputs->value, i));
+    }
+    if (all) memset(changed, 0xFF, words * sizeof(SignalWord));
+    else signal_bitset_diff(io->draw_scratch, outputs->value, changed, words);
+    memcpy(outputs->value, io->draw_scratch, words * sizeof(SignalWord));
+
+    for (int i = draw_next(changed, words, outputs->count, 0, log_all); i >= 0 && i < outputs->count;
+         i = draw_next(changed, words, outputs->count, i + 1, log_all)) {
+        if (!outputs->target[i]) continue;
+        bool value = signal_bit(outputs->value, i);
+        if (signal_bit(changed, i)) *(outputs->target[i]) = value;
+        write_log("Read output %s = %d from address %d", outputs->info[i].name, value, outputs->address[i]);
     }
 
-    // Update output mappings
-    for (int i = 0; i < config->output_count; i++) {
-        int addr = config->output_mappings[i].address;
-        bool value = output_bits[addr];
-        
-        config->output_mappings[i].prev_value = config->output_mappings[i].value;
-        config->output_mappings[i].value = value;
-        
-        if (config->output_mappings[i].struct_ptr) {
-            *(config->output_mappings[i].struct_ptr) = value;
-            write_log("Read output %s = %d from address %d", 
-                     config->output_mappings[i].name, value, addr);
+    // Registers are assigned when their raw value changed, holding registers changed on the display keep
+    // their struct value until the slave has them
+    RegisterTable* registers = &io->device->registers;
+    int register_words = SIGNAL_WORDS(registers->signals.count);
+    for (int i = signal_bitset_next(io->draw_reg_dirty, register_words, 0); i >= 0;
+         i = signal_bitset_next(io->draw_reg_dirty, register_words, i + 1)) {
+        if (io->draw_reg_change_seq[i] <= image->seq) signal_bit_set(io->draw_reg_dirty, i, false);
+    }
+    for (int i = 0; i < registers->signals.count; i++) {
+        bool update = !signal_bit(io->draw_reg_dirty, i) && (all || image->registers[i] != registers->raw[i]);
+        if (update) {
+            registers->raw[i] = image->registers[i];
+            registers->value[i] = image->register_values[i];
         }
+        if (!registers->target[i] || !(update || log_all)) continue;
+        if (update) {
+            // The field may not hold the value exactly, what it holds is what later writes are compared against
+            int type = register_field_type(registers, i);
+            store_field(registers->target[i], type, registers->value[i]);
+            registers->value[i] = load_field(registers->target[i], type);
+        }
+        write_log("Read register %s = %g from address %d", registers->signals.info[i].name, registers->value[i],
+                  registers->signals.address[i]);
+    }
+
+    // Quality only changes on connects, disconnects and stale blocks, bound fields are updated then
+    int input_words = SIGNAL_WORDS(inputs->count);
+    if (!io->draw_synced || io->draw_link != image->link ||
+        memcmp(inputs->quality, image->input_quality, input_words * sizeof(SignalWord)) != 0 ||
+        memcmp(outputs->quality, image->output_quality, words * sizeof(SignalWord)) != 0 ||
+        memcmp(registers->signals.quality, image->register_quality, register_words * sizeof(SignalWord)) != 0) {
+        memcpy(inputs->quality, image->input_quality, input_words * sizeof(SignalWord));
+        memcpy(outputs->quality, image->output_quality, words * sizeof(SignalWord));
+        memcpy(registers->signals.quality, image->register_quality, register_words * sizeof(SignalWord));
+        io->draw_link = image->link;
+        apply_quality(io);
     }
 
-    free(input_bits);
-    free(output_bits);
-    last_read_time = current_time;
+    io->draw_synced = true;
+    io->server_dirty = true;
     return true;
 }
 
-// Struct values readed and assigned into modbus all at once at change
-bool update_modbus_values_all(CONTEXT_STRUCT_NAME *context) {
-    if (!read_modbus_values(context)) return false;
+// Latest input images of all devices are taken, false if any device has no connection yet
+static bool read_all_devices(CONTEXT_STRUCT_NAME *context) {
+    if (!init_modbus_communication(context)) return false;
     if (!context || !config) {
-        write_log("ERROR: Null context or config");
+        write_log("ERROR: Null context or config in read_modbus_values");
         return false;
     }
 
-    // Allocate buffer for output bits
-    uint8_t* output_bits = calloc(config->max_output_address + 1, sizeof(uint8_t));
-    if (!output_bits) {
-        write_log("ERROR: Memory allocation failed");
-        return false;
+    if (client_running) {
+        long long now = io_now_ns();
+        gateway_client_sync(now);
+        for (int d = 0; d < device_io_count; d++) gateway_client_pull(&device_io[d], now);
+    } else if (replay_running) {
+        long long now = io_now_ns();
+        replay_advance(now);
+        for (int d = 0; d < device_io_count; d++) replay_pull(&device_io[d], now);
     }
 
-    bool values_changed = false;
-
-    // Fill buffer with current values
-    for (int i = 0; i < config->output_count; i++) {
-        if (!config->output_mappings[i].struct_ptr) continue;
-        
-        int addr = config->output_mappings[i].address;
-        bool current_value = *(config->output_mappings[i].struct_ptr);
-        output_bits[addr] = current_value ? 1 : 0;
+    bool ok = true;
+    for (int d = 0; d < device_io_count; d++) {
+        if (!read_device_values(&device_io[d])) ok = false;
+    }
+    return ok;
+}
 
-        // Check if value changed
-        if (config->output_mappings[i].prev_value != current_value) {
-            values_changed = true;
+// Client writes are applied like changes made on the display, update_modbus_values sends them to the slave
+static void server_apply_writes(void) {
+    ModbusServerWrite writes[SERVER_WRITE_BATCH];
+    int n;
+    do {
+        n = modbus_server_take_writes(writes, SERVER_WRITE_BATCH);
+        for (int i = 0; i < n; i++) {
+            const ModbusServerWrite* write = &writes[i];
+            const ModbusDevice* dev = write->unit < device_io_count ? device_io[write->unit].device : NULL;
+            int position = dev ? write_order_lower_bound(dev, write->address) : 0;
+            int signal = dev && position < dev->outputs.count ? dev->write_order[position] : -1;
+            if (signal < 0 || dev->outputs.address[signal] != write->address || !dev->outputs.target[signal]) {
+                write_log("WARNING: Server write to unmapped coil %d of unit %d dropped", write->address, write->unit + 1);
+                continue;
+            }
+            *(dev->outputs.target[signal]) = write->value;
+            write_log("Server write %s = %d at address %d", dev->outputs.info[signal].name, write->value, write->address);
         }
+    } while (n == SERVER_WRITE_BATCH);
+}
+
+// Address image of one device as the draw thread sees it now
+static void server_build_unit(ModbusServerUnit* unit, const DeviceIO* io) {
+    const SignalTable* inputs = &io->device->inputs;
+    const SignalTable* outputs = &io->device->outputs;
+    memset(unit->inputs, 0, sizeof(unit->inputs));
+    memset(unit->coils, 0, sizeof(unit->coils));
+    memset(unit->writable, 0, sizeof(unit->writable));
+    int words = SIGNAL_WORDS(inputs->count);
+    for (int i = signal_bitset_next(inputs->value, words, 0); i >= 0 && i < inputs->count;
+         i = signal_bitset_next(inputs->value, words, i + 1)) {
+        modbus_server_bit_set(unit->inputs, inputs->address[i]);
+    }
+    words = SIGNAL_WORDS(outputs->count);
+    for (int i = signal_bitset_next(outputs->value, words, 0); i >= 0 && i < outputs->count;
+         i = signal_bitset_next(outputs->value, words, i + 1)) {
+        modbus_server_bit_set(unit->coils, outputs->address[i]);
+    }
+    for (int i = 0; i < outputs->count; i++) {
+        if (outputs->target[i]) modbus_server_bit_set(unit->writable, outputs->address[i]);
+    }
+    unit->link = io->draw_link;
+    unit->version = io->server_version;
+}
+
+// Back slot still holds an older snapshot, only units whose device changed since then are rebuilt
+static void server_publish(void) {
+    ModbusServerImage* image = modbus_server_back();
+    int units = device_io_count < MODBUS_SERVER_MAX_UNITS ? device_io_count : MODBUS_SERVER_MAX_UNITS;
+    bool changed = image->unit_count != units;
+    for (int d = 0; d < units; d++) {
+        DeviceIO* io = &device_io[d];
+        if (io->server_dirty || io->server_version == 0) io->server_version = ++server_version;
+        io->server_dirty = false;
+        if (image->units[d].version == io->server_version) continue;
+        server_build_unit(&image->units[d], io);
+        changed = true;
     }
+    image->unit_count = units;
+    if (changed) modbus_server_publish();
+}
 
-    // Write to Modbus if any value changed
-    if (values_changed) {
-        if (modbus_write_bits(ctx, 0, config->max_output_address + 1, output_bits) == -1) {
-            write_log("ERROR: Failed to write outputs: %s", modbus_strerror(errno));
-            free(output_bits);
-            return false;
-        }
+// Writes of server clients go into the context, then the server gets the values of this cycle
+static void server_exchange(void) {
+    if (!server_started || !device_io) return;
+    server_apply_writes();
+    server_publish();
+}
 
-        // Update previous values after successful write
-        for (int i = 0; i < config->output_count; i++) {
-            if (!config->output_mappings[i].struct_ptr) continue;
-            
-            bool current_value = *(config->output_mappings[i].struct_ptr);
-            if (config->output_mappings[i].prev_value != current_value) {
-                write_log("Updated %s: %d -> %d at address %d", 
-                         config->output_mappings[i].name,
-                         config->output_mappings[i].prev_value,
-                         current_value,
-                         config->output_mappings[i].address);
-                         
-                config->output_mappings[i].prev_value = current_value;
-                config->output_mappings[i].value = current_value;
-            }
+// Draw cycle duration goes into the cycle histogram, only the draw thread writes it
+static void metrics_cycle(long long start_ns) {
+    if (!metrics) return;
+    metrics_add(&metrics->cycles, 1);
+    metrics_record(&metrics->cycle, (uint64_t)(io_now_ns() - start_ns));
+}
+
+bool read_modbus_values(CONTEXT_STRUCT_NAME *context) {
+    long long start = io_now_ns();
+    bool ok = read_all_devices(context);
+    server_exchange();
+    if (subscription_count > 0) modbus_dispatch_events();
+    metrics_cycle(start);
+    return ok;
+}
+
+// Bound holding registers whose struct value changed are encoded and marked dirty, returns how many changed
+static int gather_register_outputs(DeviceIO* io, unsigned long seq) {
+    const ModbusDevice* dev = io->device;
+    RegisterTable* registers = &io->device->registers;
+    int changes = 0;
+    for (int p = 0; p < dev->register_write_count; p++) {
+        int i = dev->register_write_order[p];
+        if (!registers->target[i]) continue;
+        double value = load_field(registers->target[i], register_field_type(registers, i));
+        if (value == registers->value[i] || (isnan(value) && isnan(registers->value[i]))) continue;
+        registers->value[i] = value;
+        registers->raw[i] = register_encode(registers->format[i], registers->scale[i], registers->offset[i], value);
+        io->draw_reg_change_seq[i] = seq;
+        signal_bit_set(io->draw_reg_dirty, i, true);
+        changes++;
+    }
+    return changes;
+}
+
+// Changed struct values of one device are handed to its I/O thread as a new output image
+static bool publish_device_outputs(DeviceIO* io) {
+    SignalTable* outputs = &io->device->outputs;
+    int words = SIGNAL_WORDS(outputs->count);
+
+    // Struct fields are gathered into the value bitset, unbound signals keep their value
+    memcpy(outputs->prev_value, outputs->value, words * sizeof(SignalWord));
+    for (int w = 0; w < words; w++) {
+        SGLbool* const* targets = outputs->target + w * SIGNAL_WORD_BITS;
+        int n = outputs->count - w * SIGNAL_WORD_BITS;
+        if (n > SIGNAL_WORD_BITS) n = SIGNAL_WORD_BITS;
+
+        SignalWord word = outputs->prev_value[w];
+        for (int b = 0; b < n; b++) {
+            if (!targets[b]) continue;
+            SignalWord mask = (SignalWord)1 << b;
+            word = *targets[b] ? (word | mask) : (word & ~mask);
         }
+        outputs->value[w] = word;
+    }
+
+    unsigned long seq = io->draw_publish_seq + 1;
+    uint64_t changes = (uint64_t)gather_register_outputs(io, seq);
+    bool coils_changed = signal_bitset_diff(outputs->value, outputs->prev_value, io->draw_changed, words);
+    if (!coils_changed && changes == 0) return false;
+    if (coils_changed) io->server_dirty = true;
+
+    for (int i = signal_bitset_next(io->draw_changed, words, 0); i >= 0;
+         i = signal_bitset_next(io->draw_changed, words, i + 1)) {
+        io->draw_change_seq[i] = seq;
+        signal_bit_set(io->draw_dirty, i, true);
+        changes++;
     }
+    metrics_add(&io->metrics->output_changes, changes);
 
-    free(output_bits);
+    // A client queues the changed coils to the gateway instead of its own I/O thread
+    if (client_running) {
+        if (gateway && io->gw_slot >= 0) gateway_queue_writes(io, io->draw_changed);
+        else io->gw_backlog = true;
+        io->draw_publish_seq = seq;
+        return true;
+    }
+    if (replay_running) {
+        io->draw_publish_seq = seq;
+        return true;
+    }
+
+    ModbusImage* image = image_buffer_back(&io->output_buffer);
+    memcpy(image->outputs, outputs->value, words * sizeof(SignalWord));
+    memcpy(image->dirty, io->draw_dirty, words * sizeof(SignalWord));
+    for (int i = signal_bitset_next(io->draw_dirty, words, 0); i >= 0;
+         i = signal_bitset_next(io->draw_dirty, words, i + 1)) {
+        image->change_seq[i] = io->draw_change_seq[i];
+    }
+    const RegisterTable* registers = &io->device->registers;
+    int register_words = SIGNAL_WORDS(registers->signals.count);
+    memcpy(image->registers, registers->raw, registers->signals.count * sizeof(uint32_t));
+    memcpy(image->register_dirty, io->draw_reg_dirty, register_words * sizeof(SignalWord));
+    for (int i = signal_bitset_next(io->draw_reg_dirty, register_words, 0); i >= 0;
+         i = signal_bitset_next(io->draw_reg_dirty, register_words, i + 1)) {
+        image->register_change_seq[i] = io->draw_reg_change_seq[i];
+    }
+    image->seq = seq;
+    image_buffer_publish(&io->output_buffer);
+    io->draw_publish_seq = seq;
     return true;
 }
 
-// Struct values readed and assigned into modbus one by one at change
-bool update_modbus_values(CONTEXT_STRUCT_NAME *context) {
-    if (!read_modbus_values(context)) return false;
+// Changed struct values are handed to the I/O thread, returns true if any device got new outputs
+static bool publish_modbus_outputs(CONTEXT_STRUCT_NAME *context) {
+    if (!init_modbus_communication(context)) return false;
     if (!context || !config) {
         write_log("ERROR: Null context or config");
         return false;
     }
 
-    bool any_write_success = false;
+    bool published = false;
+    for (int d = 0; d < device_io_count; d++) {
+        if (publish_device_outputs(&device_io[d])) published = true;
+    }
 
-    // Check each output mapping for changes
-    for (int i = 0; i < config->output_count; i++) {
-        if (!config->output_mappings[i].struct_ptr) continue;
-        
-        bool current_value = *(config->output_mappings[i].struct_ptr);
-        int addr = config->output_mappings[i].address;
+    // I/O thread is woken so new outputs do not wait for the next poll
+    uint64_t one = 1;
+    if (published && client_running) gateway_wake(gateway_sock, gateway_shm);
+    else if (published && !replay_running && write(io_wake, &one, sizeof(one)) < 0) write_log("ERROR: Unable to wake Modbus I/O thread");
+    return published;
+}
 
-        // Write only if value changed
-        if (config->output_mappings[i].prev_value != current_value) {
-            if (modbus_write_bit(ctx, addr, current_value ? 1 : 0) == -1) {
-                write_log("ERROR: Failed to write bit at address %d: %s", 
-                         addr, modbus_strerror(errno));
-                continue;
-            }
+// Changed struct values are written by the I/O thread with the fewest FC05/FC15/FC16 requests
+bool update_modbus_values(CONTEXT_STRUCT_NAME *context) {
+    long long start = io_now_ns();
+    bool published = publish_modbus_outputs(context);
+    read_all_devices(context);
+    server_exchange();
+    if (subscription_count > 0) modbus_dispatch_events();
+    metrics_cycle(start);
+    return published;
+}
+
+// Kept for existing projects, the write engine already batches changed outputs
+bool update_modbus_values_all(CONTEXT_STRUCT_NAME *context) {
+    return update_modbus_values(context);
+}
 
-            write_log("Updated %s: %d -> %d at address %d", 
-                     config->output_mappings[i].name,
-                     config->output_mappings[i].prev_value,
-                     current_value,
-                     addr);
-            
-            // Update previous value after successful write
-            config->output_mappings[i].prev_value = current_value;
-            config->output_mappings[i].value = current_value;
-            any_write_success = true;
+// Poll statistics of up to max_reports groups of all devices are copied, returns the number of groups
+int get_poll_stats(ModbusPollReport* reports, int max_reports) {
+    if (!config) return 0;
+    int total = 0;
+    for (int d = 0; d < config->device_count; d++) {
+        const ModbusDevice* dev = &config->devices[d];
+        for (int g = 0; g < dev->poll_group_count; g++, total++) {
+            if (total < max_reports) poll_report(dev, &dev->poll_groups[g], &reports[total]);
         }
     }
+    return total;
+}
 
-    return any_write_success;
+GatewayMode modbus_gateway_mode(void) {
+    return config ? config->gateway_mode : GATEWAY_OFF;
 }
 
-// Export mappings to a CSV file (Not using yet)
-bool export_mappings(const char* filename) {
-    FILE* file = fopen(filename, "w");
+// True once a replay has applied the last record of its capture
+bool modbus_replay_done(void) {
+    return replay_running && replay_finished;
+}
+
+// Quality of a mapped signal as last seen by the draw thread, false for unknown names
+bool get_signal_quality(const char* name) {
+    if (!config) return false;
+    for (int d = 0; d < config->device_count; d++) {
+        const ModbusDevice* dev = &config->devices[d];
+        int i = signal_table_find(&dev->inputs, name);
+        if (i >= 0) return signal_bit(dev->inputs.quality, i);
+        i = signal_table_find(&dev->outputs, name);
+        if (i >= 0) return signal_bit(dev->outputs.quality, i);
+        i = signal_table_find(&dev->registers.signals, name);
+        if (i >= 0) return signal_bit(dev->registers.signals.quality, i);
+    }
+    return false;
+}
+
+// History of every signal between two CLOCK_REALTIME times is streamed to a file, ring by ring
+bool export_history(const char* filename, HistoryExportFormat format, long long from_ns, long long to_ns) {
+    FILE* file = fopen(filename, format == HISTORY_EXPORT_BINARY ? "wb" : "w");
     if (!file) return false;
+    bool ok = history_export(&history, file, format, from_ns, to_ns);
+    if (fclose(file) != 0) ok = false;
+    if (!ok) write_log("ERROR: Unable to export history to %s", filename);
+    return ok;
+}
 
-    fprintf(file, "Type,Name,Address,Current Value\n");
+static bool history_recorded(void) {
+    if (!history.header) return false;
+    for (uint32_t r = 0; r < history.header->ring_count; r++) {
+        if (atomic_load_explicit(&history.rings[r].head, memory_order_acquire) > 0) return true;
+    }
+    return false;
+}
 
-    for (int i = 0; i < config->input_count; i++) {
-        fprintf(file, "Input,%s,%d,%d\n", 
-                config->input_mappings[i].name,
-                config->input_mappings[i].address,
-                config->input_mappings[i].value);
+static void export_snapshot_table(FILE* file, const char* stamp, const char* device, const char* type,
+                                  const SignalTable* table, const double* values) {
+    for (int i = 0; i < table->count; i++) {
+        fprintf(file, "%s,%s,%s,%s,%d,", stamp, device, type, table->info[i].name, table->address[i]);
+        if (!signal_bit(table->quality, i)) fprintf(file, ",bad\n");
+        else if (values) fprintf(file, "%.15g,good\n", values[i]);
+        else fprintf(file, "%d,good\n", signal_bit(table->value, i));
     }
+}
 
-    for (int i = 0; i < config->output_count; i++) {
-        fprintf(file, "Output,%s,%d,%d\n", 
-                config->output_mappings[i].name,
-                config->output_mappings[i].address,
-                config->output_mappings[i].value);
+// Kept for existing projects, the whole history is exported as CSV. With the history off or still empty
+// the values last seen by the draw thread are written instead, one line per signal in the same columns.
+bool export_mappings(const char* filename) {
+    if (history_recorded()) return export_history(filename, HISTORY_EXPORT_CSV, 0, INT64_MAX);
+    if (!config) return false;
+    FILE* file = fopen(filename, "w");
+    if (!file) return false;
+
+    int64_t now = history_now_ns();
+    time_t second = (time_t)(now / 1000000000LL);
+    struct tm tm_value;
+    char date[24];
+    char stamp[32];
+    localtime_r(&second, &tm_value);
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm_value);
+    snprintf(stamp, sizeof(stamp), "%s.%03d", date, (int)(now / 1000000LL % 1000));
+    fprintf(file, "Time,Device,Type,Name,Address,Value,Quality\n");
+    for (int d = 0; d < config->device_count; d++) {
+        const ModbusDevice* dev = &config->devices[d];
+        export_snapshot_table(file, stamp, dev->name, "Input", &dev->inputs, NULL);
+        export_snapshot_table(file, stamp, dev->name, "Output", &dev->outputs, NULL);
+        export_snapshot_table(file, stamp, dev->name, "Register", &dev->registers.signals, dev->registers.value);
     }
 
-    fclose(file);
-    return true;
+    bool ok = !ferror(file);
+    if (fclose(file) != 0) ok = false;
+    if (!ok) write_log("ERROR: Unable to export mappings to %s", filename);
+    return ok;
 }
 
 // Cleanup Modbus connection and free memory in a cause of error (Not using yet)
 void cleanup_modbus(void) {
-    if (ctx) {
-        modbus_flush(ctx);
-        modbus_close(ctx);
-        modbus_free(ctx);
-        ctx = NULL;
-        write_log("Modbus connection closed");
+    server_stop();
+    if (device_io) {
+        stop_devices();
+        write_log("Modbus I/O thread stopped");
     }
+    capture_end();
+    metrics_stop();
+    if (event_queue_ready) event_queue_free(&event_queue);
+    event_queue_ready = false;
+    atomic_store(&events_wanted, false);
+    free(subscriptions);
+    free(subscription_head);
+    subscriptions = NULL;
+    subscription_head = NULL;
+    subscription_count = subscription_capacity = signal_total = 0;
+    subscription_all = -1;
     if (config) {
-        free(config);
+        free_config(config);
         config = NULL;
         write_log("Config freed");
     }
-    if (log_file) {
-        fclose(log_file);
-        log_file = NULL;
-    }
-}
\ No newline at end of file
+    log_shutdown();
+}
@@ -2,54 +2,210 @@
 #define MODBUS_COMM_H
 
 #include <stdbool.h>
-#include <modbus.h>
-#include "specification_genel.h"
+#include <stdatomic.h>
+#ifndef CONTEXT_HEADER
+#define CONTEXT_HEADER "specification_genel.h" // Generated header that declares CONTEXT_STRUCT_NAME
+#endif
+#include CONTEXT_HEADER
 #include "sgl_types.h"
+#include "modbus_signals.h"
+#include "modbus_log.h"
+#include "modbus_tcp.h"
+#include "modbus_bindings.h"
+#include "modbus_metrics.h"
+#include "modbus_events.h"
+#include "modbus_gateway.h"
+#include "modbus_server.h"
+#include "modbus_capture.h"
+#include "modbus_history.h"
 
 // Constants
-#define MAX_LINE 2048
-#define MAX_MAPPINGS 1024
+#define WRITE_SINGLE_BYTES 24 // FC05 request and response on the wire
+#define WRITE_MULTIPLE_BYTES 25 // FC15 request and response without coil data
+#define DEFAULT_DEVICE "default" // Device of [ModbusConfig], [InputMappings] and [OutputMappings]
 #define DEFAULT_IP "127.0.0.1"
 #define DEFAULT_PORT 502
 #define DEFAULT_SLAVE_ID 1
+#define DEFAULT_SERVER_BIND "0.0.0.0"
+#define DEFAULT_READ_GAP 64 // Unmapped bits worth reading to save one request
+#define DEFAULT_REGISTER_GAP 8 // Unmapped registers worth reading to save one request
+#define DEFAULT_WRITE_REQUEST_COST 64 // Round trip overhead of one write request in bytes
+#define DEFAULT_UDP_RETRIES 2 // Copies of an unanswered UDP read sent before it fails
+#define DEFAULT_VERIFY_RETRIES 3 // Writes of a verified output whose read back differs before it is given up
 #define CONFIG_FILE "config.ini"
-#define LOG_FILE "trackcircuit.log"
+#define CONFIG_CACHE_FILE "config.bin" // Compiled config, rebuilt whenever the INI or the bindings change
+#define LOG_FILE LOG_TEXT_FILE
 #define EXPORT_FILE "mappings.csv"
-#define CONNECTION_RETRY_INTERVAL 5
-#define MODBUS_READ_INTERVAL 2
-#define MODBUS_TIMEOUT 100000 // 100 ms Connection timeout
+#define RECONNECT_MIN_MS 500 // First reconnect delay, doubled after every failed attempt
+#define RECONNECT_MAX_MS 30000
+#define MODBUS_MAX_TIMEOUTS 3 // Consecutive unanswered requests that mark a half-open connection
+#define DEFAULT_STALE_PERIODS 3 // Missed poll periods before a signal is reported stale
+#define MODBUS_READ_INTERVAL 1000 // Default poll period in ms
+#define DEFAULT_POLL_MIN_MS 50 // Fastest adaptive period, a configured period below it is kept
+#define DEFAULT_POLL_MAX_MS 5000 // Slowest adaptive period, a configured period above it is kept
+#define DEFAULT_POLL_RTT_MS 50 // Smoothed response time above which adaptive polling sheds load
+#define POLL_ACTIVITY_ONE 1024 // Activity of a poll group that changes on every poll
+#define POLL_ACTIVITY_QUIET 64 // Activity below which a quiet group backs off
+#define MODBUS_MAX_PERIOD_MS 3600000 // Upper bound of configured periods and timeouts
+#define MODBUS_ADDRESS_COUNT 65536
+#define MODBUS_STATS_INTERVAL 60 // Poll statistics are logged every 60 s
+#define MODBUS_TIMEOUT 100000 // 100 ms default response timeout
+#define MODBUS_CONNECT_TIMEOUT_MS 3000
+#define MODBUS_IO_TICK_MS 10 // Longest sleep of the I/O thread
+#define MODBUS_EVENT_BATCH 64 // Events taken from the queue at once by modbus_dispatch_events
+#define RELOAD_DEBOUNCE_MS 200 // Quiet time after the last write to the config before it is reloaded
+#define CAPTURE_NAME_SIZE 64
+#define MODBUS_REPLAY_MAX_SPEED 1000
+#ifndef CONTEXT_STRUCT_NAME
 #define CONTEXT_STRUCT_NAME specification_typ_genel //Context struct name from [ansys_project_name]_[layer_name].h
+#endif
 
 // Structures
 typedef struct {
-    char name[50];
-    int address;
-    bool value;
-    bool prev_value;
-    SGLbool* struct_ptr;
-} ModbusMapping;
+    int function; // MODBUS_FC_READ_COILS, _DISCRETE_INPUTS, _HOLDING_REGISTERS or _INPUT_REGISTERS
+    int start;
+    int count;
+    int offset; // Position of the block in the bit or register read buffer
+    int period_ms;
+} ModbusReadBlock;
 
+// Jitter statistics of one poll group, updated by the I/O thread and readable from any thread
 typedef struct {
+    atomic_ulong polls;
+    atomic_ulong skipped; // Deadlines dropped because the group was already late by a full period
+    atomic_long jitter_max_us;
+    atomic_long jitter_sum_us;
+    atomic_int interval_ms; // Period the group is polled at now, period_ms unless adaptive_poll is on
+} ModbusPollStats;
+
+// Plain copy of one poll group statistics for callers
+typedef struct {
+    const char* device; // Device name, valid until the next config reload or cleanup_modbus
+    int period_ms;
+    int interval_ms;
+    unsigned long polls;
+    unsigned long skipped;
+    long jitter_avg_us;
+    long jitter_max_us;
+} ModbusPollReport;
+
+// Read blocks sharing one poll period, read_plan is sorted so they are consecutive
+typedef struct {
+    int period_ms;
+    int first_block;
+    int block_count;
+    long long deadline_ns;
+    ModbusPollStats stats;
+} ModbusPollGroup;
+
+// Context field showing the quality of one signal, or of the device link when signal is -1
+typedef struct {
+    char field[SIGNAL_NAME_SIZE];
+    char source[SIGNAL_NAME_SIZE]; // Signal name, "*" for the device link
+    int field_index; // Index in modbus_fields, -1 when the model has no such field
+    const SignalTable* table;
+    int signal;
+    SGLbool* target;
+} QualityBinding;
+
+// One Modbus TCP slave with its own mappings, read plan and write plan
+typedef struct {
+    char name[SIGNAL_NAME_SIZE];
     char server_ip[20];
     int port;
     int slave_id;
-    ModbusMapping input_mappings[MAX_MAPPINGS];
-    ModbusMapping output_mappings[MAX_MAPPINGS];
-    int input_count;
-    int output_count;
+    ModbusTransport transport;
+    SignalTable inputs;
+    SignalTable outputs;
     int max_input_address;
     int max_output_address;
+    ModbusReadBlock* read_plan;
+    int read_block_count;
+    int read_bit_count;
+    uint8_t* read_bits;
+    ModbusPollGroup* poll_groups;
+    int poll_group_count;
+    int* write_order; // Output signals sorted by address
+    int* write_segment; // Runs of consecutive mapped addresses in write_order
+    RegisterTable registers; // Input and holding register mappings
+    int read_register_count;
+    uint16_t* read_regs; // Register read buffer in host order
+    int* register_write_order; // Holding register signals sorted by address
+    int register_write_count;
+    QualityBinding* quality_bindings;
+    int quality_binding_count;
+} ModbusDevice;
+
+typedef struct {
+    ModbusDevice* devices;
+    int device_count;
+    int read_gap;
+    int register_gap;
+    int poll_ms;
+    int write_request_cost;
+    int verify_retries;
+    int max_in_flight; // Requests outstanding per device
+    int udp_retries; // Times a UDP read without answer is sent again
+    int response_timeout_ms;
+    int reconnect_min_ms;
+    int reconnect_max_ms;
+    int stale_periods;
+    bool adaptive_poll; // Poll periods follow the change rate of each block and the response time of the link
+    int poll_min_ms;
+    int poll_max_ms;
+    int poll_rtt_ms;
+    LogLevel log_level;
+    LogFormat log_format;
+    int log_rate;
+    bool log_changes_only; // Value logs only for changed signals instead of every poll
+    char metrics_name[METRICS_NAME_SIZE]; // Shared memory of the runtime metrics, "none" keeps them private
+    GatewayMode gateway_mode; // Fixed for the life of the process, a reload keeps the first one
+    char gateway_name[GATEWAY_NAME_SIZE]; // Shared memory of the gateway images
+    char gateway_group[GATEWAY_NAME_SIZE]; // Group whose processes may attach as clients, empty for the gateway's own
+    int server_port; // Modbus TCP server for other masters, 0 when off
+    int server_max_clients;
+    char server_bind[20];
+    char capture_file[CAPTURE_NAME_SIZE]; // Traffic of every device is appended here, empty when off
+    char replay_file[CAPTURE_NAME_SIZE]; // Capture played back instead of the devices, empty when off
+    int replay_speed; // Multiple of the recorded pace, 0 applies one recorded answer per cycle
+    int history_depth; // Transitions kept per signal, 0 turns the history off
+    char history_file[HISTORY_PATH_SIZE]; // Segment file the history is mapped from, empty keeps it in memory
+    int error_count; // Lines rejected while loading
+    uint64_t source_key; // Hash of the INI and bindings it was built from
 } ModbusConfig;
 
+// Formats are rendered later on the log writer thread, so only string literals compile
+#define write_log(format, ...) write_log_impl("" format, ##__VA_ARGS__)
+
 // Function prototypes
-void write_log(const char* format, ...);
+void write_log_impl(const char* format, ...);
 ModbusConfig* load_config(const char* filename);
+void free_config(ModbusConfig* cfg);
+ModbusDevice* find_device(ModbusConfig* cfg, const char* name, bool create);
+bool build_read_plan(ModbusConfig* cfg);
+bool build_write_plan(ModbusConfig* cfg);
 void init_mappings(CONTEXT_STRUCT_NAME *context);
 bool init_modbus_communication(CONTEXT_STRUCT_NAME *context);
 bool read_modbus_values(CONTEXT_STRUCT_NAME *context);
 bool update_modbus_values_all(CONTEXT_STRUCT_NAME *context);
 bool update_modbus_values(CONTEXT_STRUCT_NAME *context);
 bool export_mappings(const char* filename);
+bool export_history(const char* filename, HistoryExportFormat format, long long from_ns, long long to_ns);
+int modbus_history_id(const char* name);
+bool modbus_history_value(int id, long long time_ns, double* value);
+int modbus_history_window(int id, long long from_ns, long long to_ns, HistoryEntry* entries, int max_entries);
+int get_poll_stats(ModbusPollReport* reports, int max_reports);
+bool get_signal_quality(const char* name);
+int modbus_signal_id(const char* name);
+const char* modbus_signal_name(int signal);
+int modbus_signal_count(void);
+bool modbus_signal_value(int signal, bool* value, bool* quality);
+bool modbus_subscribe(const char* name, ModbusChangeCallback callback, void* user);
+void modbus_unsubscribe(const char* name, ModbusChangeCallback callback, void* user);
+int modbus_poll_events(ModbusChangeEvent* events, int max_events);
+int modbus_dispatch_events(void);
+GatewayMode modbus_gateway_mode(void);
+bool modbus_replay_done(void);
 void cleanup_modbus(void);
 
 #endif // MODBUS_COMM_H
\ No newline at end of file
@@ -0,0 +1,71 @@
+#include "modbus_events.h"
+#include <stdlib.h>
+
+#define EVENT_QUEUE_MASK (MODBUS_EVENT_QUEUE_SIZE - 1)
+
+bool event_queue_init(ModbusEventQueue* q) {
+    q->events = calloc(MODBUS_EVENT_QUEUE_SIZE, sizeof(ModbusChangeEvent));
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->head, 0);
+    q->tail_local = q->head_cache = q->tail_cache = 0;
+    q->dropping = false;
+    return q->events != NULL;
+}
+
+void event_queue_free(ModbusEventQueue* q) {
+    free(q->events);
+    q->events = NULL;
+}
+
+// Producer side, the consumer's index is only loaded again when the cached one says the ring is full
+static bool queue_room(ModbusEventQueue* q) {
+    if (q->tail_local - q->head_cache < MODBUS_EVENT_QUEUE_SIZE) return true;
+    q->head_cache = atomic_load_explicit(&q->head, memory_order_acquire);
+    return q->tail_local - q->head_cache < MODBUS_EVENT_QUEUE_SIZE;
+}
+
+static void queue_write_resync(ModbusEventQueue* q, long long time_ns) {
+    ModbusChangeEvent* slot = &q->events[q->tail_local++ & EVENT_QUEUE_MASK];
+    slot->signal = MODBUS_EVENT_RESYNC;
+    slot->old_value = slot->new_value = slot->old_quality = slot->new_quality = false;
+    slot->time_ns = time_ns;
+    q->dropping = false;
+}
+
+// Event is staged for the next commit, a full ring drops it and a resync takes the place of everything dropped
+void event_queue_put(ModbusEventQueue* q, const ModbusChangeEvent* event) {
+    if (q->dropping) {
+        if (!queue_room(q)) return;
+        queue_write_resync(q, event->time_ns);
+    }
+    if (!queue_room(q)) {
+        q->dropping = true;
+        return;
+    }
+    q->events[q->tail_local++ & EVENT_QUEUE_MASK] = *event;
+}
+
+// Staged events become visible to the consumer together
+void event_queue_commit(ModbusEventQueue* q, long long now_ns) {
+    if (q->dropping && queue_room(q)) queue_write_resync(q, now_ns);
+    atomic_store_explicit(&q->tail, q->tail_local, memory_order_release);
+}
+
+// Consumer side, returns the number of events copied
+int event_queue_take(ModbusEventQueue* q, ModbusChangeEvent* events, int max_events) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    if (head == q->tail_cache) q->tail_cache = atomic_load_explicit(&q->tail, memory_order_acquire);
+    size_t available = q->tail_cache - head;
+    int n = available < (size_t)max_events ? (int)available : max_events;
+    for (int i = 0; i < n; i++) events[i] = q->events[(head + i) & EVENT_QUEUE_MASK];
+    atomic_store_explicit(&q->head, head + n, memory_order_release);
+    return n;
+}
+
+// Queue is emptied down to one resync, only while the producer is stopped
+void event_queue_reset(ModbusEventQueue* q, long long now_ns) {
+    q->tail_local = q->head_cache = q->tail_cache = 0;
+    atomic_store(&q->head, 0);
+    queue_write_resync(q, now_ns);
+    atomic_store(&q->tail, q->tail_local);
+}
@@ -0,0 +1,44 @@
+#ifndef MODBUS_EVENTS_H
+#define MODBUS_EVENTS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Constants
+#define MODBUS_EVENT_QUEUE_SIZE 8192 // Events, must be a power of two
+#define MODBUS_EVENT_RESYNC -1 // Signal id of the event that says earlier changes were lost
+#define MODBUS_EVENT_CACHE_LINE 64
+
+// Change of one mapped signal as seen by the I/O thread between two consecutive input images
+typedef struct {
+    int signal; // Signal id, or MODBUS_EVENT_RESYNC when the current state has to be read again
+    bool old_value;
+    bool new_value;
+    bool old_quality;
+    bool new_quality;
+    long long time_ns; // CLOCK_MONOTONIC time of the image that carried the change
+} ModbusChangeEvent;
+
+typedef void (*ModbusChangeCallback)(const ModbusChangeEvent* event, void* user);
+
+// Single producer single consumer ring, each side caches the other side's index on its own cache line
+typedef struct {
+    ModbusChangeEvent* events;
+    _Alignas(MODBUS_EVENT_CACHE_LINE) atomic_size_t tail; // Written by the producer
+    size_t tail_local; // Events put but not committed yet
+    size_t head_cache;
+    bool dropping; // Events were dropped, a resync goes in as soon as there is room
+    _Alignas(MODBUS_EVENT_CACHE_LINE) atomic_size_t head; // Written by the consumer
+    size_t tail_cache;
+} ModbusEventQueue;
+
+// Function prototypes
+bool event_queue_init(ModbusEventQueue* q);
+void event_queue_free(ModbusEventQueue* q);
+void event_queue_put(ModbusEventQueue* q, const ModbusChangeEvent* event);
+void event_queue_commit(ModbusEventQueue* q, long long now_ns);
+int event_queue_take(ModbusEventQueue* q, ModbusChangeEvent* events, int max_events);
+void event_queue_reset(ModbusEventQueue* q, long long now_ns);
+
+#endif // MODBUS_EVENTS_H
@@ -0,0 +1,208 @@
+#include "modbus_gateway.h"
+#include <errno.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define GATEWAY_QUEUE_MASK (GATEWAY_WRITE_QUEUE - 1)
+
+static bool process_alive(int32_t pid) {
+    return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+static const ModbusGateway* map_segment(const char* name, int flags, int prot) {
+    int fd = shm_open(name, flags | O_CLOEXEC, 0);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ModbusGateway)) {
+        close(fd);
+        errno = EPROTO;
+        return NULL;
+    }
+    void* map = mmap(NULL, sizeof(ModbusGateway), prot, MAP_SHARED, fd, 0);
+    close(fd);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+static bool segment_valid(const ModbusGateway* gateway) {
+    return gateway->magic == GATEWAY_MAGIC && gateway->version == GATEWAY_VERSION &&
+           gateway->size == sizeof(ModbusGateway);
+}
+
+// Exclusive flock on <name>.lock, only the gateway's user can open it so a client cannot hold it.
+// -1 with EBUSY while another gateway holds it.
+static int gateway_lock(const char* name) {
+    char lock_name[256];
+    if (snprintf(lock_name, sizeof(lock_name), "%s.lock", name) >= (int)sizeof(lock_name)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = shm_open(lock_name, O_CREAT | O_RDONLY | O_CLOEXEC, 0600);
+    if (fd < 0) return -1;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        int err = errno == EWOULDBLOCK ? EBUSY : errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+static ModbusGateway* gateway_replace(const char* name, gid_t group) {
+    const ModbusGateway* old = map_segment(name, O_RDONLY, PROT_READ);
+    if (old) {
+        bool busy = segment_valid(old) && old->pid != getpid() && process_alive(old->pid);
+        munmap((void*)old, sizeof(ModbusGateway));
+        if (busy) {
+            errno = EBUSY;
+            return NULL;
+        }
+    }
+    shm_unlink(name);
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0660);
+    if (fd < 0) return NULL;
+    // Clients push coil writes that go to the PLC, so other users get no access at all. The umask must not
+    // take the group's write access away.
+    if ((group != (gid_t)-1 && fchown(fd, (uid_t)-1, group) != 0) || fchmod(fd, 0660) != 0 ||
+        ftruncate(fd, sizeof(ModbusGateway)) != 0) {
+        int err = errno;
+        close(fd);
+        shm_unlink(name);
+        errno = err;
+        return NULL;
+    }
+    ModbusGateway* gateway = mmap(NULL, sizeof(ModbusGateway), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (gateway == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    // The segment is zero filled, the magic goes in last so a client never sees half a header
+    gateway->version = GATEWAY_VERSION;
+    gateway->size = sizeof(ModbusGateway);
+    gateway->pid = (int32_t)getpid();
+    atomic_thread_fence(memory_order_release);
+    gateway->magic = GATEWAY_MAGIC;
+    return gateway;
+}
+
+// Fresh segment under the name, NULL with EBUSY when another gateway still serves it or is starting.
+// The old segment is unlinked, clients still mapping it see its heartbeat stop and attach again.
+// Only the owner and the group can attach, group (gid_t)-1 keeps the gateway's own group.
+// The lock spans the liveness check and the unlink, so two gateways cannot replace each other.
+ModbusGateway* gateway_create(const char* name, gid_t group) {
+    int lock = gateway_lock(name);
+    if (lock < 0) return NULL;
+    ModbusGateway* gateway = gateway_replace(name, group);
+    int err = errno;
+    close(lock);
+    errno = err;
+    return gateway;
+}
+
+// Segment is unmapped and removed, clients notice the missing heartbeat
+void gateway_destroy(ModbusGateway* gateway, const char* name) {
+    atomic_store(&gateway->heartbeat_ns, 0);
+    munmap(gateway, sizeof(ModbusGateway));
+    shm_unlink(name);
+}
+
+// Mapping for clients, NULL when there is no gateway or it was built from another version
+ModbusGateway* gateway_attach(const char* name) {
+    ModbusGateway* gateway = (ModbusGateway*)map_segment(name, O_RDWR, PROT_READ | PROT_WRITE);
+    if (!gateway) return NULL;
+    if (!segment_valid(gateway)) {
+        munmap(gateway, sizeof(ModbusGateway));
+        errno = EPROTO;
+        return NULL;
+    }
+    return gateway;
+}
+
+void gateway_detach(ModbusGateway* gateway) {
+    munmap(gateway, sizeof(ModbusGateway));
+}
+
+// Free client slot is taken, slots of processes that died without releasing them are reused, -1 when all are busy
+int gateway_claim_client(ModbusGateway* gateway) {
+    int32_t self = (int32_t)getpid();
+    for (int c = 0; c < GATEWAY_MAX_CLIENTS; c++) {
+        int32_t owner = atomic_load(&gateway->clients[c].pid);
+        if (owner != 0 && process_alive(owner)) continue;
+        if (atomic_compare_exchange_strong(&gateway->clients[c].pid, &owner, self)) return c;
+    }
+    return -1;
+}
+
+void gateway_release_client(ModbusGateway* gateway, int client) {
+    if (client >= 0) atomic_store(&gateway->clients[client].pid, 0);
+}
+
+// Client side, false when the queue is full
+bool gateway_push_write(GatewayClient* client, const GatewayWrite* write) {
+    uint64_t tail = atomic_load_explicit(&client->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&client->head, memory_order_acquire) >= GATEWAY_WRITE_QUEUE) return false;
+    client->writes[tail & GATEWAY_QUEUE_MASK] = *write;
+    atomic_store_explicit(&client->tail, tail + 1, memory_order_release);
+    if (write->seq >= atomic_load_explicit(&client->next_seq, memory_order_relaxed)) {
+        atomic_store_explicit(&client->next_seq, write->seq + 1, memory_order_relaxed);
+    }
+    return true;
+}
+
+// Gateway side, returns the number of writes copied
+int gateway_take_writes(GatewayClient* client, GatewayWrite* writes, int max_writes) {
+    uint64_t head = atomic_load_explicit(&client->head, memory_order_relaxed);
+    uint64_t available = atomic_load_explicit(&client->tail, memory_order_acquire) - head;
+    // A tail past the queue size was written by a broken client, its writes are skipped
+    if (available > GATEWAY_WRITE_QUEUE) {
+        atomic_store_explicit(&client->head, head + available, memory_order_release);
+        return 0;
+    }
+    int n = available < (uint64_t)max_writes ? (int)available : max_writes;
+    for (int i = 0; i < n; i++) writes[i] = client->writes[(head + i) & GATEWAY_QUEUE_MASK];
+    atomic_store_explicit(&client->head, head + n, memory_order_release);
+    return n;
+}
+
+// Abstract unix socket named after the segment, a datagram on it wakes the gateway I/O thread
+static socklen_t wake_address(const char* name, struct sockaddr_un* address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    size_t length = strlen(name);
+    if (length > sizeof(address->sun_path) - 1) length = sizeof(address->sun_path) - 1;
+    memcpy(address->sun_path + 1, name, length);
+    return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + length);
+}
+
+// Non-blocking wake socket, bound for the gateway and unbound for clients, -1 on failure
+int gateway_wake_open(const char* name, bool server) {
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || !server) return fd;
+    struct sockaddr_un address;
+    socklen_t length = wake_address(name, &address);
+    if (bind(fd, (struct sockaddr*)&address, length) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Best effort, a full socket buffer means the gateway is about to wake anyway
+void gateway_wake(int fd, const char* name) {
+    if (fd < 0) return;
+    struct sockaddr_un address;
+    socklen_t length = wake_address(name, &address);
+    char byte = 1;
+    (void)sendto(fd, &byte, 1, MSG_DONTWAIT, (struct sockaddr*)&address, length);
+}
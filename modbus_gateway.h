@@ -0,0 +1,117 @@
+#ifndef MODBUS_GATEWAY_H
+#define MODBUS_GATEWAY_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Constants
+#define MODBUS_GATEWAY_NAME "/modbus_gateway" // Default POSIX shared memory name, see gateway_name
+#define GATEWAY_MAGIC 0x574D424Du // "MBGW"
+#define GATEWAY_VERSION 1
+#define GATEWAY_MAX_DEVICES 32
+#define GATEWAY_MAX_CLIENTS 16
+#define GATEWAY_NAME_SIZE 64
+#define GATEWAY_WORDS 1024 // One bit per Modbus address, 65536 addresses
+#define GATEWAY_WRITE_QUEUE 1024 // Coil writes per client, must be a power of two
+#define GATEWAY_TIMEOUT_MS 1000 // A gateway that has not run its loop for this long is gone
+#define GATEWAY_CACHE_LINE 64
+
+typedef enum {
+    GATEWAY_OFF, // The process polls its own devices
+    GATEWAY_SERVER, // The process polls its devices and shares them with clients
+    GATEWAY_CLIENT // The process reads and writes the images of a gateway and has no connection of its own
+} GatewayMode;
+
+typedef _Atomic uint64_t GatewayWord;
+
+// Coil write of a client, seq is the client's change sequence of the device
+typedef struct {
+    uint32_t generation; // Gateway config the device index belongs to
+    uint16_t device;
+    uint16_t address;
+    uint64_t seq;
+    uint8_t value;
+} GatewayWrite;
+
+// Image of one slave indexed by Modbus address, guarded by a seqlock: seq is odd while the gateway writes
+typedef struct {
+    char name[GATEWAY_NAME_SIZE];
+    char server[GATEWAY_NAME_SIZE];
+    _Alignas(GATEWAY_CACHE_LINE) _Atomic uint64_t seq;
+    _Atomic uint32_t link;
+    GatewayWord applied[GATEWAY_MAX_CLIENTS]; // Highest write seq of each client that is on the slave
+    GatewayWord inputs[GATEWAY_WORDS];
+    GatewayWord input_quality[GATEWAY_WORDS];
+    GatewayWord coils[GATEWAY_WORDS];
+    GatewayWord coil_quality[GATEWAY_WORDS];
+} GatewayDevice;
+
+// Write queue of one client process, the client produces and the gateway I/O thread consumes
+typedef struct {
+    _Atomic int32_t pid; // 0 while the slot is free
+    _Atomic uint64_t next_seq; // Write seqs of the next owner start here, so they never look applied already
+    _Alignas(GATEWAY_CACHE_LINE) _Atomic uint64_t tail;
+    _Alignas(GATEWAY_CACHE_LINE) _Atomic uint64_t head;
+    GatewayWrite writes[GATEWAY_WRITE_QUEUE];
+} GatewayClient;
+
+// Shared memory segment, clients check magic, version and size before they trust anything else
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    int32_t pid;
+    _Atomic uint32_t device_count;
+    _Atomic uint32_t generation; // Bumped whenever a config reload reassigns the device slots
+    _Atomic int64_t heartbeat_ns; // CLOCK_MONOTONIC of the last gateway loop
+    GatewayDevice devices[GATEWAY_MAX_DEVICES];
+    GatewayClient clients[GATEWAY_MAX_CLIENTS];
+} ModbusGateway;
+
+// Seqlock writer side, only the gateway I/O thread writes a device
+static inline void gateway_write_begin(GatewayDevice* dev) {
+    atomic_store_explicit(&dev->seq, atomic_load_explicit(&dev->seq, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void gateway_write_end(GatewayDevice* dev) {
+    atomic_store_explicit(&dev->seq, atomic_load_explicit(&dev->seq, memory_order_relaxed) + 1, memory_order_release);
+}
+
+// Seqlock reader side, a copy taken between begin and an unchanged seq is consistent
+static inline uint64_t gateway_read_begin(const GatewayDevice* dev) {
+    return atomic_load_explicit(&dev->seq, memory_order_acquire);
+}
+
+static inline bool gateway_read_retry(const GatewayDevice* dev, uint64_t seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return (seq & 1u) || atomic_load_explicit(&dev->seq, memory_order_relaxed) != seq;
+}
+
+// Bit of an address bitset, written with a plain load and store because there is a single writer
+static inline void gateway_bit_set(GatewayWord* bits, int address, bool value) {
+    uint64_t mask = (uint64_t)1 << (address % 64);
+    uint64_t word = atomic_load_explicit(&bits[address / 64], memory_order_relaxed);
+    word = value ? (word | mask) : (word & ~mask);
+    atomic_store_explicit(&bits[address / 64], word, memory_order_relaxed);
+}
+
+static inline bool gateway_bit(const GatewayWord* bits, int address) {
+    return (atomic_load_explicit(&bits[address / 64], memory_order_relaxed) >> (address % 64)) & 1u;
+}
+
+// Function prototypes
+ModbusGateway* gateway_create(const char* name, gid_t group);
+void gateway_destroy(ModbusGateway* gateway, const char* name);
+ModbusGateway* gateway_attach(const char* name);
+void gateway_detach(ModbusGateway* gateway);
+int gateway_claim_client(ModbusGateway* gateway);
+void gateway_release_client(ModbusGateway* gateway, int client);
+bool gateway_push_write(GatewayClient* client, const GatewayWrite* write);
+int gateway_take_writes(GatewayClient* client, GatewayWrite* writes, int max_writes);
+int gateway_wake_open(const char* name, bool server);
+void gateway_wake(int fd, const char* name);
+
+#endif // MODBUS_GATEWAY_H
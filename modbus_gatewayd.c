@@ -0,0 +1,50 @@
+/*
+ * Gateway daemon: one process polls and writes the devices of config.ini and shares their images
+ * with every HMI on the machine that runs with gateway_mode=client.
+ * Usage: modbus_gatewayd [directory of config.ini]
+ * The config needs gateway_mode=server. Build: see "Gateway" in README.md.
+ */
+#include "modbus_comm.h"
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t gateway_stop_requested = 0;
+
+static void on_signal(int sig) {
+    (void)sig;
+    gateway_stop_requested = 1;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [directory of %s]\n", argv[0], CONFIG_FILE);
+        return 1;
+    }
+    if (argc == 2 && chdir(argv[1]) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    // Context only exists because the draw path binds one, clients have their own
+    static CONTEXT_STRUCT_NAME context;
+    if (!init_modbus_communication(&context)) {
+        fprintf(stderr, "Unable to start, see %s\n", LOG_FILE);
+        return 1;
+    }
+    if (modbus_gateway_mode() != GATEWAY_SERVER) {
+        fprintf(stderr, "%s needs gateway_mode=server\n", CONFIG_FILE);
+        cleanup_modbus();
+        return 1;
+    }
+
+    // All network work is on the I/O thread, this loop lets reloaded configs and server_port writes in
+    while (!gateway_stop_requested) {
+        update_modbus_values(&context);
+        usleep(MODBUS_IO_TICK_MS * 1000);
+    }
+    cleanup_modbus();
+    return 0;
+}
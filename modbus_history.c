@@ -0,0 +1,388 @@
+#include "modbus_history.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HISTORY_READ_TRIES 4 // A ring lapped by the writer this often while it is read reports nothing
+
+static size_t rings_offset(void) {
+    return (sizeof(HistoryHeader) + HISTORY_CACHE_LINE - 1) / HISTORY_CACHE_LINE * HISTORY_CACHE_LINE;
+}
+
+static size_t segment_size(int ring_count, int depth) {
+    return rings_offset() + (size_t)ring_count * sizeof(HistoryRing) + (size_t)ring_count * depth * sizeof(HistorySlot);
+}
+
+static void history_layout(ModbusHistory* history, void* map, size_t size, bool writable) {
+    history->header = map;
+    history->rings = (HistoryRing*)((char*)map + rings_offset());
+    history->slots = (HistorySlot*)(history->rings + history->header->ring_count);
+    history->size = size;
+    history->mask = history->header->depth - 1;
+    history->writable = writable;
+}
+
+static HistorySlot* ring_slot(const ModbusHistory* history, int ring, uint64_t index) {
+    return &history->slots[(size_t)ring * history->header->depth + (index & history->mask)];
+}
+
+static void read_slot(const ModbusHistory* history, int ring, uint64_t index, HistoryEntry* entry) {
+    const HistorySlot* slot = ring_slot(history, ring, index);
+    uint64_t bits = atomic_load_explicit(&slot->value, memory_order_relaxed);
+    entry->time_ns = atomic_load_explicit(&slot->time_ns, memory_order_relaxed);
+    memcpy(&entry->value, &bits, sizeof(bits));
+}
+
+// First entry a reader may use, the slot of entry head - depth is the one the writer fills next
+static uint64_t ring_oldest(const ModbusHistory* history, uint64_t head) {
+    return head >= history->header->depth ? head - history->header->depth + 1 : 0;
+}
+
+// Entries from oldest on were not overwritten while they were read
+static bool ring_still_valid(const ModbusHistory* history, int ring, uint64_t oldest) {
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t head = atomic_load_explicit(&history->rings[ring].head, memory_order_relaxed);
+    return oldest + history->header->depth > head;
+}
+
+int64_t history_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint64_t ring_hash(const char* device, const char* name, int32_t kind) {
+    uint64_t h = 14695981039346656037ULL ^ (uint64_t)kind;
+    for (const char* p = device; *p; p++) h = (h ^ (uint8_t)*p) * 1099511628211ULL;
+    h = (h ^ '/') * 1099511628211ULL;
+    for (const char* p = name; *p; p++) h = (h ^ (uint8_t)*p) * 1099511628211ULL;
+    return h;
+}
+
+static bool same_ring(const HistoryRing* a, const HistoryRing* b) {
+    return a->kind == b->kind && a->address == b->address && strcmp(a->name, b->name) == 0 &&
+           strcmp(a->device, b->device) == 0;
+}
+
+// Last entries of a ring are carried into the new segment
+static void copy_ring(ModbusHistory* history, int ring, const ModbusHistory* previous, int from) {
+    uint64_t head = atomic_load_explicit(&previous->rings[from].head, memory_order_acquire);
+    uint64_t count = head - ring_oldest(previous, head);
+    if (count > history->header->depth) count = history->header->depth;
+
+    HistoryEntry entry;
+    for (uint64_t k = 0; k < count; k++) {
+        read_slot(previous, from, head - count + k, &entry);
+        history_record(history, ring, entry.time_ns, entry.value);
+    }
+}
+
+// Rings of the previous segment are matched to the new ones by device, name, kind and address
+static void adopt_rings(ModbusHistory* history, const ModbusHistory* previous) {
+    int count = (int)previous->header->ring_count;
+    size_t size = 1;
+    while (size < 2 * (size_t)count) size <<= 1;
+    int* table = malloc(size * sizeof(int));
+    if (!table) return;
+    for (size_t s = 0; s < size; s++) table[s] = -1;
+    for (int r = 0; r < count; r++) {
+        const HistoryRing* ring = &previous->rings[r];
+        size_t s = ring_hash(ring->device, ring->name, ring->kind) & (size - 1);
+        while (table[s] >= 0) s = (s + 1) & (size - 1);
+        table[s] = r;
+    }
+
+    for (int r = 0; r < (int)history->header->ring_count; r++) {
+        const HistoryRing* ring = &history->rings[r];
+        size_t s = ring_hash(ring->device, ring->name, ring->kind) & (size - 1);
+        for (; table[s] >= 0; s = (s + 1) & (size - 1)) {
+            if (!same_ring(ring, &previous->rings[table[s]])) continue;
+            copy_ring(history, r, previous, table[s]);
+            break;
+        }
+    }
+    free(table);
+}
+
+// New segment for the rings, in memory or in a file when filename is set. Entries of previous, or of
+// the file left by the last run when previous is NULL, are kept for the rings that still exist.
+// A file is built under a temporary name and renamed, so readers never map half a segment.
+bool history_open(ModbusHistory* history, const char* filename, const HistoryRing* rings, int ring_count, int depth,
+                  const ModbusHistory* previous) {
+    memset(history, 0, sizeof(ModbusHistory));
+    if (depth <= 0 || (depth & (depth - 1)) != 0) {
+        errno = EINVAL;
+        return false;
+    }
+    size_t size = segment_size(ring_count, depth);
+    bool file = filename && filename[0];
+    char temp[HISTORY_PATH_SIZE + 8];
+    void* map;
+
+    if (file) {
+        snprintf(temp, sizeof(temp), "%s.tmp", filename);
+        int fd = open(temp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        if (ftruncate(fd, (off_t)size) != 0) {
+            int error = errno;
+            close(fd);
+            unlink(temp);
+            errno = error;
+            return false;
+        }
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) unlink(temp);
+    } else {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (map == MAP_FAILED) return false;
+
+    // The segment is zero filled, the magic goes in last so a reader never sees half a header
+    HistoryHeader* header = map;
+    header->version = HISTORY_VERSION;
+    header->depth = (uint32_t)depth;
+    header->ring_count = (uint32_t)ring_count;
+    header->size = size;
+    header->created_ns = history_now_ns();
+    history_layout(history, map, size, true);
+    for (int r = 0; r < ring_count; r++) {
+        memcpy(history->rings[r].device, rings[r].device, HISTORY_NAME_SIZE);
+        memcpy(history->rings[r].name, rings[r].name, HISTORY_NAME_SIZE);
+        history->rings[r].kind = rings[r].kind;
+        history->rings[r].address = rings[r].address;
+    }
+
+    // A file left by a crash may end with good values, they were not good while nothing ran
+    ModbusHistory last;
+    if (previous && previous->header) {
+        adopt_rings(history, previous);
+    } else if (file && history_attach(&last, filename)) {
+        adopt_rings(history, &last);
+        history_close(&last);
+        history_mark_gap(history, header->created_ns);
+    }
+    atomic_thread_fence(memory_order_release);
+    header->magic = HISTORY_MAGIC;
+
+    if (file && rename(temp, filename) != 0) {
+        int error = errno;
+        history_close(history);
+        unlink(temp);
+        errno = error;
+        return false;
+    }
+    return true;
+}
+
+// Read-only view of a segment file, for tools next to a running HMI
+bool history_attach(ModbusHistory* history, const char* filename) {
+    memset(history, 0, sizeof(ModbusHistory));
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(HistoryHeader)) {
+        close(fd);
+        errno = EPROTO;
+        return false;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    const HistoryHeader* header = map;
+    bool valid = header->magic == HISTORY_MAGIC && header->version == HISTORY_VERSION && header->depth > 0 &&
+                 (header->depth & (header->depth - 1)) == 0 && header->depth <= HISTORY_MAX_DEPTH &&
+                 header->size == (uint64_t)st.st_size &&
+                 header->size == segment_size((int)header->ring_count, (int)header->depth);
+    if (!valid) {
+        munmap(map, st.st_size);
+        errno = EPROTO;
+        return false;
+    }
+    history_layout(history, map, st.st_size, false);
+    return true;
+}
+
+void history_close(ModbusHistory* history) {
+    if (history->header) munmap(history->header, history->size);
+    memset(history, 0, sizeof(ModbusHistory));
+}
+
+// Single writer, the slot is overwritten after the fence so a reader that sees the new slot also sees
+// the head that made its old entry invalid. Readers binary search on time, so a realtime clock stepped
+// back stamps entries with the time of the last one until it has caught up.
+void history_record(ModbusHistory* history, int ring, int64_t time_ns, double value) {
+    if (!history->header) return;
+    HistoryRing* r = &history->rings[ring];
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (head > 0) {
+        int64_t last = atomic_load_explicit(&ring_slot(history, ring, head - 1)->time_ns, memory_order_relaxed);
+        if (time_ns < last) time_ns = last;
+    }
+    HistorySlot* slot = ring_slot(history, ring, head);
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&slot->time_ns, time_ns, memory_order_relaxed);
+    atomic_store_explicit(&slot->value, bits, memory_order_relaxed);
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+// Every ring that does not end bad gets a bad entry, the writer calls it before it stops recording
+void history_mark_gap(ModbusHistory* history, int64_t time_ns) {
+    if (!history->header) return;
+    for (int r = 0; r < (int)history->header->ring_count; r++) {
+        double last;
+        if (history_value_at(history, r, INT64_MAX, &last) && !isnan(last)) history_record(history, r, time_ns, NAN);
+    }
+}
+
+// Value in force at time_ns, NAN while the quality was bad. False when the ring holds nothing that old.
+bool history_value_at(const ModbusHistory* history, int ring, int64_t time_ns, double* value) {
+    if (!history->header || ring < 0 || ring >= (int)history->header->ring_count) return false;
+    for (int tries = 0; tries < HISTORY_READ_TRIES; tries++) {
+        uint64_t head = atomic_load_explicit(&history->rings[ring].head, memory_order_acquire);
+        uint64_t oldest = ring_oldest(history, head);
+        uint64_t lo = oldest;
+        uint64_t hi = head;
+        HistoryEntry entry;
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            read_slot(history, ring, mid, &entry);
+            if (entry.time_ns <= time_ns) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo == oldest) return false;
+        read_slot(history, ring, lo - 1, &entry);
+        if (!ring_still_valid(history, ring, oldest)) continue;
+        *value = entry.value;
+        return true;
+    }
+    return false;
+}
+
+// Window that leaves out the first skip transitions stamped exactly from_ns, so a batch can resume after
+// entries sharing the time of the last one it copied
+static int window_after(const ModbusHistory* history, int ring, int64_t from_ns, uint64_t skip, int64_t to_ns,
+                        HistoryEntry* entries, int max_entries) {
+    for (int tries = 0; tries < HISTORY_READ_TRIES; tries++) {
+        uint64_t head = atomic_load_explicit(&history->rings[ring].head, memory_order_acquire);
+        uint64_t oldest = ring_oldest(history, head);
+        uint64_t lo = oldest;
+        uint64_t hi = head;
+        HistoryEntry entry;
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            read_slot(history, ring, mid, &entry);
+            if (entry.time_ns < from_ns) lo = mid + 1;
+            else hi = mid;
+        }
+        int n = 0;
+        uint64_t skipped = 0;
+        for (uint64_t i = lo; i < head && n < max_entries; i++) {
+            read_slot(history, ring, i, &entries[n]);
+            if (skipped < skip && entries[n].time_ns == from_ns) {
+                skipped++;
+                continue;
+            }
+            if (entries[n].time_ns > to_ns) break;
+            n++;
+        }
+        if (ring_still_valid(history, ring, oldest)) return n;
+    }
+    return 0;
+}
+
+// Transitions with from_ns <= time <= to_ns, oldest first, returns the number copied
+int history_window(const ModbusHistory* history, int ring, int64_t from_ns, int64_t to_ns,
+                   HistoryEntry* entries, int max_entries) {
+    if (!history->header || ring < 0 || ring >= (int)history->header->ring_count) return 0;
+    return window_after(history, ring, from_ns, 0, to_ns, entries, max_entries);
+}
+
+// Ring of a signal, device NULL matches any device, -1 when there is none
+int history_find(const ModbusHistory* history, const char* device, const char* name) {
+    if (!history->header) return -1;
+    for (int r = 0; r < (int)history->header->ring_count; r++) {
+        const HistoryRing* ring = &history->rings[r];
+        if (strcmp(ring->name, name) == 0 && (!device || strcmp(ring->device, device) == 0)) return r;
+    }
+    return -1;
+}
+
+static const char* kind_name(int32_t kind) {
+    switch (kind) {
+        case HISTORY_INPUT: return "Input";
+        case HISTORY_OUTPUT: return "Output";
+        default: return "Register";
+    }
+}
+
+static void export_csv_entry(FILE* file, const HistoryRing* ring, const HistoryEntry* entry) {
+    time_t second = (time_t)(entry->time_ns / 1000000000LL);
+    struct tm tm_value;
+    char stamp[32];
+    localtime_r(&second, &tm_value);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm_value);
+    fprintf(file, "%s.%03d,%s,%s,%s,%d,", stamp, (int)(entry->time_ns / 1000000LL % 1000), ring->device,
+            kind_name(ring->kind), ring->name, ring->address);
+    if (isnan(entry->value)) fprintf(file, ",bad\n");
+    else fprintf(file, "%.15g,good\n", entry->value);
+}
+
+// Every ring is written in batches of HISTORY_EXPORT_BATCH, so the export never copies a whole ring.
+// CSV has one line per transition. The binary format is the magic, uint16 version, uint32 ring count,
+// then device, name, int32 kind and int32 address of every ring, then uint32 ring, int64 time_ns and
+// double value per transition until the end of the file, host byte order.
+bool history_export(const ModbusHistory* history, FILE* file, HistoryExportFormat format, int64_t from_ns, int64_t to_ns) {
+    uint32_t ring_count = history->header ? history->header->ring_count : 0;
+    if (format == HISTORY_EXPORT_BINARY) {
+        uint16_t version = HISTORY_EXPORT_VERSION;
+        fwrite(HISTORY_EXPORT_MAGIC, 1, sizeof(HISTORY_EXPORT_MAGIC) - 1, file);
+        fwrite(&version, sizeof(version), 1, file);
+        fwrite(&ring_count, sizeof(ring_count), 1, file);
+        for (uint32_t r = 0; r < ring_count; r++) {
+            const HistoryRing* ring = &history->rings[r];
+            fwrite(ring->device, 1, HISTORY_NAME_SIZE, file);
+            fwrite(ring->name, 1, HISTORY_NAME_SIZE, file);
+            fwrite(&ring->kind, sizeof(ring->kind), 1, file);
+            fwrite(&ring->address, sizeof(ring->address), 1, file);
+        }
+    } else {
+        fprintf(file, "Time,Device,Type,Name,Address,Value,Quality\n");
+    }
+
+    HistoryEntry batch[HISTORY_EXPORT_BATCH];
+    for (uint32_t r = 0; r < ring_count; r++) {
+        int64_t from = from_ns;
+        uint64_t skip = 0; // Entries at time from already written
+        int n;
+        do {
+            n = window_after(history, (int)r, from, skip, to_ns, batch, HISTORY_EXPORT_BATCH);
+            for (int k = 0; k < n; k++) {
+                if (format == HISTORY_EXPORT_BINARY) {
+                    fwrite(&r, sizeof(r), 1, file);
+                    fwrite(&batch[k].time_ns, sizeof(batch[k].time_ns), 1, file);
+                    fwrite(&batch[k].value, sizeof(batch[k].value), 1, file);
+                } else {
+                    export_csv_entry(file, &history->rings[r], &batch[k]);
+                }
+            }
+            for (int k = 0; k < n; k++) {
+                if (batch[k].time_ns != from) {
+                    from = batch[k].time_ns;
+                    skip = 0;
+                }
+                skip++;
+            }
+        } while (n == HISTORY_EXPORT_BATCH);
+    }
+    return !ferror(file);
+}
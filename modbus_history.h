@@ -0,0 +1,88 @@
+#ifndef MODBUS_HISTORY_H
+#define MODBUS_HISTORY_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Constants
+#define HISTORY_MAGIC 0x534D424Du // "MBHS"
+#define HISTORY_VERSION 1
+#define HISTORY_EXPORT_MAGIC "MBHX"
+#define HISTORY_EXPORT_VERSION 1
+#define HISTORY_NAME_SIZE 64
+#define HISTORY_PATH_SIZE 64
+#define DEFAULT_HISTORY_DEPTH 256 // Slots per signal, a power of two, the newest depth - 1 transitions can be read
+#define HISTORY_MAX_DEPTH (1 << 20)
+#define HISTORY_EXPORT_BATCH 256 // Entries copied out of a ring at once while exporting
+#define HISTORY_CACHE_LINE 64
+
+typedef enum {
+    HISTORY_INPUT = 0,
+    HISTORY_OUTPUT,
+    HISTORY_REGISTER
+} HistoryKind;
+
+typedef enum {
+    HISTORY_EXPORT_CSV = 0,
+    HISTORY_EXPORT_BINARY
+} HistoryExportFormat;
+
+// One transition of a signal, value is NAN from the time its quality turned bad
+typedef struct {
+    int64_t time_ns; // CLOCK_REALTIME
+    double value;
+} HistoryEntry;
+
+// Slot of a ring, written with relaxed atomics so a reader racing the writer gets whole values
+typedef struct {
+    _Atomic int64_t time_ns;
+    _Atomic uint64_t value; // Bits of the double
+} HistorySlot;
+
+// Ring of one signal, head counts every entry ever written, the last depth of them are kept
+typedef struct {
+    char device[HISTORY_NAME_SIZE];
+    char name[HISTORY_NAME_SIZE];
+    int32_t kind;
+    int32_t address;
+    _Alignas(HISTORY_CACHE_LINE) _Atomic uint64_t head;
+} HistoryRing;
+
+// Start of the segment, the rings and then depth slots per ring follow
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t depth;
+    uint32_t ring_count;
+    uint64_t size;
+    int64_t created_ns; // CLOCK_REALTIME
+} HistoryHeader;
+
+// Segment in memory or mapped from a file, one writer thread and any number of readers
+typedef struct {
+    HistoryHeader* header;
+    HistoryRing* rings;
+    HistorySlot* slots;
+    size_t size;
+    uint64_t mask;
+    bool writable;
+} ModbusHistory;
+
+// Function prototypes
+bool history_open(ModbusHistory* history, const char* filename, const HistoryRing* rings, int ring_count, int depth,
+                  const ModbusHistory* previous);
+bool history_attach(ModbusHistory* history, const char* filename);
+void history_close(ModbusHistory* history);
+void history_record(ModbusHistory* history, int ring, int64_t time_ns, double value);
+void history_mark_gap(ModbusHistory* history, int64_t time_ns);
+bool history_value_at(const ModbusHistory* history, int ring, int64_t time_ns, double* value);
+int history_window(const ModbusHistory* history, int ring, int64_t from_ns, int64_t to_ns,
+                   HistoryEntry* entries, int max_entries);
+int history_find(const ModbusHistory* history, const char* device, const char* name);
+bool history_export(const ModbusHistory* history, FILE* file, HistoryExportFormat format, int64_t from_ns, int64_t to_ns);
+int64_t history_now_ns(void);
+
+#endif // MODBUS_HISTORY_H
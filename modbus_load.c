@@ -0,0 +1,232 @@
+#include "modbus_load.h"
+#include "modbus_tcp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#define LOAD_TICK_MS 10 // Timeouts and reconnects are handled this often
+#define LOAD_MAX_EVENTS 256
+#define LOAD_RETRY_MS 100
+
+typedef struct {
+    ModbusTcpClient client;
+    uint32_t events; // Registered epoll events, 0 while the socket is not registered
+    long long retry_ns;
+    bool read_coils; // Next read alternates between discrete inputs and coils
+} LoadPoller;
+
+// Every counter is written by the load thread only
+typedef struct {
+    MetricsCounter connected;
+    MetricsCounter connects;
+    MetricsCounter requests;
+    MetricsCounter responses;
+    MetricsCounter exceptions;
+    MetricsCounter failures;
+    MetricsHistogram latency;
+} LoadCounters;
+
+static ModbusLoadConfig load_cfg;
+static pthread_t load_thread;
+static atomic_bool load_running = false;
+static int load_epoll = -1;
+static LoadPoller* load_pollers = NULL;
+static uint32_t load_seed = 1;
+static LoadCounters load_counters;
+
+static long long load_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// xorshift32, only used from the load thread
+static uint32_t load_random(void) {
+    load_seed ^= load_seed << 13;
+    load_seed ^= load_seed >> 17;
+    load_seed ^= load_seed << 5;
+    return load_seed;
+}
+
+static void load_arm(LoadPoller* poller, uint32_t index) {
+    uint32_t events = EPOLLIN | (poller->client.state == MODBUS_TCP_CONNECTING || poller->client.tx_size > 0 ? EPOLLOUT : 0);
+    if (events == poller->events) return;
+    struct epoll_event ev = { .events = events, .data.u32 = index };
+    epoll_ctl(load_epoll, poller->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, poller->client.fd, &ev);
+    poller->events = events;
+}
+
+static void load_on_response(void* user, const ModbusTransaction* t, const uint8_t* pdu, int pdu_size) {
+    (void)user;
+    (void)pdu_size;
+    if (!pdu) {
+        metrics_add(&load_counters.failures, 1);
+        return;
+    }
+    metrics_record(&load_counters.latency, (uint64_t)(load_now_ns() - t->sent_ns));
+    if (pdu[0] & MODBUS_EXCEPTION_FLAG) metrics_add(&load_counters.exceptions, 1);
+    else metrics_add(&load_counters.responses, 1);
+}
+
+static void load_close(LoadPoller* poller, long long now) {
+    if (poller->client.state == MODBUS_TCP_CONNECTED) metrics_add(&load_counters.connected, (uint64_t)-1);
+    modbus_tcp_close(&poller->client, load_on_response, NULL); // Also drops the socket from the epoll set
+    poller->events = 0;
+    poller->retry_ns = now + LOAD_RETRY_MS * 1000000LL;
+}
+
+static void load_connect(LoadPoller* poller, uint32_t index, long long now) {
+    if (!modbus_tcp_connect(&poller->client, load_cfg.ip, load_cfg.port)) {
+        poller->retry_ns = now + LOAD_RETRY_MS * 1000000LL;
+        return;
+    }
+    if (poller->client.state == MODBUS_TCP_CONNECTED) {
+        metrics_add(&load_counters.connects, 1);
+        metrics_add(&load_counters.connected, 1);
+    }
+    load_arm(poller, index);
+}
+
+// Window is filled with reads of random ranges and the configured share of single coil writes
+static void load_fill(LoadPoller* poller, long long now) {
+    uint8_t pdu[MODBUS_TCP_MAX_PDU];
+    while (modbus_tcp_ready(&poller->client) && poller->client.in_flight < load_cfg.depth) {
+        int size;
+        if (load_cfg.coils > 0 && load_cfg.write_share > 0 && (load_random() >> 8) / 16777216.0 < load_cfg.write_share) {
+            size = modbus_pdu_write_bit(pdu, (int)(load_random() % (uint32_t)load_cfg.coils), load_random() & 1);
+        } else {
+            bool coils = load_cfg.inputs == 0 || (poller->read_coils && load_cfg.coils > 0);
+            int mapped = coils ? load_cfg.coils : load_cfg.inputs;
+            int count = mapped < MODBUS_MAX_READ_BITS ? mapped : MODBUS_MAX_READ_BITS;
+            int start = (int)(load_random() % (uint32_t)(mapped - count + 1));
+            size = modbus_pdu_read_bits(pdu, coils ? MODBUS_FC_READ_COILS : MODBUS_FC_READ_DISCRETE_INPUTS, start, count);
+            poller->read_coils = !poller->read_coils;
+        }
+        if (!modbus_tcp_request(&poller->client, pdu, size, 0, now)) break;
+        metrics_add(&load_counters.requests, 1);
+    }
+}
+
+static void load_handle(uint32_t index, uint32_t events, long long now) {
+    LoadPoller* poller = &load_pollers[index];
+    ModbusTcpClient* client = &poller->client;
+    if (client->state == MODBUS_TCP_CONNECTING) {
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) return;
+        if (!modbus_tcp_finish_connect(client)) {
+            load_close(poller, now);
+            return;
+        }
+        metrics_add(&load_counters.connects, 1);
+        metrics_add(&load_counters.connected, 1);
+    }
+    bool ok = !(events & (EPOLLERR | EPOLLHUP)) || (events & EPOLLIN);
+    if (ok && (events & EPOLLIN)) ok = modbus_tcp_receive(client, load_on_response, NULL);
+    if (ok) load_fill(poller, now);
+    if (ok) ok = modbus_tcp_flush(client);
+    if (ok) load_arm(poller, index);
+    else load_close(poller, now);
+}
+
+// Once per tick: requests past their timeout fail, broken connections are opened again
+static void load_tick(long long now) {
+    for (int p = 0; p < load_cfg.pollers; p++) {
+        LoadPoller* poller = &load_pollers[p];
+        if (poller->client.fd < 0) {
+            if (now >= poller->retry_ns) load_connect(poller, (uint32_t)p, now);
+            continue;
+        }
+        if (poller->client.state != MODBUS_TCP_CONNECTED) continue;
+        modbus_tcp_expire(&poller->client, now, load_on_response, NULL);
+        load_fill(poller, now);
+        if (modbus_tcp_flush(&poller->client)) load_arm(poller, (uint32_t)p);
+        else load_close(poller, now);
+    }
+}
+
+static void* load_thread_main(void* arg) {
+    (void)arg;
+    struct epoll_event events[LOAD_MAX_EVENTS];
+    long long tick_due = 0;
+    while (atomic_load(&load_running)) {
+        int n = epoll_wait(load_epoll, events, LOAD_MAX_EVENTS, LOAD_TICK_MS);
+        long long now = load_now_ns();
+        for (int e = 0; e < n; e++) load_handle(events[e].data.u32, events[e].events, now);
+        if (now >= tick_due) {
+            load_tick(now);
+            tick_due = now + LOAD_TICK_MS * 1000000LL;
+        }
+    }
+    return NULL;
+}
+
+static void load_release(void) {
+    for (int p = 0; load_pollers && p < load_cfg.pollers; p++) modbus_tcp_close(&load_pollers[p].client, NULL, NULL);
+    if (load_epoll >= 0) close(load_epoll);
+    load_epoll = -1;
+    free(load_pollers);
+    load_pollers = NULL;
+}
+
+// Connections are opened by the load thread, modbus_load_get_stats shows when they are up
+bool modbus_load_start(const ModbusLoadConfig* cfg) {
+    if (atomic_load(&load_running) || cfg->pollers < 1 || cfg->pollers > MODBUS_LOAD_MAX_POLLERS ||
+        cfg->depth < 1 || cfg->depth > MODBUS_TCP_MAX_WINDOW || (cfg->inputs < 1 && cfg->coils < 1)) return false;
+    load_cfg = *cfg;
+    load_seed = cfg->seed ? cfg->seed : 1;
+    memset(&load_counters, 0, sizeof(load_counters));
+
+    // Pollers and the server they load share one process, both ends of every connection need a descriptor
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    load_pollers = calloc(cfg->pollers, sizeof(LoadPoller));
+    load_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (!load_pollers || load_epoll < 0) {
+        fprintf(stderr, "Load setup failed: %s\n", strerror(errno));
+        load_release();
+        return false;
+    }
+    for (int p = 0; p < cfg->pollers; p++) {
+        modbus_tcp_init(&load_pollers[p].client, MODBUS_TRANSPORT_TCP, cfg->unit_id, cfg->depth, cfg->timeout_ms * 1000L, 0);
+        load_pollers[p].read_coils = p % 2;
+    }
+
+    atomic_store(&load_running, true);
+    if (pthread_create(&load_thread, NULL, load_thread_main, NULL) != 0) {
+        atomic_store(&load_running, false);
+        load_release();
+        return false;
+    }
+    return true;
+}
+
+void modbus_load_get_stats(ModbusLoadStats* stats) {
+    stats->connected = atomic_load(&load_counters.connected);
+    stats->connects = atomic_load(&load_counters.connects);
+    stats->requests = atomic_load(&load_counters.requests);
+    stats->responses = atomic_load(&load_counters.responses);
+    stats->exceptions = atomic_load(&load_counters.exceptions);
+    stats->failures = atomic_load(&load_counters.failures);
+    atomic_store(&stats->latency.count, atomic_load(&load_counters.latency.count));
+    atomic_store(&stats->latency.sum_ns, atomic_load(&load_counters.latency.sum_ns));
+    atomic_store(&stats->latency.max_ns, atomic_load(&load_counters.latency.max_ns));
+    for (int b = 0; b < METRICS_BUCKETS; b++) {
+        atomic_store(&stats->latency.buckets[b], atomic_load(&load_counters.latency.buckets[b]));
+    }
+}
+
+void modbus_load_stop(void) {
+    if (!atomic_exchange(&load_running, false)) return;
+    pthread_join(load_thread, NULL);
+    load_release();
+}
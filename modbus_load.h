@@ -0,0 +1,40 @@
+#ifndef MODBUS_LOAD_H
+#define MODBUS_LOAD_H
+
+#include <stdbool.h>
+#include "modbus_metrics.h"
+
+// Constants
+#define MODBUS_LOAD_MAX_POLLERS 4096
+
+// Many Modbus TCP masters polling one server, used by modbus_bench against the server mode
+typedef struct {
+    const char* ip;
+    int port;
+    int pollers; // Connections, each one is a separate master
+    int depth; // Requests in flight per connection
+    int unit_id;
+    int inputs; // Discrete inputs from address 0 that FC02 reads may cover
+    int coils; // Coils from address 0 that FC01 reads and FC05 writes may cover
+    double write_share; // Share of requests that write one coil, 0 to 1
+    int timeout_ms;
+    unsigned int seed;
+} ModbusLoadConfig;
+
+// Plain copy of the load counters, latency covers answered requests from send to response
+typedef struct {
+    unsigned long connected; // Connections up now
+    unsigned long connects;
+    unsigned long requests;
+    unsigned long responses;
+    unsigned long exceptions;
+    unsigned long failures; // Requests that timed out or were lost with their connection
+    MetricsHistogram latency;
+} ModbusLoadStats;
+
+// Function prototypes
+bool modbus_load_start(const ModbusLoadConfig* cfg);
+void modbus_load_get_stats(ModbusLoadStats* stats);
+void modbus_load_stop(void);
+
+#endif // MODBUS_LOAD_H
@@ -0,0 +1,568 @@
+#include "modbus_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+#define LOG_FORMAT_IDS 1024
+
+// Argument tags inside a record payload
+#define LOG_ARG_INT 'i'
+#define LOG_ARG_UINT 'u'
+#define LOG_ARG_DOUBLE 'f'
+#define LOG_ARG_STRING 's'
+
+typedef struct {
+    uint64_t time_ns;
+    const char* format; // String literal, see log_message
+    uint8_t level;
+    uint16_t size;
+    uint8_t payload[LOG_PAYLOAD_SIZE];
+} LogRecord;
+
+// Bounded multi-producer ring slot, sequence tells producers and the writer who owns it
+typedef struct {
+    atomic_size_t sequence;
+    LogRecord record;
+} LogSlot;
+
+// Rate bucket of one format string, claimed by its pointer for the life of the process
+typedef struct {
+    atomic_uintptr_t format; // Owner, 0 while the bucket is free
+    atomic_uintptr_t last; // Last suppressed format, only differs from the owner in the overflow bucket
+    atomic_ulong window;
+    atomic_uint count;
+    atomic_uint suppressed;
+} LogRateSite;
+
+// Parsed conversion specification of a printf format
+typedef struct {
+    char flags[8];
+    int width;      // -1 when absent, -2 for '*'
+    int precision;  // -1 when absent, -2 for '*'
+    char length[3];
+    char conversion;
+    const char* end;
+} LogSpec;
+
+// Global variables
+static LogSlot ring[LOG_RING_SIZE];
+static atomic_size_t enqueue_pos;
+static size_t dequeue_pos = 0;
+static LogRateSite rate_sites[LOG_RATE_SITES];
+static LogRateSite rate_overflow; // Shared by formats that find no free bucket
+static pthread_mutex_t log_start_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool ring_ready = false;
+static bool exit_registered = false;
+static pthread_t log_thread;
+static atomic_bool log_running = false;
+static atomic_int log_min_level = LOG_LEVEL_DEBUG;
+static atomic_int log_format = LOG_FORMAT_TEXT;
+static atomic_int log_rate = DEFAULT_LOG_RATE;
+static atomic_ulong log_dropped = 0;
+
+// Writer thread state
+static FILE* out_file = NULL;
+static int out_format = -1;
+static const char* format_ids[LOG_FORMAT_IDS];
+static int format_id_count = 0;
+static time_t stamp_second = 0;
+static char stamp_text[32];
+
+static uint64_t log_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// One conversion specification is parsed, p points just after '%'
+static const char* log_parse_spec(const char* p, LogSpec* spec) {
+    int n = 0;
+    memset(spec, 0, sizeof(LogSpec));
+    while (*p && strchr("-+ #0", *p) && n < (int)sizeof(spec->flags) - 1) spec->flags[n++] = *p++;
+
+    spec->width = -1;
+    if (*p == '*') {
+        spec->width = -2;
+        p++;
+    } else if (*p >= '0' && *p <= '9') {
+        spec->width = 0;
+        while (*p >= '0' && *p <= '9') spec->width = spec->width * 10 + (*p++ - '0');
+    }
+
+    spec->precision = -1;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->precision = -2;
+            p++;
+        } else {
+            spec->precision = 0;
+            while (*p >= '0' && *p <= '9') spec->precision = spec->precision * 10 + (*p++ - '0');
+        }
+    }
+
+    n = 0;
+    while (*p && strchr("hlLqjzt", *p) && n < (int)sizeof(spec->length) - 1) spec->length[n++] = *p++;
+    spec->conversion = *p;
+    spec->end = *p ? p + 1 : p;
+    return spec->end;
+}
+
+static bool log_put(LogRecord* record, const void* data, size_t size) {
+    if (record->size + size > LOG_PAYLOAD_SIZE) return false;
+    memcpy(record->payload + record->size, data, size);
+    record->size += (uint16_t)size;
+    return true;
+}
+
+static bool log_put_int(LogRecord* record, char tag, int64_t value) {
+    uint8_t t = (uint8_t)tag;
+    return log_put(record, &t, 1) && log_put(record, &value, sizeof(value));
+}
+
+// Payload bytes kept free for the conversions left in a format, a number takes a tag and 8 bytes
+static size_t log_reserve(const char* rest) {
+    size_t bytes = 0;
+    for (const char* p = rest; *p; p++) {
+        if (*p != '%') continue;
+        if (p[1] == '%') p++;
+        else bytes += 9;
+    }
+    return bytes;
+}
+
+// Arguments are copied into the record as tagged values, no text formatting on the caller thread
+static void log_pack(LogRecord* record, const char* format, va_list args) {
+    for (const char* p = format; *p; ) {
+        if (*p++ != '%') continue;
+        if (*p == '%') {
+            p++;
+            continue;
+        }
+
+        LogSpec spec;
+        p = log_parse_spec(p, &spec);
+        bool ok = true;
+        if (spec.width == -2) ok = log_put_int(record, LOG_ARG_INT, va_arg(args, int));
+        if (ok && spec.precision == -2) ok = log_put_int(record, LOG_ARG_INT, va_arg(args, int));
+        if (!ok) return;
+
+        bool is_long = spec.length[0] == 'l' || spec.length[0] == 'j' || spec.length[0] == 'z' ||
+                       spec.length[0] == 't' || spec.length[0] == 'q';
+        bool is_long_long = (spec.length[0] == 'l' && spec.length[1] == 'l') || spec.length[0] == 'j' ||
+                            spec.length[0] == 'q';
+        switch (spec.conversion) {
+            case 'd': case 'i':
+                if (is_long_long) ok = log_put_int(record, LOG_ARG_INT, va_arg(args, long long));
+                else if (is_long) ok = log_put_int(record, LOG_ARG_INT, va_arg(args, long));
+                else ok = log_put_int(record, LOG_ARG_INT, va_arg(args, int));
+                break;
+            case 'c':
+                ok = log_put_int(record, LOG_ARG_INT, va_arg(args, int));
+                break;
+            case 'u': case 'x': case 'X': case 'o':
+                if (is_long_long) ok = log_put_int(record, LOG_ARG_UINT, (int64_t)va_arg(args, unsigned long long));
+                else if (is_long) ok = log_put_int(record, LOG_ARG_UINT, (int64_t)va_arg(args, unsigned long));
+                else ok = log_put_int(record, LOG_ARG_UINT, (int64_t)va_arg(args, unsigned int));
+                break;
+            case 'p':
+                ok = log_put_int(record, LOG_ARG_UINT, (int64_t)(uintptr_t)va_arg(args, void*));
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            {
+                double value = spec.length[0] == 'L' ? (double)va_arg(args, long double) : va_arg(args, double);
+                uint8_t t = LOG_ARG_DOUBLE;
+                ok = log_put(record, &t, 1) && log_put(record, &value, sizeof(value));
+                break;
+            }
+            case 's':
+            {
+                const char* value = va_arg(args, const char*);
+                if (!value) value = "(null)";
+                size_t room = LOG_PAYLOAD_SIZE - record->size;
+                size_t reserve = log_reserve(p) + 2;
+                size_t limit = room > reserve ? room - reserve : 0;
+                if (limit > LOG_STRING_MAX) limit = LOG_STRING_MAX;
+                size_t length = strnlen(value, limit + 1);
+                bool cut = length > limit;
+                if (cut) length = limit;
+                uint8_t header[2] = { LOG_ARG_STRING, (uint8_t)length };
+                if (cut && length >= 3) {
+                    ok = log_put(record, header, 2) && log_put(record, value, length - 3) && log_put(record, "...", 3);
+                } else {
+                    ok = log_put(record, header, 2) && log_put(record, value, length);
+                }
+                break;
+            }
+            default:
+                return; // Unsupported conversion, the rest is rendered as '?'
+        }
+        if (!ok) return;
+    }
+}
+
+// Next tagged value of a payload, false when the payload is exhausted
+static bool log_take(const uint8_t** p, const uint8_t* end, char tag, int64_t* value, double* real,
+                     char* text, size_t text_size) {
+    if (*p >= end || **p != (uint8_t)tag) return false;
+    (*p)++;
+    if (tag == LOG_ARG_STRING) {
+        if (*p >= end) return false;
+        size_t length = **p;
+        (*p)++;
+        if (*p + length > end) return false;
+        size_t copy = length < text_size ? length : text_size - 1;
+        memcpy(text, *p, copy);
+        text[copy] = '\0';
+        *p += length;
+        return true;
+    }
+    if (*p + 8 > end) return false;
+    if (tag == LOG_ARG_DOUBLE) memcpy(real, *p, sizeof(double));
+    else memcpy(value, *p, sizeof(int64_t));
+    *p += 8;
+    return true;
+}
+
+// Format is rendered with the packed arguments of a record, used by the writer and the decoder
+size_t log_render(char* out, size_t size, const char* format, const uint8_t* payload, size_t payload_size) {
+    const uint8_t* p = payload;
+    const uint8_t* end = payload + payload_size;
+    size_t n = 0;
+    if (size == 0) return 0;
+
+    for (const char* f = format; *f && n + 1 < size; ) {
+        if (*f != '%') {
+            out[n++] = *f++;
+            continue;
+        }
+        f++;
+        if (*f == '%') {
+            out[n++] = *f++;
+            continue;
+        }
+
+        LogSpec spec;
+        f = log_parse_spec(f, &spec);
+        int64_t value = 0;
+        double real = 0;
+        char text[LOG_STRING_MAX + 1];
+        bool ok = true;
+        if (spec.width == -2) {
+            ok = log_take(&p, end, LOG_ARG_INT, &value, &real, text, sizeof(text));
+            spec.width = (int)value;
+        }
+        if (ok && spec.precision == -2) {
+            ok = log_take(&p, end, LOG_ARG_INT, &value, &real, text, sizeof(text));
+            spec.precision = (int)value;
+        }
+
+        // Conversion is rebuilt with explicit width/precision and the stored value size
+        char conversion[48];
+        int c = snprintf(conversion, sizeof(conversion), "%%%s", spec.flags);
+        if (spec.width >= 0) c += snprintf(conversion + c, sizeof(conversion) - c, "%d", spec.width);
+        if (spec.precision >= 0) c += snprintf(conversion + c, sizeof(conversion) - c, ".%d", spec.precision);
+
+        int written;
+        switch (spec.conversion) {
+            case 'd': case 'i': case 'c':
+                ok = ok && log_take(&p, end, LOG_ARG_INT, &value, &real, text, sizeof(text));
+                if (spec.conversion == 'c') snprintf(conversion + c, sizeof(conversion) - c, "c");
+                else snprintf(conversion + c, sizeof(conversion) - c, "lld");
+                written = ok ? snprintf(out + n, size - n, conversion,
+                                        spec.conversion == 'c' ? (int)value : (long long)value)
+                             : snprintf(out + n, size - n, "?");
+                break;
+            case 'u': case 'x': case 'X': case 'o': case 'p':
+                ok = ok && log_take(&p, end, LOG_ARG_UINT, &value, &real, text, sizeof(text));
+                snprintf(conversion + c, sizeof(conversion) - c, "ll%c",
+                         spec.conversion == 'p' ? 'x' : spec.conversion);
+                written = ok ? snprintf(out + n, size - n, conversion, (unsigned long long)value)
+                             : snprintf(out + n, size - n, "?");
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                ok = ok && log_take(&p, end, LOG_ARG_DOUBLE, &value, &real, text, sizeof(text));
+                snprintf(conversion + c, sizeof(conversion) - c, "%c", spec.conversion);
+                written = ok ? snprintf(out + n, size - n, conversion, real)
+                             : snprintf(out + n, size - n, "?");
+                break;
+            case 's':
+                ok = ok && log_take(&p, end, LOG_ARG_STRING, &value, &real, text, sizeof(text));
+                snprintf(conversion + c, sizeof(conversion) - c, "s");
+                written = ok ? snprintf(out + n, size - n, conversion, text)
+                             : snprintf(out + n, size - n, "?");
+                break;
+            default:
+                written = snprintf(out + n, size - n, "?");
+                break;
+        }
+        if (written < 0) break;
+        n += (size_t)written < size - n ? (size_t)written : size - n - 1;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+// Writer side file handling, text and binary logs are separate files
+static void log_open(int format) {
+    if (out_file && out_format == format) return;
+    if (out_file) fclose(out_file);
+
+    out_format = format;
+    format_id_count = 0;
+    out_file = fopen(format == LOG_FORMAT_BINARY ? LOG_BINARY_FILE : LOG_TEXT_FILE,
+                     format == LOG_FORMAT_BINARY ? "ab" : "a");
+    if (out_file && format == LOG_FORMAT_BINARY) {
+        // Every run starts with a header, format ids are only valid until the next one
+        uint16_t version = LOG_BINARY_VERSION;
+        fwrite(LOG_BINARY_MAGIC, 1, 4, out_file);
+        fwrite(&version, sizeof(version), 1, out_file);
+    }
+}
+
+static int log_format_id(const char* format) {
+    for (int i = 0; i < format_id_count; i++) {
+        if (format_ids[i] == format) return i;
+    }
+    if (format_id_count == LOG_FORMAT_IDS) return -1;
+
+    uint8_t type = LOG_RECORD_FORMAT;
+    uint16_t id = (uint16_t)format_id_count;
+    uint16_t length = (uint16_t)strlen(format);
+    fwrite(&type, 1, 1, out_file);
+    fwrite(&id, sizeof(id), 1, out_file);
+    fwrite(&length, sizeof(length), 1, out_file);
+    fwrite(format, 1, length, out_file);
+    format_ids[format_id_count] = format;
+    return format_id_count++;
+}
+
+static void log_write_record(const LogRecord* record) {
+    log_open(atomic_load_explicit(&log_format, memory_order_relaxed));
+    if (!out_file) return;
+
+    if (out_format == LOG_FORMAT_BINARY) {
+        int id = log_format_id(record->format);
+        if (id < 0) return;
+        uint8_t type = LOG_RECORD_EVENT;
+        uint16_t format_id = (uint16_t)id;
+        fwrite(&type, 1, 1, out_file);
+        fwrite(&record->time_ns, sizeof(record->time_ns), 1, out_file);
+        fwrite(&record->level, 1, 1, out_file);
+        fwrite(&format_id, sizeof(format_id), 1, out_file);
+        fwrite(&record->size, sizeof(record->size), 1, out_file);
+        fwrite(record->payload, 1, record->size, out_file);
+        return;
+    }
+
+    // Timestamp text is cached, localtime and strftime run once per second at most
+    time_t second = (time_t)(record->time_ns / 1000000000ull);
+    if (second != stamp_second) {
+        struct tm tm_value;
+        localtime_r(&second, &tm_value);
+        strftime(stamp_text, sizeof(stamp_text), "%Y-%m-%d %H:%M:%S", &tm_value);
+        stamp_second = second;
+    }
+    char line[LOG_LINE_MAX];
+    log_render(line, sizeof(line), record->format, record->payload, record->size);
+    fprintf(out_file, "[%s] %s\n", stamp_text, line);
+}
+
+static bool log_dequeue(LogRecord* record) {
+    LogSlot* slot = &ring[dequeue_pos & LOG_RING_MASK];
+    size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    if (sequence != dequeue_pos + 1) return false;
+
+    *record = slot->record;
+    atomic_store_explicit(&slot->sequence, dequeue_pos + LOG_RING_SIZE, memory_order_release);
+    dequeue_pos++;
+    return true;
+}
+
+// Everything queued is written in one batch and flushed once
+static void log_drain(void) {
+    LogRecord record;
+    int written = 0;
+    while (log_dequeue(&record)) {
+        log_write_record(&record);
+        written++;
+    }
+
+    unsigned long dropped = atomic_exchange(&log_dropped, 0);
+    if (dropped) {
+        memset(&record, 0, sizeof(record));
+        record.time_ns = log_now_ns();
+        record.level = LOG_LEVEL_WARN;
+        record.format = "WARNING: %lu log records dropped, log ring full";
+        log_put_int(&record, LOG_ARG_UINT, (int64_t)dropped);
+        log_write_record(&record);
+        written++;
+    }
+    if (written && out_file) fflush(out_file);
+}
+
+static void* log_thread_main(void* arg) {
+    (void)arg;
+    struct timespec ts = { 0, LOG_FLUSH_MS * 1000000L };
+    while (atomic_load(&log_running)) {
+        log_drain();
+        nanosleep(&ts, NULL);
+    }
+    log_drain();
+    return NULL;
+}
+
+// Writer thread is started by the first message, and again after log_shutdown
+static void log_start(void) {
+    pthread_mutex_lock(&log_start_lock);
+    if (!ring_ready) {
+        for (size_t i = 0; i < LOG_RING_SIZE; i++) atomic_init(&ring[i].sequence, i);
+        atomic_init(&enqueue_pos, 0);
+        ring_ready = true;
+    }
+    if (!atomic_load(&log_running)) {
+        atomic_store(&log_running, true);
+        if (pthread_create(&log_thread, NULL, log_thread_main, NULL) != 0) {
+            atomic_store(&log_running, false);
+        } else if (!exit_registered) {
+            atexit(log_shutdown);
+            exit_registered = true;
+        }
+    }
+    pthread_mutex_unlock(&log_start_lock);
+}
+
+static bool log_enqueue(LogLevel level, const char* format, va_list args) {
+    size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    LogSlot* slot;
+    for (;;) {
+        slot = &ring[pos & LOG_RING_MASK];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            atomic_fetch_add(&log_dropped, 1);
+            return false;
+        } else {
+            pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    LogRecord* record = &slot->record;
+    record->time_ns = log_now_ns();
+    record->format = format;
+    record->level = (uint8_t)level;
+    record->size = 0;
+    log_pack(record, format, args);
+    atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+    return true;
+}
+
+static void log_enqueue_args(LogLevel level, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    log_enqueue(level, format, args);
+    va_end(args);
+}
+
+// Bucket owned by exactly this format, found by linear probing from its hash
+static LogRateSite* log_rate_site(uintptr_t key) {
+    size_t i = (size_t)(((uint64_t)key * 0x9E3779B97F4A7C15ull) >> 40) & (LOG_RATE_SITES - 1);
+    for (int probe = 0; probe < LOG_RATE_SITES; probe++) {
+        LogRateSite* site = &rate_sites[i];
+        uintptr_t owner = atomic_load_explicit(&site->format, memory_order_acquire);
+        // A lost race for a free bucket leaves the winner in owner
+        if (owner == 0 && atomic_compare_exchange_strong(&site->format, &owner, key)) return site;
+        if (owner == key) return site;
+        i = (i + 1) & (LOG_RATE_SITES - 1);
+    }
+    return &rate_overflow;
+}
+
+// Each format string gets its own rate bucket per second, a flood of one message cannot bury the others
+static bool log_rate_allow(const char* format, uint64_t now_ns) {
+    int limit = atomic_load_explicit(&log_rate, memory_order_relaxed);
+    if (limit <= 0) return true;
+
+    uintptr_t key = (uintptr_t)format;
+    LogRateSite* site = log_rate_site(key);
+    unsigned long second = (unsigned long)(now_ns / 1000000000ull);
+    unsigned long window = atomic_load_explicit(&site->window, memory_order_relaxed);
+
+    if (window != second &&
+        atomic_compare_exchange_strong(&site->window, &window, second)) {
+        unsigned int suppressed = atomic_exchange(&site->suppressed, 0);
+        const char* previous = (const char*)atomic_load(&site->last);
+        atomic_store(&site->count, 0);
+        if (suppressed) {
+            log_enqueue_args(LOG_LEVEL_WARN, "WARNING: %u messages suppressed: %s",
+                             suppressed, previous ? previous : "");
+        }
+    }
+
+    if (atomic_fetch_add_explicit(&site->count, 1, memory_order_relaxed) < (unsigned int)limit) return true;
+    atomic_store_explicit(&site->last, key, memory_order_relaxed);
+    atomic_fetch_add_explicit(&site->suppressed, 1, memory_order_relaxed);
+    return false;
+}
+
+// Non-blocking log entry point, the record is formatted later by the writer thread
+void log_vmessage(LogLevel level, const char* format, va_list args) {
+    if ((int)level < atomic_load_explicit(&log_min_level, memory_order_relaxed)) return;
+
+    if (!atomic_load_explicit(&log_running, memory_order_acquire)) log_start();
+    if (!log_rate_allow(format, log_now_ns())) return;
+    log_enqueue(level, format, args);
+}
+
+void log_message_impl(LogLevel level, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    log_vmessage(level, format, args);
+    va_end(args);
+}
+
+void log_configure(LogLevel min_level, LogFormat format, int rate_limit) {
+    atomic_store(&log_min_level, min_level);
+    atomic_store(&log_format, format);
+    atomic_store(&log_rate, rate_limit);
+}
+
+// debug, info, warning (or warn) or error, false for anything else
+bool log_parse_level(const char* name, LogLevel* level) {
+    if (strcmp(name, "debug") == 0) *level = LOG_LEVEL_DEBUG;
+    else if (strcmp(name, "info") == 0) *level = LOG_LEVEL_INFO;
+    else if (strcmp(name, "warning") == 0 || strcmp(name, "warn") == 0) *level = LOG_LEVEL_WARN;
+    else if (strcmp(name, "error") == 0) *level = LOG_LEVEL_ERROR;
+    else return false;
+    return true;
+}
+
+// text or binary, false for anything else
+bool log_parse_format(const char* name, LogFormat* format) {
+    if (strcmp(name, "text") == 0) *format = LOG_FORMAT_TEXT;
+    else if (strcmp(name, "binary") == 0) *format = LOG_FORMAT_BINARY;
+    else return false;
+    return true;
+}
+
+// Queued records are written and the writer thread is stopped
+void log_shutdown(void) {
+    pthread_mutex_lock(&log_start_lock);
+    if (atomic_exchange(&log_running, false)) {
+        pthread_join(log_thread, NULL);
+    }
+    pthread_mutex_unlock(&log_start_lock);
+    if (out_file) {
+        fclose(out_file);
+        out_file = NULL;
+        out_format = -1;
+    }
+}
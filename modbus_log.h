@@ -0,0 +1,55 @@
+#ifndef MODBUS_LOG_H
+#define MODBUS_LOG_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Constants
+#define LOG_TEXT_FILE "trackcircuit.log"
+#define LOG_BINARY_FILE "trackcircuit.bin"
+#define LOG_RING_SIZE 1024 // Records, must be a power of two
+#define LOG_PAYLOAD_SIZE 200 // Packed argument bytes per record
+// Longest %s argument kept in a record, less when the payload has no room for it and the arguments after
+// it. A longer one is cut and ends in "..." so the line shows it is not whole.
+#define LOG_STRING_MAX 128
+#define LOG_LINE_MAX 1024
+#define LOG_FLUSH_MS 20 // Writer thread sleep when the ring is empty
+#define LOG_RATE_SITES 512 // Rate limit buckets, one per format string, must be a power of two
+#define DEFAULT_LOG_RATE 100 // Lines per second per format string, 0 for no limit
+#define LOG_BINARY_MAGIC "MBLG"
+#define LOG_BINARY_VERSION 1
+
+typedef enum {
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR
+} LogLevel;
+
+typedef enum {
+    LOG_FORMAT_TEXT = 0,
+    LOG_FORMAT_BINARY
+} LogFormat;
+
+// Binary log file records, host byte order
+typedef enum {
+    LOG_RECORD_FORMAT = 1, // uint16 id, uint16 length, format string
+    LOG_RECORD_EVENT = 2   // uint64 time ns, uint8 level, uint16 format id, uint16 size, payload
+} LogRecordType;
+
+// Formats are kept by pointer and rendered later on the writer thread, so they must be string literals.
+// Pasting "" in front makes anything else a compile error.
+#define log_message(level, format, ...) log_message_impl(level, "" format, ##__VA_ARGS__)
+
+// Function prototypes
+void log_message_impl(LogLevel level, const char* format, ...);
+void log_vmessage(LogLevel level, const char* format, va_list args); // format as for log_message
+void log_configure(LogLevel min_level, LogFormat format, int rate_limit);
+bool log_parse_level(const char* name, LogLevel* level);
+bool log_parse_format(const char* name, LogFormat* format);
+void log_shutdown(void);
+size_t log_render(char* out, size_t size, const char* format, const uint8_t* payload, size_t payload_size);
+
+#endif // MODBUS_LOG_H
@@ -0,0 +1,105 @@
+/*
+ * Decoder for binary logs written with log_format=binary.
+ * Usage: modbus_logdump [-l debug|info|warning|error] [trackcircuit.bin]
+ * Build: gcc -o modbus_logdump modbus_logdump.c modbus_log.c -lpthread
+ */
+#include "modbus_log.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DUMP_MAX_FORMATS 1024
+
+static char* formats[DUMP_MAX_FORMATS];
+
+static void clear_formats(void) {
+    for (int i = 0; i < DUMP_MAX_FORMATS; i++) {
+        free(formats[i]);
+        formats[i] = NULL;
+    }
+}
+
+static bool read_exact(FILE* file, void* data, size_t size) {
+    return fread(data, 1, size, file) == size;
+}
+
+int main(int argc, char** argv) {
+    const char* path = LOG_BINARY_FILE;
+    LogLevel min_level = LOG_LEVEL_DEBUG;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            if (!log_parse_level(argv[++i], &min_level)) {
+                fprintf(stderr, "Unknown level %s, use debug, info, warning or error\n", argv[i]);
+                return 1;
+            }
+        } else {
+            path = argv[i];
+        }
+    }
+
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Unable to open %s\n", path);
+        return 1;
+    }
+
+    int type;
+    while ((type = fgetc(file)) != EOF) {
+        if (type == LOG_BINARY_MAGIC[0]) {
+            // Header of a new run, format ids start over
+            char magic[3];
+            uint16_t version;
+            if (!read_exact(file, magic, 3) || memcmp(magic, LOG_BINARY_MAGIC + 1, 3) != 0 ||
+                !read_exact(file, &version, sizeof(version)) || version != LOG_BINARY_VERSION) {
+                fprintf(stderr, "Unsupported log header\n");
+                break;
+            }
+            clear_formats();
+        } else if (type == LOG_RECORD_FORMAT) {
+            uint16_t id, length;
+            if (!read_exact(file, &id, sizeof(id)) || !read_exact(file, &length, sizeof(length))) break;
+            char* format = malloc(length + 1);
+            if (!format || !read_exact(file, format, length)) {
+                free(format);
+                break;
+            }
+            format[length] = '\0';
+            if (id < DUMP_MAX_FORMATS) {
+                free(formats[id]);
+                formats[id] = format;
+            } else {
+                free(format);
+            }
+        } else if (type == LOG_RECORD_EVENT) {
+            uint64_t time_ns;
+            uint8_t level;
+            uint16_t id, size;
+            uint8_t payload[LOG_PAYLOAD_SIZE];
+            if (!read_exact(file, &time_ns, sizeof(time_ns)) || !read_exact(file, &level, 1) ||
+                !read_exact(file, &id, sizeof(id)) || !read_exact(file, &size, sizeof(size)) ||
+                size > LOG_PAYLOAD_SIZE || !read_exact(file, payload, size)) break;
+            if (level < min_level) continue;
+
+            char line[LOG_LINE_MAX];
+            const char* format = id < DUMP_MAX_FORMATS && formats[id] ? formats[id] : "<unknown format>";
+            log_render(line, sizeof(line), format, payload, size);
+
+            time_t second = (time_t)(time_ns / 1000000000ull);
+            struct tm tm_value;
+            char stamp[32];
+            localtime_r(&second, &tm_value);
+            strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm_value);
+            printf("[%s.%06u] %s\n", stamp, (unsigned int)(time_ns % 1000000000ull / 1000), line);
+        } else {
+            fprintf(stderr, "Corrupt record at offset %ld\n", ftell(file) - 1);
+            break;
+        }
+    }
+
+    clear_formats();
+    fclose(file);
+    return 0;
+}
@@ -0,0 +1,164 @@
+#include "modbus_metrics.h"
+#include <errno.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Header of a fresh segment, every counter starts at zero
+void metrics_init(ModbusMetrics* metrics) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    memset(metrics, 0, sizeof(ModbusMetrics));
+    metrics->magic = METRICS_MAGIC;
+    metrics->version = METRICS_VERSION;
+    metrics->size = sizeof(ModbusMetrics);
+    metrics->buckets = METRICS_BUCKETS;
+    metrics->unit_shift = METRICS_UNIT_SHIFT;
+    metrics->sub_bits = METRICS_SUB_BITS;
+    metrics->pid = (int32_t)getpid();
+    metrics->start_time_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Process that created the segment under the name is still running, an earlier run that died does not count
+static bool metrics_owner_alive(const char* name) {
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) return false;
+    struct stat st;
+    bool alive = false;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)offsetof(ModbusMetrics, device_count)) {
+        const ModbusMetrics* old = mmap(NULL, offsetof(ModbusMetrics, device_count), PROT_READ, MAP_SHARED, fd, 0);
+        if (old != MAP_FAILED) {
+            int32_t pid = old->magic == METRICS_MAGIC ? old->pid : 0;
+            alive = pid > 0 && pid != getpid() && (kill(pid, 0) == 0 || errno != ESRCH);
+            munmap((void*)old, offsetof(ModbusMetrics, device_count));
+        }
+    }
+    close(fd);
+    return alive;
+}
+
+// Exclusive flock on the object <name>.lock, which is never removed. -1 with EBUSY while another process
+// holds it and -1 with errno when it cannot be opened.
+static int metrics_lock(const char* name) {
+    char lock_name[256];
+    if (snprintf(lock_name, sizeof(lock_name), "%s.lock", name) >= (int)sizeof(lock_name)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = shm_open(lock_name, O_CREAT | O_RDONLY | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        int err = errno == EWOULDBLOCK ? EBUSY : errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+static ModbusMetrics* metrics_replace(const char* name) {
+    if (metrics_owner_alive(name)) {
+        errno = EBUSY;
+        return NULL;
+    }
+    shm_unlink(name);
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0) return NULL;
+    if (ftruncate(fd, sizeof(ModbusMetrics)) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    void* map = mmap(NULL, sizeof(ModbusMetrics), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+    metrics_init(map);
+    return map;
+}
+
+// Fresh segment under the name, taken over from an earlier run, NULL with EBUSY when another running
+// process owns it or is taking it over, and NULL when shared memory is not available. The lock is held
+// from the owner check until the new segment carries our pid, so two processes cannot both take it over.
+ModbusMetrics* metrics_create(const char* name) {
+    int lock = metrics_lock(name);
+    if (lock < 0) return NULL;
+    ModbusMetrics* metrics = metrics_replace(name);
+    int err = errno;
+    close(lock);
+    errno = err;
+    return metrics;
+}
+
+// Segment is unmapped and removed, readers that still have it mapped keep the last values
+void metrics_destroy(ModbusMetrics* metrics, const char* name) {
+    munmap(metrics, sizeof(ModbusMetrics));
+    shm_unlink(name);
+}
+
+// Read-only mapping for readers, NULL when there is no segment or it was written by another version
+const ModbusMetrics* metrics_attach(const char* name) {
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ModbusMetrics)) {
+        close(fd);
+        return NULL;
+    }
+    const ModbusMetrics* metrics = mmap(NULL, sizeof(ModbusMetrics), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (metrics == MAP_FAILED) return NULL;
+    if (metrics->magic != METRICS_MAGIC || metrics->version != METRICS_VERSION ||
+        metrics->size != sizeof(ModbusMetrics) || metrics->buckets != METRICS_BUCKETS ||
+        metrics->unit_shift != METRICS_UNIT_SHIFT || metrics->sub_bits != METRICS_SUB_BITS) {
+        munmap((void*)metrics, sizeof(ModbusMetrics));
+        return NULL;
+    }
+    return metrics;
+}
+
+void metrics_detach(const ModbusMetrics* metrics) {
+    munmap((void*)metrics, sizeof(ModbusMetrics));
+}
+
+// Exclusive upper bound of a bucket in nanoseconds
+uint64_t metrics_bucket_high_ns(int bucket) {
+    if (bucket < METRICS_SUB_BUCKETS) return (uint64_t)(bucket + 1) << METRICS_UNIT_SHIFT;
+    int shift = bucket / METRICS_SUB_BUCKETS - 1;
+    uint64_t low = (uint64_t)(METRICS_SUB_BUCKETS + bucket % METRICS_SUB_BUCKETS) << shift;
+    return (low + ((uint64_t)1 << shift)) << METRICS_UNIT_SHIFT;
+}
+
+// Upper bound of the bucket holding the p quantile, capped by the largest value seen, 0 when empty
+uint64_t metrics_percentile_ns(const MetricsHistogram* h, double p) {
+    uint64_t counts[METRICS_BUCKETS];
+    uint64_t total = 0;
+    for (int b = 0; b < METRICS_BUCKETS; b++) {
+        counts[b] = atomic_load_explicit(&h->buckets[b], memory_order_relaxed);
+        total += counts[b];
+    }
+    if (total == 0) return 0;
+
+    uint64_t rank = (uint64_t)(p * total + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t max_ns = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+    uint64_t seen = 0;
+    for (int b = 0; b < METRICS_BUCKETS; b++) {
+        seen += counts[b];
+        if (seen >= rank) {
+            uint64_t high = metrics_bucket_high_ns(b);
+            return max_ns && max_ns < high ? max_ns : high;
+        }
+    }
+    return max_ns;
+}
@@ -0,0 +1,101 @@
+#ifndef MODBUS_METRICS_H
+#define MODBUS_METRICS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Constants
+#define MODBUS_METRICS_NAME "/modbus_metrics" // Default POSIX shared memory name, see metrics_name
+#define METRICS_MAGIC 0x544D424Du // "MBMT"
+#define METRICS_VERSION 2
+#define METRICS_MAX_DEVICES 32 // Devices past this are added to the counters of the last slot
+#define METRICS_NAME_SIZE 64
+#define METRICS_SUB_BITS 3 // 8 sub-buckets per power of two, values are kept within 12.5 %
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BITS)
+#define METRICS_BUCKETS 256 // Up to 2^34 units, about 18 minutes
+#define METRICS_UNIT_SHIFT 6 // Histograms count in units of 64 ns
+
+typedef _Atomic uint64_t MetricsCounter;
+
+// Log-linear latency histogram in the style of HdrHistogram, values are nanoseconds
+typedef struct {
+    MetricsCounter count;
+    MetricsCounter sum_ns;
+    MetricsCounter max_ns;
+    MetricsCounter buckets[METRICS_BUCKETS];
+} MetricsHistogram;
+
+// Counters of one device, written by the I/O thread except output_changes which the draw thread writes
+typedef struct {
+    char name[METRICS_NAME_SIZE];
+    char server[METRICS_NAME_SIZE];
+    MetricsCounter requests;
+    MetricsCounter responses;
+    MetricsCounter timeouts;
+    MetricsCounter read_errors;
+    MetricsCounter write_errors;
+    MetricsCounter bytes_sent;
+    MetricsCounter bytes_received;
+    MetricsCounter connects;
+    MetricsCounter reconnects; // Connects after the first one
+    MetricsCounter connect_failures;
+    MetricsCounter disconnects;
+    MetricsCounter input_changes; // Bits that changed between two reads of the slave
+    MetricsCounter output_changes; // Outputs the draw thread changed
+    MetricsCounter poll_misses; // Poll deadlines dropped because the device was still busy
+    MetricsCounter retransmits; // UDP reads sent again because no answer came in time
+    MetricsHistogram connect;
+    MetricsHistogram read;
+    MetricsHistogram write;
+} MetricsDevice;
+
+// Shared memory segment, readers check magic, version and size before they trust anything else
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t buckets;
+    uint32_t unit_shift;
+    uint32_t sub_bits;
+    int32_t pid;
+    _Atomic uint32_t device_count;
+    uint64_t start_time_ns; // CLOCK_REALTIME when the segment was created
+    MetricsCounter generation; // Bumped whenever the device slots are reassigned by a config reload
+    MetricsCounter cycles;
+    MetricsHistogram cycle; // Duration of update_modbus_values and read_modbus_values
+    MetricsDevice devices[METRICS_MAX_DEVICES];
+} ModbusMetrics;
+
+// Every counter has a single writer thread, so a relaxed load and store is enough and avoids a locked add
+static inline void metrics_add(MetricsCounter* counter, uint64_t value) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+static inline int metrics_bucket(uint64_t ns) {
+    uint64_t units = ns >> METRICS_UNIT_SHIFT;
+    if (units < METRICS_SUB_BUCKETS) return (int)units;
+    int shift = 63 - __builtin_clzll(units) - METRICS_SUB_BITS;
+    int bucket = (shift + 1) * METRICS_SUB_BUCKETS + (int)((units >> shift) - METRICS_SUB_BUCKETS);
+    return bucket < METRICS_BUCKETS ? bucket : METRICS_BUCKETS - 1;
+}
+
+static inline void metrics_record(MetricsHistogram* h, uint64_t ns) {
+    metrics_add(&h->count, 1);
+    metrics_add(&h->sum_ns, ns);
+    metrics_add(&h->buckets[metrics_bucket(ns)], 1);
+    if (ns > atomic_load_explicit(&h->max_ns, memory_order_relaxed)) {
+        atomic_store_explicit(&h->max_ns, ns, memory_order_relaxed);
+    }
+}
+
+// Function prototypes
+ModbusMetrics* metrics_create(const char* name);
+void metrics_destroy(ModbusMetrics* metrics, const char* name);
+void metrics_init(ModbusMetrics* metrics);
+const ModbusMetrics* metrics_attach(const char* name);
+void metrics_detach(const ModbusMetrics* metrics);
+uint64_t metrics_bucket_high_ns(int bucket);
+uint64_t metrics_percentile_ns(const MetricsHistogram* h, double p);
+
+#endif // MODBUS_METRICS_H
@@ -0,0 +1,176 @@
+/*
+ * Reader for the runtime metrics segment of a running HMI.
+ * Usage: modbus_metricsdump [-p] [-w seconds] [/modbus_metrics]
+ * -p prints Prometheus text format, -w repeats every few seconds.
+ * Build: gcc -o modbus_metricsdump modbus_metricsdump.c modbus_metrics.c -lrt
+ */
+#include "modbus_metrics.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    const char* name;
+    const char* help;
+    size_t offset;
+} CounterInfo;
+
+typedef struct {
+    const char* name;
+    const char* help;
+    size_t offset;
+} HistogramInfo;
+
+#define COUNTER(field, help) { #field, help, offsetof(MetricsDevice, field) }
+
+static const CounterInfo counters[] = {
+    COUNTER(requests, "Requests sent"),
+    COUNTER(responses, "Responses received"),
+    COUNTER(timeouts, "Requests that got no response in time"),
+    COUNTER(read_errors, "Reads answered with an exception or not at all"),
+    COUNTER(write_errors, "Writes answered with an exception or not at all"),
+    COUNTER(bytes_sent, "Modbus bytes sent"),
+    COUNTER(bytes_received, "Modbus bytes received"),
+    COUNTER(connects, "Connections established"),
+    COUNTER(reconnects, "Connections established after the first one"),
+    COUNTER(connect_failures, "Connect attempts that failed"),
+    COUNTER(disconnects, "Established connections that were lost"),
+    COUNTER(input_changes, "Bits that changed between two reads"),
+    COUNTER(output_changes, "Outputs changed by the HMI"),
+    COUNTER(poll_misses, "Poll deadlines dropped because the device was busy"),
+    COUNTER(retransmits, "UDP reads sent again after a timeout"),
+};
+
+static const HistogramInfo histograms[] = {
+    { "connect", "Time to establish a connection", offsetof(MetricsDevice, connect) },
+    { "read", "Round trip time of read requests", offsetof(MetricsDevice, read) },
+    { "write", "Round trip time of write requests", offsetof(MetricsDevice, write) },
+};
+
+static uint64_t load(const MetricsCounter* counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static const MetricsCounter* device_counter(const MetricsDevice* dev, size_t offset) {
+    return (const MetricsCounter*)((const char*)dev + offset);
+}
+
+static const MetricsHistogram* device_histogram(const MetricsDevice* dev, size_t offset) {
+    return (const MetricsHistogram*)((const char*)dev + offset);
+}
+
+static int device_count(const ModbusMetrics* m) {
+    uint32_t count = atomic_load(&m->device_count);
+    return count < METRICS_MAX_DEVICES ? (int)count : METRICS_MAX_DEVICES;
+}
+
+static void print_histogram(const char* name, const MetricsHistogram* h) {
+    uint64_t count = load(&h->count);
+    if (count == 0) {
+        printf("  %-8s no samples\n", name);
+        return;
+    }
+    printf("  %-8s %10llu samples, avg %9.1f us, p50 %9.1f, p99 %9.1f, p99.9 %9.1f, max %9.1f\n", name,
+           (unsigned long long)count, load(&h->sum_ns) / 1000.0 / count,
+           metrics_percentile_ns(h, 0.50) / 1000.0, metrics_percentile_ns(h, 0.99) / 1000.0,
+           metrics_percentile_ns(h, 0.999) / 1000.0, load(&h->max_ns) / 1000.0);
+}
+
+static void print_text(const ModbusMetrics* m, const char* name) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    double uptime = ts.tv_sec + ts.tv_nsec / 1e9 - m->start_time_ns / 1e9;
+    printf("%s: pid %d, up %.0f s, %llu cycles\n", name, m->pid, uptime, (unsigned long long)load(&m->cycles));
+    print_histogram("cycle", &m->cycle);
+
+    for (int d = 0; d < device_count(m); d++) {
+        const MetricsDevice* dev = &m->devices[d];
+        printf("device %s at %s\n", dev->name, dev->server);
+        for (size_t c = 0; c < sizeof(counters) / sizeof(counters[0]); c++) {
+            printf("  %-17s %llu\n", counters[c].name, (unsigned long long)load(device_counter(dev, counters[c].offset)));
+        }
+        for (size_t h = 0; h < sizeof(histograms) / sizeof(histograms[0]); h++) {
+            print_histogram(histograms[h].name, device_histogram(dev, histograms[h].offset));
+        }
+    }
+}
+
+// Cumulative buckets, only the bounds that hold samples are listed
+static void print_prometheus_histogram(const char* metric, const char* labels, const MetricsHistogram* h) {
+    uint64_t cumulative = 0;
+    for (int b = 0; b < METRICS_BUCKETS; b++) {
+        uint64_t n = load(&h->buckets[b]);
+        if (n == 0) continue;
+        cumulative += n;
+        printf("%s_bucket{%s%sle=\"%.9f\"} %llu\n", metric, labels, *labels ? "," : "",
+               metrics_bucket_high_ns(b) / 1e9, (unsigned long long)cumulative);
+    }
+    printf("%s_bucket{%s%sle=\"+Inf\"} %llu\n", metric, labels, *labels ? "," : "", (unsigned long long)cumulative);
+    const char* open = *labels ? "{" : "";
+    const char* close = *labels ? "}" : "";
+    printf("%s_sum%s%s%s %.9f\n", metric, open, labels, close, load(&h->sum_ns) / 1e9);
+    printf("%s_count%s%s%s %llu\n", metric, open, labels, close, (unsigned long long)cumulative);
+}
+
+static void print_prometheus(const ModbusMetrics* m) {
+    printf("# HELP modbus_cycles_total Calls of update_modbus_values and read_modbus_values\n");
+    printf("# TYPE modbus_cycles_total counter\nmodbus_cycles_total %llu\n", (unsigned long long)load(&m->cycles));
+    printf("# HELP modbus_cycle_seconds Duration of one draw cycle\n# TYPE modbus_cycle_seconds histogram\n");
+    print_prometheus_histogram("modbus_cycle_seconds", "", &m->cycle);
+
+    char labels[2 * METRICS_NAME_SIZE + 32];
+    for (size_t c = 0; c < sizeof(counters) / sizeof(counters[0]); c++) {
+        printf("# HELP modbus_%s_total %s\n# TYPE modbus_%s_total counter\n",
+               counters[c].name, counters[c].help, counters[c].name);
+        for (int d = 0; d < device_count(m); d++) {
+            const MetricsDevice* dev = &m->devices[d];
+            printf("modbus_%s_total{device=\"%s\",server=\"%s\"} %llu\n", counters[c].name, dev->name, dev->server,
+                   (unsigned long long)load(device_counter(dev, counters[c].offset)));
+        }
+    }
+    for (size_t h = 0; h < sizeof(histograms) / sizeof(histograms[0]); h++) {
+        char metric[64];
+        snprintf(metric, sizeof(metric), "modbus_%s_seconds", histograms[h].name);
+        printf("# HELP %s %s\n# TYPE %s histogram\n", metric, histograms[h].help, metric);
+        for (int d = 0; d < device_count(m); d++) {
+            const MetricsDevice* dev = &m->devices[d];
+            snprintf(labels, sizeof(labels), "device=\"%s\",server=\"%s\"", dev->name, dev->server);
+            print_prometheus_histogram(metric, labels, device_histogram(dev, histograms[h].offset));
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    bool prometheus = false;
+    int interval = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "pw:")) != -1) {
+        if (opt == 'p') prometheus = true;
+        else if (opt == 'w' && atoi(optarg) > 0) interval = atoi(optarg);
+        else {
+            fprintf(stderr, "Usage: %s [-p] [-w seconds] [%s]\n", argv[0], MODBUS_METRICS_NAME);
+            return 1;
+        }
+    }
+    const char* name = optind < argc ? argv[optind] : MODBUS_METRICS_NAME;
+
+    const ModbusMetrics* m = metrics_attach(name);
+    if (!m) {
+        fprintf(stderr, "No metrics of version %d at %s\n", METRICS_VERSION, name);
+        return 1;
+    }
+    for (;;) {
+        if (prometheus) print_prometheus(m);
+        else print_text(m, name);
+        fflush(stdout);
+        if (interval == 0) break;
+        sleep(interval);
+        printf("\n");
+    }
+    metrics_detach(m);
+    return 0;
+}
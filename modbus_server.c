@@ -0,0 +1,452 @@
+#define _GNU_SOURCE // accept4
+#include "modbus_server.h"
+#include "modbus_log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define SERVER_TICK_MS 10 // Longest sleep, also bounds how late modbus_server_stop is noticed
+#define SERVER_MAX_EVENTS 256
+#define SERVER_LISTEN_TAG UINT32_MAX
+#define SERVER_IMAGE_FRESH 4u
+#define SERVER_IMAGE_MASK 3u
+#define SERVER_QUEUE_MASK (MODBUS_SERVER_WRITE_QUEUE - 1)
+#define SERVER_EXCEPTION_ADDRESS 0x02
+#define SERVER_EXCEPTION_VALUE 0x03
+#define SERVER_EXCEPTION_BUSY 0x06
+#define SERVER_EXCEPTION_PATH 0x0A // Unit id without a device
+#define SERVER_EXCEPTION_TARGET 0x0B // Device not connected
+
+typedef struct {
+    int fd; // -1 while the slot is free
+    uint32_t events; // Registered epoll events
+    int rx_size;
+    int tx_size;
+    uint8_t rx[MODBUS_TCP_BUFFER_SIZE];
+    uint8_t tx[MODBUS_SERVER_TX_SIZE];
+} ServerClient;
+
+typedef struct {
+    atomic_ulong connections;
+    atomic_ulong rejected;
+    atomic_ulong clients;
+    atomic_ulong requests;
+    atomic_ulong exceptions;
+    atomic_ulong busy;
+    atomic_ulong writes;
+    atomic_ulong bytes_in;
+    atomic_ulong bytes_out;
+} ServerCounters;
+
+static pthread_t server_thread;
+static atomic_bool server_running = false;
+static int server_listen = -1;
+static int server_epoll = -1;
+static int server_port = 0;
+static ServerClient* server_clients = NULL;
+static int server_client_capacity = 0;
+static int* server_free = NULL; // Stack of free client slots
+static int server_free_count = 0;
+static ServerCounters server_counters;
+
+// Triple buffer of snapshots: the draw thread builds the back slot, the server thread answers from the front
+static ModbusServerImage* server_slots = NULL;
+static atomic_uint server_middle;
+static unsigned int server_front;
+static unsigned int server_back;
+
+// Client writes, the server thread produces and the draw thread consumes
+static ModbusServerWrite* server_queue = NULL;
+static _Atomic size_t server_queue_tail;
+static _Atomic size_t server_queue_head;
+
+static long long server_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Latest snapshot published by the draw thread, the previous one while nothing new arrived
+static const ModbusServerImage* server_latest(void) {
+    if (atomic_load_explicit(&server_middle, memory_order_relaxed) & SERVER_IMAGE_FRESH) {
+        server_front = atomic_exchange_explicit(&server_middle, server_front, memory_order_acq_rel) & SERVER_IMAGE_MASK;
+    }
+    return &server_slots[server_front];
+}
+
+// No room for one more response, the client is not read until the socket takes some
+static bool server_blocked(const ServerClient* client) {
+    return client->tx_size + MODBUS_TCP_MAX_ADU > MODBUS_SERVER_TX_SIZE;
+}
+
+static void server_arm(ServerClient* client, uint32_t index) {
+    uint32_t events = (server_blocked(client) ? 0 : EPOLLIN) | (client->tx_size > 0 ? EPOLLOUT : 0);
+    if (events == client->events) return;
+    struct epoll_event ev = { .events = events, .data.u32 = index };
+    epoll_ctl(server_epoll, EPOLL_CTL_MOD, client->fd, &ev);
+    client->events = events;
+}
+
+static void server_close(uint32_t index) {
+    ServerClient* client = &server_clients[index];
+    if (client->fd < 0) return;
+    epoll_ctl(server_epoll, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    client->fd = -1;
+    server_free[server_free_count++] = (int)index;
+    atomic_fetch_sub_explicit(&server_counters.clients, 1, memory_order_relaxed);
+}
+
+// Buffered responses go out as far as the socket takes them, false when the connection is broken
+static bool server_flush(ServerClient* client) {
+    int sent = 0;
+    while (sent < client->tx_size) {
+        ssize_t n = send(client->fd, client->tx + sent, client->tx_size - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += (int)n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            return false;
+        }
+    }
+    memmove(client->tx, client->tx + sent, client->tx_size - sent);
+    client->tx_size -= sent;
+    atomic_fetch_add_explicit(&server_counters.bytes_out, sent, memory_order_relaxed);
+    return true;
+}
+
+static int server_exception(uint8_t function, uint8_t code, uint8_t* out) {
+    out[0] = function | MODBUS_EXCEPTION_FLAG;
+    out[1] = code;
+    atomic_fetch_add_explicit(&server_counters.exceptions, 1, memory_order_relaxed);
+    return 2;
+}
+
+// Eight bits from address on, bits past the end of the word come from the next one
+static uint8_t server_byte(const uint64_t* bits, int address) {
+    int shift = address % 64;
+    uint64_t word = bits[address / 64] >> shift;
+    if (shift > 56 && address / 64 + 1 < MODBUS_SERVER_WORDS) word |= bits[address / 64 + 1] << (64 - shift);
+    return (uint8_t)word;
+}
+
+// Writes of one request go into the queue together or not at all
+static bool server_queue_room(int count) {
+    size_t tail = atomic_load_explicit(&server_queue_tail, memory_order_relaxed);
+    return tail - atomic_load_explicit(&server_queue_head, memory_order_acquire) + count <= MODBUS_SERVER_WRITE_QUEUE;
+}
+
+static void server_queue_push(int unit, int address, bool value) {
+    size_t tail = atomic_load_explicit(&server_queue_tail, memory_order_relaxed);
+    ModbusServerWrite* write = &server_queue[tail & SERVER_QUEUE_MASK];
+    write->unit = (uint16_t)unit;
+    write->address = (uint16_t)address;
+    write->value = value;
+    atomic_store_explicit(&server_queue_tail, tail + 1, memory_order_release);
+}
+
+static bool server_writable(const ModbusServerUnit* unit, int address, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!modbus_server_bit(unit->writable, address + i)) return false;
+    }
+    return true;
+}
+
+// Response PDU of one request PDU, reads come from the snapshot and writes go to the queue
+static int server_answer(const ModbusServerImage* image, int unit_id, const uint8_t* pdu, int size, uint8_t* out) {
+    int function = pdu[0];
+    if (function != MODBUS_FC_READ_COILS && function != MODBUS_FC_READ_DISCRETE_INPUTS &&
+        function != MODBUS_FC_WRITE_SINGLE_COIL && function != MODBUS_FC_WRITE_MULTIPLE_COILS) {
+        return server_exception(function, 1, out);
+    }
+    if (size < 5) return server_exception(function, SERVER_EXCEPTION_VALUE, out);
+    int unit = unit_id == 0 || unit_id == 255 ? 0 : unit_id - 1;
+    if (unit >= image->unit_count) return server_exception(function, SERVER_EXCEPTION_PATH, out);
+    const ModbusServerUnit* slot = &image->units[unit];
+    int address = modbus_get_u16(pdu + 1);
+    int count = modbus_get_u16(pdu + 3);
+
+    switch (function) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS: {
+        if (count < 1 || count > MODBUS_MAX_READ_BITS) return server_exception(function, SERVER_EXCEPTION_VALUE, out);
+        if (address + count > MODBUS_SERVER_WORDS * 64) return server_exception(function, SERVER_EXCEPTION_ADDRESS, out);
+        if (!slot->link) return server_exception(function, SERVER_EXCEPTION_TARGET, out);
+        const uint64_t* bits = function == MODBUS_FC_READ_COILS ? slot->coils : slot->inputs;
+        int bytes = (count + 7) / 8;
+        out[0] = function;
+        out[1] = bytes;
+        for (int b = 0; b < bytes; b++) out[2 + b] = server_byte(bits, address + b * 8);
+        if (count % 8) out[1 + bytes] &= (uint8_t)((1u << (count % 8)) - 1);
+        return 2 + bytes;
+    }
+    case MODBUS_FC_WRITE_SINGLE_COIL:
+        if (count != 0xFF00 && count != 0) return server_exception(function, SERVER_EXCEPTION_VALUE, out);
+        if (!server_writable(slot, address, 1)) return server_exception(function, SERVER_EXCEPTION_ADDRESS, out);
+        if (!server_queue_room(1)) {
+            atomic_fetch_add_explicit(&server_counters.busy, 1, memory_order_relaxed);
+            return server_exception(function, SERVER_EXCEPTION_BUSY, out);
+        }
+        server_queue_push(unit, address, count == 0xFF00);
+        atomic_fetch_add_explicit(&server_counters.writes, 1, memory_order_relaxed);
+        memcpy(out, pdu, 5);
+        return 5;
+    default: // MODBUS_FC_WRITE_MULTIPLE_COILS
+        if (count < 1 || count > MODBUS_MAX_WRITE_BITS || size < 6 || pdu[5] != (count + 7) / 8 ||
+            size < 6 + pdu[5]) return server_exception(function, SERVER_EXCEPTION_VALUE, out);
+        if (address + count > MODBUS_SERVER_WORDS * 64 || !server_writable(slot, address, count)) {
+            return server_exception(function, SERVER_EXCEPTION_ADDRESS, out);
+        }
+        if (!server_queue_room(count)) {
+            atomic_fetch_add_explicit(&server_counters.busy, 1, memory_order_relaxed);
+            return server_exception(function, SERVER_EXCEPTION_BUSY, out);
+        }
+        for (int i = 0; i < count; i++) server_queue_push(unit, address + i, (pdu[6 + i / 8] >> (i % 8)) & 1);
+        atomic_fetch_add_explicit(&server_counters.writes, count, memory_order_relaxed);
+        memcpy(out, pdu, 5);
+        return 5;
+    }
+}
+
+// Complete frames are answered while there is room for the responses, false on a broken frame
+static bool server_process(ServerClient* client, const ModbusServerImage* image) {
+    int used = 0;
+    while (client->rx_size - used >= MODBUS_TCP_HEADER_SIZE && !server_blocked(client)) {
+        const uint8_t* frame = client->rx + used;
+        int length = modbus_get_u16(frame + 4);
+        if (modbus_get_u16(frame + 2) != 0 || length < 2 || length > MODBUS_TCP_MAX_PDU + 1) return false;
+        int size = MODBUS_TCP_HEADER_SIZE - 1 + length;
+        if (client->rx_size - used < size) break;
+
+        uint8_t* response = client->tx + client->tx_size;
+        int pdu_size = server_answer(image, frame[6], frame + MODBUS_TCP_HEADER_SIZE, size - MODBUS_TCP_HEADER_SIZE,
+                                     response + MODBUS_TCP_HEADER_SIZE);
+        memcpy(response, frame, MODBUS_TCP_HEADER_SIZE);
+        modbus_put_u16(response + 4, pdu_size + 1);
+        client->tx_size += MODBUS_TCP_HEADER_SIZE + pdu_size;
+        atomic_fetch_add_explicit(&server_counters.requests, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&server_counters.bytes_in, size, memory_order_relaxed);
+        used += size;
+    }
+    memmove(client->rx, client->rx + used, client->rx_size - used);
+    client->rx_size -= used;
+    return true;
+}
+
+// Everything readable is taken and answered, false when the peer closed or sent garbage
+static bool server_receive(ServerClient* client, const ModbusServerImage* image) {
+    while (!server_blocked(client)) {
+        ssize_t n = recv(client->fd, client->rx + client->rx_size, sizeof(client->rx) - client->rx_size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+        if (n <= 0) return false;
+        client->rx_size += (int)n;
+        if (!server_process(client, image)) return false;
+    }
+    return true;
+}
+
+static void server_handle(uint32_t index, uint32_t events, const ModbusServerImage* image) {
+    ServerClient* client = &server_clients[index];
+    bool ok = !(events & EPOLLERR);
+    if (ok && (events & EPOLLOUT)) ok = server_flush(client);
+    if (ok) ok = server_process(client, image); // Frames held back while the client was blocked
+    if (ok && (events & (EPOLLIN | EPOLLHUP))) ok = server_receive(client, image) && !(events & EPOLLHUP);
+    if (ok) ok = server_flush(client);
+    if (ok) server_arm(client, index);
+    else server_close(index);
+}
+
+static void server_accept(void) {
+    for (;;) {
+        int fd = accept4(server_listen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+        if (server_free_count == 0) {
+            close(fd);
+            atomic_fetch_add_explicit(&server_counters.rejected, 1, memory_order_relaxed);
+            log_message(LOG_LEVEL_WARN, "WARNING: Modbus server on port %d is full, %d clients connected",
+                        server_port, server_client_capacity);
+            continue;
+        }
+
+        // Same socket options as the client side, a dead poller is found and its slot freed
+        int one = 1, idle = MODBUS_TCP_KEEPIDLE, interval = MODBUS_TCP_KEEPINTVL, count = MODBUS_TCP_KEEPCNT;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+
+        uint32_t index = (uint32_t)server_free[server_free_count - 1];
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = index };
+        if (epoll_ctl(server_epoll, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close(fd);
+            continue;
+        }
+        server_free_count--;
+        ServerClient* client = &server_clients[index];
+        client->fd = fd;
+        client->events = EPOLLIN;
+        client->rx_size = client->tx_size = 0;
+        atomic_fetch_add_explicit(&server_counters.connections, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&server_counters.clients, 1, memory_order_relaxed);
+    }
+}
+
+// Counters of the last interval, in the same log as the poll statistics
+static void server_log_stats(ModbusServerStats* last) {
+    ModbusServerStats now;
+    modbus_server_get_stats(&now);
+    log_message(LOG_LEVEL_INFO, "Modbus server port %d: %lu clients, %lu requests, %lu exceptions, %lu busy, %lu writes in %d s",
+                server_port, now.clients, now.requests - last->requests, now.exceptions - last->exceptions,
+                now.busy - last->busy, now.writes - last->writes, MODBUS_SERVER_STATS_S);
+    *last = now;
+}
+
+static void* server_thread_main(void* arg) {
+    (void)arg;
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    ModbusServerStats last;
+    modbus_server_get_stats(&last);
+    long long stats_due = server_now_ns() + MODBUS_SERVER_STATS_S * 1000000000LL;
+    while (atomic_load(&server_running)) {
+        int n = epoll_wait(server_epoll, events, SERVER_MAX_EVENTS, SERVER_TICK_MS);
+        const ModbusServerImage* image = server_latest();
+        for (int e = 0; e < n; e++) {
+            uint32_t tag = events[e].data.u32;
+            if (tag == SERVER_LISTEN_TAG) server_accept();
+            else if (server_clients[tag].fd >= 0) server_handle(tag, events[e].events, image);
+        }
+        if (server_now_ns() >= stats_due) {
+            server_log_stats(&last);
+            stats_due += MODBUS_SERVER_STATS_S * 1000000000LL;
+        }
+    }
+    return NULL;
+}
+
+static void server_release(void) {
+    for (int i = 0; server_clients && i < server_client_capacity; i++) {
+        if (server_clients[i].fd >= 0) close(server_clients[i].fd);
+    }
+    if (server_listen >= 0) close(server_listen);
+    if (server_epoll >= 0) close(server_epoll);
+    server_listen = server_epoll = -1;
+    free(server_clients);
+    free(server_free);
+    free(server_slots);
+    free(server_queue);
+    server_clients = NULL;
+    server_free = NULL;
+    server_slots = NULL;
+    server_queue = NULL;
+    server_client_capacity = server_free_count = 0;
+}
+
+// Listening socket is bound before this returns, false with errno set when the server cannot start
+bool modbus_server_start(const char* bind_ip, int port, int max_clients) {
+    if (atomic_load(&server_running) || max_clients < 1 || max_clients > MODBUS_SERVER_MAX_CLIENTS) {
+        errno = EINVAL;
+        return false;
+    }
+    memset(&server_counters, 0, sizeof(server_counters));
+    server_port = port;
+    server_clients = malloc(max_clients * sizeof(ServerClient));
+    server_free = malloc(max_clients * sizeof(int));
+    server_slots = calloc(3, sizeof(ModbusServerImage));
+    server_queue = calloc(MODBUS_SERVER_WRITE_QUEUE, sizeof(ModbusServerWrite));
+    server_epoll = epoll_create1(EPOLL_CLOEXEC);
+    server_listen = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (!server_clients || !server_free || !server_slots || !server_queue || server_epoll < 0 || server_listen < 0) {
+        int err = errno;
+        server_release();
+        errno = err;
+        return false;
+    }
+
+    // Slots are handed out from the low end so a few clients touch little memory
+    server_client_capacity = max_clients;
+    for (int i = 0; i < max_clients; i++) {
+        server_clients[i].fd = -1;
+        server_free[i] = max_clients - 1 - i;
+    }
+    server_free_count = max_clients;
+    atomic_init(&server_middle, 1);
+    server_front = 0;
+    server_back = 2;
+    atomic_init(&server_queue_tail, 0);
+    atomic_init(&server_queue_head, 0);
+
+    int one = 1;
+    setsockopt(server_listen, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons((uint16_t)port) };
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = SERVER_LISTEN_TAG };
+    bool ok = inet_pton(AF_INET, bind_ip, &addr.sin_addr) == 1;
+    if (!ok) errno = EINVAL;
+    if (!ok || bind(server_listen, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(server_listen, SOMAXCONN) != 0 || epoll_ctl(server_epoll, EPOLL_CTL_ADD, server_listen, &ev) != 0) {
+        int err = errno;
+        server_release();
+        errno = err;
+        return false;
+    }
+
+    atomic_store(&server_running, true);
+    if (pthread_create(&server_thread, NULL, server_thread_main, NULL) != 0) {
+        atomic_store(&server_running, false);
+        server_release();
+        errno = EAGAIN;
+        return false;
+    }
+    return true;
+}
+
+// Slot the draw thread fills, it keeps the units of the snapshot it held two publishes ago
+ModbusServerImage* modbus_server_back(void) {
+    return server_slots ? &server_slots[server_back] : NULL;
+}
+
+void modbus_server_publish(void) {
+    server_back = atomic_exchange_explicit(&server_middle, server_back | SERVER_IMAGE_FRESH, memory_order_acq_rel) & SERVER_IMAGE_MASK;
+}
+
+// Draw thread side, returns the number of writes copied
+int modbus_server_take_writes(ModbusServerWrite* writes, int max_writes) {
+    if (!server_queue) return 0;
+    size_t head = atomic_load_explicit(&server_queue_head, memory_order_relaxed);
+    size_t available = atomic_load_explicit(&server_queue_tail, memory_order_acquire) - head;
+    int n = available < (size_t)max_writes ? (int)available : max_writes;
+    for (int i = 0; i < n; i++) writes[i] = server_queue[(head + i) & SERVER_QUEUE_MASK];
+    atomic_store_explicit(&server_queue_head, head + n, memory_order_release);
+    return n;
+}
+
+void modbus_server_get_stats(ModbusServerStats* stats) {
+    stats->connections = atomic_load(&server_counters.connections);
+    stats->rejected = atomic_load(&server_counters.rejected);
+    stats->clients = atomic_load(&server_counters.clients);
+    stats->requests = atomic_load(&server_counters.requests);
+    stats->exceptions = atomic_load(&server_counters.exceptions);
+    stats->busy = atomic_load(&server_counters.busy);
+    stats->writes = atomic_load(&server_counters.writes);
+    stats->bytes_in = atomic_load(&server_counters.bytes_in);
+    stats->bytes_out = atomic_load(&server_counters.bytes_out);
+}
+
+void modbus_server_stop(void) {
+    if (!atomic_exchange(&server_running, false)) return;
+    pthread_join(server_thread, NULL);
+    server_release();
+}
@@ -0,0 +1,68 @@
+#ifndef MODBUS_SERVER_H
+#define MODBUS_SERVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "modbus_tcp.h"
+
+// Constants
+#define MODBUS_SERVER_DEFAULT_CLIENTS 256
+#define MODBUS_SERVER_MAX_CLIENTS 4096
+#define MODBUS_SERVER_MAX_UNITS 32 // Unit id N serves device N, 0 and 255 serve the first device
+#define MODBUS_SERVER_WORDS 1024 // One bit per Modbus address, 65536 addresses
+#define MODBUS_SERVER_WRITE_QUEUE 4096 // Coil writes waiting for the draw thread, must be a power of two
+#define MODBUS_SERVER_TX_SIZE 8192 // Per client responses the socket did not take yet
+#define MODBUS_SERVER_STATS_S 60 // Server counters are logged this often
+
+// Address image of one unit, built by the draw thread from the signal tables of one device
+typedef struct {
+    unsigned long version; // Change counter of the device when the unit was built, 0 before that
+    bool link; // Device connected, reads answer exception 0B while it is not
+    uint64_t inputs[MODBUS_SERVER_WORDS];
+    uint64_t coils[MODBUS_SERVER_WORDS];
+    uint64_t writable[MODBUS_SERVER_WORDS]; // Coils bound to a context field
+} ModbusServerUnit;
+
+// Snapshot handed from the draw thread to the server thread as a whole
+typedef struct {
+    int unit_count;
+    ModbusServerUnit units[MODBUS_SERVER_MAX_UNITS];
+} ModbusServerImage;
+
+// Coil write of a client, applied to the context by the draw thread
+typedef struct {
+    uint16_t unit; // Device index
+    uint16_t address;
+    uint8_t value;
+} ModbusServerWrite;
+
+// Plain copy of the server counters, bytes are Modbus TCP payload in each direction
+typedef struct {
+    unsigned long connections;
+    unsigned long rejected; // Connections closed at once because max_clients were connected
+    unsigned long clients; // Connected now
+    unsigned long requests;
+    unsigned long exceptions;
+    unsigned long busy; // Writes refused with exception 06 because the write queue was full
+    unsigned long writes;
+    unsigned long bytes_in;
+    unsigned long bytes_out;
+} ModbusServerStats;
+
+// Function prototypes
+bool modbus_server_start(const char* bind_ip, int port, int max_clients);
+ModbusServerImage* modbus_server_back(void);
+void modbus_server_publish(void);
+int modbus_server_take_writes(ModbusServerWrite* writes, int max_writes);
+void modbus_server_get_stats(ModbusServerStats* stats);
+void modbus_server_stop(void);
+
+static inline bool modbus_server_bit(const uint64_t* bits, int address) {
+    return (bits[address / 64] >> (address % 64)) & 1u;
+}
+
+static inline void modbus_server_bit_set(uint64_t* bits, int address) {
+    bits[address / 64] |= (uint64_t)1 << (address % 64);
+}
+
+#endif // MODBUS_SERVER_H
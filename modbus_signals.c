@@ -0,0 +1,303 @@
+#include "modbus_signals.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Every array of the table is grown together, bitsets keep their new words cleared
+static bool signal_table_grow(SignalTable* table) {
+    int capacity = table->capacity ? table->capacity * 2 : SIGNAL_MIN_CAPACITY;
+    int old_words = SIGNAL_WORDS(table->capacity);
+    int words = SIGNAL_WORDS(capacity);
+
+    uint16_t* address = realloc(table->address, capacity * sizeof(uint16_t));
+    if (!address) return false;
+    table->address = address;
+
+    int* read_offset = realloc(table->read_offset, capacity * sizeof(int));
+    if (!read_offset) return false;
+    table->read_offset = read_offset;
+
+    SGLbool** target = realloc(table->target, capacity * sizeof(SGLbool*));
+    if (!target) return false;
+    table->target = target;
+
+    SignalInfo* info = realloc(table->info, capacity * sizeof(SignalInfo));
+    if (!info) return false;
+    table->info = info;
+
+    SignalWord* value = realloc(table->value, words * sizeof(SignalWord));
+    if (!value) return false;
+    memset(value + old_words, 0, (words - old_words) * sizeof(SignalWord));
+    table->value = value;
+
+    SignalWord* prev_value = realloc(table->prev_value, words * sizeof(SignalWord));
+    if (!prev_value) return false;
+    memset(prev_value + old_words, 0, (words - old_words) * sizeof(SignalWord));
+    table->prev_value = prev_value;
+
+    SignalWord* quality = realloc(table->quality, words * sizeof(SignalWord));
+    if (!quality) return false;
+    memset(quality + old_words, 0, (words - old_words) * sizeof(SignalWord));
+    table->quality = quality;
+
+    table->capacity = capacity;
+    return true;
+}
+
+static uint32_t signal_name_hash(const char* name) {
+    uint32_t h = 2166136261u;
+    for (; *name; name++) {
+        h ^= (uint8_t)*name;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void signal_index_insert(int* index, int capacity, const SignalInfo* info, int id) {
+    uint32_t slot = signal_name_hash(info[id].name) & (uint32_t)(capacity - 1);
+    while (index[slot]) slot = (slot + 1) & (uint32_t)(capacity - 1);
+    index[slot] = id + 1;
+}
+
+// Index is kept at most half full so probes stay short
+static bool signal_index_reserve(SignalTable* table, int count) {
+    if (count * 2 <= table->index_capacity) return true;
+
+    int capacity = table->index_capacity ? table->index_capacity : SIGNAL_MIN_CAPACITY;
+    while (count * 2 > capacity) capacity *= 2;
+    int* index = calloc(capacity, sizeof(int));
+    if (!index) return false;
+    for (int id = 0; id < table->count; id++) signal_index_insert(index, capacity, table->info, id);
+    free(table->index);
+    table->index = index;
+    table->index_capacity = capacity;
+    return true;
+}
+
+// Id of the named signal, -1 when the table has no such signal
+int signal_table_find(const SignalTable* table, const char* name) {
+    if (!table->index_capacity) return -1;
+    uint32_t slot = signal_name_hash(name) & (uint32_t)(table->index_capacity - 1);
+    for (; table->index[slot]; slot = (slot + 1) & (uint32_t)(table->index_capacity - 1)) {
+        int id = table->index[slot] - 1;
+        if (strcmp(table->info[id].name, name) == 0) return id;
+    }
+    return -1;
+}
+
+// Signal is appended and its id returned, -1 when memory runs out
+int signal_table_add(SignalTable* table, const char* name, int address) {
+    if (table->count == table->capacity && !signal_table_grow(table)) return -1;
+    if (!signal_index_reserve(table, table->count + 1)) return -1;
+
+    int id = table->count++;
+    strncpy(table->info[id].name, name, SIGNAL_NAME_SIZE - 1);
+    table->info[id].name[SIGNAL_NAME_SIZE - 1] = '\0';
+    table->info[id].poll_ms = 0;
+    table->info[id].field_index = -1;
+    table->address[id] = (uint16_t)address;
+    table->read_offset[id] = 0;
+    table->target[id] = NULL;
+    signal_bit_set(table->value, id, false);
+    signal_bit_set(table->prev_value, id, false);
+    signal_bit_set(table->quality, id, false);
+    signal_index_insert(table->index, table->index_capacity, table->info, id);
+    return id;
+}
+
+void signal_table_free(SignalTable* table) {
+    free(table->address);
+    free(table->read_offset);
+    free(table->target);
+    free(table->value);
+    free(table->prev_value);
+    free(table->quality);
+    free(table->info);
+    free(table->index);
+    memset(table, 0, sizeof(SignalTable));
+}
+
+// Zeroed bitset for count signals, at least one word so empty tables need no special case
+SignalWord* signal_bitset_alloc(int count) {
+    int words = SIGNAL_WORDS(count);
+    return calloc(words ? words : 1, sizeof(SignalWord));
+}
+
+// changed = a XOR b, returns true if any bit differs
+bool signal_bitset_diff(const SignalWord* a, const SignalWord* b, SignalWord* changed, int words) {
+    int w = 0;
+#if defined(__SSE2__)
+    __m128i any = _mm_setzero_si128();
+    for (; w + 2 <= words; w += 2) {
+        __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + w)),
+                                  _mm_loadu_si128((const __m128i*)(b + w)));
+        _mm_storeu_si128((__m128i*)(changed + w), x);
+        any = _mm_or_si128(any, x);
+    }
+    SignalWord tail = 0;
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) != 0xFFFF) tail = 1;
+#else
+    SignalWord tail = 0;
+#endif
+    for (; w < words; w++) {
+        changed[w] = a[w] ^ b[w];
+        tail |= changed[w];
+    }
+    return tail != 0;
+}
+
+// Index of the next set bit at or after from, -1 when there is none
+int signal_bitset_next(const SignalWord* bits, int words, int from) {
+    int w = from / SIGNAL_WORD_BITS;
+    if (w >= words) return -1;
+
+    SignalWord word = bits[w] & (~(SignalWord)0 << (from % SIGNAL_WORD_BITS));
+    while (!word) {
+        if (++w >= words) return -1;
+        word = bits[w];
+    }
+    return w * SIGNAL_WORD_BITS + __builtin_ctzll(word);
+}
+
+// Register columns follow the capacity of the embedded signal table
+static bool register_table_grow(RegisterTable* table, int capacity) {
+    RegisterFormat* format = realloc(table->format, capacity * sizeof(RegisterFormat));
+    if (!format) return false;
+    table->format = format;
+
+    double* scale = realloc(table->scale, capacity * sizeof(double));
+    if (!scale) return false;
+    table->scale = scale;
+
+    double* offset = realloc(table->offset, capacity * sizeof(double));
+    if (!offset) return false;
+    table->offset = offset;
+
+    uint32_t* raw = realloc(table->raw, capacity * sizeof(uint32_t));
+    if (!raw) return false;
+    table->raw = raw;
+
+    double* value = realloc(table->value, capacity * sizeof(double));
+    if (!value) return false;
+    table->value = value;
+
+    void** target = realloc(table->target, capacity * sizeof(void*));
+    if (!target) return false;
+    table->target = target;
+
+    table->capacity = capacity;
+    return true;
+}
+
+// Register signal is appended and its id returned, -1 when memory runs out
+int register_table_add(RegisterTable* table, const char* name, int address, RegisterFormat format, double scale, double offset) {
+    int id = signal_table_add(&table->signals, name, address);
+    if (id < 0) return -1;
+    if (table->signals.capacity > table->capacity && !register_table_grow(table, table->signals.capacity)) {
+        table->signals.count--;
+        return -1;
+    }
+    table->format[id] = format;
+    table->scale[id] = scale;
+    table->offset[id] = offset;
+    table->raw[id] = 0;
+    table->value[id] = 0;
+    table->target[id] = NULL;
+    return id;
+}
+
+void register_table_free(RegisterTable* table) {
+    signal_table_free(&table->signals);
+    free(table->format);
+    free(table->scale);
+    free(table->offset);
+    free(table->raw);
+    free(table->value);
+    free(table->target);
+    memset(table, 0, sizeof(RegisterTable));
+}
+
+static bool register_low_first(RegisterFormat format) {
+    return format.order == REGISTER_CDAB || format.order == REGISTER_DCBA;
+}
+
+static bool register_swapped(RegisterFormat format) {
+    return format.order == REGISTER_BADC || format.order == REGISTER_DCBA;
+}
+
+// Raw values of a run of signals sharing one layout, each taken from its position in the register buffer.
+// The layout is fixed for the whole run, so the loops carry no branches and the byte swap vectorizes.
+void register_gather(const uint16_t* registers, const int* offsets, int count, RegisterFormat format, uint32_t* raw) {
+    if (format.width == 1) {
+        for (int k = 0; k < count; k++) raw[k] = registers[offsets[k]];
+    } else {
+        int high = register_low_first(format) ? 1 : 0;
+        for (int k = 0; k < count; k++) {
+            const uint16_t* r = registers + offsets[k];
+            raw[k] = (uint32_t)r[high] << 16 | r[1 - high];
+        }
+    }
+    if (register_swapped(format)) {
+        for (int k = 0; k < count; k++) raw[k] = (raw[k] & 0x00FF00FFu) << 8 | (raw[k] >> 8 & 0x00FF00FFu);
+    }
+}
+
+// Raw values of one type are turned into field values
+void register_convert(const uint32_t* raw, const double* scale, const double* offset, int count, int type, double* value) {
+    switch (type) {
+        case REGISTER_INT16:
+            for (int k = 0; k < count; k++) value[k] = (int16_t)raw[k] * scale[k] + offset[k];
+            break;
+        case REGISTER_INT32:
+            for (int k = 0; k < count; k++) value[k] = (int32_t)raw[k] * scale[k] + offset[k];
+            break;
+        case REGISTER_FLOAT32:
+            for (int k = 0; k < count; k++) {
+                float f;
+                memcpy(&f, &raw[k], sizeof(f));
+                value[k] = f * scale[k] + offset[k];
+            }
+            break;
+        default:
+            for (int k = 0; k < count; k++) value[k] = raw[k] * scale[k] + offset[k];
+            break;
+    }
+}
+
+static double register_clamp(double value, double low, double high) {
+    if (isnan(value)) return 0;
+    value = nearbyint(value);
+    return value < low ? low : value > high ? high : value;
+}
+
+// Raw value of a field value, integer types are rounded and saturated
+uint32_t register_encode(RegisterFormat format, double scale, double offset, double value) {
+    double raw = scale != 0 ? (value - offset) / scale : 0;
+    switch (format.type) {
+        case REGISTER_INT16: return (uint16_t)(int16_t)register_clamp(raw, INT16_MIN, INT16_MAX);
+        case REGISTER_UINT16: return (uint16_t)register_clamp(raw, 0, UINT16_MAX);
+        case REGISTER_INT32: return (uint32_t)(int32_t)register_clamp(raw, INT32_MIN, INT32_MAX);
+        case REGISTER_UINT32: return (uint32_t)register_clamp(raw, 0, UINT32_MAX);
+        default: {
+            float f = (float)raw;
+            uint32_t bits;
+            memcpy(&bits, &f, sizeof(bits));
+            return bits;
+        }
+    }
+}
+
+// Wire registers of one raw value, the reverse of register_gather
+void register_scatter(uint32_t raw, RegisterFormat format, uint16_t* registers) {
+    if (register_swapped(format)) raw = (raw & 0x00FF00FFu) << 8 | (raw >> 8 & 0x00FF00FFu);
+    if (format.width == 1) {
+        registers[0] = (uint16_t)raw;
+        return;
+    }
+    int high = register_low_first(format) ? 1 : 0;
+    registers[high] = (uint16_t)(raw >> 16);
+    registers[1 - high] = (uint16_t)raw;
+}
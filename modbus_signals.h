@@ -0,0 +1,104 @@
+#ifndef MODBUS_SIGNALS_H
+#define MODBUS_SIGNALS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sgl_types.h"
+
+// Constants
+#define SIGNAL_NAME_SIZE 50
+#define SIGNAL_MIN_CAPACITY 64
+#define SIGNAL_WORD_BITS 64
+#define SIGNAL_WORDS(count) (((count) + SIGNAL_WORD_BITS - 1) / SIGNAL_WORD_BITS)
+
+typedef uint64_t SignalWord;
+
+// Cold per-signal data, only used while loading, logging and exporting
+typedef struct {
+    char name[SIGNAL_NAME_SIZE];
+    int poll_ms; // 0 uses the default poll period
+    int field_index; // Index in modbus_fields, -1 when the model has no such field
+    bool verify; // Output is written alone and read back before the write counts as done
+} SignalInfo;
+
+// Hot signal data as structure of arrays, values are packed bitsets indexed by signal id
+typedef struct {
+    int count;
+    int capacity;
+    uint16_t* address;
+    int* read_offset; // Position of the address in the read buffer
+    SGLbool** target; // Bound context field, NULL when the model has no such field
+    SignalWord* value;
+    SignalWord* prev_value;
+    SignalWord* quality; // Set while the signal is read from a connected device and not stale
+    SignalInfo* info;
+    int* index; // Open addressing name index, a slot holds id + 1 and 0 when empty
+    int index_capacity;
+} SignalTable;
+
+// Value layouts of register mappings
+typedef enum {
+    REGISTER_INT16,
+    REGISTER_UINT16,
+    REGISTER_INT32,
+    REGISTER_UINT32,
+    REGISTER_FLOAT32
+} RegisterType;
+
+// Byte order of a value on the wire, A is the most significant byte and ABCD is the Modbus default
+typedef enum {
+    REGISTER_ABCD,
+    REGISTER_CDAB, // Low word first
+    REGISTER_BADC, // Bytes swapped inside each word
+    REGISTER_DCBA
+} RegisterOrder;
+
+typedef struct {
+    uint8_t function; // Read function, 3 for holding registers that are also written with FC16, 4 for input registers
+    uint8_t type;
+    uint8_t order;
+    uint8_t width; // Registers the value covers, 1 or 2
+} RegisterFormat;
+
+// Register signals, the embedded table keeps names, first addresses, read offsets and quality.
+// Field value = raw * scale + offset.
+typedef struct {
+    SignalTable signals;
+    RegisterFormat* format;
+    double* scale;
+    double* offset;
+    uint32_t* raw; // Register contents last seen by the draw thread, 16-bit values in the low half
+    double* value; // Bound field value last seen by the draw thread
+    void** target; // Bound context field of any scalar type, NULL when the model has no such field
+    int capacity;
+} RegisterTable;
+
+// Function prototypes
+int signal_table_add(SignalTable* table, const char* name, int address);
+int signal_table_find(const SignalTable* table, const char* name);
+void signal_table_free(SignalTable* table);
+SignalWord* signal_bitset_alloc(int count);
+bool signal_bitset_diff(const SignalWord* a, const SignalWord* b, SignalWord* changed, int words);
+int signal_bitset_next(const SignalWord* bits, int words, int from);
+int register_table_add(RegisterTable* table, const char* name, int address, RegisterFormat format, double scale, double offset);
+void register_table_free(RegisterTable* table);
+void register_gather(const uint16_t* registers, const int* offsets, int count, RegisterFormat format, uint32_t* raw);
+void register_convert(const uint32_t* raw, const double* scale, const double* offset, int count, int type, double* value);
+uint32_t register_encode(RegisterFormat format, double scale, double offset, double value);
+void register_scatter(uint32_t raw, RegisterFormat format, uint16_t* registers);
+
+static inline bool register_same_layout(RegisterFormat a, RegisterFormat b) {
+    return a.type == b.type && a.order == b.order && a.width == b.width;
+}
+
+static inline bool signal_bit(const SignalWord* bits, int i) {
+    return (bits[i / SIGNAL_WORD_BITS] >> (i % SIGNAL_WORD_BITS)) & 1u;
+}
+
+static inline void signal_bit_set(SignalWord* bits, int i, bool value) {
+    SignalWord mask = (SignalWord)1 << (i % SIGNAL_WORD_BITS);
+    if (value) bits[i / SIGNAL_WORD_BITS] |= mask;
+    else bits[i / SIGNAL_WORD_BITS] &= ~mask;
+}
+
+#endif // MODBUS_SIGNALS_H
@@ -0,0 +1,512 @@
+#define _GNU_SOURCE // accept4
+#include "modbus_sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define SIM_TICK_MS 10 // Longest sleep, also bounds how late modbus_sim_stop is noticed
+#define SIM_LISTEN_TAG MODBUS_SIM_MAX_CLIENTS
+
+typedef struct {
+    int fd;
+    unsigned int generation; // Delayed responses of a closed client are not sent to the next one
+    bool writing; // EPOLLOUT is armed
+    int rx_size;
+    int tx_size;
+    uint8_t rx[MODBUS_TCP_BUFFER_SIZE];
+    uint8_t tx[MODBUS_SIM_TX_SIZE];
+} SimClient;
+
+typedef struct {
+    long long due_ns;
+    int client; // -1 for a UDP peer
+    struct sockaddr_in peer;
+    unsigned int generation;
+    int size;
+    uint8_t adu[MODBUS_TCP_MAX_ADU];
+} SimResponse;
+
+typedef struct {
+    atomic_ulong connections;
+    atomic_ulong requests;
+    atomic_ulong dropped;
+    atomic_ulong exceptions;
+    atomic_ulong bytes_in;
+    atomic_ulong bytes_out;
+    atomic_ulong changes;
+} SimCounters;
+
+static ModbusSimConfig sim_cfg;
+static pthread_t sim_thread;
+static atomic_bool sim_running = false;
+static int sim_listen = -1;
+static int sim_epoll = -1;
+static uint32_t sim_seed = 1;
+static uint8_t* sim_coils = NULL; // One byte per coil, written by FC05 and FC15
+static uint8_t* sim_inputs = NULL; // One byte per discrete input, flipped at change_rate
+// Registers are also set and checked by the bench thread, hence the atomics
+static _Atomic uint16_t* sim_holding = NULL; // Written by FC06 and FC16
+static _Atomic uint16_t* sim_input_regs = NULL; // Only set by the bench
+static double sim_change_credit = 0;
+static SimClient sim_clients[MODBUS_SIM_MAX_CLIENTS];
+static SimResponse sim_delayed[MODBUS_SIM_MAX_DELAYED]; // Min-heap on due_ns
+static int sim_delayed_count = 0;
+static SimCounters sim_counters;
+
+static long long sim_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// xorshift32, only used from the simulator thread
+static uint32_t sim_random(void) {
+    sim_seed ^= sim_seed << 13;
+    sim_seed ^= sim_seed >> 17;
+    sim_seed ^= sim_seed << 5;
+    return sim_seed;
+}
+
+static double sim_uniform(void) {
+    return (sim_random() >> 8) / 16777216.0;
+}
+
+static void sim_arm(SimClient* client, bool writing) {
+    if (client->writing == writing) return;
+    struct epoll_event ev = { .events = EPOLLIN | (writing ? EPOLLOUT : 0),
+                              .data.u32 = (uint32_t)(client - sim_clients) };
+    epoll_ctl(sim_epoll, EPOLL_CTL_MOD, client->fd, &ev);
+    client->writing = writing;
+}
+
+static void sim_close(SimClient* client) {
+    if (client->fd < 0) return;
+    epoll_ctl(sim_epoll, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    client->fd = -1;
+    client->generation++;
+    client->rx_size = client->tx_size = 0;
+    client->writing = false;
+}
+
+// Buffered bytes go out as far as the socket takes them, the rest waits for EPOLLOUT
+static void sim_flush(SimClient* client) {
+    int sent = 0;
+    while (sent < client->tx_size) {
+        ssize_t n = send(client->fd, client->tx + sent, client->tx_size - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += (int)n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            sim_close(client);
+            return;
+        }
+    }
+    memmove(client->tx, client->tx + sent, client->tx_size - sent);
+    client->tx_size -= sent;
+    sim_arm(client, client->tx_size > 0);
+}
+
+static void sim_send(int index, unsigned int generation, const struct sockaddr_in* peer, const uint8_t* adu, int size) {
+    if (index < 0) {
+        if (sendto(sim_listen, adu, size, MSG_NOSIGNAL, (const struct sockaddr*)peer, sizeof(*peer)) == size) {
+            atomic_fetch_add_explicit(&sim_counters.bytes_out, size, memory_order_relaxed);
+        }
+        return;
+    }
+    SimClient* client = &sim_clients[index];
+    if (client->fd < 0 || client->generation != generation) return;
+    if (client->tx_size + size > MODBUS_SIM_TX_SIZE) {
+        sim_close(client);
+        return;
+    }
+    memcpy(client->tx + client->tx_size, adu, size);
+    client->tx_size += size;
+    atomic_fetch_add_explicit(&sim_counters.bytes_out, size, memory_order_relaxed);
+    sim_flush(client);
+}
+
+static void sim_delay_push(const SimResponse* response) {
+    int i = sim_delayed_count++;
+    while (i > 0 && sim_delayed[(i - 1) / 2].due_ns > response->due_ns) {
+        sim_delayed[i] = sim_delayed[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    sim_delayed[i] = *response;
+}
+
+static void sim_delay_pop(void) {
+    SimResponse last = sim_delayed[--sim_delayed_count];
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= sim_delayed_count) break;
+        if (child + 1 < sim_delayed_count && sim_delayed[child + 1].due_ns < sim_delayed[child].due_ns) child++;
+        if (sim_delayed[child].due_ns >= last.due_ns) break;
+        sim_delayed[i] = sim_delayed[child];
+        i = child;
+    }
+    if (sim_delayed_count > 0) sim_delayed[i] = last;
+}
+
+static int sim_exception(uint8_t function, uint8_t code, uint8_t* out) {
+    out[0] = function | MODBUS_EXCEPTION_FLAG;
+    out[1] = code;
+    atomic_fetch_add_explicit(&sim_counters.exceptions, 1, memory_order_relaxed);
+    return 2;
+}
+
+// Register function codes of sim_answer, arguments are checked the same way as for the bits
+static int sim_answer_registers(const uint8_t* pdu, int size, uint8_t* out) {
+    int function = pdu[0];
+    int address = (pdu[1] << 8) | pdu[2];
+    int count = (pdu[3] << 8) | pdu[4];
+
+    switch (function) {
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS: {
+        if (count < 1 || count > MODBUS_MAX_READ_REGISTERS) return sim_exception(function, 3, out);
+        if (address + count > sim_cfg.coils) return sim_exception(function, 2, out);
+        _Atomic uint16_t* registers = function == MODBUS_FC_READ_HOLDING_REGISTERS ? sim_holding : sim_input_regs;
+        out[0] = function;
+        out[1] = 2 * count;
+        for (int i = 0; i < count; i++) modbus_put_u16(out + 2 + 2 * i, atomic_load(&registers[address + i]));
+        return 2 + 2 * count;
+    }
+    case MODBUS_FC_WRITE_SINGLE_REGISTER:
+        if (address >= sim_cfg.coils) return sim_exception(function, 2, out);
+        atomic_store(&sim_holding[address], (uint16_t)count);
+        memcpy(out, pdu, 5);
+        return 5;
+    case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+        if (count < 1 || count > MODBUS_MAX_WRITE_REGISTERS || size < 6 || pdu[5] != 2 * count ||
+            size < 6 + pdu[5]) return sim_exception(function, 3, out);
+        if (address + count > sim_cfg.coils) return sim_exception(function, 2, out);
+        for (int i = 0; i < count; i++) atomic_store(&sim_holding[address + i], modbus_get_u16(pdu + 6 + 2 * i));
+        memcpy(out, pdu, 5);
+        return 5;
+    default:
+        return sim_exception(function, 1, out);
+    }
+}
+
+// Response PDU of one request PDU
+static int sim_answer(const uint8_t* pdu, int size, uint8_t* out) {
+    if (size < 5) return sim_exception(pdu[0], 3, out);
+    int function = pdu[0];
+    int address = (pdu[1] << 8) | pdu[2];
+    int count = (pdu[3] << 8) | pdu[4];
+
+    switch (function) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS: {
+        if (count < 1 || count > MODBUS_MAX_READ_BITS) return sim_exception(function, 3, out);
+        if (address + count > sim_cfg.coils) return sim_exception(function, 2, out);
+        const uint8_t* bits = function == MODBUS_FC_READ_COILS ? sim_coils : sim_inputs;
+        int bytes = (count + 7) / 8;
+        out[0] = function;
+        out[1] = bytes;
+        memset(out + 2, 0, bytes);
+        for (int i = 0; i < count; i++) {
+            if (bits[address + i]) out[2 + i / 8] |= 1 << (i % 8);
+        }
+        return 2 + bytes;
+    }
+    case MODBUS_FC_WRITE_SINGLE_COIL:
+        if (count != 0xFF00 && count != 0) return sim_exception(function, 3, out);
+        if (address >= sim_cfg.coils) return sim_exception(function, 2, out);
+        sim_coils[address] = count == 0xFF00;
+        memcpy(out, pdu, 5);
+        return 5;
+    case MODBUS_FC_WRITE_MULTIPLE_COILS:
+        if (count < 1 || count > MODBUS_MAX_WRITE_BITS || size < 6 || pdu[5] != (count + 7) / 8 ||
+            size < 6 + pdu[5]) return sim_exception(function, 3, out);
+        if (address + count > sim_cfg.coils) return sim_exception(function, 2, out);
+        for (int i = 0; i < count; i++) sim_coils[address + i] = (pdu[6 + i / 8] >> (i % 8)) & 1;
+        memcpy(out, pdu, 5);
+        return 5;
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+    case MODBUS_FC_WRITE_SINGLE_REGISTER:
+    case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+        return sim_answer_registers(pdu, size, out);
+    default:
+        return sim_exception(function, 1, out);
+    }
+}
+
+// Complete frames are answered in the framing they came in, each one is dropped or delayed as configured
+static void sim_handle_frame(int index, const struct sockaddr_in* peer, const uint8_t* frame, int size, long long now) {
+    atomic_fetch_add_explicit(&sim_counters.requests, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sim_counters.bytes_in, size, memory_order_relaxed);
+    if (sim_cfg.loss > 0 && sim_uniform() < sim_cfg.loss) {
+        atomic_fetch_add_explicit(&sim_counters.dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    SimResponse response;
+    response.client = index;
+    response.generation = index >= 0 ? sim_clients[index].generation : 0;
+    if (peer) response.peer = *peer;
+    if (sim_cfg.transport == MODBUS_TRANSPORT_RTU) {
+        int pdu_size = sim_answer(frame + 1, size - MODBUS_RTU_OVERHEAD, response.adu + 1);
+        response.adu[0] = frame[0];
+        uint16_t crc = modbus_rtu_crc(response.adu, pdu_size + 1);
+        response.adu[pdu_size + 1] = (uint8_t)crc;
+        response.adu[pdu_size + 2] = (uint8_t)(crc >> 8);
+        response.size = pdu_size + MODBUS_RTU_OVERHEAD;
+    } else {
+        int pdu_size = sim_answer(frame + MODBUS_TCP_HEADER_SIZE, size - MODBUS_TCP_HEADER_SIZE,
+                                  response.adu + MODBUS_TCP_HEADER_SIZE);
+        memcpy(response.adu, frame, MODBUS_TCP_HEADER_SIZE);
+        response.adu[4] = (uint8_t)((pdu_size + 1) >> 8);
+        response.adu[5] = (uint8_t)(pdu_size + 1);
+        response.size = MODBUS_TCP_HEADER_SIZE + pdu_size;
+    }
+
+    long long delay_ns = sim_cfg.rtt_us * 1000LL;
+    if (sim_cfg.jitter_us > 0) delay_ns += (long long)((sim_uniform() * 2 - 1) * sim_cfg.jitter_us * 1000);
+    if (delay_ns <= 0 || sim_delayed_count == MODBUS_SIM_MAX_DELAYED) {
+        sim_send(index, response.generation, peer, response.adu, response.size);
+        return;
+    }
+    response.due_ns = now + delay_ns;
+    sim_delay_push(&response);
+}
+
+// Length of the request at the start of a stream buffer, 0 while more bytes are needed, -1 for garbage
+static int sim_frame_size(const uint8_t* frame, int available) {
+    int size;
+    if (sim_cfg.transport == MODBUS_TRANSPORT_RTU) {
+        if (available < 2) return 0;
+        if (frame[1] == MODBUS_FC_WRITE_MULTIPLE_COILS || frame[1] == MODBUS_FC_WRITE_MULTIPLE_REGISTERS) {
+            if (available < 7) return 0;
+            size = 9 + frame[6];
+        } else if (frame[1] >= MODBUS_FC_READ_COILS && frame[1] <= MODBUS_FC_WRITE_SINGLE_REGISTER) {
+            size = 8;
+        } else {
+            return -1;
+        }
+        if (available < size) return 0;
+        return modbus_rtu_crc(frame, size) == 0 ? size : -1;
+    }
+    if (available < MODBUS_TCP_HEADER_SIZE) return 0;
+    int length = (frame[4] << 8) | frame[5];
+    if (frame[2] != 0 || frame[3] != 0 || length < 2 || length > MODBUS_TCP_MAX_PDU + 1) return -1;
+    size = MODBUS_TCP_HEADER_SIZE - 1 + length;
+    return available >= size ? size : 0;
+}
+
+// Every datagram is one MBAP frame, anything else is dropped
+static void sim_receive_datagrams(long long now) {
+    uint8_t frame[MODBUS_TCP_MAX_ADU];
+    for (;;) {
+        struct sockaddr_in peer;
+        socklen_t peer_size = sizeof(peer);
+        ssize_t n = recvfrom(sim_listen, frame, sizeof(frame), 0, (struct sockaddr*)&peer, &peer_size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return;
+        if (sim_frame_size(frame, (int)n) == n) sim_handle_frame(-1, &peer, frame, (int)n, now);
+    }
+}
+
+static void sim_receive(int index, long long now) {
+    SimClient* client = &sim_clients[index];
+    for (;;) {
+        ssize_t n = recv(client->fd, client->rx + client->rx_size, sizeof(client->rx) - client->rx_size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            sim_close(client);
+            return;
+        }
+        client->rx_size += (int)n;
+
+        int used = 0;
+        for (;;) {
+            int size = sim_frame_size(client->rx + used, client->rx_size - used);
+            if (size == 0) break;
+            if (size < 0) {
+                sim_close(client);
+                return;
+            }
+            sim_handle_frame(index, NULL, client->rx + used, size, now);
+            if (client->fd < 0) return;
+            used += size;
+        }
+        memmove(client->rx, client->rx + used, client->rx_size - used);
+        client->rx_size -= used;
+    }
+}
+
+static void sim_accept(void) {
+    for (;;) {
+        int fd = accept4(sim_listen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+        int index = 0;
+        while (index < MODBUS_SIM_MAX_CLIENTS && sim_clients[index].fd >= 0) index++;
+        if (index == MODBUS_SIM_MAX_CLIENTS) {
+            close(fd);
+            continue;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        SimClient* client = &sim_clients[index];
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = (uint32_t)index };
+        if (epoll_ctl(sim_epoll, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        client->rx_size = client->tx_size = 0;
+        client->writing = false;
+        atomic_fetch_add_explicit(&sim_counters.connections, 1, memory_order_relaxed);
+    }
+}
+
+// Discrete inputs flip at the configured rate, fractions are carried to the next pass
+static void sim_apply_changes(long long elapsed_ns) {
+    if (sim_cfg.change_rate <= 0) return;
+    sim_change_credit += sim_cfg.change_rate * elapsed_ns / 1e9;
+    int flips = (int)sim_change_credit;
+    sim_change_credit -= flips;
+    for (int i = 0; i < flips; i++) {
+        int address = (int)(sim_random() % (uint32_t)sim_cfg.coils);
+        sim_inputs[address] ^= 1;
+    }
+    atomic_fetch_add_explicit(&sim_counters.changes, flips, memory_order_relaxed);
+}
+
+static void* sim_thread_main(void* arg) {
+    (void)arg;
+    struct epoll_event events[MODBUS_SIM_MAX_CLIENTS + 1];
+    long long last = sim_now_ns();
+    while (atomic_load(&sim_running)) {
+        long long now = sim_now_ns();
+        int timeout_ms = SIM_TICK_MS;
+        if (sim_delayed_count > 0) {
+            long long wait_ms = (sim_delayed[0].due_ns - now + 999999) / 1000000;
+            if (wait_ms < timeout_ms) timeout_ms = wait_ms > 0 ? (int)wait_ms : 0;
+        }
+
+        int n = epoll_wait(sim_epoll, events, MODBUS_SIM_MAX_CLIENTS + 1, timeout_ms);
+        now = sim_now_ns();
+        for (int e = 0; e < n; e++) {
+            uint32_t tag = events[e].data.u32;
+            if (tag == SIM_LISTEN_TAG) {
+                if (sim_cfg.transport == MODBUS_TRANSPORT_UDP) sim_receive_datagrams(now);
+                else sim_accept();
+                continue;
+            }
+            SimClient* client = &sim_clients[tag];
+            if (client->fd >= 0 && (events[e].events & EPOLLOUT)) sim_flush(client);
+            if (client->fd >= 0 && (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) sim_receive(tag, now);
+        }
+
+        while (sim_delayed_count > 0 && sim_delayed[0].due_ns <= now) {
+            SimResponse* due = &sim_delayed[0];
+            sim_send(due->client, due->generation, &due->peer, due->adu, due->size);
+            sim_delay_pop();
+        }
+        sim_apply_changes(now - last);
+        last = now;
+    }
+    return NULL;
+}
+
+static void sim_release(void) {
+    for (int i = 0; i < MODBUS_SIM_MAX_CLIENTS; i++) sim_close(&sim_clients[i]);
+    if (sim_listen >= 0) close(sim_listen);
+    if (sim_epoll >= 0) close(sim_epoll);
+    sim_listen = sim_epoll = -1;
+    free(sim_coils);
+    free(sim_inputs);
+    free(sim_holding);
+    free(sim_input_regs);
+    sim_coils = sim_inputs = NULL;
+    sim_holding = sim_input_regs = NULL;
+    sim_delayed_count = 0;
+}
+
+// Listening socket is bound before this returns, so a client started right after finds it
+bool modbus_sim_start(const ModbusSimConfig* cfg) {
+    if (atomic_load(&sim_running) || cfg->coils < 1 || cfg->coils > 65536) return false;
+    sim_cfg = *cfg;
+    sim_seed = cfg->seed ? cfg->seed : 1;
+    sim_change_credit = 0;
+    memset(&sim_counters, 0, sizeof(sim_counters));
+    for (int i = 0; i < MODBUS_SIM_MAX_CLIENTS; i++) sim_clients[i].fd = -1;
+
+    sim_coils = calloc(cfg->coils, 1);
+    sim_inputs = calloc(cfg->coils, 1);
+    sim_holding = calloc(cfg->coils, sizeof(*sim_holding));
+    sim_input_regs = calloc(cfg->coils, sizeof(*sim_input_regs));
+    sim_epoll = epoll_create1(EPOLL_CLOEXEC);
+    bool udp = cfg->transport == MODBUS_TRANSPORT_UDP;
+    sim_listen = socket(AF_INET, (udp ? SOCK_DGRAM : SOCK_STREAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (!sim_coils || !sim_inputs || !sim_holding || !sim_input_regs || sim_epoll < 0 || sim_listen < 0) {
+        fprintf(stderr, "Simulator setup failed: %s\n", strerror(errno));
+        sim_release();
+        return false;
+    }
+
+    int one = 1;
+    setsockopt(sim_listen, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons((uint16_t)cfg->port) };
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = SIM_LISTEN_TAG };
+    if (inet_pton(AF_INET, cfg->bind_ip ? cfg->bind_ip : "127.0.0.1", &addr.sin_addr) != 1 ||
+        bind(sim_listen, (struct sockaddr*)&addr, sizeof(addr)) != 0 || (!udp && listen(sim_listen, 16) != 0) ||
+        epoll_ctl(sim_epoll, EPOLL_CTL_ADD, sim_listen, &ev) != 0) {
+        fprintf(stderr, "Simulator cannot listen on port %d: %s\n", cfg->port, strerror(errno));
+        sim_release();
+        return false;
+    }
+
+    atomic_store(&sim_running, true);
+    if (pthread_create(&sim_thread, NULL, sim_thread_main, NULL) != 0) {
+        atomic_store(&sim_running, false);
+        sim_release();
+        return false;
+    }
+    return true;
+}
+
+void modbus_sim_get_stats(ModbusSimStats* stats) {
+    stats->connections = atomic_load(&sim_counters.connections);
+    stats->requests = atomic_load(&sim_counters.requests);
+    stats->dropped = atomic_load(&sim_counters.dropped);
+    stats->exceptions = atomic_load(&sim_counters.exceptions);
+    stats->bytes_in = atomic_load(&sim_counters.bytes_in);
+    stats->bytes_out = atomic_load(&sim_counters.bytes_out);
+    stats->changes = atomic_load(&sim_counters.changes);
+}
+
+// Register access for the bench while the simulator runs, addresses are checked by the caller
+uint16_t modbus_sim_get_register(bool holding, int address) {
+    return atomic_load(holding ? &sim_holding[address] : &sim_input_regs[address]);
+}
+
+void modbus_sim_set_register(bool holding, int address, uint16_t value) {
+    atomic_store(holding ? &sim_holding[address] : &sim_input_regs[address], value);
+}
+
+void modbus_sim_stop(void) {
+    if (!atomic_exchange(&sim_running, false)) return;
+    pthread_join(sim_thread, NULL);
+    sim_release();
+}
@@ -0,0 +1,44 @@
+#ifndef MODBUS_SIM_H
+#define MODBUS_SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "modbus_tcp.h"
+
+// Constants
+#define MODBUS_SIM_MAX_CLIENTS 16
+#define MODBUS_SIM_MAX_DELAYED 4096 // Responses waiting for their simulated round trip
+#define MODBUS_SIM_TX_SIZE 65536 // Per client bytes that the socket did not take yet
+
+// Local Modbus slave used by modbus_bench, coils, discrete inputs and both register kinds share one address range
+typedef struct {
+    const char* bind_ip;
+    int port;
+    int rtt_us; // Added before every response
+    int jitter_us; // Uniform spread around rtt_us, responses may overtake each other
+    double loss; // Share of requests that never get a response, 0 to 1
+    int coils; // Addresses of every kind, reads and writes past this answer with exception 02
+    double change_rate; // Discrete input flips per second
+    unsigned int seed;
+    ModbusTransport transport; // Framing the slave answers in, UDP serves every peer from one socket
+} ModbusSimConfig;
+
+// Plain copy of the simulator counters, bytes are whole frames in each direction
+typedef struct {
+    unsigned long connections;
+    unsigned long requests;
+    unsigned long dropped;
+    unsigned long exceptions;
+    unsigned long bytes_in;
+    unsigned long bytes_out;
+    unsigned long changes;
+} ModbusSimStats;
+
+// Function prototypes
+bool modbus_sim_start(const ModbusSimConfig* cfg);
+void modbus_sim_get_stats(ModbusSimStats* stats);
+uint16_t modbus_sim_get_register(bool holding, int address);
+void modbus_sim_set_register(bool holding, int address, uint16_t value);
+void modbus_sim_stop(void);
+
+#endif // MODBUS_SIM_H
@@ -0,0 +1,462 @@
+#include "modbus_tcp.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+void modbus_tcp_init(ModbusTcpClient* c, ModbusTransport transport, int unit_id, int window, long timeout_us, int retries) {
+    memset(c, 0, sizeof(ModbusTcpClient));
+    c->fd = -1;
+    c->transport = transport;
+    c->state = MODBUS_TCP_CLOSED;
+    c->unit_id = unit_id;
+    if (window < 1 || transport == MODBUS_TRANSPORT_RTU) window = 1;
+    if (window > MODBUS_TCP_MAX_WINDOW) window = MODBUS_TCP_MAX_WINDOW;
+    c->window = window;
+    c->timeout_ns = (long long)timeout_us * 1000LL;
+    if (retries < 0 || transport != MODBUS_TRANSPORT_UDP) retries = 0;
+    c->retries = retries > MODBUS_UDP_MAX_RETRIES ? MODBUS_UDP_MAX_RETRIES : retries;
+}
+
+// tcp, udp or rtu, false for anything else
+bool modbus_transport_parse(const char* text, ModbusTransport* transport) {
+    if (strcmp(text, "tcp") == 0) *transport = MODBUS_TRANSPORT_TCP;
+    else if (strcmp(text, "udp") == 0) *transport = MODBUS_TRANSPORT_UDP;
+    else if (strcmp(text, "rtu") == 0) *transport = MODBUS_TRANSPORT_RTU;
+    else return false;
+    return true;
+}
+
+const char* modbus_transport_name(ModbusTransport transport) {
+    switch (transport) {
+        case MODBUS_TRANSPORT_UDP: return "udp";
+        case MODBUS_TRANSPORT_RTU: return "rtu";
+        default: return "tcp";
+    }
+}
+
+// Bytes a frame adds to its PDU on the wire
+int modbus_tcp_overhead(const ModbusTcpClient* c) {
+    return c->transport == MODBUS_TRANSPORT_RTU ? MODBUS_RTU_OVERHEAD : MODBUS_TCP_HEADER_SIZE;
+}
+
+// Connection is started without waiting, the socket becomes writable once connect completes
+bool modbus_tcp_connect(ModbusTcpClient* c, const char* ip, int port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // A UDP socket is only bound to the peer, it is usable at once and a dead peer shows up as timeouts
+    // or as ECONNREFUSED from an ICMP port unreachable
+    bool udp = c->transport == MODBUS_TRANSPORT_UDP;
+    c->fd = socket(AF_INET, (udp ? SOCK_DGRAM : SOCK_STREAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd < 0) return false;
+    if (udp) {
+        if (connect(c->fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+            c->state = MODBUS_TCP_CONNECTED;
+            return true;
+        }
+        int err = errno;
+        close(c->fd);
+        c->fd = -1;
+        errno = err;
+        return false;
+    }
+
+    // Requests are small and latency bound, they must not wait for Nagle
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // Keepalive finds a dead peer on an idle link, the user timeout one that stopped acknowledging data
+    int idle = MODBUS_TCP_KEEPIDLE, interval = MODBUS_TCP_KEEPINTVL, count = MODBUS_TCP_KEEPCNT;
+    unsigned int user_timeout = MODBUS_TCP_USER_TIMEOUT_MS;
+    setsockopt(c->fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+    setsockopt(c->fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(c->fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(c->fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+    setsockopt(c->fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof(user_timeout));
+
+    if (connect(c->fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+        c->state = MODBUS_TCP_CONNECTED;
+        return true;
+    }
+    if (errno == EINPROGRESS) {
+        c->state = MODBUS_TCP_CONNECTING;
+        return true;
+    }
+    int err = errno;
+    close(c->fd);
+    c->fd = -1;
+    errno = err;
+    return false;
+}
+
+// Result of a pending connect, called when the socket reports writable
+bool modbus_tcp_finish_connect(ModbusTcpClient* c) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) err = errno;
+    if (err != 0) {
+        errno = err;
+        return false;
+    }
+    c->state = MODBUS_TCP_CONNECTED;
+    return true;
+}
+
+// Socket is closed and every transaction still in flight is reported as failed
+void modbus_tcp_close(ModbusTcpClient* c, ModbusTcpHandler handler, void* user) {
+    if (c->fd >= 0) close(c->fd);
+    c->fd = -1;
+    c->state = MODBUS_TCP_CLOSED;
+    c->tx_size = 0;
+    c->rx_size = 0;
+    c->quiet_ns = 0;
+
+    for (int s = 0; s < MODBUS_TCP_MAX_WINDOW; s++) {
+        ModbusTransaction t = c->transactions[s];
+        if (!t.used) continue;
+        c->transactions[s].used = false;
+        c->in_flight--;
+        if (handler) handler(user, &t, NULL, 0);
+    }
+}
+
+bool modbus_tcp_ready(const ModbusTcpClient* c) {
+    return c->state == MODBUS_TCP_CONNECTED && c->in_flight < c->window && c->quiet_ns == 0;
+}
+
+// Request ADU of a transaction, returns its size
+static int frame_request(const ModbusTcpClient* c, const ModbusTransaction* t, uint8_t* adu) {
+    if (c->transport == MODBUS_TRANSPORT_RTU) {
+        adu[0] = t->unit;
+        memcpy(adu + 1, t->pdu, t->pdu_size);
+        uint16_t crc = modbus_rtu_crc(adu, t->pdu_size + 1);
+        adu[t->pdu_size + 1] = (uint8_t)crc; // CRC goes low byte first
+        adu[t->pdu_size + 2] = (uint8_t)(crc >> 8);
+        return t->pdu_size + MODBUS_RTU_OVERHEAD;
+    }
+    modbus_put_u16(adu, t->id);
+    modbus_put_u16(adu + 2, 0); // Protocol id
+    modbus_put_u16(adu + 4, t->pdu_size + 1);
+    adu[6] = t->unit;
+    memcpy(adu + MODBUS_TCP_HEADER_SIZE, t->pdu, t->pdu_size);
+    return MODBUS_TCP_HEADER_SIZE + t->pdu_size;
+}
+
+// Request is framed into the send buffer, modbus_tcp_flush puts it on the wire. Over UDP a read is sent
+// again every timeout_ns until it is answered or its retries are used up, reads are safe to repeat.
+bool modbus_tcp_request(ModbusTcpClient* c, const uint8_t* pdu, int pdu_size, int tag, long long now_ns) {
+    if (!modbus_tcp_ready(c) || pdu_size < 1 || pdu_size > MODBUS_TCP_MAX_PDU) return false;
+
+    int slot = 0;
+    while (c->transactions[slot].used) slot++;
+    ModbusTransaction* t = &c->transactions[slot];
+    bool repeat = c->retries > 0 && pdu[0] <= MODBUS_FC_READ_INPUT_REGISTERS;
+    t->used = true;
+    t->id = c->next_id++;
+    t->unit = (uint8_t)c->unit_id;
+    t->tag = tag;
+    t->sent_ns = now_ns;
+    t->retry_ns = repeat ? now_ns + c->timeout_ns : 0;
+    t->deadline_ns = now_ns + c->timeout_ns * (repeat ? c->retries + 1 : 1);
+    t->pdu_size = pdu_size;
+    memcpy(t->pdu, pdu, pdu_size);
+    c->in_flight++;
+
+    c->tx_size += frame_request(c, t, c->tx + c->tx_size);
+    return true;
+}
+
+// As much of the send buffer as the socket takes, false when the connection is broken. Over UDP every frame
+// is a datagram of its own.
+bool modbus_tcp_flush(ModbusTcpClient* c) {
+    bool udp = c->transport == MODBUS_TRANSPORT_UDP;
+    int sent = 0;
+    while (sent < c->tx_size) {
+        int size = udp ? 6 + modbus_get_u16(c->tx + sent + 4) : c->tx_size - sent;
+        ssize_t n = send(c->fd, c->tx + sent, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return false;
+        }
+        sent += (int)n;
+    }
+    memmove(c->tx, c->tx + sent, c->tx_size - sent);
+    c->tx_size -= sent;
+    return true;
+}
+
+// Complete frames are matched to their transaction, answers to expired requests or from another unit behind
+// a gateway are dropped and the request runs into its timeout
+static bool dispatch_frames(ModbusTcpClient* c, ModbusTcpHandler handler, void* user) {
+    int used = 0;
+    while (c->rx_size - used >= MODBUS_TCP_HEADER_SIZE) {
+        const uint8_t* adu = c->rx + used;
+        int length = modbus_get_u16(adu + 4);
+        if (modbus_get_u16(adu + 2) != 0 || length < 2 || length > MODBUS_TCP_MAX_PDU + 1) {
+            errno = EPROTO;
+            return false;
+        }
+        if (c->rx_size - used < 6 + length) break;
+
+        uint16_t id = modbus_get_u16(adu);
+        const uint8_t* pdu = adu + MODBUS_TCP_HEADER_SIZE;
+        for (int s = 0; s < MODBUS_TCP_MAX_WINDOW; s++) {
+            if (!c->transactions[s].used || c->transactions[s].id != id) continue;
+            if (c->transactions[s].unit != adu[6]) break;
+            ModbusTransaction t = c->transactions[s];
+            c->transactions[s].used = false;
+            c->in_flight--;
+            handler(user, &t, pdu, length - 1);
+            break;
+        }
+        used += 6 + length;
+    }
+    memmove(c->rx, c->rx + used, c->rx_size - used);
+    c->rx_size -= used;
+    return true;
+}
+
+// Length of the RTU response at the start of a buffer, 0 while more bytes are needed, -1 for a function
+// whose length is unknown
+static int rtu_frame_size(const uint8_t* frame, int available) {
+    if (available < 3) return 0;
+    int size;
+    if (frame[1] & MODBUS_EXCEPTION_FLAG) size = 5;
+    else if (frame[1] >= MODBUS_FC_READ_COILS && frame[1] <= MODBUS_FC_READ_INPUT_REGISTERS) size = 5 + frame[2];
+    else if (frame[1] == MODBUS_FC_WRITE_SINGLE_COIL || frame[1] == MODBUS_FC_WRITE_SINGLE_REGISTER ||
+             frame[1] == MODBUS_FC_WRITE_MULTIPLE_COILS || frame[1] == MODBUS_FC_WRITE_MULTIPLE_REGISTERS) size = 8;
+    else return -1;
+    return available >= size ? size : 0;
+}
+
+// Response answers the request in every field it echoes, a late answer to an expired request does not
+static bool rtu_answers(const ModbusTransaction* t, const uint8_t* pdu) {
+    if (pdu[0] == (t->pdu[0] | MODBUS_EXCEPTION_FLAG)) return true;
+    if (pdu[0] != t->pdu[0]) return false;
+    int count = modbus_get_u16(t->pdu + 3);
+    switch (pdu[0]) {
+        case MODBUS_FC_READ_COILS:
+        case MODBUS_FC_READ_DISCRETE_INPUTS: return pdu[1] == (count + 7) / 8;
+        case MODBUS_FC_READ_HOLDING_REGISTERS:
+        case MODBUS_FC_READ_INPUT_REGISTERS: return pdu[1] == count * 2;
+        default: return memcmp(pdu + 1, t->pdu + 1, 4) == 0;
+    }
+}
+
+// RTU frames carry no transaction id, a frame is the answer to the one request in flight. A bad CRC or an
+// answer to another request means the stream is out of step, the connection is dropped to resynchronise.
+static bool dispatch_rtu_frames(ModbusTcpClient* c, ModbusTcpHandler handler, void* user) {
+    int used = 0;
+    for (;;) {
+        const uint8_t* frame = c->rx + used;
+        int size = rtu_frame_size(frame, c->rx_size - used);
+        if (size == 0) break;
+        if (size < 0 || modbus_rtu_crc(frame, size) != 0 || frame[0] != c->unit_id) {
+            errno = EPROTO;
+            return false;
+        }
+        for (int s = 0; s < MODBUS_TCP_MAX_WINDOW; s++) {
+            if (!c->transactions[s].used) continue;
+            if (!rtu_answers(&c->transactions[s], frame + 1)) {
+                errno = EPROTO;
+                return false;
+            }
+            ModbusTransaction t = c->transactions[s];
+            c->transactions[s].used = false;
+            c->in_flight--;
+            handler(user, &t, frame + 1, size - MODBUS_RTU_OVERHEAD);
+            break;
+        }
+        used += size;
+    }
+    memmove(c->rx, c->rx + used, c->rx_size - used);
+    c->rx_size -= used;
+    return true;
+}
+
+// A datagram holds one frame, one that does not parse is dropped and the link stays up
+static bool receive_datagrams(ModbusTcpClient* c, ModbusTcpHandler handler, void* user) {
+    for (;;) {
+        ssize_t n = recv(c->fd, c->rx, sizeof(c->rx), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            return false;
+        }
+        c->rx_size = (int)n;
+        if (n >= MODBUS_TCP_HEADER_SIZE && 6 + modbus_get_u16(c->rx + 4) == n) dispatch_frames(c, handler, user);
+        c->rx_size = 0;
+    }
+}
+
+// Everything readable is taken from the socket, false when the peer closed or sent garbage
+bool modbus_tcp_receive(ModbusTcpClient* c, ModbusTcpHandler handler, void* user) {
+    if (c->transport == MODBUS_TRANSPORT_UDP) return receive_datagrams(c, handler, user);
+    for (;;) {
+        ssize_t n = recv(c->fd, c->rx + c->rx_size, sizeof(c->rx) - c->rx_size, 0);
+        if (n == 0) {
+            errno = ECONNRESET;
+            return false;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            return false;
+        }
+        c->rx_size += (int)n;
+        if (c->quiet_ns) {
+            c->rx_size = 0;
+            continue;
+        }
+        if (!(c->transport == MODBUS_TRANSPORT_RTU ? dispatch_rtu_frames(c, handler, user) : dispatch_frames(c, handler, user))) {
+            return false;
+        }
+    }
+}
+
+// Transactions past their deadline are reported as failed, a late answer is ignored later. UDP reads due
+// for a retry are framed again with the same transaction id, so an answer to any copy completes them.
+// An RTU answer has nothing to tell it from the next one, so after a timeout the link stays quiet for
+// another timeout and whatever the slave still sends in that time is dropped.
+void modbus_tcp_expire(ModbusTcpClient* c, long long now_ns, ModbusTcpHandler handler, void* user) {
+    if (c->quiet_ns && c->quiet_ns <= now_ns) {
+        c->quiet_ns = 0;
+        c->rx_size = 0;
+    }
+    for (int s = 0; s < MODBUS_TCP_MAX_WINDOW; s++) {
+        ModbusTransaction* t = &c->transactions[s];
+        if (!t->used) continue;
+        if (t->deadline_ns > now_ns) {
+            if (!t->retry_ns || t->retry_ns > now_ns) continue;
+            // A copy that does not fit waits for the next pass
+            if (c->tx_size + MODBUS_TCP_MAX_ADU > (int)sizeof(c->tx)) continue;
+            c->tx_size += frame_request(c, t, c->tx + c->tx_size);
+            c->resent++;
+            t->retry_ns += c->timeout_ns;
+            if (t->retry_ns >= t->deadline_ns) t->retry_ns = 0;
+            continue;
+        }
+        ModbusTransaction expired = *t;
+        t->used = false;
+        c->in_flight--;
+        if (c->transport == MODBUS_TRANSPORT_RTU) {
+            c->rx_size = 0;
+            c->quiet_ns = now_ns + c->timeout_ns;
+        }
+        handler(user, &expired, NULL, 0);
+    }
+}
+
+// Earliest transaction deadline, UDP retry or end of an RTU quiet time, 0 when there is none
+long long modbus_tcp_next_deadline(const ModbusTcpClient* c) {
+    long long next = c->quiet_ns;
+    for (int s = 0; s < MODBUS_TCP_MAX_WINDOW; s++) {
+        const ModbusTransaction* t = &c->transactions[s];
+        if (!t->used) continue;
+        long long due = t->retry_ns ? t->retry_ns : t->deadline_ns;
+        if (next == 0 || due < next) next = due;
+    }
+    return next;
+}
+
+// FC01, FC02, FC03 or FC04 request
+int modbus_pdu_read_bits(uint8_t* pdu, int function, int start, int count) {
+    pdu[0] = (uint8_t)function;
+    modbus_put_u16(pdu + 1, start);
+    modbus_put_u16(pdu + 3, count);
+    return 5;
+}
+
+// FC05 request
+int modbus_pdu_write_bit(uint8_t* pdu, int address, bool value) {
+    pdu[0] = MODBUS_FC_WRITE_SINGLE_COIL;
+    modbus_put_u16(pdu + 1, address);
+    modbus_put_u16(pdu + 3, value ? 0xFF00 : 0x0000);
+    return 5;
+}
+
+// FC15 request, bits holds one coil per byte
+int modbus_pdu_write_bits(uint8_t* pdu, int start, int count, const uint8_t* bits) {
+    int bytes = (count + 7) / 8;
+    pdu[0] = MODBUS_FC_WRITE_MULTIPLE_COILS;
+    modbus_put_u16(pdu + 1, start);
+    modbus_put_u16(pdu + 3, count);
+    pdu[5] = (uint8_t)bytes;
+    memset(pdu + 6, 0, bytes);
+    for (int i = 0; i < count; i++) {
+        if (bits[i]) pdu[6 + i / 8] |= (uint8_t)(1u << (i % 8));
+    }
+    return 6 + bytes;
+}
+
+// FC01 or FC02 response unpacked to one coil per byte, false if the size does not match
+bool modbus_pdu_unpack_bits(const uint8_t* pdu, int pdu_size, int count, uint8_t* bits) {
+    int bytes = (count + 7) / 8;
+    if (pdu_size != 2 + bytes || pdu[1] != bytes) return false;
+    for (int i = 0; i < count; i++) bits[i] = (pdu[2 + i / 8] >> (i % 8)) & 1u;
+    return true;
+}
+
+// FC16 request, registers are in host order
+int modbus_pdu_write_registers(uint8_t* pdu, int start, int count, const uint16_t* registers) {
+    pdu[0] = MODBUS_FC_WRITE_MULTIPLE_REGISTERS;
+    modbus_put_u16(pdu + 1, start);
+    modbus_put_u16(pdu + 3, count);
+    pdu[5] = (uint8_t)(count * 2);
+    for (int i = 0; i < count; i++) modbus_put_u16(pdu + 6 + 2 * i, registers[i]);
+    return 6 + count * 2;
+}
+
+// FC03 or FC04 response swapped to host order in bulk, false if the size does not match
+bool modbus_pdu_unpack_registers(const uint8_t* pdu, int pdu_size, int count, uint16_t* registers) {
+    if (pdu_size != 2 + count * 2 || pdu[1] != count * 2) return false;
+    const uint8_t* p = pdu + 2;
+    int i = 0;
+#if defined(__SSE2__)
+    for (; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(p + 2 * i));
+        _mm_storeu_si128((__m128i*)(registers + i), _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8)));
+    }
+#endif
+    for (; i < count; i++) registers[i] = modbus_get_u16(p + 2 * i);
+    return true;
+}
+
+const char* modbus_exception_string(int code) {
+    switch (code) {
+        case 1: return "Illegal function";
+        case 2: return "Illegal data address";
+        case 3: return "Illegal data value";
+        case 4: return "Slave device failure";
+        case 5: return "Acknowledge";
+        case 6: return "Slave device busy";
+        case 10: return "Gateway path unavailable";
+        case 11: return "Gateway target failed to respond";
+        default: return "Unknown exception";
+    }
+}
+
+// CRC-16 of RTU frames, polynomial 0xA001 reflected, over a frame with its CRC appended it is 0
+uint16_t modbus_rtu_crc(const uint8_t* data, int size) {
+    uint16_t crc = 0xFFFF;
+    for (int i = 0; i < size; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) crc = (crc & 1) ? (uint16_t)((crc >> 1) ^ 0xA001) : (uint16_t)(crc >> 1);
+    }
+    return crc;
+}
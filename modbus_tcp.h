@@ -0,0 +1,122 @@
+#ifndef MODBUS_TCP_H
+#define MODBUS_TCP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Constants
+#define MODBUS_TCP_MAX_WINDOW 32 // Upper bound of requests in flight on one connection
+#define MODBUS_TCP_DEFAULT_WINDOW 8
+#define MODBUS_TCP_HEADER_SIZE 7 // MBAP header including the unit id
+#define MODBUS_TCP_MAX_PDU 253
+#define MODBUS_TCP_MAX_ADU (MODBUS_TCP_HEADER_SIZE + MODBUS_TCP_MAX_PDU)
+#define MODBUS_TCP_BUFFER_SIZE (MODBUS_TCP_MAX_WINDOW * MODBUS_TCP_MAX_ADU)
+#define MODBUS_EXCEPTION_FLAG 0x80
+#define MODBUS_TCP_KEEPIDLE 5 // Seconds of silence before the first keepalive probe
+#define MODBUS_TCP_KEEPINTVL 1
+#define MODBUS_TCP_KEEPCNT 3
+#define MODBUS_TCP_USER_TIMEOUT_MS 5000 // Unacknowledged data older than this drops the connection
+#define MODBUS_RTU_OVERHEAD 3 // Unit id and CRC around the PDU of an RTU frame
+#define MODBUS_UDP_MAX_RETRIES 10
+
+// Function codes and PDU limits, same values as libmodbus
+#ifndef MODBUS_FC_READ_COILS
+#define MODBUS_FC_READ_COILS 0x01
+#define MODBUS_FC_READ_DISCRETE_INPUTS 0x02
+#define MODBUS_FC_READ_HOLDING_REGISTERS 0x03
+#define MODBUS_FC_READ_INPUT_REGISTERS 0x04
+#define MODBUS_FC_WRITE_SINGLE_COIL 0x05
+#define MODBUS_FC_WRITE_SINGLE_REGISTER 0x06
+#define MODBUS_FC_WRITE_MULTIPLE_COILS 0x0F
+#define MODBUS_FC_WRITE_MULTIPLE_REGISTERS 0x10
+#endif
+#ifndef MODBUS_MAX_READ_BITS
+#define MODBUS_MAX_READ_BITS 2000
+#define MODBUS_MAX_WRITE_BITS 1968
+#define MODBUS_MAX_READ_REGISTERS 125
+#define MODBUS_MAX_WRITE_REGISTERS 123
+#endif
+
+// Framing and socket of a connection
+typedef enum {
+    MODBUS_TRANSPORT_TCP = 0, // MBAP frames on a TCP stream
+    MODBUS_TRANSPORT_UDP, // One MBAP frame per datagram, unanswered reads are sent again
+    MODBUS_TRANSPORT_RTU // RTU frames with CRC on a TCP stream, as spoken by serial gateways, one request at a time
+} ModbusTransport;
+
+typedef enum {
+    MODBUS_TCP_CLOSED,
+    MODBUS_TCP_CONNECTING,
+    MODBUS_TCP_CONNECTED
+} ModbusTcpState;
+
+// One outstanding request, the PDU is kept so the response can be checked against it
+typedef struct {
+    bool used;
+    uint16_t id; // MBAP transaction id
+    uint8_t unit; // Unit id the request went to, the answer must come from it
+    int tag; // Caller's request descriptor
+    long long sent_ns;
+    long long retry_ns; // UDP: next time an unanswered read is sent again, 0 when it is not
+    long long deadline_ns;
+    int pdu_size;
+    uint8_t pdu[MODBUS_TCP_MAX_PDU];
+} ModbusTransaction;
+
+// Non-blocking Modbus client, requests are pipelined and answers matched by transaction id. RTU frames have no
+// transaction id, so an RTU client keeps one request in flight.
+typedef struct {
+    int fd;
+    ModbusTransport transport;
+    ModbusTcpState state;
+    int unit_id;
+    int window;
+    long long timeout_ns; // UDP: time before a read is sent again, it fails after retries + 1 of them
+    int retries; // UDP: times an unanswered read is sent again
+    unsigned long resent; // UDP: reads sent again, counted up for the caller
+    long long quiet_ns; // RTU: after a timeout nothing is sent and received bytes are dropped until this time
+    uint16_t next_id;
+    int in_flight;
+    ModbusTransaction transactions[MODBUS_TCP_MAX_WINDOW];
+    uint8_t tx[MODBUS_TCP_BUFFER_SIZE]; // Requests not yet accepted by the socket
+    int tx_size;
+    uint8_t rx[MODBUS_TCP_BUFFER_SIZE]; // Received bytes of incomplete frames
+    int rx_size;
+} ModbusTcpClient;
+
+// Called once for every transaction, pdu is NULL when it timed out or the connection was closed
+typedef void (*ModbusTcpHandler)(void* user, const ModbusTransaction* t, const uint8_t* pdu, int pdu_size);
+
+// Function prototypes
+void modbus_tcp_init(ModbusTcpClient* c, ModbusTransport transport, int unit_id, int window, long timeout_us, int retries);
+bool modbus_transport_parse(const char* text, ModbusTransport* transport);
+const char* modbus_transport_name(ModbusTransport transport);
+int modbus_tcp_overhead(const ModbusTcpClient* c);
+bool modbus_tcp_connect(ModbusTcpClient* c, const char* ip, int port);
+bool modbus_tcp_finish_connect(ModbusTcpClient* c);
+void modbus_tcp_close(ModbusTcpClient* c, ModbusTcpHandler handler, void* user);
+bool modbus_tcp_ready(const ModbusTcpClient* c);
+bool modbus_tcp_request(ModbusTcpClient* c, const uint8_t* pdu, int pdu_size, int tag, long long now_ns);
+bool modbus_tcp_flush(ModbusTcpClient* c);
+bool modbus_tcp_receive(ModbusTcpClient* c, ModbusTcpHandler handler, void* user);
+void modbus_tcp_expire(ModbusTcpClient* c, long long now_ns, ModbusTcpHandler handler, void* user);
+long long modbus_tcp_next_deadline(const ModbusTcpClient* c);
+int modbus_pdu_read_bits(uint8_t* pdu, int function, int start, int count);
+int modbus_pdu_write_bit(uint8_t* pdu, int address, bool value);
+int modbus_pdu_write_bits(uint8_t* pdu, int start, int count, const uint8_t* bits);
+bool modbus_pdu_unpack_bits(const uint8_t* pdu, int pdu_size, int count, uint8_t* bits);
+int modbus_pdu_write_registers(uint8_t* pdu, int start, int count, const uint16_t* registers);
+bool modbus_pdu_unpack_registers(const uint8_t* pdu, int pdu_size, int count, uint16_t* registers);
+const char* modbus_exception_string(int code);
+uint16_t modbus_rtu_crc(const uint8_t* data, int size);
+
+static inline uint16_t modbus_get_u16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline void modbus_put_u16(uint8_t* p, int value) {
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+}
+
+#endif // MODBUS_TCP_H
@@ -38,8 +38,7 @@ void specification_genel_draw(specification_typ_genel *pContext, SGLint32 pPrior
 {
   /* Your program runs here and redraws at every milisecınds regarded with your processing speed. */
   /* Update modbus function should called here and the rest work done by modbus_comm.c functions. */
-  update_modbus_values(pContext);  //Update modbus function with sending only the changed bits.
-  update_modbus_values_all(pContext);  //Update modbus function with sending all bits at once.
+  update_modbus_values(pContext);  //Update modbus function with sending only the changed bits in the fewest requests.
 }
 
 